@@ -41,6 +41,8 @@ void RESTServer::Init() {
   rest_server_.init(Http::Endpoint::options().threads(1));
 
   Routes::Get(router_, "/metrics", Routes::bind(&RESTServer::HandleGet, this));
+  Routes::Post(router_, "/threads/:count",
+      Routes::bind(&RESTServer::HandleSetThreads, this));
   rest_server_.setHandler(router_.handler());
 
   rest_server_.serve();
@@ -54,6 +56,24 @@ void RESTServer::HandleGet(const Rest::Request& request,
   response.send(Http::Code::Ok, metrics_str);
 }
 
+void RESTServer::HandleSetThreads(const Rest::Request& request,
+    Http::ResponseWriter response) {
+  int num_threads;
+  try {
+    num_threads = request.param(":count").as<int>();
+  } catch (const std::exception&) {
+    response.send(Http::Code::Bad_Request, "Number of threads must be an integer\n");
+    return;
+  }
+
+  Status s = task_scheduler_->dumper()->ScaleThreads(num_threads);
+  if (!s.ok()) {
+    response.send(Http::Code::Bad_Request, s.ToString() + "\n");
+    return;
+  }
+  response.send(Http::Code::Ok, "Running " + std::to_string(num_threads) + " threads\n");
+}
+
 void RESTServer::Shutdown() {
   rest_server_.shutdown();
   server_thread_.join();
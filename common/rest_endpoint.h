@@ -36,6 +36,8 @@ class RESTServer {
   RESTServer(TaskScheduler* task_scheduler);
   void Init();
   void HandleGet(const Rest::Request&, Http::ResponseWriter response);
+  // Changes the number of task threads to the ':count' parameter.
+  void HandleSetThreads(const Rest::Request& request, Http::ResponseWriter response);
   void Shutdown();
 
  private:
@@ -41,7 +41,11 @@ void DumperMain(DumperOptions& opts) {
   }
 
   // Begin dumping.
-  dumper.Run();
+  dumper_status = dumper.Run();
+  if (!dumper_status.ok()) {
+    LOG_ERROR("Dump failed: " + dumper_status.ToString());
+    exit(-1);
+  }
 }
 
 } // namespace memcachedumper
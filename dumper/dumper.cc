@@ -26,13 +26,21 @@
 #include "tasks/task.h"
 #include "tasks/task_scheduler.h"
 #include "utils/aws_utils.h"
+#include "utils/base_dump_index.h"
+#include "utils/disk_space_governor.h"
+#include "utils/file_finisher.h"
 #include "utils/file_util.h"
 #include "utils/mem_mgr.h"
 #include "utils/metrics.h"
 #include "utils/memcache_utils.h"
 #include "utils/net_util.h"
+#include "utils/numa_topology.h"
+#include "utils/output_volumes.h"
 #include "utils/socket_pool.h"
+#include "utils/sqs_notifier.h"
+#include "utils/storage_sink.h"
 
+#include <memory>
 #include <sstream>
 
 #include <string.h>
@@ -50,45 +58,155 @@
 
 namespace memcachedumper {
 
+namespace {
+
+// Points SQS clients at 'sqs_endpoint', if one is given.
+Aws::Client::ClientConfiguration SQSClientConfig(DumperOptions& opts) {
+  Aws::Client::ClientConfiguration config;
+  if (!opts.sqs_endpoint().empty()) config.endpointOverride = opts.sqs_endpoint();
+  return config;
+}
+
+} // anonymous namespace
+
 Dumper::Dumper(DumperOptions& opts)
   : opts_(opts),
-    s3_client_(s3_config_) {
+    s3_client_(s3_config_),
+    sqs_config_(SQSClientConfig(opts)),
+    sqs_client_(sqs_config_) {
+  std::stringstream output_dirs_log;
+  for (const std::string& output_dir_path : opts_.output_dir_paths()) {
+    if (output_dirs_log.tellp() > 0) output_dirs_log << ", ";
+    output_dirs_log << output_dir_path;
+  }
+
   std::stringstream options_log;
   options_log << "Starting dumper with options: " << std::endl
             << "Hostname: " << opts_.memcached_hostname() << std::endl
             << "Port: " << opts_.memcached_port() << std::endl
             << "Num threads: " << opts_.num_threads() << std::endl
+            << "Max threads: " << opts_.max_threads() << std::endl
+            << "Auto scale threads: " << opts_.auto_scale_threads() << std::endl
             << "Chunk size: " << opts_.chunk_size() << std::endl
             << "Max memory limit: " << opts_.max_memory_limit() << std::endl
             << "Max key file size: " << opts_.max_key_file_size() << std::endl
             << "Max data file size: " << opts_.max_data_file_size() << std::endl
             << "Bulk get threshold: " << opts_.bulk_get_threshold() << std::endl
-            << "Output directory: " << opts_.output_dir_path() << std::endl
+            << "Output directories: " << output_dirs_log.str() << std::endl
+            << "Delta base key files: " << opts_.delta_base_keyfile_dir() << std::endl
+            << "io_uring: " << opts_.use_io_uring() << std::endl
+            << "Direct I/O: " << opts_.direct_io() << std::endl
+            << "Checksum: " << Checksum::TypeName(opts_.checksum_type()) << std::endl
+            << "Bulk task threads: " << opts_.bulk_task_threads() << std::endl
+            << "Finisher threads: " << opts_.finisher_threads() << std::endl
+            << "Upload threads: " << opts_.upload_threads() << std::endl
+            << "Compression threads: " << opts_.compression_threads() << std::endl
+            << "Stream upload: " << opts_.stream_upload() << std::endl
+            << "Upload journal: " << opts_.upload_journal() << std::endl
+            << "SQS batch ms: " << opts_.sqs_batch_ms() << std::endl
+            << "SQS endpoint: " << opts_.sqs_endpoint() << std::endl
+            << "Storage sink: " << StorageSink::TypeName(opts_.storage_sink_type()) << std::endl
+            << "Compression: " << Compressor::TypeName(opts_.compression_type())
+            << " (level " << opts_.compression_level() << ")" << std::endl
+            << "Record compression: " << opts_.record_compression() << std::endl
+            << "Dump format version: " << opts_.dump_format_version() << std::endl
+            << "Key index: " << opts_.key_index() << std::endl
+            << "Dedup values: " << opts_.dedup_values() << std::endl
+            << "Min free space: " << opts_.min_free_space() << std::endl
+            << "Metrics interval ms: " << opts_.metrics_interval_ms() << std::endl
+            << "Task CPUs: " << opts_.task_cpus() << std::endl
+            << "Memcached CPUs: " << opts_.memcached_cpus() << std::endl
+            << "NUMA affinity: " << opts_.numa_affinity() << std::endl
             << std::endl;
   LOG(options_log.str());
 
   socket_pool_.reset(new SocketPool(
       opts_.memcached_hostname(), opts_.memcached_port(), opts_.num_threads() + 1));
-  mem_mgr_.reset(new MemoryManager(
-      opts_.chunk_size(), opts_.max_memory_limit() / opts_.chunk_size()));
+  MemcachedUtils::SetChecksumType(opts_.checksum_type());
+  MemcachedUtils::SetUseIoUring(opts_.use_io_uring());
+  MemcachedUtils::SetDirectIO(opts_.direct_io());
+  MemcachedUtils::SetStreamUpload(opts_.stream_upload());
+  MemcachedUtils::SetCompression(opts_.compression_type(), opts_.compression_level());
+  if (opts_.record_compression()) {
+    MemcachedUtils::InitRecordCompression(opts_.compression_level());
+  }
+  MemcachedUtils::SetDumpFormatVersion(opts_.dump_format_version());
+  MemcachedUtils::SetKeyIndex(opts_.key_index());
+  MemcachedUtils::SetValueDedup(opts_.dedup_values());
+  if (opts_.finisher_threads() > 0) {
+    MemcachedUtils::InitFileFinisher(opts_.finisher_threads());
+  }
+  if (opts_.is_s3_dump() && opts_.upload_threads() > 0) {
+    MemcachedUtils::InitFileUploader(opts_.upload_threads());
+  }
+  if (opts_.compression_type() != CompressionType::NONE &&
+      opts_.compression_threads() > 0) {
+    MemcachedUtils::InitBlockCompressor(opts_.compression_threads());
+  }
+
+  int num_chunks = opts_.max_memory_limit() / opts_.chunk_size();
+  // Threads added at runtime need staging buffers too.
+  int num_staging_chunks = opts_.max_threads() * MemcachedUtils::StagingBuffersPerWriter();
+  if (num_staging_chunks > 0) {
+    // O_DIRECT needs block aligned buffers.
+    staging_mem_mgr_.reset(new MemoryManager(opts_.chunk_size(), num_staging_chunks,
+        opts_.direct_io() ? DIRECT_IO_ALIGNMENT : 0));
+    num_chunks -= num_staging_chunks;
+  }
+  if (opts_.compression_type() != CompressionType::NONE) {
+    // The compression buffers are bigger than a chunk, so they take up as many
+    // chunks as it takes to cover them.
+    int num_compression_buffers = opts_.max_threads() * COMPRESSION_BLOCKS_IN_FLIGHT;
+    compression_mem_mgr_.reset(new MemoryManager(COMPRESSION_BUFFER_SIZE,
+        num_compression_buffers));
+    num_chunks -= (static_cast<uint64_t>(num_compression_buffers) * COMPRESSION_BUFFER_SIZE +
+        opts_.chunk_size() - 1) / opts_.chunk_size();
+  }
+  mem_mgr_.reset(new MemoryManager(opts_.chunk_size(), num_chunks));
 }
 
-Dumper::~Dumper() = default;
+Dumper::~Dumper() {
+  // 'sqs_notifier_' drains its queue as it goes away below.
+  if (sqs_notifier_) AwsUtils::SetSQSNotifier(nullptr);
+}
 
 Status Dumper::ClearOutputDirs() {
-  LOG("Clearing output directories if they exist... Path: " + MemcachedUtils::OutputDirPath());
-  return FileUtils::RemoveDirectoryAndContents(MemcachedUtils::OutputDirPath());
+  OutputVolumes* volumes = MemcachedUtils::GetOutputVolumes();
+  for (int i = 0; i < volumes->size(); ++i) {
+    LOG("Clearing output directories if they exist... Path: " + volumes->dir_path(i));
+    RETURN_ON_ERROR(FileUtils::RemoveDirectoryAndContents(volumes->dir_path(i)));
+  }
+  return Status::OK();
 }
 
 Status Dumper::CreateAndValidateOutputDirs() {
   RETURN_ON_ERROR(FileUtils::CreateDirectory(MemcachedUtils::OutputDirPath()));
   RETURN_ON_ERROR(FileUtils::CreateDirectory(MemcachedUtils::GetKeyFilePath()));
-  RETURN_ON_ERROR(FileUtils::CreateDirectory(MemcachedUtils::GetDataStagingPath()));
-  RETURN_ON_ERROR(FileUtils::CreateDirectory(MemcachedUtils::GetDataFinalPath()));
+
+  // Data files may go to any volume.
+  OutputVolumes* volumes = MemcachedUtils::GetOutputVolumes();
+  for (int i = 0; i < volumes->size(); ++i) {
+    if (i > 0) RETURN_ON_ERROR(FileUtils::CreateDirectory(volumes->dir_path(i)));
+    RETURN_ON_ERROR(FileUtils::CreateDirectory(volumes->DataStagingPath(i)));
+    RETURN_ON_ERROR(FileUtils::CreateDirectory(volumes->DataFinalPath(i)));
+  }
 
   return Status::OK();
 }
 
+Status Dumper::CreateMissingDataDirs() {
+  OutputVolumes* volumes = MemcachedUtils::GetOutputVolumes();
+  for (int i = 0; i < volumes->size(); ++i) {
+    for (const std::string& dir_path :
+        {volumes->DataStagingPath(i), volumes->DataFinalPath(i)}) {
+      if (!FileUtils::FileExists(dir_path)) {
+        RETURN_ON_ERROR(FileUtils::CreateDirectory(dir_path));
+      }
+    }
+  }
+  return Status::OK();
+}
+
 Status Dumper::InitSQS() {
   Aws::String queue_name = AwsUtils::GetSQSQueueName();
 
@@ -169,8 +287,24 @@ Status Dumper::Init() {
     RETURN_ON_ERROR(MemcachedUtils::InitKeyFilter(opts_.ketama_bucket_size()));
   }
 
+  // If we're live migrating, every key goes to the instance it hashes to in the
+  // dest IPs, or to its replacement if one is given.
+  if (opts_.is_live_migrate()) {
+    const std::vector<std::string>& targets = opts_.live_migrate_targets().empty() ?
+        opts_.dest_ips() : opts_.live_migrate_targets();
+    LOG("Live migration enabled. Streaming keys to {0} destination(s).", targets.size());
+    MemcachedUtils::SetLiveMigrateTargets(targets);
+  }
+  MemcachedUtils::SetWriteDataFiles(opts_.write_data_files());
+
+  // If we're dumping only the changes since a previous dump, load its key index.
+  if (opts_.is_delta_dump()) {
+    LOG("--delta_base_keyfile_dir provided. Initializing base dump index.");
+    RETURN_ON_ERROR(MemcachedUtils::InitBaseDumpIndex(opts_.delta_base_keyfile_dir()));
+  }
+
   MemcachedUtils::SetReqId(opts_.req_id());
-  MemcachedUtils::SetOutputDirPath(opts_.output_dir_path());
+  MemcachedUtils::SetOutputDirPaths(opts_.output_dir_paths());
   MemcachedUtils::SetBulkGetThreshold(opts_.bulk_get_threshold());
   if (opts_.only_expire_after() > 0) {
     MemcachedUtils::SetOnlyExpireAfter(opts_.only_expire_after());
@@ -195,49 +329,198 @@ Status Dumper::Init() {
   // 'opts.is_resume_mode' to 'false'.
   if (!opts_.is_resume_mode()) {
     RETURN_ON_ERROR(CreateAndValidateOutputDirs());
+  } else {
+    // Volumes may have been added since the previous run.
+    RETURN_ON_ERROR(CreateMissingDataDirs());
   }
 
   RETURN_ON_ERROR(socket_pool_->PrimeConnections());
+  if (opts_.pin_task_threads()) {
+    RETURN_ON_ERROR(MemcachedUtils::InitNumaTopology(opts_.task_cpus(),
+        opts_.memcached_cpus(), opts_.numa_affinity()));
+    NumaTopology* numa = MemcachedUtils::GetNumaTopology();
+    LOG("Pinning task threads to CPUs: {0}", numa->ToString());
+    // Every node gets its own share of the buffers.
+    if (opts_.numa_affinity()) {
+      mem_mgr_->SetNumaTopology(numa);
+      if (staging_mem_mgr_) staging_mem_mgr_->SetNumaTopology(numa);
+      if (compression_mem_mgr_) compression_mem_mgr_->SetNumaTopology(numa);
+    }
+  }
   RETURN_ON_ERROR(mem_mgr_->PreallocateChunks());
+  if (staging_mem_mgr_) {
+    RETURN_ON_ERROR(staging_mem_mgr_->PreallocateChunks());
+  }
+  if (compression_mem_mgr_) {
+    RETURN_ON_ERROR(compression_mem_mgr_->PreallocateChunks());
+  }
 
-  // TODO: Validate if we have enough free space to run the dump smoothly.
-  uint64_t free_space = FileUtils::GetSpaceAvailable(opts_.output_dir_path());
-  LOG("Amount of free space on disk: {0} MB", free_space / 1024 / 1024);
+  for (const std::string& output_dir_path : opts_.output_dir_paths()) {
+    uint64_t free_space = FileUtils::GetSpaceAvailable(output_dir_path);
+    LOG("Amount of free space on disk: {0} MB (Path: {1})", free_space / 1024 / 1024,
+        output_dir_path);
+  }
+
+  // By default, keep enough room for every thread to complete the data file it's
+  // writing.
+  uint64_t min_free_space = opts_.min_free_space();
+  if (min_free_space == 0) {
+    min_free_space = static_cast<uint64_t>(opts_.num_threads()) * opts_.max_data_file_size();
+  }
+  MemcachedUtils::InitDiskSpaceGovernor(min_free_space);
+  uint64_t free_space = MemcachedUtils::GetDiskSpaceGovernor()->FreeSpace();
+  if (free_space < 2 * min_free_space) {
+    // Only uploading files to S3 frees up space as we go.
+    LOG_ERROR("Only {0} MB free across the output directories.{1}", free_space / 1024 / 1024,
+        opts_.is_s3_dump() ? " Writes will wait for uploads to free up space." :
+        " The dump may run out of space.");
+  }
 
   if (opts_.is_s3_dump()) {
-    LOG("Dump target set to S3. S3 Bucket: {0} ; S3 Path: {1}", opts_.s3_bucket(), opts_.s3_path());
+    switch (opts_.storage_sink_type()) {
+      case StorageSinkType::S3:
+        LOG("Dump target set to S3. S3 Bucket: {0} ; S3 Path: {1}", opts_.s3_bucket(),
+            opts_.s3_path());
+        storage_sink_.reset(new S3StorageSink(&s3_client_, opts_.s3_bucket()));
+        break;
+      case StorageSinkType::LOCAL:
+        LOG("Dump target set to local directory: {0}", opts_.storage_sink_path());
+        storage_sink_.reset(new LocalStorageSink(opts_.storage_sink_path()));
+        break;
+      case StorageSinkType::FAKE:
+        LOG("Dump target set to a fake storage sink. Uploaded files are discarded.");
+        storage_sink_.reset(new FakeStorageSink(opts_.fake_sink_options()));
+        break;
+    }
+    MemcachedUtils::SetStorageSink(storage_sink_.get());
+    // A resumed dump replays the previous run's journal.
+    if (opts_.upload_journal()) {
+      RETURN_ON_ERROR(MemcachedUtils::InitUploadJournal(opts_.is_resume_mode()));
+    }
     AwsUtils::SetS3Client(&s3_client_);
     AwsUtils::SetSQSClient(&sqs_client_);
     AwsUtils::SetS3Bucket(opts_.s3_bucket());
     AwsUtils::SetS3Path(opts_.s3_path());
-    AwsUtils::SetSQSQueueName(opts_.sqs_queue_name());
-    RETURN_ON_ERROR(InitSQS());
+    // Other sinks only notify a queue if given one, eg. on a local SQS-compatible
+    // server.
+    if (!opts_.sqs_queue_name().empty()) {
+      AwsUtils::SetSQSQueueName(opts_.sqs_queue_name());
+      RETURN_ON_ERROR(InitSQS());
+      if (opts_.sqs_batch_ms() > 0) {
+        sqs_notifier_.reset(new SQSNotifier(&sqs_client_,
+            AwsUtils::GetCachedSQSQueueURL(), opts_.sqs_batch_ms()));
+        sqs_notifier_->Start();
+        AwsUtils::SetSQSNotifier(sqs_notifier_.get());
+      }
+    }
   }
 
   task_scheduler_.reset(new TaskScheduler(opts_.num_threads(), this));
+  task_scheduler_->SetMaxRunning(TaskPriority::BULK, opts_.bulk_task_threads());
+  task_scheduler_->SetMetricsInterval(opts_.metrics_interval_ms());
+  task_scheduler_->SetMaxThreads(opts_.max_threads());
+  task_scheduler_->SetAutoScale(opts_.auto_scale_threads());
   task_scheduler_->Init();
 
   rest_server_.reset(new RESTServer(task_scheduler_.get()));
   return Status::OK();
 }
 
-Socket* Dumper::GetMemcachedSocket() {
-  return socket_pool_->GetSocket();
+Status Dumper::GetMemcachedSocket(Socket** out_sock) {
+  return socket_pool_->GetSocket(out_sock);
 }
 
 void Dumper::ReleaseMemcachedSocket(Socket *sock) {
   return socket_pool_->ReleaseSocket(sock);
 }
 
+Status Dumper::ScaleThreads(int num_threads) {
+  if (num_threads < 1 || num_threads > task_scheduler_->max_threads()) {
+    return Status::InvalidArgument("Number of threads must be between 1 and " +
+        std::to_string(task_scheduler_->max_threads()), std::to_string(num_threads));
+  }
+
+  std::lock_guard<std::mutex> lock(scale_mutex_);
+  int prev_num_threads = task_scheduler_->num_threads();
+  if (num_threads == prev_num_threads) return Status::OK();
+  // One socket per task thread, plus one for the metadump. Threads are removed
+  // before their sockets, and added after them.
+  if (num_threads < prev_num_threads) {
+    task_scheduler_->SetNumThreads(num_threads);
+    RETURN_ON_ERROR(socket_pool_->Resize(num_threads + 1));
+  } else {
+    RETURN_ON_ERROR(socket_pool_->Resize(num_threads + 1));
+    task_scheduler_->SetNumThreads(num_threads);
+  }
+  LOG("Scaled task threads from {0} to {1}", prev_num_threads, num_threads);
+  return Status::OK();
+}
+
 bool Dumper::ValidateKeyDumpComplete() {
   LOG("[Resume mode] Validating if key dump is complete from the previous run.");
-  std::string keydump_checkpoint_file = MemcachedUtils::GetKeyFilePath() +
-    KEYDUMP_CHECKPOINT_FILENAME;
-  return FileUtils::FileExists(keydump_checkpoint_file);
+  // The key files are on the primary volume, unless the volumes were listed in a
+  // different order on the previous run.
+  OutputVolumes* volumes = MemcachedUtils::GetOutputVolumes();
+  for (int i = 0; i < volumes->size(); ++i) {
+    std::string keydump_checkpoint_file = volumes->KeyFilePath(i) +
+      KEYDUMP_CHECKPOINT_FILENAME;
+    if (FileUtils::FileExists(keydump_checkpoint_file)) return true;
+  }
+  return false;
 }
 
-void Dumper::Run() {
+Status Dumper::WriteTombstones() {
+  // Every task is done by now, so their compression buffers are free.
+  std::vector<uint8_t*> compression_buffers;
+  Status s;
+  if (compression_mem_mgr_) {
+    for (int i = 0; i < COMPRESSION_BLOCKS_IN_FLIGHT && s.ok(); ++i) {
+      uint8_t* buf = compression_mem_mgr_->GetBuffer();
+      if (buf == nullptr) {
+        s = Status::OutOfMemoryError("No compression buffers left");
+      } else {
+        compression_buffers.push_back(buf);
+      }
+    }
+  }
+  if (s.ok()) s = WriteTombstoneFiles(compression_buffers);
 
+  for (uint8_t* buf : compression_buffers) {
+    compression_mem_mgr_->ReturnBuffer(buf);
+  }
+  return s;
+}
+
+Status Dumper::WriteTombstoneFiles(const std::vector<uint8_t*>& compression_buffers) {
+  RotatingFile tombstone_files(
+      MemcachedUtils::GetDataStagingPath(),
+      MemcachedUtils::TombstoneFilePrefix(),
+      MemcachedUtils::MaxDataFileSize(),
+      MemcachedUtils::GetDataFinalPath(),
+      true /* suffix checksum */,
+      opts_.is_s3_dump() /* Upload each file to S3 on close */);
+  if (!compression_buffers.empty()) {
+    RETURN_ON_ERROR(tombstone_files.EnableCompression(compression_buffers,
+        compression_mem_mgr_->chunk_size()));
+  }
+  RETURN_ON_ERROR(tombstone_files.Init());
+
+  uint64_t n_tombstones = 0;
+  RETURN_ON_ERROR(MemcachedUtils::GetBaseDumpIndex()->WriteTombstones(
+      MemcachedUtils::GetKeyFilePath(), &tombstone_files, &n_tombstones));
+  auto finish_status = std::make_shared<Status>();
+  RETURN_ON_ERROR(tombstone_files.Finish(
+      [finish_status](Status status) { *finish_status = status; }));
+  MemcachedUtils::WaitUntilFilesComplete();
+  RETURN_ON_ERROR(*finish_status);
+
+  DumpMetrics::update_total_tombstones(n_tombstones);
+  return Status::OK();
+}
+
+Status Dumper::Run() {
+
+  Status tombstone_status;
   {
     SCOPED_STOP_WATCH(&DumpMetrics::total_msw());
 
@@ -253,6 +536,37 @@ void Dumper::Run() {
     }
 
     task_scheduler_->WaitUntilTasksComplete();
+    // The last data files may still be on their way to datafiles_completed/ or S3.
+    MemcachedUtils::WaitUntilFilesComplete();
+
+    if (opts_.is_delta_dump()) {
+      tombstone_status = WriteTombstones();
+      if (!tombstone_status.ok()) {
+        LOG_ERROR("Could not write tombstones. (Status: {0})", tombstone_status.ToString());
+      }
+    }
+  }
+
+  rest_server_->Shutdown();
+
+  // Nothing's left to notify by now. Send anything that is and stop the notifier
+  // thread, so that a failure is accounted for below.
+  if (sqs_notifier_) {
+    AwsUtils::SetSQSNotifier(nullptr);
+    sqs_notifier_.reset();
+  }
+
+  // A dump with a missing or unchecked data file must not be marked DONE.
+  Status files_status = MemcachedUtils::FileErrorStatus();
+  if (!files_status.ok()) {
+    LOG(DumpMetrics::MetricsAsJsonString());
+    return Status::IOError("Data files failed to complete", files_status.ToString());
+  }
+
+  // Without the tombstones, the delta can't be applied correctly.
+  if (!tombstone_status.ok()) {
+    LOG(DumpMetrics::MetricsAsJsonString());
+    return Status::IOError("Could not write tombstones", tombstone_status.ToString());
   }
 
   // Output the "DONE" file.
@@ -263,13 +577,15 @@ void Dumper::Run() {
     DumpMetrics::total_keys_ignored(),
     DumpMetrics::total_keys_missing(),
     DumpMetrics::total_keys_filtered(),
+    DumpMetrics::total_keys_unchanged(),
+    DumpMetrics::total_tombstones(),
     DumpMetrics::time_elapsed_str());
   dtask.Execute();
 
-  rest_server_->Shutdown();
-
   LOG(DumpMetrics::MetricsAsJsonString());
+  if (storage_sink_) storage_sink_->LogStats();
   LOG("Status: All tasks completed. Exiting...");
+  return Status::OK();
 }
 
 } // namespace memcachedumper
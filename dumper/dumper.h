@@ -23,6 +23,7 @@
 #include "utils/stopwatch.h"
 
 #include <memory>
+#include <mutex>
 #include <string>
 #include <vector>
 
@@ -36,6 +37,8 @@ class MemoryManager;
 class RESTServer;
 class Socket;
 class SocketPool;
+class SQSNotifier;
+class StorageSink;
 class TaskScheduler;
 
 class Dumper {
@@ -48,6 +51,8 @@ class Dumper {
   Aws::SQS::SQSClient* GetSQSClient() { return &sqs_client_; }
 
   MemoryManager *mem_mgr() { return mem_mgr_.get(); }
+  MemoryManager *staging_mem_mgr() { return staging_mem_mgr_.get(); }
+  MemoryManager *compression_mem_mgr() { return compression_mem_mgr_.get(); }
 
   // Initializes the dumper by connecting to memcached.
   Status Init();
@@ -55,15 +60,21 @@ class Dumper {
   // Initialize the SQS queue.
   Status InitSQS();
 
-  // Starts the dumping process.
-  void Run();
+  // Starts the dumping process. Returns an error instead of marking the dump DONE
+  // if any data file failed to complete.
+  Status Run();
 
-  // Returns a socket to memcached from the socket pool.
-  Socket* GetMemcachedSocket();
+  // Takes a socket to memcached from the socket pool into 'out_sock', waiting for
+  // one if they're all in use.
+  Status GetMemcachedSocket(Socket** out_sock);
 
   // Releases a memcached socket back to the socket pool.
   void ReleaseMemcachedSocket(Socket *sock);
 
+  // Runs 'num_threads' task threads with a socket to memcached each, while the
+  // dump is running. Must be between 1 and the 'max_threads' option.
+  Status ScaleThreads(int num_threads);
+
   // Check if key dump is complete before attempting to resume from checkpoints.
   // If it's not complete, bubble up an error to indicate that we must start from scratch.
   bool ValidateKeyDumpComplete();
@@ -77,6 +88,16 @@ class Dumper {
   // Set up the output directories and make sure they're empty.
   Status CreateAndValidateOutputDirs();
 
+  // Creates the data file directories of volumes that don't have them yet, when
+  // resuming.
+  Status CreateMissingDataDirs();
+
+  // For delta dumps, write out the keys from the base dump that are no longer
+  // present.
+  Status WriteTombstones();
+  // Writes the tombstone files, compressing them in 'compression_buffers' if any.
+  Status WriteTombstoneFiles(const std::vector<uint8_t*>& compression_buffers);
+
   std::string memcached_hostname_;
 
   DumperOptions opts_;
@@ -87,15 +108,34 @@ class Dumper {
   // Owned memory manager.
   std::unique_ptr<MemoryManager> mem_mgr_;
 
+  // Staging buffers for writing data files through io_uring. Carved out of the
+  // memory limit only if enabled.
+  std::unique_ptr<MemoryManager> staging_mem_mgr_;
+
+  // Buffers that data files are compressed in. Carved out of the memory limit
+  // only if compressing.
+  std::unique_ptr<MemoryManager> compression_mem_mgr_;
+
   // The task scheduler that will carry out all the work.
   std::unique_ptr<TaskScheduler> task_scheduler_;
 
+  // Serializes ScaleThreads() calls from the REST endpoint and the auto scaler.
+  std::mutex scale_mutex_;
+
   // A REST Server to report metrics.
   std::unique_ptr<RESTServer> rest_server_;
 
+  // Where files are uploaded to, if they are.
+  std::unique_ptr<StorageSink> storage_sink_;
+
   Aws::Client::ClientConfiguration s3_config_;
   Aws::S3::S3Client s3_client_;
+  Aws::Client::ClientConfiguration sqs_config_;
   Aws::SQS::SQSClient sqs_client_;
+
+  // Batches SQS notifications, if enabled. Declared after 'sqs_client_' so that it
+  // is drained and joined before the client goes away.
+  std::unique_ptr<SQSNotifier> sqs_notifier_;
 };
 
 } // namespace memcachedumper
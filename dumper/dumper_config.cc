@@ -21,12 +21,60 @@
 
 // Local project includes
 #include "common/logger.h"
+#include "utils/file_util.h"
+#include "utils/multipart_upload.h"
+#include "utils/numa_topology.h"
 
 // C++ includes
+#include <algorithm>
+#include <cstdlib>
 #include <iostream>
 
 namespace memcachedumper {
 
+// 'output_dir' is either a single path or a list of them.
+static std::vector<std::string> OutputDirPaths(const YAML::Node& config) {
+  if (config[ARG_OUTPUT_DIR].IsSequence()) {
+    return config[ARG_OUTPUT_DIR].as<std::vector<std::string>>();
+  }
+  return {config[ARG_OUTPUT_DIR].as<std::string>()};
+}
+
+// Splits 'path' into its components. The path is resolved with realpath() when
+// it exists, and is otherwise normalized lexically.
+static std::vector<std::string> PathComponents(const std::string& path) {
+  std::string resolved = path;
+  char* real = realpath(path.c_str(), nullptr);
+  if (real != nullptr) {
+    resolved = real;
+    free(real);
+  }
+
+  std::vector<std::string> components;
+  size_t pos = 0;
+  while (pos <= resolved.length()) {
+    size_t next = resolved.find('/', pos);
+    if (next == std::string::npos) next = resolved.length();
+    std::string component = resolved.substr(pos, next - pos);
+    if (component == "..") {
+      if (!components.empty()) components.pop_back();
+    } else if (!component.empty() && component != ".") {
+      components.push_back(component);
+    }
+    pos = next + 1;
+  }
+  return components;
+}
+
+// Returns true if 'path' is 'dir' or lies anywhere under it.
+static bool IsPathUnder(const std::string& path, const std::string& dir) {
+  std::vector<std::string> path_components = PathComponents(path);
+  std::vector<std::string> dir_components = PathComponents(dir);
+  if (path_components.size() < dir_components.size()) return false;
+  return std::equal(dir_components.begin(), dir_components.end(),
+      path_components.begin());
+}
+
 Status DumperConfig::ValidateConfig(const YAML::Node& config) {
 
   LOG("Validating configuration...");
@@ -57,10 +105,17 @@ Status DumperConfig::ValidateConfig(const YAML::Node& config) {
   uint16_t num_threads = config[ARG_THREADS].as<uint16_t>();
   uint64_t bufsize = config[ARG_BUFSIZE].as<uint64_t>();
   uint64_t memlimit = config[ARG_MEMLIMIT].as<uint64_t>();
-  if (!(num_threads > 0 && num_threads < 49)) {
+  if (!(num_threads > 0 && num_threads <= MAX_TASK_THREADS)) {
     return Status::InvalidArgument(
         "Bad 'threads' argument", std::to_string(num_threads));
   }
+  // Memory is set aside for every thread that may be run.
+  uint16_t max_threads = config[ARG_MAX_THREADS] ?
+      config[ARG_MAX_THREADS].as<uint16_t>() : num_threads;
+  if (!(max_threads >= num_threads && max_threads <= MAX_TASK_THREADS)) {
+    return Status::InvalidArgument(
+        "Bad 'max_threads' argument", std::to_string(max_threads));
+  }
   if (bufsize == 0) {
     return Status::InvalidArgument(
         "Bad 'bufsize' argument", std::to_string(bufsize));
@@ -70,11 +125,11 @@ Status DumperConfig::ValidateConfig(const YAML::Node& config) {
         "Bad 'memlimit' argument", std::to_string(memlimit));
   }
 
-  if (static_cast<uint64_t>(num_threads * 2 * bufsize) > memlimit) {
+  if (static_cast<uint64_t>(max_threads * 2 * bufsize) > memlimit) {
     LOG_ERROR("Configuration error: Memory given is not enough for all threads.\n\
         Given: {0} bytes. \
         Required: {1} bytes for {2} buffers of size {3} (2 buffers per thread)",
-            memlimit, num_threads * 2 * bufsize, 2 * num_threads, bufsize);
+            memlimit, max_threads * 2 * bufsize, 2 * max_threads, bufsize);
     return Status::InvalidArgument(
         "Insufficient 'memlimit' w.r.t 'num_threads' and 'bufsize'.");
   }
@@ -87,9 +142,20 @@ Status DumperConfig::ValidateConfig(const YAML::Node& config) {
     return Status::InvalidArgument(
         "Bad 'data_file_size' argument", config[ARG_DATA_FILE_SIZE].as<std::string>());
   }
-  if (config[ARG_OUTPUT_DIR].as<std::string>().empty()) {
+  std::vector<std::string> output_dir_paths = OutputDirPaths(config);
+  if (output_dir_paths.empty()) {
     return Status::InvalidArgument("'output_dir' argument required");
   }
+  for (size_t i = 0; i < output_dir_paths.size(); ++i) {
+    if (output_dir_paths[i].empty()) {
+      return Status::InvalidArgument("'output_dir' argument required");
+    }
+    for (size_t j = 0; j < i; ++j) {
+      if (output_dir_paths[i] == output_dir_paths[j]) {
+        return Status::InvalidArgument("Duplicate 'output_dir' path", output_dir_paths[i]);
+      }
+    }
+  }
   if (!(config[ARG_BULK_GET_THRESHOLD].as<uint64_t>() > 0)) {
     return Status::InvalidArgument(
         "Bad 'bulk_get_threshold' argument",
@@ -114,8 +180,197 @@ Status DumperConfig::ValidateConfig(const YAML::Node& config) {
     }
   }
 
+  if (config[ARG_DELTA_BASE_KEYFILE_DIR]) {
+    if (config[ARG_DELTA_BASE_KEYFILE_DIR].as<std::string>().empty()) {
+      return Status::InvalidArgument("Bad 'delta_base_keyfile_dir' argument");
+    }
+    for (const std::string& output_dir_path : output_dir_paths) {
+      if (IsPathUnder(config[ARG_DELTA_BASE_KEYFILE_DIR].as<std::string>(),
+          output_dir_path)) {
+        return Status::InvalidArgument(
+            "'delta_base_keyfile_dir' must not be under 'output_dir'",
+            config[ARG_DELTA_BASE_KEYFILE_DIR].as<std::string>());
+      }
+    }
+  }
+
+  bool live_migrate = config[ARG_LIVE_MIGRATE] && config[ARG_LIVE_MIGRATE].as<bool>();
+  if (live_migrate) {
+    if (!config[ARG_DEST_IPS] || !config[ARG_ALL_IPS]) {
+      return Status::InvalidArgument(
+          "Must provide 'dest_ips' and 'all_ips' along with 'live_migrate'");
+    }
+    if (config[ARG_LIVE_MIGRATE_TARGETS] &&
+        config[ARG_LIVE_MIGRATE_TARGETS].size() != config[ARG_DEST_IPS].size()) {
+      return Status::InvalidArgument(
+          "'live_migrate_targets' must have one entry for every entry in 'dest_ips'");
+    }
+  }
+
+  if (config[ARG_WRITE_DATA_FILES] && !config[ARG_WRITE_DATA_FILES].as<bool>()) {
+    if (!live_migrate) {
+      return Status::InvalidArgument(
+          "'write_data_files' can only be disabled along with 'live_migrate'");
+    }
+    if (config[ARG_IS_S3_DUMP] && config[ARG_IS_S3_DUMP].as<bool>()) {
+      return Status::InvalidArgument(
+          "'write_data_files' can not be disabled for an S3 dump");
+    }
+  }
+
+  bool use_io_uring = config[ARG_IO_URING] && config[ARG_IO_URING].as<bool>();
+  bool direct_io = config[ARG_DIRECT_IO] && config[ARG_DIRECT_IO].as<bool>();
+#ifndef USE_IO_URING
+  if (use_io_uring) {
+    return Status::InvalidArgument(
+        "'io_uring' requires building with io_uring support (-DIO_URING_ENABLED=1)");
+  }
+#endif
+  if (config[ARG_CHECKSUM]) {
+    ChecksumType checksum_type;
+    RETURN_ON_ERROR(Checksum::ParseType(config[ARG_CHECKSUM].as<std::string>(),
+        &checksum_type));
+    if (!Checksum::Supported(checksum_type)) {
+      return Status::InvalidArgument("'checksum' is not supported by this build",
+          config[ARG_CHECKSUM].as<std::string>());
+    }
+  }
+
+  if (config[ARG_COMPRESSION]) {
+    CompressionType compression_type;
+    RETURN_ON_ERROR(Compressor::ParseType(config[ARG_COMPRESSION].as<std::string>(),
+        &compression_type));
+    if (!Compressor::Supported(compression_type)) {
+      return Status::InvalidArgument("'compression' is not supported by this build",
+          config[ARG_COMPRESSION].as<std::string>());
+    }
+  }
+
+  if (config[ARG_RECORD_COMPRESSION] && config[ARG_RECORD_COMPRESSION].as<bool>()) {
+    if (!Compressor::Supported(CompressionType::ZSTD)) {
+      return Status::InvalidArgument(
+          "'record_compression' needs a build with zstd support");
+    }
+    // Compressing the whole file would take away random access to the records.
+    if (config[ARG_COMPRESSION] && config[ARG_COMPRESSION].as<std::string>() != "none") {
+      return Status::InvalidArgument(
+          "'record_compression' and 'compression' can not both be enabled");
+    }
+  }
+
+  if (config[ARG_DUMP_FORMAT_VERSION]) {
+    int dump_format_version = config[ARG_DUMP_FORMAT_VERSION].as<int>();
+    if (dump_format_version != 0 && dump_format_version != 1) {
+      return Status::InvalidArgument("'dump_format_version' must be 0 or 1",
+          std::to_string(dump_format_version));
+    }
+  }
+
+  // References are offsets in the stream of records, which V1 files don't have.
+  if (config[ARG_DEDUP_VALUES] && config[ARG_DEDUP_VALUES].as<bool>() &&
+      config[ARG_DUMP_FORMAT_VERSION] && config[ARG_DUMP_FORMAT_VERSION].as<int>() != 0) {
+    return Status::InvalidArgument(
+        "'dedup_values' is only supported with 'dump_format_version' 0");
+  }
+
+  if (config[ARG_BULK_TASK_THREADS] && config[ARG_BULK_TASK_THREADS].as<int>() < 0) {
+    return Status::InvalidArgument("'bulk_task_threads' can not be negative");
+  }
+  if (config[ARG_FINISHER_THREADS] && config[ARG_FINISHER_THREADS].as<int>() < 0) {
+    return Status::InvalidArgument("'finisher_threads' can not be negative");
+  }
+  if (config[ARG_METRICS_INTERVAL_MS] && config[ARG_METRICS_INTERVAL_MS].as<int>() < 0) {
+    return Status::InvalidArgument("'metrics_interval_ms' can not be negative");
+  }
+  if (config[ARG_UPLOAD_THREADS] && config[ARG_UPLOAD_THREADS].as<int>() < 0) {
+    return Status::InvalidArgument("'upload_threads' can not be negative");
+  }
+  if (config[ARG_COMPRESSION_THREADS] && config[ARG_COMPRESSION_THREADS].as<int>() < 0) {
+    return Status::InvalidArgument("'compression_threads' can not be negative");
+  }
+  if (config[ARG_SQS_BATCH_MS] && config[ARG_SQS_BATCH_MS].as<int>() < 0) {
+    return Status::InvalidArgument("'sqs_batch_ms' can not be negative");
+  }
+  std::vector<int> cpus;
+  if (config[ARG_TASK_CPUS]) {
+    RETURN_ON_ERROR(NumaTopology::ParseCpuList(
+        config[ARG_TASK_CPUS].as<std::string>(), &cpus));
+  }
+  if (config[ARG_MEMCACHED_CPUS]) {
+    RETURN_ON_ERROR(NumaTopology::ParseCpuList(
+        config[ARG_MEMCACHED_CPUS].as<std::string>(), &cpus));
+  }
+
+  if (direct_io && config[ARG_BUFSIZE].as<uint64_t>() < DIRECT_IO_ALIGNMENT) {
+    return Status::InvalidArgument("'bufsize' is too small for 'direct_io'");
+  }
+
+  bool stream_upload = config[ARG_STREAM_UPLOAD] && config[ARG_STREAM_UPLOAD].as<bool>();
+  if (stream_upload) {
+    if (!config[ARG_IS_S3_DUMP] || !config[ARG_IS_S3_DUMP].as<bool>()) {
+      return Status::InvalidArgument("'stream_upload' needs 'is_s3_dump'");
+    }
+    if (use_io_uring || direct_io) {
+      return Status::InvalidArgument(
+          "'stream_upload' can not be combined with 'io_uring' or 'direct_io'");
+    }
+    // Every buffer is a part, and the upload is copied to its final name in one go.
+    // Files grow past 'data_file_size' by up to a buffer before rotating.
+    uint64_t bufsize = config[ARG_BUFSIZE].as<uint64_t>();
+    uint64_t max_file_size = config[ARG_DATA_FILE_SIZE].as<uint64_t>() + bufsize;
+    if (bufsize < S3_MIN_PART_SIZE) {
+      return Status::InvalidArgument("'bufsize' must be at least 5MB for 'stream_upload'");
+    }
+    if (max_file_size > S3_MAX_COPY_SIZE || max_file_size / bufsize + 1 > S3_MAX_PARTS) {
+      return Status::InvalidArgument("'data_file_size' is too large for 'stream_upload'");
+    }
+  }
+  bool compression = config[ARG_COMPRESSION] &&
+      config[ARG_COMPRESSION].as<std::string>() != "none";
+  if (use_io_uring || direct_io || stream_upload || compression) {
+    // Each thread needs its staging buffers on top of its two working buffers.
+    uint64_t staging_buffers = 0;
+    if (use_io_uring || direct_io || stream_upload) {
+      staging_buffers = stream_upload ? STREAM_UPLOAD_PART_BUFFERS :
+          (use_io_uring ? ASYNC_WRITE_STAGING_BUFFERS : 1);
+    }
+    // And its compression buffers, which take up as many chunks as they cover.
+    uint64_t compression_chunks = 0;
+    if (compression) {
+      compression_chunks = (static_cast<uint64_t>(max_threads) *
+          COMPRESSION_BLOCKS_IN_FLIGHT * COMPRESSION_BUFFER_SIZE + bufsize - 1) / bufsize;
+    }
+    uint64_t num_chunks = memlimit / bufsize;
+    if (num_chunks <= max_threads * (staging_buffers + 2) + compression_chunks) {
+      return Status::InvalidArgument(
+          "'memlimit' is too low for the staging buffers of 'io_uring', 'direct_io' "
+          "or 'stream_upload', or the buffers of 'compression'");
+    }
+  }
+
+  StorageSinkType storage_sink_type = StorageSinkType::S3;
+  if (config[ARG_STORAGE_SINK]) {
+    RETURN_ON_ERROR(StorageSink::ParseType(config[ARG_STORAGE_SINK].as<std::string>(),
+        &storage_sink_type));
+  }
+  if (storage_sink_type == StorageSinkType::LOCAL &&
+      (!config[ARG_STORAGE_SINK_PATH] ||
+       config[ARG_STORAGE_SINK_PATH].as<std::string>().empty())) {
+    return Status::InvalidArgument("The 'local' storage sink needs 'storage_sink_path'");
+  }
+  if (config[ARG_FAKE_SINK_LATENCY_MS] && config[ARG_FAKE_SINK_LATENCY_MS].as<int>() < 0) {
+    return Status::InvalidArgument("'fake_sink_latency_ms' can not be negative");
+  }
+  if (config[ARG_FAKE_SINK_ERROR_RATE] &&
+      (config[ARG_FAKE_SINK_ERROR_RATE].as<double>() < 0 ||
+       config[ARG_FAKE_SINK_ERROR_RATE].as<double>() > 1)) {
+    return Status::InvalidArgument("'fake_sink_error_rate' must be between 0 and 1");
+  }
+
   if (config[ARG_IS_S3_DUMP]) {
-    if (config[ARG_IS_S3_DUMP].as<bool>() == true) {
+    // Only S3 needs a bucket and a queue to notify.
+    if (config[ARG_IS_S3_DUMP].as<bool>() == true &&
+        storage_sink_type == StorageSinkType::S3) {
       if (config[ARG_S3_BUCKET].as<std::string>().empty() ||
           config[ARG_S3_FINAL_PATH].as<std::string>().empty() ||
           config[ARG_SQS_QUEUE].as<std::string>().empty()) {
@@ -138,7 +393,7 @@ Status DumperConfig::LoadConfig(std::string config_filepath, DumperOptions& out_
   out_opts.set_max_memory_limit(config[ARG_MEMLIMIT].as<uint64_t>());
   out_opts.set_max_key_file_size(config[ARG_KEY_FILE_SIZE].as<uint64_t>());
   out_opts.set_max_data_file_size(config[ARG_DATA_FILE_SIZE].as<uint64_t>());
-  out_opts.set_output_dir_path(config[ARG_OUTPUT_DIR].as<std::string>());
+  out_opts.set_output_dir_paths(OutputDirPaths(config));
   out_opts.set_bulk_get_threshold(config[ARG_BULK_GET_THRESHOLD].as<uint32_t>());
   out_opts.set_only_expire_after(config[ARG_ONLY_EXPIRE_AFTER_S].as<int>());
   out_opts.set_log_file_path(config[ARG_LOG_FILE_PATH].as<std::string>());
@@ -151,6 +406,10 @@ Status DumperConfig::LoadConfig(std::string config_filepath, DumperOptions& out_
   if (config[ARG_KETAMA_BUCKET_SIZE]) {
     out_opts.set_ketama_bucket_size(config[ARG_KETAMA_BUCKET_SIZE].as<uint32_t>());
   }
+  if (config[ARG_DELTA_BASE_KEYFILE_DIR]) {
+    out_opts.set_delta_base_keyfile_dir(
+        config[ARG_DELTA_BASE_KEYFILE_DIR].as<std::string>());
+  }
   for (auto dip : config[ARG_DEST_IPS]) {
     out_opts.add_dest_ip(dip.as<std::string>());
   }
@@ -158,12 +417,125 @@ Status DumperConfig::LoadConfig(std::string config_filepath, DumperOptions& out_
     out_opts.add_all_ip(aip.as<std::string>());
   }
 
+  if (config[ARG_LIVE_MIGRATE]) {
+    out_opts.set_live_migrate(config[ARG_LIVE_MIGRATE].as<bool>());
+  }
+  for (auto target : config[ARG_LIVE_MIGRATE_TARGETS]) {
+    out_opts.add_live_migrate_target(target.as<std::string>());
+  }
+  if (config[ARG_WRITE_DATA_FILES]) {
+    out_opts.set_write_data_files(config[ARG_WRITE_DATA_FILES].as<bool>());
+  }
+  if (config[ARG_IO_URING]) {
+    out_opts.set_use_io_uring(config[ARG_IO_URING].as<bool>());
+  }
+  if (config[ARG_DIRECT_IO]) {
+    out_opts.set_direct_io(config[ARG_DIRECT_IO].as<bool>());
+  }
+  if (config[ARG_CHECKSUM]) {
+    ChecksumType checksum_type;
+    RETURN_ON_ERROR(Checksum::ParseType(config[ARG_CHECKSUM].as<std::string>(),
+        &checksum_type));
+    out_opts.set_checksum_type(checksum_type);
+  }
+  if (config[ARG_BULK_TASK_THREADS]) {
+    out_opts.set_bulk_task_threads(config[ARG_BULK_TASK_THREADS].as<int>());
+  }
+  if (config[ARG_FINISHER_THREADS]) {
+    out_opts.set_finisher_threads(config[ARG_FINISHER_THREADS].as<int>());
+  }
+  if (config[ARG_UPLOAD_THREADS]) {
+    out_opts.set_upload_threads(config[ARG_UPLOAD_THREADS].as<int>());
+  }
+  if (config[ARG_STREAM_UPLOAD]) {
+    out_opts.set_stream_upload(config[ARG_STREAM_UPLOAD].as<bool>());
+  }
+  if (config[ARG_UPLOAD_JOURNAL]) {
+    out_opts.set_upload_journal(config[ARG_UPLOAD_JOURNAL].as<bool>());
+  }
+  if (config[ARG_SQS_BATCH_MS]) {
+    out_opts.set_sqs_batch_ms(config[ARG_SQS_BATCH_MS].as<int>());
+  }
+  if (config[ARG_SQS_ENDPOINT]) {
+    out_opts.set_sqs_endpoint(config[ARG_SQS_ENDPOINT].as<std::string>());
+  }
+  if (config[ARG_STORAGE_SINK]) {
+    StorageSinkType storage_sink_type;
+    RETURN_ON_ERROR(StorageSink::ParseType(config[ARG_STORAGE_SINK].as<std::string>(),
+        &storage_sink_type));
+    out_opts.set_storage_sink_type(storage_sink_type);
+  }
+  if (config[ARG_STORAGE_SINK_PATH]) {
+    out_opts.set_storage_sink_path(config[ARG_STORAGE_SINK_PATH].as<std::string>());
+  }
+  FakeStorageSink::Options fake_sink_options;
+  if (config[ARG_FAKE_SINK_LATENCY_MS]) {
+    fake_sink_options.latency_ms = config[ARG_FAKE_SINK_LATENCY_MS].as<int>();
+  }
+  if (config[ARG_FAKE_SINK_BANDWIDTH]) {
+    fake_sink_options.bandwidth = config[ARG_FAKE_SINK_BANDWIDTH].as<uint64_t>();
+  }
+  if (config[ARG_FAKE_SINK_ERROR_RATE]) {
+    fake_sink_options.error_rate = config[ARG_FAKE_SINK_ERROR_RATE].as<double>();
+  }
+  out_opts.set_fake_sink_options(fake_sink_options);
+  if (config[ARG_COMPRESSION]) {
+    CompressionType compression_type;
+    RETURN_ON_ERROR(Compressor::ParseType(config[ARG_COMPRESSION].as<std::string>(),
+        &compression_type));
+    out_opts.set_compression_type(compression_type);
+  }
+  if (config[ARG_COMPRESSION_LEVEL]) {
+    out_opts.set_compression_level(config[ARG_COMPRESSION_LEVEL].as<int>());
+  }
+  if (config[ARG_COMPRESSION_THREADS]) {
+    out_opts.set_compression_threads(config[ARG_COMPRESSION_THREADS].as<int>());
+  }
+  if (config[ARG_RECORD_COMPRESSION]) {
+    out_opts.set_record_compression(config[ARG_RECORD_COMPRESSION].as<bool>());
+  }
+  if (config[ARG_DUMP_FORMAT_VERSION]) {
+    out_opts.set_dump_format_version(config[ARG_DUMP_FORMAT_VERSION].as<int>());
+  }
+  if (config[ARG_KEY_INDEX]) {
+    out_opts.set_key_index(config[ARG_KEY_INDEX].as<bool>());
+  }
+  if (config[ARG_DEDUP_VALUES]) {
+    out_opts.set_dedup_values(config[ARG_DEDUP_VALUES].as<bool>());
+  }
+  if (config[ARG_MIN_FREE_SPACE]) {
+    out_opts.set_min_free_space(config[ARG_MIN_FREE_SPACE].as<uint64_t>());
+  }
+  if (config[ARG_METRICS_INTERVAL_MS]) {
+    out_opts.set_metrics_interval_ms(config[ARG_METRICS_INTERVAL_MS].as<int>());
+  }
+  out_opts.set_max_threads(config[ARG_MAX_THREADS] ?
+      config[ARG_MAX_THREADS].as<int>() : config[ARG_THREADS].as<int>());
+  if (config[ARG_AUTO_SCALE_THREADS]) {
+    out_opts.set_auto_scale_threads(config[ARG_AUTO_SCALE_THREADS].as<bool>());
+  }
+  if (config[ARG_TASK_CPUS]) {
+    out_opts.set_task_cpus(config[ARG_TASK_CPUS].as<std::string>());
+  }
+  if (config[ARG_MEMCACHED_CPUS]) {
+    out_opts.set_memcached_cpus(config[ARG_MEMCACHED_CPUS].as<std::string>());
+  }
+  if (config[ARG_NUMA_AFFINITY]) {
+    out_opts.set_numa_affinity(config[ARG_NUMA_AFFINITY].as<bool>());
+  }
+
   if (config[ARG_IS_S3_DUMP]) {
     if (config[ARG_IS_S3_DUMP].as<bool>() == true) {
       out_opts.set_is_s3_dump(true);
-      out_opts.set_s3_bucket_name(config[ARG_S3_BUCKET].as<std::string>());
-      out_opts.set_s3_final_path(config[ARG_S3_FINAL_PATH].as<std::string>());
-      out_opts.set_sqs_queue_name(config[ARG_SQS_QUEUE].as<std::string>());
+      if (config[ARG_S3_BUCKET]) {
+        out_opts.set_s3_bucket_name(config[ARG_S3_BUCKET].as<std::string>());
+      }
+      if (config[ARG_S3_FINAL_PATH]) {
+        out_opts.set_s3_final_path(config[ARG_S3_FINAL_PATH].as<std::string>());
+      }
+      if (config[ARG_SQS_QUEUE]) {
+        out_opts.set_sqs_queue_name(config[ARG_SQS_QUEUE].as<std::string>());
+      }
     } else {
       out_opts.set_is_s3_dump(false);
     }
@@ -207,8 +579,8 @@ void DumperOptions::set_log_file_path(std::string_view log_file_path) {
   log_file_path_ = log_file_path;
 }
 
-void DumperOptions::set_output_dir_path(std::string_view output_dir_path) {
-  output_dir_path_ = output_dir_path;
+void DumperOptions::set_output_dir_paths(const std::vector<std::string>& output_dir_paths) {
+  output_dir_paths_ = output_dir_paths;
 }
 
 void DumperOptions::set_bulk_get_threshold(uint32_t bulk_get_threshold) {
@@ -255,4 +627,129 @@ void DumperOptions::set_ketama_bucket_size(uint32_t ketama_bucket_size) {
   ketama_bucket_size_ = ketama_bucket_size;
 }
 
+void DumperOptions::set_delta_base_keyfile_dir(std::string delta_base_keyfile_dir) {
+  delta_base_keyfile_dir_ = delta_base_keyfile_dir;
+}
+
+void DumperOptions::set_live_migrate(bool live_migrate) {
+  live_migrate_ = live_migrate;
+}
+
+void DumperOptions::add_live_migrate_target(const std::string& target) {
+  live_migrate_targets_.push_back(target);
+}
+
+void DumperOptions::set_write_data_files(bool write_data_files) {
+  write_data_files_ = write_data_files;
+}
+
+void DumperOptions::set_use_io_uring(bool use_io_uring) {
+  use_io_uring_ = use_io_uring;
+}
+
+void DumperOptions::set_direct_io(bool direct_io) {
+  direct_io_ = direct_io;
+}
+
+void DumperOptions::set_checksum_type(ChecksumType checksum_type) {
+  checksum_type_ = checksum_type;
+}
+
+void DumperOptions::set_bulk_task_threads(int bulk_task_threads) {
+  bulk_task_threads_ = bulk_task_threads;
+}
+
+void DumperOptions::set_finisher_threads(int finisher_threads) {
+  finisher_threads_ = finisher_threads;
+}
+
+void DumperOptions::set_upload_threads(int upload_threads) {
+  upload_threads_ = upload_threads;
+}
+
+void DumperOptions::set_stream_upload(bool stream_upload) {
+  stream_upload_ = stream_upload;
+}
+
+void DumperOptions::set_upload_journal(bool upload_journal) {
+  upload_journal_ = upload_journal;
+}
+
+void DumperOptions::set_sqs_batch_ms(int sqs_batch_ms) {
+  sqs_batch_ms_ = sqs_batch_ms;
+}
+
+void DumperOptions::set_sqs_endpoint(std::string sqs_endpoint) {
+  sqs_endpoint_ = sqs_endpoint;
+}
+
+void DumperOptions::set_storage_sink_type(StorageSinkType storage_sink_type) {
+  storage_sink_type_ = storage_sink_type;
+}
+
+void DumperOptions::set_storage_sink_path(std::string storage_sink_path) {
+  storage_sink_path_ = storage_sink_path;
+}
+
+void DumperOptions::set_fake_sink_options(
+    const FakeStorageSink::Options& fake_sink_options) {
+  fake_sink_options_ = fake_sink_options;
+}
+
+void DumperOptions::set_compression_type(CompressionType compression_type) {
+  compression_type_ = compression_type;
+}
+
+void DumperOptions::set_compression_level(int compression_level) {
+  compression_level_ = compression_level;
+}
+
+void DumperOptions::set_compression_threads(int compression_threads) {
+  compression_threads_ = compression_threads;
+}
+
+void DumperOptions::set_record_compression(bool record_compression) {
+  record_compression_ = record_compression;
+}
+
+void DumperOptions::set_dump_format_version(int dump_format_version) {
+  dump_format_version_ = dump_format_version;
+}
+
+void DumperOptions::set_key_index(bool key_index) {
+  key_index_ = key_index;
+}
+
+void DumperOptions::set_dedup_values(bool dedup_values) {
+  dedup_values_ = dedup_values;
+}
+
+void DumperOptions::set_min_free_space(uint64_t min_free_space) {
+  min_free_space_ = min_free_space;
+}
+
+void DumperOptions::set_metrics_interval_ms(int metrics_interval_ms) {
+  metrics_interval_ms_ = metrics_interval_ms;
+}
+
+void DumperOptions::set_max_threads(int max_threads) {
+  max_threads_ = max_threads;
+}
+
+void DumperOptions::set_auto_scale_threads(bool auto_scale_threads) {
+  auto_scale_threads_ = auto_scale_threads;
+}
+
+void DumperOptions::set_task_cpus(std::string task_cpus) {
+  task_cpus_ = task_cpus;
+}
+
+void DumperOptions::set_memcached_cpus(std::string memcached_cpus) {
+  memcached_cpus_ = memcached_cpus;
+}
+
+void DumperOptions::set_numa_affinity(bool numa_affinity) {
+  numa_affinity_ = numa_affinity;
+}
+
 } // namespace memcachedumper
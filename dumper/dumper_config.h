@@ -19,13 +19,17 @@
 #pragma once
 
 // Local project includes
+#include "utils/checksum.h"
+#include "utils/compression.h"
 #include "utils/status.h"
+#include "utils/storage_sink.h"
 
 // Extern includes
 #include "yaml-cpp/yaml.h"
 
 // C++ includes
 #include <string>
+#include <vector>
 
 // YAML argument definitions
 #define ARG_IP                        "ip"
@@ -48,6 +52,43 @@
 #define ARG_S3_BUCKET                 "s3_bucket"
 #define ARG_S3_FINAL_PATH             "s3_final_path"
 #define ARG_SQS_QUEUE                 "sqs_queue"
+#define ARG_DELTA_BASE_KEYFILE_DIR    "delta_base_keyfile_dir"
+#define ARG_LIVE_MIGRATE              "live_migrate"
+#define ARG_LIVE_MIGRATE_TARGETS      "live_migrate_targets"
+#define ARG_WRITE_DATA_FILES          "write_data_files"
+#define ARG_IO_URING                  "io_uring"
+#define ARG_DIRECT_IO                 "direct_io"
+#define ARG_CHECKSUM                  "checksum"
+#define ARG_BULK_TASK_THREADS         "bulk_task_threads"
+#define ARG_FINISHER_THREADS          "finisher_threads"
+#define ARG_UPLOAD_THREADS            "upload_threads"
+#define ARG_STREAM_UPLOAD             "stream_upload"
+#define ARG_UPLOAD_JOURNAL            "upload_journal"
+#define ARG_SQS_BATCH_MS              "sqs_batch_ms"
+#define ARG_SQS_ENDPOINT              "sqs_endpoint"
+#define ARG_STORAGE_SINK              "storage_sink"
+#define ARG_STORAGE_SINK_PATH         "storage_sink_path"
+#define ARG_FAKE_SINK_LATENCY_MS      "fake_sink_latency_ms"
+#define ARG_FAKE_SINK_BANDWIDTH       "fake_sink_bandwidth"
+#define ARG_FAKE_SINK_ERROR_RATE      "fake_sink_error_rate"
+#define ARG_COMPRESSION               "compression"
+#define ARG_COMPRESSION_LEVEL         "compression_level"
+#define ARG_COMPRESSION_THREADS       "compression_threads"
+#define ARG_RECORD_COMPRESSION        "record_compression"
+#define ARG_DUMP_FORMAT_VERSION       "dump_format_version"
+#define ARG_KEY_INDEX                 "key_index"
+#define ARG_DEDUP_VALUES              "dedup_values"
+#define ARG_MIN_FREE_SPACE            "min_free_space"
+#define ARG_METRICS_INTERVAL_MS       "metrics_interval_ms"
+#define ARG_MAX_THREADS               "max_threads"
+#define ARG_AUTO_SCALE_THREADS        "auto_scale_threads"
+#define ARG_TASK_CPUS                 "task_cpus"
+#define ARG_MEMCACHED_CPUS            "memcached_cpus"
+#define ARG_NUMA_AFFINITY             "numa_affinity"
+
+// Most task threads that may be configured. Every thread holds its own memcached
+// connection, and memcached accepts 1024 connections by default.
+#define MAX_TASK_THREADS 512
 
 #define ENSURE_OPT_EXISTS(config, opt) do {                                 \
   if (!config[opt]) {                                                       \
@@ -85,7 +126,7 @@ class DumperOptions {
   void set_max_key_file_size(uint64_t max_key_file_size);
   void set_max_data_file_size(uint64_t max_data_file_size);
   void set_log_file_path(std::string_view logfile_path);
-  void set_output_dir_path(std::string_view output_dir_path);
+  void set_output_dir_paths(const std::vector<std::string>& output_dir_paths);
   void set_only_expire_after(int only_expire_after);
   void set_resume_mode(bool resume_mode);
   void set_is_s3_dump(bool is_s3_dump);
@@ -98,6 +139,37 @@ class DumperOptions {
   void add_dest_ip(const std::string& dest_ip);
   void add_all_ip(const std::string& all_ip);
   void set_ketama_bucket_size(uint32_t ketama_bucket_size);
+  void set_delta_base_keyfile_dir(std::string delta_base_keyfile_dir);
+  void set_live_migrate(bool live_migrate);
+  void add_live_migrate_target(const std::string& target);
+  void set_write_data_files(bool write_data_files);
+  void set_use_io_uring(bool use_io_uring);
+  void set_direct_io(bool direct_io);
+  void set_checksum_type(ChecksumType checksum_type);
+  void set_bulk_task_threads(int bulk_task_threads);
+  void set_finisher_threads(int finisher_threads);
+  void set_upload_threads(int upload_threads);
+  void set_stream_upload(bool stream_upload);
+  void set_upload_journal(bool upload_journal);
+  void set_sqs_batch_ms(int sqs_batch_ms);
+  void set_sqs_endpoint(std::string sqs_endpoint);
+  void set_storage_sink_type(StorageSinkType storage_sink_type);
+  void set_storage_sink_path(std::string storage_sink_path);
+  void set_fake_sink_options(const FakeStorageSink::Options& fake_sink_options);
+  void set_compression_type(CompressionType compression_type);
+  void set_compression_level(int compression_level);
+  void set_compression_threads(int compression_threads);
+  void set_record_compression(bool record_compression);
+  void set_dump_format_version(int dump_format_version);
+  void set_key_index(bool key_index);
+  void set_dedup_values(bool dedup_values);
+  void set_min_free_space(uint64_t min_free_space);
+  void set_metrics_interval_ms(int metrics_interval_ms);
+  void set_max_threads(int max_threads);
+  void set_auto_scale_threads(bool auto_scale_threads);
+  void set_task_cpus(std::string task_cpus);
+  void set_memcached_cpus(std::string memcached_cpus);
+  void set_numa_affinity(bool numa_affinity);
 
   std::string config_file_path() { return config_file_path_; }
   std::string memcached_hostname() { return memcached_hostname_; }
@@ -109,7 +181,9 @@ class DumperOptions {
   uint64_t max_key_file_size() { return max_key_file_size_; }
   uint64_t max_data_file_size() { return max_data_file_size_; }
   std::string log_file_path() { return log_file_path_; }
-  std::string output_dir_path() { return output_dir_path_; }
+  // The primary output directory, where everything but data files goes.
+  std::string output_dir_path() { return output_dir_paths_[0]; }
+  const std::vector<std::string>& output_dir_paths() { return output_dir_paths_; }
   int only_expire_after() { return only_expire_after_; }
   bool is_resume_mode() { return resume_mode_; }
   bool is_s3_dump() { return is_s3_dump_; }
@@ -120,6 +194,42 @@ class DumperOptions {
   const std::vector<std::string>& dest_ips() { return dest_ips_; }
   const std::vector<std::string>& all_ips() { return all_ips_; }
   uint32_t ketama_bucket_size() { return ketama_bucket_size_; }
+  std::string delta_base_keyfile_dir() { return delta_base_keyfile_dir_; }
+  bool is_delta_dump() { return !delta_base_keyfile_dir_.empty(); }
+  bool is_live_migrate() { return live_migrate_; }
+  const std::vector<std::string>& live_migrate_targets() { return live_migrate_targets_; }
+  bool write_data_files() { return write_data_files_; }
+  bool use_io_uring() { return use_io_uring_; }
+  bool direct_io() { return direct_io_; }
+  ChecksumType checksum_type() { return checksum_type_; }
+  int bulk_task_threads() { return bulk_task_threads_; }
+  int finisher_threads() { return finisher_threads_; }
+  int upload_threads() { return upload_threads_; }
+  bool stream_upload() { return stream_upload_; }
+  bool upload_journal() { return upload_journal_; }
+  int sqs_batch_ms() { return sqs_batch_ms_; }
+  std::string sqs_endpoint() { return sqs_endpoint_; }
+  StorageSinkType storage_sink_type() { return storage_sink_type_; }
+  std::string storage_sink_path() { return storage_sink_path_; }
+  const FakeStorageSink::Options& fake_sink_options() { return fake_sink_options_; }
+  CompressionType compression_type() { return compression_type_; }
+  int compression_level() { return compression_level_; }
+  int compression_threads() { return compression_threads_; }
+  bool record_compression() { return record_compression_; }
+  int dump_format_version() { return dump_format_version_; }
+  bool key_index() { return key_index_; }
+  bool dedup_values() { return dedup_values_; }
+  uint64_t min_free_space() { return min_free_space_; }
+  int metrics_interval_ms() { return metrics_interval_ms_; }
+  int max_threads() { return max_threads_; }
+  bool auto_scale_threads() { return auto_scale_threads_; }
+  std::string task_cpus() { return task_cpus_; }
+  std::string memcached_cpus() { return memcached_cpus_; }
+  bool numa_affinity() { return numa_affinity_; }
+  // Whether task threads are pinned to CPUs at all.
+  bool pin_task_threads() {
+    return !task_cpus_.empty() || !memcached_cpus_.empty() || numa_affinity_;
+  }
 
  private:
   // Path to configuration file.
@@ -142,8 +252,8 @@ class DumperOptions {
   uint64_t max_data_file_size_;
   // Path to the log file.
   std::string log_file_path_;
-  // Path to the output directory.
-  std::string output_dir_path_;
+  // Paths to the output directories. Data files are spread across all of them.
+  std::vector<std::string> output_dir_paths_;
   // Ignore keys that expire within these many seconds.
   int only_expire_after_ = 0;
   // Indicates that we have to resume from a checkpoint and not start dumping
@@ -165,6 +275,82 @@ class DumperOptions {
   std::vector<std::string> all_ips_;
   // The bucket size to be used while evaluating ketama hashes.
   uint32_t ketama_bucket_size_;
+  // Key file directory of a previous dump to take an incremental dump against.
+  // Empty for a full dump.
+  std::string delta_base_keyfile_dir_;
+  // Stream dumped keys to their instances in 'dest_ips_' if set.
+  bool live_migrate_ = false;
+  // IP:port pairs to send keys to instead of the corresponding instance in
+  // 'dest_ips_'. Used when the destination instances are replacing those in
+  // 'dest_ips_'.
+  std::vector<std::string> live_migrate_targets_;
+  // Write the dumped keys to data files if set.
+  bool write_data_files_ = true;
+  // Write data files asynchronously through io_uring if set.
+  bool use_io_uring_ = false;
+  // Write data files with O_DIRECT, bypassing the page cache, if set.
+  bool direct_io_ = false;
+  // Checksum to suffix data file names with.
+  ChecksumType checksum_type_ = ChecksumType::MD5;
+  // Max. number of task threads running bulk tasks, so that the rest are free for
+  // critical ones. 0 lets them all run bulk tasks.
+  int bulk_task_threads_ = 0;
+  // Number of threads that fsync and move completed data files. If 0, the dumping
+  // threads do it themselves.
+  int finisher_threads_ = 2;
+  // Number of threads uploading data files to S3. 0 uploads them from the
+  // finisher threads.
+  int upload_threads_ = 4;
+  // Stream data files to S3 as multipart uploads instead of writing them to disk.
+  bool stream_upload_ = false;
+  // Journal uploads, so that resuming finishes them instead of redoing their key
+  // files.
+  bool upload_journal_ = true;
+  // Max. time an SQS notification waits to be sent in a batch. 0 sends every
+  // notification on its own.
+  int sqs_batch_ms_ = 100;
+  // Overrides the SQS endpoint, eg. to test against a local SQS-compatible server.
+  std::string sqs_endpoint_;
+  // Where files are uploaded to when 'is_s3_dump_' is set.
+  StorageSinkType storage_sink_type_ = StorageSinkType::S3;
+  // Root directory of a LOCAL storage sink.
+  std::string storage_sink_path_;
+  FakeStorageSink::Options fake_sink_options_;
+  // Codec to compress data files with.
+  CompressionType compression_type_ = CompressionType::NONE;
+  // Compression level. 0 picks the codec's default.
+  int compression_level_ = 0;
+  // Threads that compress the blocks of data files. 0 compresses them on the
+  // task threads.
+  int compression_threads_ = 4;
+  // Compress each record's value with a trained zstd dictionary if set.
+  bool record_compression_ = false;
+  // Format to write data files in. 0 for the bare stream of records, 1 for blocks
+  // with a footer index.
+  int dump_format_version_ = 0;
+  // Write a key index sidecar next to every data file if set.
+  bool key_index_ = false;
+  // Write repeated values as references to an earlier record if set.
+  bool dedup_values_ = false;
+  // Push back on the task threads once fewer than these many bytes are free
+  // across the output directories. 0 picks one data file per thread.
+  uint64_t min_free_space_ = 0;
+  // How often the metrics are persisted. 0 only persists them at the end.
+  int metrics_interval_ms_ = 1000;
+  // Most worker threads that may be run at a time, when scaling them at runtime.
+  int max_threads_ = 0;
+  // Add and remove worker threads with the load, between 'num_threads_' and
+  // 'max_threads_', if set.
+  bool auto_scale_threads_ = false;
+  // CPUs to pin the worker threads to, in the kernel's list format. All the ones
+  // we may run on if empty.
+  std::string task_cpus_;
+  // CPUs that memcached's worker threads run on, which the worker threads stay
+  // off of.
+  std::string memcached_cpus_;
+  // Pin every worker thread to the CPUs of one NUMA node, and hand it buffers
+  // allocated on that node.
+  bool numa_affinity_ = false;
 };
 
 } // namespace memcachedumper
@@ -1,6 +1,6 @@
 export DEBIAN_FRONTEND=noninteractive
 apt update
-yes | apt install -y cmake g++ libcurl4-openssl-dev rapidjson-dev libssl-dev
+yes | apt install -y cmake g++ libcurl4-openssl-dev rapidjson-dev libssl-dev libxxhash-dev libzstd-dev liblz4-dev python3-crcmod
 
 # For the AWS SDK
 yes | apt install uuid-dev zlib1g-dev libpulse-dev
@@ -2,18 +2,53 @@ ord() {
   LC_CTYPE=C printf '%d' "'$1"
 }
 
+# Usage: confirm_md5_sums.sh <dir> [md5|crc32c|xxh3]
+# The checksum type of a dump is listed in its DONE file. (Default = md5)
 DIR=$1
+CHECKSUM=${2:-md5}
+
+# CRC32C needs either the 'crc32c' or the 'crcmod' Python package (with its C
+# extension), e.g. 'pip3 install crc32c' or 'apt install python3-crcmod'.
+crc32c_sum() {
+  python3 - "$1" <<'PYEOF'
+import sys
+try:
+    from crc32c import crc32c as extend
+except ImportError:
+    import crcmod.predefined
+    extend = crcmod.predefined.mkCrcFun('crc-32c')
+crc = 0
+with open(sys.argv[1], 'rb') as f:
+    for chunk in iter(lambda: f.read(1 << 22), b''):
+        crc = extend(chunk, crc)
+print('%08x' % crc)
+PYEOF
+}
+
+if [[ $CHECKSUM == crc32c ]] && ! python3 -c 'import crc32c' 2>/dev/null \
+    && ! python3 -c 'import crcmod' 2>/dev/null; then
+  echo "CRC32C needs the crc32c or crcmod Python package"
+  exit 1
+fi
+
 #FILE_PREFIX=$2
 for fname in $DIR/*; do
-  RET=$(md5sum $fname)
-  REAL_MD5=$(sed -e 's/\s.*$//' <<< $RET)
-  FILE_MD5=$(sed "s/^.*_\([^_]*\)$/\1/" <<< $RET)
-  FILE_MD5_LOWER=$(sed -e "s/\(.*\)/\L\1/" <<< $FILE_MD5)
+  # Key index sidecars aren't named with a checksum.
+  [[ $fname == *.idx ]] && continue
+  case $CHECKSUM in
+    md5)    REAL_SUM=$(md5sum $fname | sed -e 's/\s.*$//') ;;
+    crc32c) REAL_SUM=$(crc32c_sum $fname) ;;
+    xxh3)   REAL_SUM=$(xxhsum -H3 $fname | sed -e 's/\s.*$//' -e 's/^XXH3_//') ;;
+    *)      echo "Unknown checksum type: $CHECKSUM"; exit 1 ;;
+  esac
+  # Compressed files have a .zst or .lz4 extension after the checksum.
+  FILE_SUM=$(sed -e "s/\.\(zst\|lz4\)$//" -e "s/^.*_\([^_]*\)$/\1/" <<< $fname)
+  FILE_SUM_LOWER=$(sed -e "s/\(.*\)/\L\1/" <<< $FILE_SUM)
 
-  if [[ "$FILE_MD5_LOWER" != "$REAL_MD5" ]]; then
+  if [[ "$FILE_SUM_LOWER" != "$REAL_SUM" ]]; then
     echo $fname " IS CORRUPT"
-    echo $FILE_MD5_LOWER
-    echo $REAL_MD5
+    echo $FILE_SUM_LOWER
+    echo $REAL_SUM
     echo ""
   fi
 done
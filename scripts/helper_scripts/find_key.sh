@@ -0,0 +1,52 @@
+# Usage: find_key.sh <dir> <key>
+# Looks up <key> in the key index sidecars (*.idx) of the data files in <dir>,
+# and prints the data files and offsets its records start at. Needs a dump taken
+# with 'key_index: true'.
+DIR=$1
+KEY=$2
+
+python3 - "$DIR" "$KEY" <<'PYEOF'
+import glob, os, struct, sys
+
+def fnv1a_64(data):
+    h = 0xCBF29CE484222325
+    for b in data:
+        h = ((h ^ b) * 0x100000001B3) & 0xFFFFFFFFFFFFFFFF
+    return h
+
+def bloom_may_contain(bloom, probes, key_hash):
+    nbits = len(bloom) * 8
+    h1, h2 = key_hash & 0xFFFFFFFF, key_hash >> 32
+    for i in range(probes):
+        bit = (h1 + i * h2) % nbits
+        if not bloom[bit // 8] & (1 << (bit % 8)):
+            return False
+    return True
+
+key_hash = fnv1a_64(sys.argv[2].encode())
+for idx_path in sorted(glob.glob(os.path.join(sys.argv[1], '*.idx'))):
+    with open(idx_path, 'rb') as f:
+        header = f.read(16)
+        magic, version, hash_fn, probes, _, n_entries, bloom_len = struct.unpack('>4sBBBBII', header)
+        if magic != b'MCDI':
+            print(idx_path, 'is not a key index')
+            continue
+        if not bloom_may_contain(f.read(bloom_len), probes, key_hash):
+            continue
+        # Binary search the sorted (hash, offset) table.
+        base = 16 + bloom_len
+        lo, hi = 0, n_entries
+        while lo < hi:
+            mid = (lo + hi) // 2
+            f.seek(base + mid * 16)
+            if struct.unpack('>Q', f.read(8))[0] < key_hash:
+                lo = mid + 1
+            else:
+                hi = mid
+        f.seek(base + lo * 16)
+        for i in range(lo, n_entries):
+            entry_hash, offset = struct.unpack('>QQ', f.read(16))
+            if entry_hash != key_hash:
+                break
+            print(idx_path[:-len('.idx')], offset)
+PYEOF
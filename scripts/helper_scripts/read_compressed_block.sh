@@ -0,0 +1,61 @@
+# Usage: read_compressed_block.sh <file> [block]
+# Checks the trailer and the block index of a compressed data file and prints
+# the index. Given a block number, writes that block's frame to stdout instead,
+# eg. to pipe into 'zstd -dc' or 'lz4 -dc'.
+FILE=$1
+BLOCK=$2
+
+python3 - "$FILE" "$BLOCK" <<'PYEOF'
+import os, struct, sys
+
+FRAME_MAGIC = 0x184D2A5E
+TRAILER_LEN = 12
+
+def fail(msg):
+    sys.stderr.write('%s: %s\n' % (sys.argv[1], msg))
+    sys.exit(1)
+
+with open(sys.argv[1], 'rb') as f:
+    file_len = os.fstat(f.fileno()).st_size
+    if file_len < 8 + 24 + TRAILER_LEN:
+        fail('too short to be a compressed data file')
+    f.seek(file_len - TRAILER_LEN)
+    footer_len, n_trailer_blocks, magic = struct.unpack('<II4s', f.read(TRAILER_LEN))
+    if magic != b'MCDC':
+        fail('no compressed data file trailer')
+    if footer_len < 8 + 24 + TRAILER_LEN or footer_len > file_len:
+        fail('bad footer length %d' % footer_len)
+
+    footer_offset = file_len - footer_len
+    f.seek(footer_offset)
+    footer = f.read(footer_len)
+    frame_magic, payload_len = struct.unpack_from('<II', footer, 0)
+    if frame_magic != FRAME_MAGIC or payload_len != footer_len - 8:
+        fail('trailer does not point at the footer frame')
+    magic, version, codec, _, block_size, n_blocks, uncompressed_size = \
+        struct.unpack_from('<4sBBHIIQ', footer, 8)
+    if magic != b'MCDC' or version != 2:
+        fail('unsupported footer version %d' % version)
+    if n_blocks != n_trailer_blocks or footer_len != 8 + 24 + 8 * n_blocks + TRAILER_LEN:
+        fail('footer and trailer disagree on the number of blocks')
+    offsets = list(struct.unpack_from('<%dQ' % n_blocks, footer, 32))
+    # Every frame runs up to the next one, and the last one up to the footer.
+    ends = offsets[1:] + [footer_offset]
+    if any(end <= start for start, end in zip(offsets, ends)) or \
+            (offsets and offsets[0] != 0):
+        fail('block offsets are out of order')
+
+    if sys.argv[2] == '':
+        print('codec=%s block_size=%d blocks=%d uncompressed_size=%d' % (
+            {1: 'zstd', 2: 'lz4'}.get(codec, codec), block_size, n_blocks,
+            uncompressed_size))
+        for i, (start, end) in enumerate(zip(offsets, ends)):
+            print(i, start, end - start)
+        sys.exit(0)
+
+    block = int(sys.argv[2])
+    if block < 0 or block >= n_blocks:
+        fail('no block %d' % block)
+    f.seek(offsets[block])
+    sys.stdout.buffer.write(f.read(ends[block] - offsets[block]))
+PYEOF
@@ -69,8 +69,12 @@ void WriteCompleteMarker(int num_files) {
 
 void MetadumpTask::Execute() {
 
-  memcached_socket_ = owning_thread()->task_scheduler()->GetMemcachedSocket();
-  assert(memcached_socket_ != nullptr);
+  Status sock_status =
+      owning_thread()->task_scheduler()->GetMemcachedSocket(&memcached_socket_);
+  if (!sock_status.ok()) {
+    LOG_ERROR("Could not get a memcached socket. (Status: {0})", sock_status.ToString());
+    abort();
+  }
 
   bool busy_crawler = true;
   std::random_device rand_device;
@@ -144,7 +148,10 @@ Status MetadumpTask::RecvResponse() {
   bool busy_crawler = false;
 
   do {
+    MonotonicStopWatch recv_msw;
+    recv_msw.Start();
     Status stat = memcached_socket_->Recv(buf, chunk_size-1, &bytes_read);
+    DumpMetrics::record_memcached_wait(recv_msw.ElapsedTime() / 1000);
     if (!stat.ok()) {
       chunk_file.close();
       mem_mgr_->ReturnBuffer(buf);
@@ -36,6 +36,9 @@ class MetadumpTask : public Task {
 
   void Execute() override;
 
+  // Every data dump task comes out of this one.
+  TaskPriority priority() override { return TaskPriority::CRITICAL; }
+
  private:
   Status SendCommand(const std::string& metadump_cmd);
   Status RecvResponse();
@@ -22,11 +22,14 @@
 #include "tasks/s3_upload_task.h"
 #include "tasks/task_scheduler.h"
 #include "tasks/task_thread.h"
+#include "utils/base_dump_index.h"
+#include "utils/disk_space_governor.h"
 #include "utils/mem_mgr.h"
 #include "utils/memcache_utils.h"
 #include "utils/socket.h"
 
 #include <fstream>
+#include <mutex>
 #include <sstream>
 
 namespace memcachedumper {
@@ -36,27 +39,6 @@ ProcessMetabufTask::ProcessMetabufTask(const std::string& filename, bool is_s3_d
     is_s3_dump_(is_s3_dump) {
 }
 
-std::string ProcessMetabufTask::UrlDecode(std::string& str){
-    std::ostringstream oss;
-    char ch;
-    int i, ii, len = str.length();
-
-    for (i=0; i < len; i++){
-        if(str[i] != '%'){
-            if(str[i] == '+')
-                oss << ' ';
-            else
-                oss << str[i];
-        }else{
-            sscanf(str.substr(i + 1, 2).c_str(), "%x", &ii);
-            ch = static_cast<char>(ii);
-            oss << ch;
-            i = i + 2;
-        }
-    }
-    return oss.str();
-}
-
 void ProcessMetabufTask::ProcessMetaBuffer(MetaBufferSlice* mslice) {
 
   time_t now = std::time(0);
@@ -87,6 +69,17 @@ void ProcessMetabufTask::ProcessMetaBuffer(MetaBufferSlice* mslice) {
       break;
     }
 
+    // The 'cas' tells if a key changed since the base dump, and is listed with
+    // the dumped keys for a later delta.
+    const char *cas_pos = mslice->next_cas_pos();
+    if (cas_pos == nullptr) {
+      if (newline_pos != nullptr) {
+        mslice->CopyRemainingToStart(newline_pos);
+      }
+      break;
+    }
+    uint64_t cas = strtoull(cas_pos + 4, nullptr, 10);
+
     char *unused;
     int32_t expiry = strtol(exp_pos + 4, &unused, 10);
 
@@ -94,7 +87,7 @@ void ProcessMetabufTask::ProcessMetaBuffer(MetaBufferSlice* mslice) {
         const_cast<char*>(key_pos) + 4, static_cast<int>(
             exp_pos - key_pos - 4 - 1));
 
-    std::string decoded_key = UrlDecode(encoded_key);
+    std::string decoded_key = MemcachedUtils::UrlDecode(encoded_key);
 
     if (expiry != -1 && MemcachedUtils::KeyExpiresSoon(now,
         static_cast<uint32_t>(expiry))) {
@@ -108,32 +101,64 @@ void ProcessMetabufTask::ProcessMetaBuffer(MetaBufferSlice* mslice) {
       continue;
     }
 
+    // Skip the key if it's identical in the dump we're taking a delta against.
+    // Its value is still part of what this dump holds once applied on top of the
+    // base, so it's listed as dumped for a delta taken against this one.
+    if (MemcachedUtils::KeyUnchangedSinceBase(encoded_key, cas, expiry)) {
+      owning_thread()->increment_keys_unchanged();
+      BaseDumpIndex::AppendDumpedKey(encoded_key, cas, expiry, &dumped_keys_);
+      continue;
+    }
+
     // Track the key and queue it for processing.
     McData *new_key = new McData(decoded_key, expiry);
     data_writer_->QueueForProcessing(new_key);
+    BaseDumpIndex::AppendDumpedKey(encoded_key, cas, expiry, &dumped_keys_);
 
   } while ((newline_pos = const_cast<char*>(mslice->next_newline())) != nullptr);
 
 }
 
-void ProcessMetabufTask::MarkCheckpoint() {
+void ProcessMetabufTask::MarkCheckpoint(const std::string& keyfile_name,
+    const std::string& thread_name) {
+  // Finisher threads may append to the same checkpoint file concurrently.
+  static std::mutex checkpoint_mutex;
+  std::lock_guard<std::mutex> lock(checkpoint_mutex);
+
   std::ofstream checkpoint_file;
 
   std::string chkpt_file_path =
-      MemcachedUtils::GetKeyFilePath() + "CHECKPOINTS_" + owning_thread()->thread_name();
+      MemcachedUtils::GetKeyFilePath() + "CHECKPOINTS_" + thread_name;
   checkpoint_file.open(chkpt_file_path, std::ofstream::app);
 
-  // Omit the path while writing the file name.
-  // Also add a new line after every file name.
-  std::string file_sans_path = filename_.substr(filename_.rfind("/") + 1) + "\n";
-  checkpoint_file.write(file_sans_path.c_str(), file_sans_path.length());
+  // Add a new line after every file name.
+  std::string line = keyfile_name + "\n";
+  checkpoint_file.write(line.c_str(), line.length());
   checkpoint_file.close();
 }
 
 void ProcessMetabufTask::Execute() {
 
-  Socket *mc_sock = owning_thread()->task_scheduler()->GetMemcachedSocket();
-  assert(mc_sock != nullptr);
+  // Hold off on starting a new key file while disk space is low.
+  if (MemcachedUtils::GetDiskSpaceGovernor() != nullptr) {
+    Status space_status = MemcachedUtils::GetDiskSpaceGovernor()->WaitToAdmitTask();
+    if (!space_status.ok()) {
+      LOG_ERROR("Could not process {0}. (Status: {1})", filename_, space_status.ToString());
+      MemcachedUtils::RecordFileError(space_status);
+      return;
+    }
+  }
+
+  Socket *mc_sock;
+  Status sock_status = owning_thread()->task_scheduler()->GetMemcachedSocket(&mc_sock);
+  if (!sock_status.ok()) {
+    // No socket is coming back, so the key file can't be processed. Fail the dump
+    // rather than silently leave out its keys.
+    LOG_ERROR("Could not get a memcached socket for {0}. (Status: {1})", filename_,
+        sock_status.ToString());
+    MemcachedUtils::RecordFileError(sock_status);
+    return;
+  }
 
   uint8_t* data_writer_buf = owning_thread()->mem_mgr()->GetBuffer();
   assert(data_writer_buf != nullptr);
@@ -146,12 +171,14 @@ void ProcessMetabufTask::Execute() {
       MemcachedUtils::DataFilePrefix() + "_" + keyfile_idx_str,
       owning_thread()->thread_name(),
       data_writer_buf, owning_thread()->mem_mgr()->chunk_size(),
-      MemcachedUtils::MaxDataFileSize(), mc_sock));
+      MemcachedUtils::MaxDataFileSize(), mc_sock, owning_thread()->staging_mem_mgr(),
+      owning_thread()->compression_mem_mgr()));
 
   // TODO: Check return status
   Status init_status = data_writer_->Init();
   if (!init_status.ok()) {
     LOG_ERROR("FAILED TO INITIALIZE KeyValueWriter. (Status: {0})", init_status.ToString());
+    MemcachedUtils::RecordFileError(init_status);
     owning_thread()->task_scheduler()->ReleaseMemcachedSocket(mc_sock);
     owning_thread()->mem_mgr()->ReturnBuffer(data_writer_buf);
     return;
@@ -188,7 +215,35 @@ void ProcessMetabufTask::Execute() {
     mslice_size = size_remaining + bytes_read;
   }
 
-  data_writer_->Finalize();
+  // Only checkpoint the key file once all its data files are complete, so that
+  // a resumed dump redoes it otherwise.
+  // Omit the path while writing the file name.
+  std::string keyfile_name = filename_.substr(filename_.rfind("/") + 1);
+  std::string thread_name = owning_thread()->thread_name();
+  Status finalize_status = data_writer_->Finalize(
+      [keyfile_name, thread_name](Status status) {
+        if (!status.ok()) {
+          LOG_ERROR("Data files for {0} failed to complete. (Status: {1})", keyfile_name,
+              status.ToString());
+          MemcachedUtils::RecordFileError(status);
+          return;
+        }
+        MarkCheckpoint(keyfile_name, thread_name);
+      });
+  if (!finalize_status.ok()) {
+    LOG_ERROR("Could not finalize data files for {0}. (Status: {1})", keyfile_name,
+        finalize_status.ToString());
+    MemcachedUtils::RecordFileError(finalize_status);
+  } else {
+    // Keys that went missing on get were never written.
+    Status dumped_keys_status = BaseDumpIndex::WriteDumpedKeys(filename_, dumped_keys_,
+        data_writer_->missing_keys());
+    if (!dumped_keys_status.ok()) {
+      LOG_ERROR("Could not write the dumped keys of {0}. (Status: {1})", keyfile_name,
+          dumped_keys_status.ToString());
+      MemcachedUtils::RecordFileError(dumped_keys_status);
+    }
+  }
 
   owning_thread()->account_keys_processed(data_writer_->num_processed_keys());
   owning_thread()->account_keys_missing(data_writer_->num_missing_keys());
@@ -197,7 +252,6 @@ void ProcessMetabufTask::Execute() {
   owning_thread()->task_scheduler()->ReleaseMemcachedSocket(mc_sock);
   owning_thread()->mem_mgr()->ReturnBuffer(reinterpret_cast<uint8_t*>(metabuf));
   owning_thread()->mem_mgr()->ReturnBuffer(data_writer_buf);
-  MarkCheckpoint();
 }
 
 } // namespace memcachedumper
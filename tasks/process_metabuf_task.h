@@ -36,22 +36,26 @@ class ProcessMetabufTask : public Task {
   ProcessMetabufTask(const std::string& filename, bool is_s3_dump);
   ~ProcessMetabufTask() = default;
 
-  std::string UrlDecode(std::string& str);
-
   void ProcessMetaBuffer(MetaBufferSlice* mslice);
 
   void Execute() override;
 
  private:
 
-  // Writes out 'filename_' to a thread specific checkpoint file to indicate that
-  // we've already processed that keyfile.
-  void MarkCheckpoint();
+  // Writes out 'keyfile_name' to the checkpoint file of 'thread_name' to indicate
+  // that we've already processed that keyfile.
+  // Called once the keyfile's data files are complete, possibly from a finisher
+  // thread.
+  static void MarkCheckpoint(const std::string& keyfile_name,
+      const std::string& thread_name);
 
   std::string filename_;
 
   std::unique_ptr<KeyValueWriter> data_writer_;
 
+  // The lines of the dumped keys file of 'filename_', for the keys queued so far.
+  std::string dumped_keys_;
+
   // CURL object used for decoding URL encoded keys.
   CURL* curl_;
 
@@ -19,8 +19,15 @@
 #include "common/logger.h"
 #include "tasks/resume_task.h"
 
+#include "utils/aws_utils.h"
+#include "utils/file_finisher.h"
+#include "utils/file_util.h"
+#include "utils/key_index.h"
 #include "utils/memcache_utils.h"
+#include "utils/output_volumes.h"
+#include "utils/storage_sink.h"
 #include "tasks/process_metabuf_task.h"
+#include "tasks/s3_upload_task.h"
 #include "tasks/task_scheduler.h"
 #include "tasks/task_thread.h"
 
@@ -28,6 +35,7 @@
 #include <fstream>
 #include <iostream>
 #include <string>
+#include <vector>
 
 namespace fs = std::experimental::filesystem;
 namespace memcachedumper {
@@ -37,34 +45,45 @@ ResumeTask::ResumeTask(bool is_s3_dump)
 }
 
 void ResumeTask::ProcessCheckpoints() {
-  for (auto file : fs::directory_iterator(MemcachedUtils::GetKeyFilePath())) {
-    std::string filename = file.path().filename();
-    if (filename.rfind("CHECKPOINTS_", 0) == 0) {
+  OutputVolumes* volumes = MemcachedUtils::GetOutputVolumes();
+  for (int i = 0; i < volumes->size(); ++i) {
+    std::string keyfile_path = volumes->KeyFilePath(i);
+    if (!fs::exists(keyfile_path)) continue;
 
-      std::ifstream chkpt_file;
-      chkpt_file.open(file.path());
+    for (auto file : fs::directory_iterator(keyfile_path)) {
+      std::string filename = file.path().filename();
+      if (filename.rfind("CHECKPOINTS_", 0) == 0) {
 
-      std::string key_filename;
-      while (std::getline(chkpt_file, key_filename)) {
-        if (unprocessed_files_.find(key_filename) != unprocessed_files_.end()) {
-          LOG("Ignoring keyfile since it was already processed: {0}", key_filename);
+        std::ifstream chkpt_file;
+        chkpt_file.open(file.path());
 
-          // Remove files seen in checkpoint files to leave only unprocessed keyfiles.
-          unprocessed_files_.erase(key_filename);
+        std::string key_filename;
+        while (std::getline(chkpt_file, key_filename)) {
+          if (unprocessed_files_.find(key_filename) != unprocessed_files_.end()) {
+            LOG("Ignoring keyfile since it was already processed: {0}", key_filename);
+
+            // Remove files seen in checkpoint files to leave only unprocessed keyfiles.
+            unprocessed_files_.erase(key_filename);
+          }
         }
+        chkpt_file.close();
       }
-      chkpt_file.close();
     }
   }
 }
 
 void ResumeTask::GetKeyFileList() {
+  OutputVolumes* volumes = MemcachedUtils::GetOutputVolumes();
+  for (int i = 0; i < volumes->size(); ++i) {
+    std::string keyfile_path = volumes->KeyFilePath(i);
+    if (!fs::exists(keyfile_path)) continue;
 
-  for (auto file : fs::directory_iterator(MemcachedUtils::GetKeyFilePath())) {
-    std::string filename = file.path().filename();
-    if (filename.rfind("key_", 0) == 0) {
-      // Get all the file names into the set first.
-      unprocessed_files_.insert(filename);
+    for (auto file : fs::directory_iterator(keyfile_path)) {
+      std::string filename = file.path().filename();
+      if (filename.rfind("key_", 0) == 0) {
+        // Get all the file names into the map first.
+        unprocessed_files_.emplace(filename, keyfile_path);
+      }
     }
   }
 }
@@ -74,14 +93,87 @@ void ResumeTask::QueueUnprocessedFiles() {
   LOG("Queuing {0} files for processing.", unprocessed_files_.size());
   TaskScheduler* task_scheduler = owning_thread()->task_scheduler();
   for (auto& file : unprocessed_files_) {
-    LOG("Queueing {0}.", file);
+    LOG("Queueing {0}.", file.second + file.first);
     ProcessMetabufTask *ptask = new ProcessMetabufTask(
-        MemcachedUtils::GetKeyFilePath() + file, is_s3_dump_);
+        file.second + file.first, is_s3_dump_);
     task_scheduler->SubmitTask(ptask);
   }
 }
 
+void ResumeTask::ReplayUploads() {
+  UploadJournal* journal = MemcachedUtils::GetUploadJournal();
+  if (journal == nullptr) return;
+
+  std::vector<UploadJournal::PendingUpload> pending;
+  Status s = UploadJournal::Load(journal->path(), &pending);
+  if (!s.ok()) {
+    LOG_ERROR("Could not read the upload journal. (Status: {0})", s.ToString());
+    return;
+  }
+  LOG("Replaying {0} uploads left over from the previous run.", pending.size());
+
+  // A key index sidecar is journaled right before its data file, and has to be
+  // uploaded before it again.
+  std::vector<std::vector<UploadJournal::PendingUpload>> batches;
+  for (const UploadJournal::PendingUpload& upload : pending) {
+    if (!batches.empty() &&
+        batches.back().back().filename == upload.filename + KEY_INDEX_FILE_SUFFIX) {
+      batches.back().push_back(upload);
+      continue;
+    }
+    batches.push_back({upload});
+  }
+
+  FileFinisher* uploader = MemcachedUtils::GetFileUploader();
+  for (const auto& batch : batches) {
+    auto replay = [batch]() {
+      for (const UploadJournal::PendingUpload& upload : batch) {
+        Status s = ReplayUpload(upload);
+        if (!s.ok()) {
+          MemcachedUtils::RecordFileError(s);
+          return s;
+        }
+      }
+      return Status::OK();
+    };
+    if (uploader != nullptr) {
+      uploader->Submit(replay, nullptr);
+      continue;
+    }
+    Status replay_status = replay();
+    if (!replay_status.ok()) {
+      LOG_ERROR("Could not replay upload. (Status: {0})", replay_status.ToString());
+    }
+  }
+}
+
+Status ResumeTask::ReplayUpload(const UploadJournal::PendingUpload& upload) {
+  UploadJournal* journal = MemcachedUtils::GetUploadJournal();
+  if (upload.uploaded) {
+    // Only the notification is left.
+    std::string file_uri = MemcachedUtils::GetStorageSink()->ObjectUri(
+        AwsUtils::S3KeyForFile(upload.filename));
+    RETURN_ON_ERROR(AwsUtils::SendSQSNotification(file_uri));
+    RETURN_ON_ERROR(journal->RecordNotified(upload.filename));
+  } else {
+    if (!FileUtils::FileExists(upload.local_path)) {
+      return Status::NotFound("Lost the local copy of " + upload.filename,
+          upload.local_path);
+    }
+    // The previous run may have crashed after the upload, but before journaling it.
+    S3UploadFileTask upload_task(upload.local_path, upload.filename);
+    upload_task.set_journaled(true);
+    upload_task.set_skip_if_present(true);
+    upload_task.Execute();
+    RETURN_ON_ERROR(upload_task.GetUploadStatus());
+  }
+
+  if (!FileUtils::FileExists(upload.local_path)) return Status::OK();
+  return FileUtils::RemoveFile(upload.local_path);
+}
+
 void ResumeTask::Execute() {
+  ReplayUploads();
   GetKeyFileList();
   ProcessCheckpoints();
   QueueUnprocessedFiles();
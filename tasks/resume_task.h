@@ -20,8 +20,9 @@
 
 #include "tasks/task.h"
 #include "utils/status.h"
+#include "utils/upload_journal.h"
 
-#include <set>
+#include <map>
 #include <string>
 
 namespace memcachedumper {
@@ -33,14 +34,27 @@ class ResumeTask : public Task {
 
   void Execute() override;
 
+  // Every data dump task comes out of this one.
+  TaskPriority priority() override { return TaskPriority::CRITICAL; }
+
   void GetKeyFileList();
 
   void ProcessCheckpoints();
 
   void QueueUnprocessedFiles();
 
+  // Finishes the uploads in the upload journal that the previous run didn't.
+  void ReplayUploads();
+
  private:
-  std::set<std::string> unprocessed_files_;
+  // Uploads 'upload' unless it's already in the sink, notifies and removes the
+  // local copy.
+  static Status ReplayUpload(const UploadJournal::PendingUpload& upload);
+
+  // Maps the name of every key file not yet processed to the directory it's in.
+  // Key files live on the primary volume, but every volume is scanned in case
+  // the volumes were listed in a different order on the previous run.
+  std::map<std::string, std::string> unprocessed_files_;
 
   // Passes on this value to a ProcessMetabufTask.
   bool is_s3_dump_;
@@ -22,100 +22,139 @@
 #include "tasks/task_scheduler.h"
 #include "tasks/task_thread.h"
 #include "utils/aws_utils.h"
+#include "utils/checksum.h"
 #include "utils/mem_mgr.h"
 #include "utils/memcache_utils.h"
 #include "utils/socket.h"
+#include "utils/storage_sink.h"
+#include "utils/upload_journal.h"
 
 #include <unistd.h>
 #include <string.h>
 
+#include <algorithm>
 #include <experimental/filesystem>
 #include <fstream>
 #include <sstream>
 
 #include <aws/core/Aws.h>
-#include <aws/s3/model/PutObjectRequest.h>
 #include <aws/sqs/SQSClient.h>
 #include <aws/sqs/model/ReceiveMessageRequest.h>
 #include <aws/sqs/model/ReceiveMessageResult.h>
 #include <aws/sqs/model/SendMessageRequest.h>
 #include <aws/sqs/model/SendMessageResult.h>
 
-#define CACHE_DUMP_CHUNK_JSON "cacheDumpChunk"
-
 namespace fs = std::experimental::filesystem;
 namespace memcachedumper {
 
 S3UploadFileTask::~S3UploadFileTask() = default;
 
-S3UploadFileTask::S3UploadFileTask(std::string fq_local_path, std::string filename)
+S3UploadFileTask::S3UploadFileTask(std::string fq_local_path, std::string filename,
+    std::shared_ptr<FinishGroup> group)
   : fq_local_path_(fq_local_path),
     filename_(filename),
+    group_(group),
+    journaled_(false),
+    skip_if_present_(false),
     upload_status_(Status::OK()) {
 }
 
-Status S3UploadFileTask::SendSQSNotification(std::string s3_file_uri,
-    std::string sqs_msg_body) {
-  Aws::SQS::Model::SendMessageRequest sm_req;
-  std::string queue_url = AwsUtils::GetCachedSQSQueueURL();
-  sm_req.SetQueueUrl(queue_url);
-
-  std::string msg_body;
-  RETURN_ON_ERROR(AwsUtils::SQSBodyForS3(s3_file_uri, &msg_body));
-  sm_req.SetMessageBody(msg_body);
-
-  auto sm_out = AwsUtils::GetSQSClient()->SendMessage(sm_req);
-  if (sm_out.IsSuccess()) {
-    LOG("Successfully sent SQS message to {0} for file {1}", queue_url, filename_);
-  } else {
-    return Status::NetworkError("Error sending SQS message to : " + queue_url,
-        sm_out.GetError().GetMessage());
+Status S3UploadFileTask::IsAlreadyUploaded(const std::string& key,
+    const std::string& checksum_md, bool* out_present) {
+  *out_present = false;
+  ObjectInfo info;
+  Status s = MemcachedUtils::GetStorageSink()->HeadObject(key, &info);
+  if (s.IsNotFound()) return Status::OK();
+  RETURN_ON_ERROR(s);
+
+  std::error_code ec;
+  uint64_t local_size = fs::file_size(fq_local_path_, ec);
+  if (ec) return Status::IOError("Could not stat " + fq_local_path_, ec.message());
+  if (info.size != local_size) return Status::OK();
+
+  auto stored_checksum = info.metadata.find(FILE_CHECKSUM_METADATA);
+  if (stored_checksum != info.metadata.end()) {
+    *out_present = stored_checksum->second == checksum_md;
+    return Status::OK();
   }
 
+  // Only an object uploaded in one go, without encryption by KMS, has its MD5 as
+  // its ETag. Anything else without a checksum is uploaded again.
+  std::string etag = info.etag;
+  etag.erase(std::remove(etag.begin(), etag.end(), '"'), etag.end());
+  bool etag_is_md5 = etag.size() == 32 &&
+      etag.find_first_not_of("0123456789abcdef") == std::string::npos;
+  if (!etag_is_md5) return Status::OK();
+
+  std::string local_etag;
+  RETURN_ON_ERROR(StorageSink::FileETag(fq_local_path_, &local_etag));
+  *out_present = local_etag == "\"" + etag + "\"";
   return Status::OK();
 }
 
 void S3UploadFileTask::Execute() {
-  std::string s3_key_name = AwsUtils::GetS3Path() + "/" +
-      MemcachedUtils::GetReqId() + "/" + filename_;
+  std::string s3_key_name = AwsUtils::S3KeyForFile(filename_);
 
-  std::string s3_file_uri = "s3://" + AwsUtils::GetS3Bucket() + "/" + s3_key_name;
+  StorageSink* sink = MemcachedUtils::GetStorageSink();
+  std::string s3_file_uri = sink->ObjectUri(s3_key_name);
 
   // Retrieve the payload for the S3 file metadata and for the SQS notification.
   std::string obj_md_string;
   Status s = AwsUtils::SQSBodyForS3(s3_file_uri, &obj_md_string);
   if (!s.ok()) {
     LOG_ERROR("Can't get S3 File metadata: " + s.ToString());
+    upload_status_ = s;
     return;
   }
 
-  const std::shared_ptr<Aws::IOStream> input_data =
-  Aws::MakeShared<Aws::FStream>("SampleAllocationTag",
-    fq_local_path_.c_str(),
-    std::ios_base::in | std::ios_base::binary);
+  // Files that weren't checksummed as they were written are read once more.
+  if (checksum_hex_.empty()) {
+    upload_status_ = Checksum::OfFile(MemcachedUtils::GetChecksumType(), fq_local_path_,
+        &checksum_hex_);
+    if (!upload_status_.ok()) return;
+  }
+  std::string checksum_md = AwsUtils::FileChecksumMetadata(checksum_hex_);
 
-  Aws::S3::Model::PutObjectRequest object_request;
+  ObjectMetadata metadata;
+  metadata.emplace(CACHE_DUMP_CHUNK_JSON, obj_md_string);
+  metadata.emplace(FILE_CHECKSUM_METADATA, checksum_md);
 
-  object_request.SetBucket(AwsUtils::GetS3Bucket());
-  object_request.SetKey(s3_key_name);
-  object_request.SetBody(input_data);
+  bool present = false;
+  if (skip_if_present_) {
+    upload_status_ = IsAlreadyUploaded(s3_key_name, checksum_md, &present);
+    if (!upload_status_.ok()) return;
+  }
 
-  // The AWS SDK takes metadata as a map. We set a single key_value pair
-  // for the metadata.
-  Aws::Map<Aws::String, Aws::String> md_map;
-  md_map.emplace(CACHE_DUMP_CHUNK_JSON, obj_md_string);
-  object_request.SetMetadata(md_map);
+  if (present) {
+    LOG("{0} is already in {1}. Skipping its upload.", filename_,
+        StorageSink::TypeName(sink->type()));
+  } else {
+    // Put the object
+    upload_status_ = sink->PutFile(fq_local_path_, s3_key_name, metadata);
+    if (!upload_status_.ok()) return;
+    LOG("Successfully uploaded {0} to {1}. Sending SQS notification...", filename_,
+        StorageSink::TypeName(sink->type()));
+  }
 
-  // Put the object
-  auto put_object_outcome = AwsUtils::GetS3Client()->PutObject(object_request);
-  if (!put_object_outcome.IsSuccess()) {
-    auto error = put_object_outcome.GetError();
-    upload_status_ = Status::NetworkError(error.GetExceptionName() + " : ", error.GetMessage());
-    return;
+  UploadJournal* journal = journaled_ ? MemcachedUtils::GetUploadJournal() : nullptr;
+  std::function<void()> on_notified;
+  if (journal != nullptr) {
+    upload_status_ = journal->RecordUploaded(filename_);
+    if (!upload_status_.ok()) return;
+
+    std::string filename = filename_;
+    on_notified = [journal, filename]() {
+      // At worst, a resumed dump sends the notification again.
+      Status s = journal->RecordNotified(filename);
+      if (!s.ok()) {
+        LOG_ERROR("Could not journal the notification for {0}. (Status: {1})", filename,
+            s.ToString());
+      }
+    };
   }
-  LOG("Successfully uploaded {0} to S3. Sending SQS notification...", filename_);
 
-  Status sqs_notify_status = SendSQSNotification(s3_file_uri, obj_md_string);
+  Status sqs_notify_status = AwsUtils::SendSQSNotification(s3_file_uri, group_,
+      on_notified);
   if (!sqs_notify_status.ok()) {
     upload_status_ = sqs_notify_status;
     return;
@@ -22,25 +22,51 @@
 #include "utils/status.h"
 
 #include <iostream>
+#include <memory>
 #include <string>
 
 namespace memcachedumper {
 
+class FinishGroup;
+
 class S3UploadFileTask : public Task {
  public:
-  S3UploadFileTask(std::string fq_local_path, std::string filename);
+  // If the SQS notification is batched, it's accounted to 'group' (see
+  // AwsUtils::SendSQSNotification()).
+  S3UploadFileTask(std::string fq_local_path, std::string filename,
+      std::shared_ptr<FinishGroup> group = nullptr);
   ~S3UploadFileTask();
 
   void Execute() override;
   Status GetUploadStatus() { return upload_status_; }
 
+  // Records the upload and the notification in the upload journal.
+  void set_journaled(bool journaled) { journaled_ = journaled; }
+
+  // Skips the upload if the object is already in the sink with the same contents,
+  // eg. from before a crash. Objects the sink won't look up are uploaded again.
+  void set_skip_if_present(bool skip_if_present) { skip_if_present_ = skip_if_present; }
+
+  // The checksum of the file (see MemcachedUtils::GetChecksumType()), if it was
+  // computed as the file was written. Otherwise, it's computed from the file.
+  void set_checksum(const std::string& checksum_hex) { checksum_hex_ = checksum_hex; }
+
  private:
+  // Returns in 'out_present' whether the object 'key' has the same size as the
+  // local file and the same checksum as 'checksum_md' (see
+  // FILE_CHECKSUM_METADATA). Objects stored without one are only taken to be
+  // present if their ETag is the file's MD5.
+  Status IsAlreadyUploaded(const std::string& key, const std::string& checksum_md,
+      bool* out_present);
+
   std::string fq_local_path_;
   std::string filename_;
+  std::shared_ptr<FinishGroup> group_;
+  bool journaled_;
+  bool skip_if_present_;
+  std::string checksum_hex_;
 
   Status upload_status_;
-
-  Status SendSQSNotification(std::string s3_file_uri, std::string sqs_msg_body);
 };
 
 } // namespace memcachedumper
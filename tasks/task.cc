@@ -23,6 +23,7 @@
 #include "tasks/task_thread.h"
 #include "utils/mem_mgr.h"
 #include "utils/memcache_utils.h"
+#include "utils/metrics.h"
 #include "utils/socket.h"
 
 #include <unistd.h>
@@ -40,11 +41,15 @@ DoneTask::DoneTask(uint64_t total,
     uint64_t skipped,
     uint64_t not_found,
     uint64_t filtered,
+    uint64_t unchanged,
+    uint64_t tombstones,
     std::string time_taken_str) : total_(total),
                                   dumped_(dumped),
                                   skipped_(skipped),
                                   not_found_(not_found),
                                   filtered_(filtered),
+                                  unchanged_(unchanged),
+                                  tombstones_(tombstones),
                                   total_time_taken_str_(time_taken_str) {
 }
 
@@ -58,6 +63,27 @@ std::string DoneTask::PrepareFinalMetricsString() {
       "Total keys skipped: " << skipped_ << std::endl <<
       "Total keys not found: " << not_found_ << std::endl <<
       "Total keys filtered: " << filtered_ << std::endl <<
+      "Checksum: " << Checksum::TypeName(MemcachedUtils::GetChecksumType()) << std::endl <<
+      "Compression: " << Compressor::TypeName(MemcachedUtils::GetCompressionType()) <<
+      std::endl <<
+      "Record compression: " << (MemcachedUtils::RecordCompression() ? "ZSTD_DICT" : "NONE") <<
+      std::endl <<
+      "Dump format version: " << MemcachedUtils::DumpFormatVersion() << std::endl <<
+      "Value dedup: " << (MemcachedUtils::ValueDedup() ? "true" : "false") << std::endl;
+
+  if (MemcachedUtils::ValueDedup()) {
+    final_metrics <<
+        "Total keys deduplicated: " << DumpMetrics::total_dedup_refs() << std::endl;
+  }
+
+  if (MemcachedUtils::IsDeltaDump()) {
+    final_metrics <<
+        "Delta dump: true" << std::endl <<
+        "Total keys unchanged: " << unchanged_ << std::endl <<
+        "Total tombstones: " << tombstones_ << std::endl;
+  }
+
+  final_metrics <<
       "Total time taken: " << total_time_taken_str_ << std::endl;
 
   return final_metrics.str();
@@ -21,11 +21,23 @@
 #include <iostream>
 #include <string>
 
+// Number of values of TaskPriority.
+#define NUM_TASK_PRIORITIES 2
+
 namespace memcachedumper {
 
 class MemoryManager;
 class TaskThread;
 
+// Task threads run every queued task of a higher priority before any of a lower
+// one. Lower values are higher priorities.
+enum class TaskPriority {
+  // Work that the rest of the dump waits on, eg. dumping the keys.
+  CRITICAL = 0,
+  // Work that makes up the bulk of the dump, eg. dumping the values of a key file.
+  BULK = 1
+};
+
 class Task {
 public:
   virtual ~Task() = default;
@@ -35,6 +47,8 @@ public:
   void set_owning_thread(TaskThread* thread) { owning_thread_ = thread; }
 
   virtual void Execute() = 0;
+
+  virtual TaskPriority priority() { return TaskPriority::BULK; }
   //std::atomic<bool> running_;
 
  private:
@@ -49,6 +63,8 @@ class DoneTask : public Task {
       uint64_t skipped,
       uint64_t not_found,
       uint64_t filtered,
+      uint64_t unchanged,
+      uint64_t tombstones,
       std::string time_taken_str);
   ~DoneTask();
 
@@ -60,6 +76,8 @@ class DoneTask : public Task {
   uint64_t skipped_;
   uint64_t not_found_;
   uint64_t filtered_;
+  uint64_t unchanged_;
+  uint64_t tombstones_;
   std::string total_time_taken_str_;
 
   std::string PrepareFinalMetricsString();
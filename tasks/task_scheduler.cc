@@ -22,76 +22,218 @@
 #include "tasks/task_thread.h"
 #include "utils/metrics.h"
 
+#include <stdlib.h>
+
+#include <algorithm>
 #include <chrono>
 #include <iostream>
 #include <sstream>
 
+// How often the auto scaler looks at the load.
+#define AUTO_SCALE_INTERVAL_MS 5000
+
+// The auto scaler takes memcached to be overloaded once the average wait on it
+// over an interval is this many times the lowest average seen so far, and at
+// least AUTO_SCALE_MIN_SLOW_WAIT_US. Below that, waits are too short to tell.
+#define AUTO_SCALE_SLOW_WAIT_FACTOR 3
+#define AUTO_SCALE_MIN_SLOW_WAIT_US 2000
+
 namespace memcachedumper {
 
+namespace {
+
+// The scheduler and index of the task thread running on this thread, if any.
+thread_local TaskScheduler* tls_scheduler = nullptr;
+thread_local int tls_thread_idx = -1;
+
+} // anonymous namespace
+
 TaskScheduler::TaskScheduler(int num_threads, Dumper* dumper)
   : num_threads_(num_threads),
-    num_running_(0),
-    num_waiting_(0),
+    min_threads_(num_threads),
+    max_threads_(num_threads),
+    auto_scale_(false),
+    last_memcached_waits_(0),
+    last_memcached_wait_us_(0),
+    min_avg_memcached_wait_us_(0),
+    num_pending_(0),
+    num_parked_(0),
+    metrics_interval_ms_(0),
+    stop_background_threads_(false),
     dumper_(dumper),
     all_tasks_complete_(false) {
-  threads_.reserve(num_threads_);
+  for (int p = 0; p < NUM_TASK_PRIORITIES; ++p) {
+    num_queued_[p] = 0;
+    num_running_[p] = 0;
+    max_running_[p] = 0;
+  }
 }
 
-TaskScheduler::~TaskScheduler() = default;
+TaskScheduler::~TaskScheduler() {
+  StopBackgroundThreads();
+}
 
 int TaskScheduler::Init() {
   LOG("Initing task scheduler");
-  for (int i = 0; i < num_threads_; ++i) {
-    threads_.push_back(
-        std::make_unique<TaskThread>(this, "task_thread_" + std::to_string(i + 1)));
+  max_threads_ = std::max(max_threads_, num_threads_.load());
+  // The queues have to be there before the threads start looking at them. Threads
+  // started later steal from all of them, so they're never resized.
+  for (int i = 0; i < max_threads_; ++i) {
+    thread_queues_.push_back(std::make_unique<WorkQueue>());
+  }
+  SetNumThreads(num_threads_);
+  if (metrics_interval_ms_ > 0) {
+    metrics_thread_ = std::thread(&TaskScheduler::MetricsReporterLoop, this);
+  }
+  if (auto_scale_ && max_threads_ > min_threads_) {
+    auto_scale_thread_ = std::thread(&TaskScheduler::AutoScaleLoop, this);
   }
   return 0;
 }
 
+void TaskScheduler::SetNumThreads(int num_threads) {
+  std::lock_guard<std::mutex> lock(scale_mutex_);
+  num_threads_ = num_threads;
+  for (int i = 0; i < num_threads; ++i) {
+    if (i == static_cast<int>(threads_.size())) {
+      threads_.push_back(
+          std::make_unique<TaskThread>(this, "task_thread_" + std::to_string(i + 1), i));
+      thread_running_.push_back(true);
+    } else if (!thread_running_[i]) {
+      // The thread was retired and has exited, or is about to.
+      threads_[i]->Restart();
+      thread_running_[i] = true;
+    }
+  }
+
+  // Parked threads that were retired have to wake up to exit.
+  { std::lock_guard<std::mutex> plock(park_mutex_); }
+  park_cv_.notify_all();
+}
+
+bool TaskScheduler::ThreadExiting(int thread_idx) {
+  std::lock_guard<std::mutex> lock(scale_mutex_);
+  if (!AllTasksComplete() && thread_idx < num_threads_) return false;
+  thread_running_[thread_idx] = false;
+  return true;
+}
+
+void TaskScheduler::SetMaxRunning(TaskPriority priority, int max_running) {
+  max_running_[static_cast<int>(priority)] = max_running;
+}
+
 MemoryManager* TaskScheduler::mem_mgr() {
   return dumper_->mem_mgr();
 }
 
+MemoryManager* TaskScheduler::staging_mem_mgr() {
+  return dumper_->staging_mem_mgr();
+}
+
+MemoryManager* TaskScheduler::compression_mem_mgr() {
+  return dumper_->compression_mem_mgr();
+}
+
+void TaskScheduler::RegisterTaskThread(int thread_idx) {
+  tls_scheduler = this;
+  tls_thread_idx = thread_idx;
+}
+
 void TaskScheduler::SubmitTask(Task *task) {
-  std::lock_guard<std::mutex> lock(queue_mutex_);
-  task_queue_.push(task);
+  ++num_pending_;
+
+  int p = static_cast<int>(task->priority());
+  WorkQueue* queue = &shared_queue_;
+  if (tls_scheduler == this) queue = thread_queues_[tls_thread_idx].get();
   {
-    std::lock_guard<std::mutex> mlock(metrics_mutex_);
-    num_waiting_++;
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    queue->tasks[p].push_back(task);
   }
-  queue_cv_.notify_one();
+  ++num_queued_[p];
+
+  // A thread about to park counts itself before checking 'num_queued_', so either
+  // it sees this task or we see it parked.
+  if (num_parked_ > 0) WakeParkedThread();
 }
 
-Task* TaskScheduler::WaitForNextTask() {
-  std::unique_lock<std::mutex> lock(queue_mutex_);
-  Task *next_task = GetNextTaskHelper();
-  while (next_task == nullptr) {
-    queue_cv_.wait(lock);
-    if (AllTasksComplete()) {
-      next_task = nullptr;
-      break;
-    }
+void TaskScheduler::WakeParkedThread() {
+  { std::lock_guard<std::mutex> lock(park_mutex_); }
+  park_cv_.notify_one();
+}
 
-    next_task = GetNextTaskHelper();
-  }
+Task* TaskScheduler::WaitForNextTask(int thread_idx) {
+  while (!AllTasksComplete() && thread_idx < num_threads_) {
+    Task* task = FindTask(thread_idx);
+    if (task != nullptr) return task;
 
-  return next_task;
+    std::unique_lock<std::mutex> lock(park_mutex_);
+    ++num_parked_;
+    park_cv_.wait(lock, [this, thread_idx] {
+      return HasRunnableTask() || AllTasksComplete() || thread_idx >= num_threads_;
+    });
+    --num_parked_;
+  }
+  return nullptr;
 }
 
-Task* TaskScheduler::GetNextTaskHelper() {
-  if (task_queue_.empty()) {
-    return nullptr;
+bool TaskScheduler::HasRunnableTask() {
+  for (int p = 0; p < NUM_TASK_PRIORITIES; ++p) {
+    if (num_queued_[p] > 0 && (max_running_[p] == 0 || num_running_[p] < max_running_[p])) {
+      return true;
+    }
   }
+  return false;
+}
 
-  Task* task_to_return = task_queue_.front();
-  task_queue_.pop();
+bool TaskScheduler::TryStartRunning(int p) {
+  int running = num_running_[p];
+  do {
+    if (max_running_[p] > 0 && running >= max_running_[p]) return false;
+  } while (!num_running_[p].compare_exchange_weak(running, running + 1));
+  return true;
+}
 
-  {
-    std::lock_guard<std::mutex> mlock(metrics_mutex_);
-    num_waiting_--;
-    num_running_++;
+void TaskScheduler::StopRunning(int p) {
+  --num_running_[p];
+  // A thread may have parked because the priority had no thread to spare.
+  if (max_running_[p] > 0 && num_queued_[p] > 0 && num_parked_ > 0) WakeParkedThread();
+}
+
+Task* TaskScheduler::FindTask(int thread_idx) {
+  auto take_task = [](WorkQueue* queue, int p, bool newest) -> Task* {
+    std::lock_guard<std::mutex> lock(queue->mutex);
+    std::deque<Task*>& tasks = queue->tasks[p];
+    if (tasks.empty()) return nullptr;
+    Task* task;
+    if (newest) {
+      task = tasks.back();
+      tasks.pop_back();
+    } else {
+      task = tasks.front();
+      tasks.pop_front();
+    }
+    return task;
+  };
+
+  for (int p = 0; p < NUM_TASK_PRIORITIES; ++p) {
+    if (num_queued_[p] == 0 || !TryStartRunning(p)) continue;
+
+    // Our own newest task is the likeliest to still be in cache.
+    Task* task = take_task(thread_queues_[thread_idx].get(), p, true);
+    if (task == nullptr) task = take_task(&shared_queue_, p, false);
+    // Steal the oldest task of another thread. Starting at our neighbour spreads
+    // the thieves out over the queues. Retired threads may have left tasks behind.
+    for (int i = 1; task == nullptr && i < max_threads_; ++i) {
+      task = take_task(thread_queues_[(thread_idx + i) % max_threads_].get(), p, false);
+    }
+
+    if (task != nullptr) {
+      --num_queued_[p];
+      return task;
+    }
+    StopRunning(p);
   }
-  return task_to_return;
+  return nullptr;
 }
 
 void TaskScheduler::UpdateMetrics() {
@@ -99,47 +241,151 @@ void TaskScheduler::UpdateMetrics() {
   uint64_t total_keys_ignored = 0;
   uint64_t total_keys_missing = 0;
   uint64_t total_keys_filtered = 0;
-  for (auto& t : threads_) {
-    total_keys_processed += t->num_keys_processed();
-    total_keys_ignored += t->num_keys_ignored();
-    total_keys_missing += t->num_keys_missing();
-    total_keys_filtered += t->num_keys_filtered();
+  uint64_t total_keys_unchanged = 0;
+  {
+    // Retired threads are kept around, so their keys are still counted.
+    std::lock_guard<std::mutex> lock(scale_mutex_);
+    for (auto& t : threads_) {
+      total_keys_processed += t->num_keys_processed();
+      total_keys_ignored += t->num_keys_ignored();
+      total_keys_missing += t->num_keys_missing();
+      total_keys_filtered += t->num_keys_filtered();
+      total_keys_unchanged += t->num_keys_unchanged();
+    }
   }
   DumpMetrics::update_total_keys_processed(total_keys_processed);
   DumpMetrics::update_total_keys_ignored(total_keys_ignored);
   DumpMetrics::update_total_keys_missing(total_keys_missing);
   DumpMetrics::update_total_keys_filtered(total_keys_filtered);
+  DumpMetrics::update_total_keys_unchanged(total_keys_unchanged);
 
-  DumpMetrics::PersistMetrics();
+  Status s = DumpMetrics::PersistMetrics();
+  if (!s.ok()) {
+    LOG_ERROR("Could not persist metrics. (Status: {0})", s.ToString());
+  }
 }
 
-void TaskScheduler::MarkTaskComplete(Task *task) {
-  std::lock_guard<std::mutex> mlock(metrics_mutex_);
-  num_running_--;
+void TaskScheduler::MetricsReporterLoop() {
+  std::unique_lock<std::mutex> lock(background_mutex_);
+  while (!background_cv_.wait_for(lock, std::chrono::milliseconds(metrics_interval_ms_),
+      [this] { return stop_background_threads_; })) {
+    // Not holding up StopBackgroundThreads() while writing the file.
+    lock.unlock();
+    UpdateMetrics();
+    lock.lock();
+  }
+}
+
+void TaskScheduler::AutoScaleLoop() {
+  std::unique_lock<std::mutex> lock(background_mutex_);
+  while (!background_cv_.wait_for(lock, std::chrono::milliseconds(AUTO_SCALE_INTERVAL_MS),
+      [this] { return stop_background_threads_; })) {
+    lock.unlock();
+    int target = AutoScaleTarget();
+    if (target != num_threads_) {
+      Status s = dumper_->ScaleThreads(target);
+      if (!s.ok()) {
+        LOG_ERROR("Could not scale to {0} task threads. (Status: {1})", target, s.ToString());
+      }
+    }
+    lock.lock();
+  }
+}
+
+bool TaskScheduler::MemcachedOverloaded() {
+  uint64_t waits = DumpMetrics::total_memcached_waits();
+  uint64_t wait_us = DumpMetrics::total_memcached_wait_us();
+  uint64_t interval_waits = waits - last_memcached_waits_;
+  uint64_t interval_wait_us = wait_us - last_memcached_wait_us_;
+  last_memcached_waits_ = waits;
+  last_memcached_wait_us_ = wait_us;
+  if (interval_waits == 0) return false;
+
+  uint64_t avg_wait_us = interval_wait_us / interval_waits;
+  if (min_avg_memcached_wait_us_ == 0 || avg_wait_us < min_avg_memcached_wait_us_) {
+    min_avg_memcached_wait_us_ = std::max<uint64_t>(avg_wait_us, 1);
+  }
+  return avg_wait_us >= AUTO_SCALE_MIN_SLOW_WAIT_US &&
+      avg_wait_us > AUTO_SCALE_SLOW_WAIT_FACTOR * min_avg_memcached_wait_us_;
+}
+
+int TaskScheduler::AutoScaleTarget() {
+  int num_threads = num_threads_;
+  uint32_t num_queued = 0;
+  for (int p = 0; p < NUM_TASK_PRIORITIES; ++p) {
+    num_queued += num_queued_[p];
+  }
+
+  // More threads would only slow memcached down further, so give one back.
+  if (MemcachedOverloaded()) {
+    if (num_threads > min_threads_) {
+      LOG("Memcached is slowing down. Scaling down task threads.");
+      return num_threads - 1;
+    }
+    return num_threads;
+  }
+
+  if (num_queued == 0) {
+    // Give back one idle thread at a time, in case the lull is short.
+    if (num_parked_ > 0 && num_threads > min_threads_) return num_threads - 1;
+    return num_threads;
+  }
+
+  // Every thread is busy and tasks are waiting. Only add threads while the host
+  // has cores to spare, or they'd take them from memcached.
+  if (num_parked_ > 0 || num_threads >= max_threads_) return num_threads;
+  double load;
+  if (getloadavg(&load, 1) != 1) return num_threads;
+  int spare_cores = static_cast<int>(std::thread::hardware_concurrency()) -
+      static_cast<int>(load + 0.5);
+  if (spare_cores <= 0) return num_threads;
+  int num_new = std::min({static_cast<int>(num_queued), spare_cores,
+      max_threads_ - num_threads});
+  return num_threads + num_new;
+}
 
+void TaskScheduler::StopBackgroundThreads() {
+  {
+    std::lock_guard<std::mutex> lock(background_mutex_);
+    stop_background_threads_ = true;
+  }
+  background_cv_.notify_all();
+  if (metrics_thread_.joinable()) metrics_thread_.join();
+  if (auto_scale_thread_.joinable()) auto_scale_thread_.join();
+}
+
+void TaskScheduler::MarkTaskComplete(Task *task) {
+  int p = static_cast<int>(task->priority());
   delete task;
-  UpdateMetrics();
+  StopRunning(p);
+
+  // A task submits the tasks it spawns before completing, so this only drops to 0
+  // once there's nothing left to do.
+  if (--num_pending_ > 0) return;
 
-  // If all tasks completed, notify everyone waiting on the task queue
-  // and everyone waiting for all tasks to complete.
-  if (num_running_ == 0 && num_waiting_ == 0) {
+  // If all tasks completed, notify everyone parked waiting for a task and everyone
+  // waiting for all tasks to complete.
+  {
+    std::lock_guard<std::mutex> mlock(metrics_mutex_);
     all_tasks_complete_ = true;
-    tasks_completed_cv_.notify_all();
-    queue_cv_.notify_all();
   }
+  tasks_completed_cv_.notify_all();
+  { std::lock_guard<std::mutex> lock(park_mutex_); }
+  park_cv_.notify_all();
 }
 
 void TaskScheduler::WaitUntilTasksComplete() {
-  std::chrono::minutes min(1);
   std::unique_lock<std::mutex> mlock(metrics_mutex_);
-  tasks_completed_cv_.wait(mlock);
+  tasks_completed_cv_.wait(mlock, [this] { return AllTasksComplete(); });
+  mlock.unlock();
 
   // Update all metrics one last time.
+  StopBackgroundThreads();
   UpdateMetrics();
 }
 
-Socket* TaskScheduler::GetMemcachedSocket() {
-  return dumper_->GetMemcachedSocket();
+Status TaskScheduler::GetMemcachedSocket(Socket** out_sock) {
+  return dumper_->GetMemcachedSocket(out_sock);
 }
 
 void TaskScheduler::ReleaseMemcachedSocket(Socket *sock) {
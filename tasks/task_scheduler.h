@@ -19,13 +19,15 @@
 #pragma once
 
 #include "tasks/task.h"
+#include "utils/status.h"
 
 #include <atomic>
 #include <condition_variable>
-#include <queue>
+#include <deque>
 #include <memory>
 #include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 namespace memcachedumper {
@@ -34,6 +36,19 @@ class Dumper;
 class Socket;
 class TaskThread;
 
+/// Runs tasks on a pool of TaskThreads with work stealing. Every thread has its
+/// own deque: tasks submitted from a task thread go on its deque and it takes the
+/// newest one first, while idle threads steal the oldest ones from the others.
+/// Tasks submitted from elsewhere go on a shared queue. Threads with nothing to
+/// do park until a task is submitted.
+///
+/// Every priority has deques of its own, and a thread looks for a task of every
+/// higher priority before taking one of a lower priority. A priority may be
+/// limited to fewer threads, so that the rest are left for higher priorities.
+///
+/// The number of threads may be changed while tasks run, up to a maximum set
+/// before Init(). A retired thread exits once it's done with its current task,
+/// and the tasks left on its queue are stolen by the others.
 class TaskScheduler {
  public:
   TaskScheduler(int num_threads, Dumper* dumper);
@@ -41,22 +56,57 @@ class TaskScheduler {
   ~TaskScheduler();
 
   MemoryManager* mem_mgr();
+  MemoryManager* staging_mem_mgr();
+  MemoryManager* compression_mem_mgr();
 
   Dumper* dumper() { return dumper_; }
 
   int Init();
 
+  // Runs at most 'max_running' tasks of 'priority' at a time. 0 means no limit.
+  // Must be called before Init().
+  void SetMaxRunning(TaskPriority priority, int max_running);
+
+  // Updates the metrics every 'interval_ms' on a thread of its own. 0 only
+  // updates them once all tasks are complete. Must be called before Init().
+  void SetMetricsInterval(int interval_ms) { metrics_interval_ms_ = interval_ms; }
+
+  // Allows up to 'max_threads' task threads to be run with SetNumThreads().
+  // Must be called before Init().
+  void SetMaxThreads(int max_threads) { max_threads_ = max_threads; }
+
+  // Periodically adds threads while tasks are backed up and the host has CPU to
+  // spare, and takes them away again while threads are idle or memcached is
+  // slowing down. Must be called before Init().
+  void SetAutoScale(bool auto_scale) { auto_scale_ = auto_scale; }
+
+  int num_threads() { return num_threads_; }
+  int max_threads() { return max_threads_; }
+
+  // Runs 'num_threads' task threads, starting new ones or retiring the ones
+  // above it. Must be between 1 and max_threads().
+  void SetNumThreads(int num_threads);
+
   void SubmitTask(Task *task);
 
-  Task* WaitForNextTask();
+  // Returns the next task for the thread 'thread_idx' to run, parking it until
+  // there is one. Returns nullptr once all tasks are complete, or if the thread
+  // was retired.
+  Task* WaitForNextTask(int thread_idx);
+
+  // Called by the thread 'thread_idx' when WaitForNextTask() returns nullptr.
+  // Returns true if the thread should exit, or false if it was brought back in
+  // the meantime.
+  bool ThreadExiting(int thread_idx);
 
   void WaitUntilTasksComplete();
 
-  // Obtain the latest metrics from task threads and update the dump metrics.
+  // Obtain the latest metrics from task threads, update the dump metrics and
+  // persist them.
   void UpdateMetrics();
 
   // Get a socket to memcached.
-  Socket* GetMemcachedSocket();
+  Status GetMemcachedSocket(Socket** out_sock);
 
   // Release a memcached socket.
   void ReleaseMemcachedSocket(Socket *sock);
@@ -64,32 +114,111 @@ class TaskScheduler {
  private:
   friend class TaskThread;
 
-  // Returns the next task in the queue of it's present.
-  // Returns nullptr otherwise. Not thread-safe.
-  Task* GetNextTaskHelper();
+  // Tasks queued by one task thread. Padded to keep the threads' queues off of
+  // each other's cache lines.
+  struct alignas(64) WorkQueue {
+    std::mutex mutex;
+    // Indexed by priority.
+    std::deque<Task*> tasks[NUM_TASK_PRIORITIES];
+  };
+
+  // Marks the calling thread as the task thread 'thread_idx', so that the tasks
+  // it submits go on its own queue.
+  void RegisterTaskThread(int thread_idx);
+
+  // Returns a task of the highest priority that has one queued and a thread to
+  // spare, from the thread's own queue, the shared queue or another thread's
+  // queue, in that order. Returns nullptr if there are none.
+  Task* FindTask(int thread_idx);
+
+  // Returns true if a task is queued with a priority that has a thread to spare.
+  bool HasRunnableTask();
+
+  // Takes one of the threads that tasks of priority 'p' may run on. Returns false
+  // if they're all taken.
+  bool TryStartRunning(int p);
+
+  // Gives back a thread taken with TryStartRunning().
+  void StopRunning(int p);
+
+  // Wakes up a parked thread, if there is one.
+  void WakeParkedThread();
 
   // Returns true if 'all_tasks_compete_' is true.
   bool AllTasksComplete() { return all_tasks_complete_; }
 
   void MarkTaskComplete(Task *task);
 
-  // A queue of tasks to work on.
-  std::queue<Task*> task_queue_;
-  std::mutex queue_mutex_;
-  std::condition_variable queue_cv_;
+  // Runs on 'metrics_thread_', updating the metrics every 'metrics_interval_ms_'.
+  void MetricsReporterLoop();
 
-  std::vector<std::unique_ptr<TaskThread>> threads_;
-  int num_threads_;
+  // Runs on 'auto_scale_thread_', adjusting the number of task threads every
+  // AUTO_SCALE_INTERVAL_MS.
+  void AutoScaleLoop();
+
+  // Returns the number of task threads to run given the current load.
+  int AutoScaleTarget();
 
-  // Number of tasks currently running.
-  uint32_t num_running_;
+  // Returns true if the time spent waiting on memcached since the last call is
+  // well above the lowest seen, ie. memcached can't keep up.
+  bool MemcachedOverloaded();
 
-  // Number of tasks waiting in the queue.
-  uint32_t num_waiting_;
+  // Stops 'metrics_thread_' and 'auto_scale_thread_', if running.
+  void StopBackgroundThreads();
+
+  // One queue for each thread up to 'max_threads_', and the shared queue for
+  // tasks submitted from other threads.
+  std::vector<std::unique_ptr<WorkQueue>> thread_queues_;
+  WorkQueue shared_queue_;
+
+  // Protects 'threads_' and 'thread_running_'.
+  std::mutex scale_mutex_;
+  std::vector<std::unique_ptr<TaskThread>> threads_;
+  // Whether the thread at every index is running, or has exited.
+  std::vector<bool> thread_running_;
+
+  // Number of threads that take tasks. Threads at higher indexes exit.
+  std::atomic<int> num_threads_;
+  // Number of threads asked for at start, which the auto scaler doesn't go below.
+  int min_threads_;
+  int max_threads_;
+  bool auto_scale_;
+
+  // Memcached waits as of the last MemcachedOverloaded() call, and the lowest
+  // average wait over an interval. Only used by the auto scaler.
+  uint64_t last_memcached_waits_;
+  uint64_t last_memcached_wait_us_;
+  uint64_t min_avg_memcached_wait_us_;
+
+  // Number of tasks submitted and not yet complete, whether queued or running.
+  std::atomic<uint32_t> num_pending_;
+
+  // Number of tasks of every priority waiting in the queues. May briefly count a
+  // task that was just taken.
+  std::atomic<uint32_t> num_queued_[NUM_TASK_PRIORITIES];
+
+  // Number of tasks of every priority running, and the limit on it (0 for none).
+  std::atomic<int> num_running_[NUM_TASK_PRIORITIES];
+  int max_running_[NUM_TASK_PRIORITIES];
+
+  // Idle threads park on 'park_cv_'. A submitter only takes 'park_mutex_' to
+  // wake one up if 'num_parked_' says any are parked.
+  std::mutex park_mutex_;
+  std::condition_variable park_cv_;
+  std::atomic<int> num_parked_;
 
   std::mutex metrics_mutex_;
   std::condition_variable tasks_completed_cv_;
 
+  int metrics_interval_ms_;
+  std::thread metrics_thread_;
+  std::thread auto_scale_thread_;
+  // Protects 'stop_background_threads_'. 'background_cv_' is signalled when it's
+  // set.
+  std::mutex background_mutex_;
+  std::condition_variable background_cv_;
+  bool stop_background_threads_;
+
   // Back pointer to the owning Dumper class.
   Dumper* dumper_;
 
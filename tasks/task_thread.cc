@@ -21,6 +21,8 @@
 #include "common/logger.h"
 #include "tasks/task.h"
 #include "tasks/task_scheduler.h"
+#include "utils/memcache_utils.h"
+#include "utils/numa_topology.h"
 #include "utils/socket.h"
 
 #include <unistd.h>
@@ -29,14 +31,17 @@
 
 namespace memcachedumper {
 
-TaskThread::TaskThread(TaskScheduler *task_scheduler, const std::string& thread_name)
+TaskThread::TaskThread(TaskScheduler *task_scheduler, const std::string& thread_name,
+    int thread_idx)
   : task_scheduler_(task_scheduler),
     thread_name_(thread_name),
-    thread_(&TaskThread::WorkerLoop, this),
+    thread_idx_(thread_idx),
     num_keys_processed_(0),
     num_keys_ignored_(0),
     num_keys_missing_(0),
-    num_keys_filtered_(0) {
+    num_keys_filtered_(0),
+    num_keys_unchanged_(0),
+    thread_(&TaskThread::WorkerLoop, this) {
 }
 
 TaskThread::~TaskThread() {
@@ -47,23 +52,44 @@ MemoryManager* TaskThread::mem_mgr() {
   return task_scheduler_->mem_mgr();
 }
 
-bool TaskThread::ShuttingDown() {
-  return task_scheduler_->AllTasksComplete();
+MemoryManager* TaskThread::staging_mem_mgr() {
+  return task_scheduler_->staging_mem_mgr();
+}
+
+MemoryManager* TaskThread::compression_mem_mgr() {
+  return task_scheduler_->compression_mem_mgr();
+}
+
+void TaskThread::Restart() {
+  if (thread_.joinable()) thread_.join();
+  thread_ = std::thread(&TaskThread::WorkerLoop, this);
 }
 
 Task* TaskThread::WaitForNextTask() {
-  return task_scheduler_->WaitForNextTask();
+  return task_scheduler_->WaitForNextTask(thread_idx_);
 }
 
 void TaskThread::WorkerLoop() {
-  while (!ShuttingDown()) {
+  NumaTopology* numa = MemcachedUtils::GetNumaTopology();
+  if (numa != nullptr) {
+    // Not fatal; the thread is only slower for running elsewhere.
+    Status s = numa->PinTaskThread(thread_idx_);
+    if (!s.ok()) {
+      LOG_ERROR("Could not pin {0} to its CPUs. (Status: {1})", thread_name_, s.ToString());
+    }
+  }
+  task_scheduler_->RegisterTaskThread(thread_idx_);
+  while (true) {
     Task *task = WaitForNextTask();
 
-    if (task != nullptr) {
-      task->set_owning_thread(this);
-      task->Execute();
-      task_scheduler_->MarkTaskComplete(task);
+    if (task == nullptr) {
+      // All tasks are complete, or this thread was retired.
+      if (task_scheduler_->ThreadExiting(thread_idx_)) break;
+      continue;
     }
+    task->set_owning_thread(this);
+    task->Execute();
+    task_scheduler_->MarkTaskComplete(task);
   }
 
   // TODO: There's a race here, the main thread can complete before this thread completes.
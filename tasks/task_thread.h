@@ -21,6 +21,7 @@
 #include "dumper/dumper.h"
 #include "tasks/task_scheduler.h"
 
+#include <atomic>
 #include <string>
 #include <thread>
 #include <iostream>
@@ -36,7 +37,8 @@ class TaskScheduler;
 
 class TaskThread {
  public:
-  TaskThread(TaskScheduler *task_scheduler_, const std::string& thread_name);
+  TaskThread(TaskScheduler *task_scheduler_, const std::string& thread_name,
+      int thread_idx);
   ~TaskThread();
 
   TaskScheduler *task_scheduler() { return task_scheduler_; }
@@ -44,45 +46,65 @@ class TaskThread {
   std::string thread_name() { return thread_name_; }
 
   MemoryManager *mem_mgr();
+  // Memory manager for staging buffers of asynchronous writes. 'nullptr' if
+  // they're not enabled.
+  MemoryManager *staging_mem_mgr();
+  // Memory manager for the buffers that data files are compressed in. 'nullptr'
+  // if they aren't compressed.
+  MemoryManager *compression_mem_mgr();
 
   int Init();
 
   void Join();
 
+  // Starts the thread again after it exited on being retired by the scheduler.
+  void Restart();
+
+  // Only the thread itself updates its counters, so they need no read-modify-write.
+  // Others may read them at any time (see TaskScheduler::UpdateMetrics()).
   inline void account_keys_processed(uint64_t num_keys) {
-    num_keys_processed_ += num_keys;
+    AddToCounter(&num_keys_processed_, num_keys);
   }
-  inline void increment_keys_ignored() { num_keys_ignored_++; }
-  inline void increment_keys_filtered() { num_keys_filtered_++; }
+  inline void increment_keys_ignored() { AddToCounter(&num_keys_ignored_, 1); }
+  inline void increment_keys_filtered() { AddToCounter(&num_keys_filtered_, 1); }
+  inline void increment_keys_unchanged() { AddToCounter(&num_keys_unchanged_, 1); }
   inline void account_keys_missing(uint64_t num_keys) {
-    num_keys_missing_ += num_keys;
+    AddToCounter(&num_keys_missing_, num_keys);
   }
 
-  uint64_t num_keys_processed() { return num_keys_processed_; }
-  uint64_t num_keys_ignored() { return num_keys_ignored_; }
-  uint64_t num_keys_missing() { return num_keys_missing_; }
-  uint64_t num_keys_filtered() { return num_keys_filtered_; }
+  uint64_t num_keys_processed() { return num_keys_processed_.load(std::memory_order_relaxed); }
+  uint64_t num_keys_ignored() { return num_keys_ignored_.load(std::memory_order_relaxed); }
+  uint64_t num_keys_missing() { return num_keys_missing_.load(std::memory_order_relaxed); }
+  uint64_t num_keys_filtered() { return num_keys_filtered_.load(std::memory_order_relaxed); }
+  uint64_t num_keys_unchanged() { return num_keys_unchanged_.load(std::memory_order_relaxed); }
 
  private:
 
+  static void AddToCounter(std::atomic<uint64_t>* counter, uint64_t n) {
+    counter->store(counter->load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
   void WorkerLoop();
 
   Task* WaitForNextTask();
 
-  bool ShuttingDown();
-
   // Back pointer to owning TaskScheduler.
   TaskScheduler *task_scheduler_;
 
   // Name of thread.
   std::string thread_name_;
 
-  std::thread thread_;
+  // Index of the thread's work queue in the TaskScheduler.
+  int thread_idx_;
+
+  std::atomic<uint64_t> num_keys_processed_;
+  std::atomic<uint64_t> num_keys_ignored_;
+  std::atomic<uint64_t> num_keys_missing_;
+  std::atomic<uint64_t> num_keys_filtered_;
+  std::atomic<uint64_t> num_keys_unchanged_;
 
-  uint64_t num_keys_processed_;
-  uint64_t num_keys_ignored_;
-  uint64_t num_keys_missing_;
-  uint64_t num_keys_filtered_;
+  // Started last, once everything it uses is initialized.
+  std::thread thread_;
 
 };
 
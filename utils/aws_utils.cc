@@ -16,15 +16,22 @@
  *
  */
 
+#include "common/logger.h"
 #include "utils/aws_utils.h"
+#include "utils/file_finisher.h"
+#include "utils/key_index.h"
 #include "utils/memcache_utils.h"
 #include "utils/metrics.h"
 #include "utils/net_util.h"
+#include "utils/sqs_notifier.h"
 
 #include <rapidjson/document.h>
 #include <rapidjson/stringbuffer.h>
 #include <rapidjson/writer.h>
 
+#include <string.h>
+
+#include <future>
 #include <iostream>
 #include <sstream>
 
@@ -32,6 +39,8 @@
 #include <aws/sqs/model/CreateQueueResult.h>
 #include <aws/sqs/model/GetQueueUrlRequest.h>
 #include <aws/sqs/model/GetQueueUrlResult.h>
+#include <aws/sqs/model/SendMessageRequest.h>
+#include <aws/sqs/model/SendMessageResult.h>
 
 namespace memcachedumper {
 
@@ -42,6 +51,7 @@ std::string AwsUtils::sqs_queue_name_;
 std::string AwsUtils::sqs_url_;
 Aws::S3::S3Client* AwsUtils::s3_client_;
 Aws::SQS::SQSClient* AwsUtils::sqs_client_;
+SQSNotifier* AwsUtils::sqs_notifier_ = nullptr;
 
 void AwsUtils::SetS3Bucket(std::string s3_bucket) {
   AwsUtils::s3_bucket_ = s3_bucket;
@@ -65,6 +75,10 @@ void AwsUtils::SetSQSQueueName(std::string sqs_queue) {
   AwsUtils::sqs_queue_name_ = sqs_queue;
 }
 
+void AwsUtils::SetSQSNotifier(SQSNotifier* sqs_notifier) {
+  AwsUtils::sqs_notifier_ = sqs_notifier;
+}
+
 Status AwsUtils::GetSQSUrlFromName(std::string& queue_name, std::string* out_url) {
   Aws::SQS::Model::GetQueueUrlRequest gqu_req;
   gqu_req.SetQueueName(queue_name);
@@ -90,6 +104,80 @@ Status AwsUtils::CreateNewSQSQueue(std::string& queue_name, std::string* out_url
   return Status::OK();
 }
 
+std::string AwsUtils::FileChecksumMetadata(const std::string& checksum_hex) {
+  return std::string(Checksum::TypeName(MemcachedUtils::GetChecksumType())) + ":" +
+      checksum_hex;
+}
+
+std::string AwsUtils::S3KeyForFile(const std::string& filename) {
+  // The path is only optional when not uploading to S3.
+  if (AwsUtils::s3_path_.empty()) return MemcachedUtils::GetReqId() + "/" + filename;
+  return AwsUtils::s3_path_ + "/" + MemcachedUtils::GetReqId() + "/" + filename;
+}
+
+Status AwsUtils::SendSQSNotification(std::string& s3_file_uri,
+    std::shared_ptr<FinishGroup> group, std::function<void()> on_notified) {
+  // Other storage sinks may go without notifications.
+  if (AwsUtils::sqs_url_.empty()) {
+    if (on_notified) on_notified();
+    return Status::OK();
+  }
+
+  std::string msg_body;
+  RETURN_ON_ERROR(AwsUtils::SQSBodyForS3(s3_file_uri, &msg_body));
+
+  if (AwsUtils::sqs_notifier_ != nullptr) {
+    if (group || on_notified) {
+      // The group stays open until the notification is sent.
+      if (group) group->JobAdded();
+      AwsUtils::sqs_notifier_->Notify(msg_body,
+          [s3_file_uri, group, on_notified](Status status) {
+            if (status.ok() && on_notified) on_notified();
+            if (group) {
+              group->JobDone(status);
+            } else if (!status.ok()) {
+              // A journaled file is left to a resumed run, but the dump must
+              // not be marked DONE without its notification.
+              LOG_ERROR("Could not send SQS notification for {0}. (Status: {1})",
+                  s3_file_uri, status.ToString());
+              MemcachedUtils::RecordFileError(status);
+            }
+          });
+      return Status::OK();
+    }
+    std::promise<Status> sent;
+    std::future<Status> sent_status = sent.get_future();
+    AwsUtils::sqs_notifier_->Notify(msg_body,
+        [&sent](Status status) { sent.set_value(status); });
+    return sent_status.get();
+  }
+
+  Aws::SQS::Model::SendMessageRequest sm_req;
+  sm_req.SetQueueUrl(AwsUtils::sqs_url_);
+  sm_req.SetMessageBody(msg_body);
+
+  auto sm_out = AwsUtils::sqs_client_->SendMessage(sm_req);
+  if (!sm_out.IsSuccess()) {
+    return Status::NetworkError("Error sending SQS message to : " + AwsUtils::sqs_url_,
+        sm_out.GetError().GetMessage());
+  }
+  LOG("Successfully sent SQS message to {0} for {1}", AwsUtils::sqs_url_, s3_file_uri);
+  if (on_notified) on_notified();
+  return Status::OK();
+}
+
+const char* AwsUtils::FileTypeForUri(const std::string& s3_file_uri) {
+  std::string filename = s3_file_uri.substr(s3_file_uri.rfind('/') + 1);
+  size_t suffix_len = strlen(KEY_INDEX_FILE_SUFFIX);
+  if (filename.size() >= suffix_len &&
+      filename.compare(filename.size() - suffix_len, suffix_len, KEY_INDEX_FILE_SUFFIX) == 0) {
+    return "KEY_INDEX";
+  }
+  if (filename.rfind(MemcachedUtils::TombstoneFilePrefix(), 0) == 0) return "TOMBSTONES";
+  if (filename.rfind(MemcachedUtils::DictFilePrefix(), 0) == 0) return "DICTIONARY";
+  return "DATA";
+}
+
 Status AwsUtils::SQSBodyForS3(std::string& s3_file_uri, std::string* out_sqs_body) {
   using namespace rapidjson;
 
@@ -115,7 +203,22 @@ Status AwsUtils::SQSBodyForS3(std::string& s3_file_uri, std::string* out_sqs_bod
   root.AddMember("uri", req_id_val, allocator);
 
   root.AddMember("keysCount", DumpMetrics::total_metadump_keys(), allocator);
+  // Only "DATA" files hold records to load.
+  root.AddMember("fileType", StringRef(AwsUtils::FileTypeForUri(s3_file_uri)), allocator);
   root.AddMember("dumpFormat", "BINARY", allocator);
+  root.AddMember("dumpFormatVersion", MemcachedUtils::DumpFormatVersion(), allocator);
+  root.AddMember("dumpType",
+      StringRef(MemcachedUtils::IsDeltaDump() ? "DELTA" : "FULL"), allocator);
+  // The algorithm of the checksum suffixed to the file name.
+  root.AddMember("checksumType",
+      StringRef(Checksum::TypeName(MemcachedUtils::GetChecksumType())), allocator);
+  // The codec that data files are compressed with, if any.
+  root.AddMember("compression",
+      StringRef(Compressor::TypeName(MemcachedUtils::GetCompressionType())), allocator);
+  root.AddMember("recordCompression",
+      StringRef(MemcachedUtils::RecordCompression() ? "ZSTD_DICT" : "NONE"), allocator);
+  // Whether records may refer to an earlier record's value.
+  root.AddMember("valueDedup", MemcachedUtils::ValueDedup(), allocator);
 
   rapidjson::StringBuffer strbuf;
   rapidjson::Writer<rapidjson::StringBuffer> writer(strbuf);
@@ -20,13 +20,25 @@
 
 #include "utils/status.h"
 
+#include <functional>
+#include <memory>
 #include <string>
 
 #include <aws/s3/S3Client.h>
 #include <aws/sqs/SQSClient.h>
 
+// Key of the S3 object metadata that holds the same JSON as the SQS notification.
+#define CACHE_DUMP_CHUNK_JSON "cacheDumpChunk"
+
+// Key of the S3 object metadata that holds the checksum of the uploaded file, as
+// "<type>:<hex digest>" (see AwsUtils::FileChecksumMetadata()).
+#define FILE_CHECKSUM_METADATA "fileChecksum"
+
 namespace memcachedumper {
 
+class FinishGroup;
+class SQSNotifier;
+
 class AwsUtils {
  public:
   static void SetS3Bucket(std::string s3_bucket);
@@ -43,13 +55,40 @@ class AwsUtils {
   static Aws::S3::S3Client* GetS3Client() { return AwsUtils::s3_client_; }
   static Aws::SQS::SQSClient* GetSQSClient() { return AwsUtils::sqs_client_; }
 
+  // Batches SQS notifications through 'sqs_notifier' from here on. Not owned; it
+  // must outlive every notification sent, or be unset first.
+  static void SetSQSNotifier(SQSNotifier* sqs_notifier);
+  // 'nullptr' if notifications aren't batched.
+  static SQSNotifier* GetSQSNotifier() { return AwsUtils::sqs_notifier_; }
+
   static Status GetSQSUrlFromName(std::string& queue_name, std::string* out_url);
   static Status CreateNewSQSQueue(std::string& queue_name, std::string* out_url);
 
   // Returns a JSON string in 'out_sqs_body' with the following format:
-  // {"reqId":'123',"host":'127.0.0.1',"uri":'s3://bucket/file',"keysCount":0,"dumpFormat":'BINARY'}
+  // {"reqId":'123',"host":'127.0.0.1',"uri":'s3://bucket/file',"keysCount":0,
+  //  "fileType":'DATA',"dumpFormat":'BINARY',"dumpType":'FULL'}
   static Status SQSBodyForS3(std::string& s3_file_uri, std::string* out_sqs_body);
 
+  // Returns the kind of file at 's3_file_uri', going by its name: "DATA",
+  // "KEY_INDEX", "TOMBSTONES" or "DICTIONARY".
+  static const char* FileTypeForUri(const std::string& s3_file_uri);
+
+  // Returns the value of FILE_CHECKSUM_METADATA for a file whose checksum of the
+  // configured type (see MemcachedUtils::GetChecksumType()) is 'checksum_hex'.
+  static std::string FileChecksumMetadata(const std::string& checksum_hex);
+
+  // Returns the key that the file named 'filename' is uploaded to in the S3 bucket.
+  static std::string S3KeyForFile(const std::string& filename);
+
+  // Sends the SQS notification for the file uploaded to 's3_file_uri'.
+  //
+  // If notifications are batched, the notification is only queued when 'group'
+  // or 'on_notified' is given, and accounted to 'group' until it is sent.
+  // Otherwise, waits for it to be sent. 'on_notified' is called once it's sent.
+  static Status SendSQSNotification(std::string& s3_file_uri,
+      std::shared_ptr<FinishGroup> group = nullptr,
+      std::function<void()> on_notified = nullptr);
+
  private:
   static std::string s3_bucket_;
   static std::string s3_path_;
@@ -57,6 +96,7 @@ class AwsUtils {
   static std::string sqs_url_;
   static Aws::S3::S3Client* s3_client_;
   static Aws::SQS::SQSClient* sqs_client_;
+  static SQSNotifier* sqs_notifier_;
 };
 
 } // namespace memcachedumper
@@ -0,0 +1,225 @@
+/**
+ *
+ *  Copyright 2021 Netflix, Inc.
+ *
+ *     Licensed under the Apache License, Version 2.0 (the "License");
+ *     you may not use this file except in compliance with the License.
+ *     You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *     Unless required by applicable law or agreed to in writing, software
+ *     distributed under the License is distributed on an "AS IS" BASIS,
+ *     WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *     See the License for the specific language governing permissions and
+ *     limitations under the License.
+ *
+ */
+
+#include "common/logger.h"
+#include "utils/base_dump_index.h"
+#include "utils/file_util.h"
+#include "utils/memcache_utils.h"
+
+#include <stdlib.h>
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <experimental/filesystem>
+#include <fstream>
+#include <functional>
+
+// Flush tombstone records to the output file once we've gathered this many bytes.
+#define TOMBSTONE_FLUSH_BYTES (1024 * 1024)
+
+namespace fs = std::experimental::filesystem;
+namespace memcachedumper {
+
+BaseDumpIndex::BaseDumpIndex(std::string base_keyfile_dir)
+  : base_keyfile_dir_(base_keyfile_dir) {
+}
+
+bool BaseDumpIndex::ParseKeyLine(const std::string& line,
+    std::string_view* encoded_key, uint64_t* cas, int32_t* expiry) {
+  // Lines are of the format:
+  // key=<key> exp=<exp> la=<la> cas=<cas> fetch=<yes|no> cls=<cls> size=<size>
+  // Dumped keys files only have the 'key', 'exp' and 'cas' fields.
+  if (line.compare(0, 4, "key=") != 0) return false;
+
+  size_t key_end = line.find(' ', 4);
+  size_t exp_pos = line.find("exp=", 4);
+  size_t cas_pos = line.find("cas=", 4);
+  if (key_end == std::string::npos || exp_pos == std::string::npos ||
+      cas_pos == std::string::npos) {
+    return false;
+  }
+
+  *encoded_key = std::string_view(line.data() + 4, key_end - 4);
+  *expiry = strtol(line.c_str() + exp_pos + 4, nullptr, 10);
+  *cas = strtoull(line.c_str() + cas_pos + 4, nullptr, 10);
+  return true;
+}
+
+Status BaseDumpIndex::Init() {
+  if (!fs::is_directory(base_keyfile_dir_)) {
+    return Status::InvalidArgument("Base key file directory not found", base_keyfile_dir_);
+  }
+
+  LOG("Loading base dump index from: {0}", base_keyfile_dir_);
+  std::hash<std::string_view> hasher;
+  bool have_keyfiles = false;
+  bool have_dumped_keys = false;
+  for (auto& file : fs::directory_iterator(base_keyfile_dir_)) {
+    std::string filename = file.path().filename();
+    if (filename.rfind("key_", 0) == 0) have_keyfiles = true;
+    if (filename.rfind(DUMPED_KEYS_FILE_PREFIX "key_", 0) != 0) continue;
+    have_dumped_keys = true;
+
+    std::ifstream keyfile(file.path());
+    std::string line;
+    while (std::getline(keyfile, line)) {
+      std::string_view encoded_key;
+      uint64_t cas;
+      int32_t expiry;
+      if (!ParseKeyLine(line, &encoded_key, &cas, &expiry)) continue;
+
+      entries_.push_back({hasher(encoded_key), keys_.length(),
+          static_cast<uint32_t>(encoded_key.length()), expiry, cas});
+      keys_.append(encoded_key);
+    }
+  }
+
+  // Indexing the key files instead would skip keys that are in neither dump.
+  if (have_keyfiles && !have_dumped_keys) {
+    return Status::InvalidArgument(
+        "Base dump doesn't list the keys it dumped. Take a full dump to use as a base",
+        base_keyfile_dir_);
+  }
+
+  std::sort(entries_.begin(), entries_.end(),
+      [](const Entry& a, const Entry& b) { return a.key_hash < b.key_hash; });
+
+  LOG("Loaded {0} keys ({1} MB) into the base dump index.", entries_.size(),
+      (entries_.size() * sizeof(Entry) + keys_.length()) / 1024 / 1024);
+  return Status::OK();
+}
+
+void BaseDumpIndex::AppendDumpedKey(std::string_view encoded_key, uint64_t cas,
+    int32_t expiry, std::string* out) {
+  out->append("key=");
+  out->append(encoded_key);
+  out->append(" exp=");
+  out->append(std::to_string(expiry));
+  out->append(" cas=");
+  out->append(std::to_string(cas));
+  out->push_back('\n');
+}
+
+Status BaseDumpIndex::WriteDumpedKeys(const std::string& keyfile_path,
+    const std::string& dumped_keys, const std::unordered_set<std::string>& missing_keys) {
+  fs::path path(keyfile_path);
+  std::string dumped_keys_path =
+      (path.parent_path() / (DUMPED_KEYS_FILE_PREFIX + path.filename().string())).string();
+
+  // Rewritten from scratch if the key file is redone on resume.
+  std::ofstream out(dumped_keys_path, std::ofstream::trunc);
+  if (!out.is_open()) return Status::IOError("Could not open " + dumped_keys_path);
+
+  if (missing_keys.empty()) {
+    out.write(dumped_keys.data(), dumped_keys.length());
+  } else {
+    size_t line_begin = 0;
+    while (line_begin < dumped_keys.length()) {
+      size_t line_end = dumped_keys.find('\n', line_begin) + 1;
+      // Lines begin with "key=<key> ".
+      size_t key_end = dumped_keys.find(' ', line_begin);
+      std::string key = MemcachedUtils::UrlDecode(
+          dumped_keys.substr(line_begin + 4, key_end - line_begin - 4));
+      if (missing_keys.find(key) == missing_keys.end()) {
+        out.write(dumped_keys.data() + line_begin, line_end - line_begin);
+      }
+      line_begin = line_end;
+    }
+  }
+
+  out.close();
+  if (out.fail()) return Status::IOError("Could not write " + dumped_keys_path);
+  return Status::OK();
+}
+
+int64_t BaseDumpIndex::Find(std::string_view encoded_key) const {
+  uint64_t key_hash = std::hash<std::string_view>()(encoded_key);
+  auto it = std::lower_bound(entries_.begin(), entries_.end(), key_hash,
+      [](const Entry& e, uint64_t h) { return e.key_hash < h; });
+  // Colliding keys are next to each other.
+  for (; it != entries_.end() && it->key_hash == key_hash; ++it) {
+    if (std::string_view(keys_.data() + it->key_offset, it->key_len) == encoded_key) {
+      return it - entries_.begin();
+    }
+  }
+  return -1;
+}
+
+bool BaseDumpIndex::Unchanged(std::string_view encoded_key, uint64_t cas,
+    int32_t expiry) const {
+  int64_t idx = Find(encoded_key);
+  if (idx < 0) return false;
+  return entries_[idx].cas == cas && entries_[idx].expiry == expiry;
+}
+
+Status BaseDumpIndex::WriteTombstones(const std::string& new_keyfile_dir,
+    RotatingFile* out, uint64_t* n_tombstones) {
+  *n_tombstones = 0;
+
+  // Mark every base key whose value the new dump holds once applied. Its key files
+  // also list keys that went missing on get, which must be tombstoned.
+  std::vector<bool> seen(entries_.size(), false);
+  for (auto& file : fs::directory_iterator(new_keyfile_dir)) {
+    std::string filename = file.path().filename();
+    if (filename.rfind(DUMPED_KEYS_FILE_PREFIX "key_", 0) != 0) continue;
+
+    std::ifstream keyfile(file.path());
+    std::string line;
+    while (std::getline(keyfile, line)) {
+      std::string_view encoded_key;
+      uint64_t cas;
+      int32_t expiry;
+      if (!ParseKeyLine(line, &encoded_key, &cas, &expiry)) continue;
+
+      int64_t idx = Find(encoded_key);
+      if (idx >= 0) seen[idx] = true;
+    }
+  }
+
+  // Everything left unseen was deleted, evicted or has expired since the base dump.
+  std::string records;
+  records.reserve(TOMBSTONE_FLUSH_BYTES);
+  for (size_t idx = 0; idx < entries_.size(); ++idx) {
+    if (seen[idx]) continue;
+
+    // <keylen (2-bytes)> <key>
+    const Entry& entry = entries_[idx];
+    std::string key = MemcachedUtils::UrlDecode(keys_.substr(entry.key_offset, entry.key_len));
+    records.append(MemcachedUtils::ConvertIntToBytes(key.length(), 2));
+    records.append(key);
+    ++(*n_tombstones);
+
+    if (records.length() >= TOMBSTONE_FLUSH_BYTES) {
+      struct iovec iov = { const_cast<char*>(records.data()), records.length() };
+      ssize_t nwritten;
+      RETURN_ON_ERROR(out->WriteV(&iov, 1, &nwritten));
+      records.clear();
+    }
+  }
+
+  if (!records.empty()) {
+    struct iovec iov = { const_cast<char*>(records.data()), records.length() };
+    ssize_t nwritten;
+    RETURN_ON_ERROR(out->WriteV(&iov, 1, &nwritten));
+  }
+
+  LOG("Found {0} tombstones against the base dump.", *n_tombstones);
+  return Status::OK();
+}
+
+} // namespace memcachedumper
@@ -0,0 +1,110 @@
+/**
+ *
+ *  Copyright 2021 Netflix, Inc.
+ *
+ *     Licensed under the Apache License, Version 2.0 (the "License");
+ *     you may not use this file except in compliance with the License.
+ *     You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *     Unless required by applicable law or agreed to in writing, software
+ *     distributed under the License is distributed on an "AS IS" BASIS,
+ *     WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *     See the License for the specific language governing permissions and
+ *     limitations under the License.
+ *
+ */
+
+#pragma once
+
+#include "utils/status.h"
+
+#include <stdint.h>
+
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+// Prefix of the files next to every key file, that list the keys whose values
+// were dumped from it (or, for a delta, were unchanged since its base). Key files
+// also list keys that were filtered out, had expired or went missing, so only
+// these are indexed as the base of a delta.
+#define DUMPED_KEYS_FILE_PREFIX "dumped_"
+
+namespace memcachedumper {
+
+class RotatingFile;
+
+/// The 'BaseDumpIndex' holds the (key, cas, expiry) of every key whose value a
+/// previous dump wrote, as read from that dump's dumped keys files. It's used for
+/// incremental dumps, where we only fetch keys that are new or have changed since
+/// the base dump, and emit a list of tombstones for keys that have since gone away.
+///
+/// Keys are kept in their URL encoded form (as they appear in a metadump), back
+/// to back in a single buffer, and looked up by a 64-bit hash. Keys are compared
+/// on a hash match, so colliding keys are told apart.
+class BaseDumpIndex {
+ public:
+  BaseDumpIndex(std::string base_keyfile_dir);
+
+  // Loads the index from the dumped keys files under 'base_keyfile_dir_'. Returns
+  // an error if the base dump has key files but no dumped keys files.
+  Status Init();
+
+  // Appends the line for a key whose value is being dumped to 'out', the
+  // contents of a dumped keys file.
+  static void AppendDumpedKey(std::string_view encoded_key, uint64_t cas,
+      int32_t expiry, std::string* out);
+
+  // Writes the dumped keys file of the key file at 'keyfile_path', with the lines
+  // in 'dumped_keys' except for those of 'missing_keys' (URL decoded), whose
+  // values weren't there after all.
+  static Status WriteDumpedKeys(const std::string& keyfile_path,
+      const std::string& dumped_keys, const std::unordered_set<std::string>& missing_keys);
+
+  // Returns 'true' if 'encoded_key' was present in the base dump with the same
+  // 'cas' and 'expiry', i.e. it does not need to be dumped again.
+  // Thread-safe once Init() has returned.
+  bool Unchanged(std::string_view encoded_key, uint64_t cas, int32_t expiry) const;
+
+  // Finds every key in the base dump that is absent from the dumped keys files
+  // under 'new_keyfile_dir' and writes it to 'out' as a tombstone record. The number of
+  // tombstones written is returned in 'n_tombstones'.
+  // Not thread-safe. Must be called only once all key files have been dumped.
+  Status WriteTombstones(const std::string& new_keyfile_dir, RotatingFile* out,
+      uint64_t* n_tombstones);
+
+  size_t num_keys() { return entries_.size(); }
+
+ private:
+  struct Entry {
+    uint64_t key_hash;
+    // Position of the key in 'keys_'.
+    uint64_t key_offset;
+    uint32_t key_len;
+    int32_t expiry;
+    uint64_t cas;
+  };
+
+  // Returns the index of the entry for 'encoded_key' in 'entries_', or -1 if it
+  // isn't present.
+  int64_t Find(std::string_view encoded_key) const;
+
+  // Parses a single metadump or dumped keys line into its URL encoded key, 'cas'
+  // and expiry. Returns 'false' if 'line' isn't a key line (eg. "END").
+  static bool ParseKeyLine(const std::string& line, std::string_view* encoded_key,
+      uint64_t* cas, int32_t* expiry);
+
+  // Path to the key files of the base dump.
+  std::string base_keyfile_dir_;
+
+  // Index entries sorted by 'key_hash'.
+  std::vector<Entry> entries_;
+
+  // The URL encoded keys of 'entries_', back to back.
+  std::string keys_;
+};
+
+} // namespace memcachedumper
@@ -0,0 +1,167 @@
+/**
+ *
+ *  Copyright 2021 Netflix, Inc.
+ *
+ *     Licensed under the Apache License, Version 2.0 (the "License");
+ *     you may not use this file except in compliance with the License.
+ *     You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *     Unless required by applicable law or agreed to in writing, software
+ *     distributed under the License is distributed on an "AS IS" BASIS,
+ *     WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *     See the License for the specific language governing permissions and
+ *     limitations under the License.
+ *
+ */
+
+#include "utils/block_format.h"
+#include "utils/checksum.h"
+#include "utils/key_index.h"
+
+#include <string.h>
+
+namespace memcachedumper {
+
+namespace {
+
+// Appends the low 'nbytes' bytes of 'val' to 'out' in big-endian order.
+void AppendBE(uint64_t val, int nbytes, std::string* out) {
+  for (int i = nbytes - 1; i >= 0; --i) {
+    out->push_back(static_cast<char>((val >> (i * 8)) & 0xFF));
+  }
+}
+
+// Returns the key of the record whose header is 'header'.
+std::string RecordKey(const struct iovec& header) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(header.iov_base);
+  size_t keylen = (static_cast<size_t>(bytes[0]) << 8) | bytes[1];
+  return std::string(reinterpret_cast<const char*>(bytes + 2), keylen);
+}
+
+} // anonymous namespace
+
+BlockWriter::BlockWriter(RotatingFile* file, uint8_t flags)
+  : file_(file),
+    flags_(flags),
+    block_(new char[V1_BLOCK_SIZE]),
+    block_len_(0),
+    block_records_(0),
+    file_offset_(0) {
+  file_->set_format_hooks(this);
+}
+
+Status BlockWriter::AppendRecords(struct iovec* iovecs, int n_iovecs) {
+  for (int i = 0; i + 1 < n_iovecs; i += 2) {
+    size_t record_len = iovecs[i].iov_len + iovecs[i + 1].iov_len;
+
+    if (block_len_ + record_len > V1_BLOCK_SIZE) {
+      RETURN_ON_ERROR(Flush());
+    }
+
+    // Too large to ever fit in a block; write it straight from 'iovecs'.
+    if (record_len > V1_BLOCK_SIZE) {
+      std::vector<uint64_t> key_hashes;
+      if (file_->key_index_enabled()) {
+        key_hashes.push_back(KeyIndex::HashRecordKey(iovecs[i]));
+      }
+      RETURN_ON_ERROR(WriteBlock(&iovecs[i], 2, 1, RecordKey(iovecs[i]), key_hashes));
+      continue;
+    }
+
+    if (block_records_ == 0) block_first_key_ = RecordKey(iovecs[i]);
+    if (file_->key_index_enabled()) {
+      block_key_hashes_.push_back(KeyIndex::HashRecordKey(iovecs[i]));
+    }
+    memcpy(block_.get() + block_len_, iovecs[i].iov_base, iovecs[i].iov_len);
+    block_len_ += iovecs[i].iov_len;
+    memcpy(block_.get() + block_len_, iovecs[i + 1].iov_base, iovecs[i + 1].iov_len);
+    block_len_ += iovecs[i + 1].iov_len;
+    ++block_records_;
+  }
+  return Status::OK();
+}
+
+Status BlockWriter::Flush() {
+  if (block_records_ == 0) return Status::OK();
+
+  struct iovec payload;
+  payload.iov_base = block_.get();
+  payload.iov_len = block_len_;
+  RETURN_ON_ERROR(WriteBlock(&payload, 1, block_records_, block_first_key_,
+      block_key_hashes_));
+
+  block_len_ = 0;
+  block_records_ = 0;
+  block_key_hashes_.clear();
+  return Status::OK();
+}
+
+Status BlockWriter::WriteBlock(struct iovec* payload, int n_payload,
+    uint32_t num_records, const std::string& first_key,
+    const std::vector<uint64_t>& key_hashes) {
+  uint32_t payload_len = 0;
+  uint32_t crc = 0;
+  for (int i = 0; i < n_payload; ++i) {
+    payload_len += payload[i].iov_len;
+    crc = Crc32cExtend(crc, payload[i].iov_base, payload[i].iov_len);
+  }
+
+  std::string header;
+  AppendBE(payload_len, 4, &header);
+  AppendBE(num_records, 4, &header);
+  AppendBE(crc, 4, &header);
+
+  struct iovec iovecs[3];
+  iovecs[0].iov_base = &header[0];
+  iovecs[0].iov_len = header.size();
+  for (int i = 0; i < n_payload; ++i) {
+    iovecs[i + 1] = payload[i];
+  }
+
+  // Account for the block before writing it, since the write may rotate the
+  // file, which finishes the index with this block and starts a new one.
+  // Keys are indexed by the offset of their block, since a reader has to check
+  // the whole block's CRC anyway.
+  index_.push_back({file_offset_, first_key});
+  for (uint64_t key_hash : key_hashes) {
+    file_->IndexKey(key_hash, file_offset_);
+  }
+  file_offset_ += header.size() + payload_len;
+
+  ssize_t nwritten = 0;
+  return file_->WriteV(iovecs, n_payload + 1, &nwritten);
+}
+
+Status BlockWriter::FileHeader(std::string* out) {
+  out->append(V1_FILE_MAGIC);
+  AppendBE(V1_FORMAT_VERSION, 1, out);
+  AppendBE(flags_, 1, out);
+  AppendBE(0, 2, out);
+  AppendBE(V1_BLOCK_SIZE, 4, out);
+
+  index_.clear();
+  file_offset_ = out->size();
+  return Status::OK();
+}
+
+Status BlockWriter::FileFooter(std::string* out) {
+  uint64_t index_offset = file_offset_;
+  for (const IndexEntry& entry : index_) {
+    AppendBE(entry.offset, 8, out);
+    AppendBE(entry.first_key.length(), 2, out);
+    out->append(entry.first_key);
+  }
+  uint32_t index_crc = Crc32cExtend(0, out->data(), out->size());
+
+  AppendBE(index_offset, 8, out);
+  AppendBE(index_.size(), 4, out);
+  AppendBE(index_crc, 4, out);
+  out->append(V1_FILE_MAGIC);
+
+  file_offset_ += out->size();
+  return Status::OK();
+}
+
+} // namespace memcachedumper
@@ -0,0 +1,104 @@
+/**
+ *
+ *  Copyright 2021 Netflix, Inc.
+ *
+ *     Licensed under the Apache License, Version 2.0 (the "License");
+ *     you may not use this file except in compliance with the License.
+ *     You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *     Unless required by applicable law or agreed to in writing, software
+ *     distributed under the License is distributed on an "AS IS" BASIS,
+ *     WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *     See the License for the specific language governing permissions and
+ *     limitations under the License.
+ *
+ */
+
+#pragma once
+
+#include "utils/file_util.h"
+#include "utils/status.h"
+
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// See docs/dump-format-V1.md.
+#define V1_FILE_MAGIC "MCDV"
+#define V1_FORMAT_VERSION 1
+// <magic (4-bytes)> <version (1-byte)> <flags (1-byte)> <reserved (2-bytes)>
+// <block size (4-bytes)>
+#define V1_FILE_HEADER_LEN 12
+// <payload len (4-bytes)> <record count (4-bytes)> <crc32c of payload (4-bytes)>
+#define V1_BLOCK_HEADER_LEN 12
+// <index offset (8-bytes)> <block count (4-bytes)> <crc32c of index (4-bytes)>
+// <magic (4-bytes)>
+#define V1_TRAILER_LEN 20
+
+// Records are packed into blocks of up to this many bytes. A record larger than
+// this gets a block of its own.
+#define V1_BLOCK_SIZE (64 * 1024)
+
+// Flags in the file header.
+// Records have the extra header fields of record compression.
+#define V1_FLAG_RECORD_COMPRESSION 0x1
+
+namespace memcachedumper {
+
+/// Writes records to a RotatingFile in the V1 dump format: every file starts
+/// with a header, holds its records in CRC-checked blocks, and ends with an
+/// index of its blocks, so that readers can split a file across threads.
+///
+/// Records are copied into a block buffer, so the caller may reuse the memory
+/// they point to once AppendRecords() returns.
+class BlockWriter : public FileFormatHooks {
+ public:
+  // 'file' must not have been Init()ed yet.
+  BlockWriter(RotatingFile* file, uint8_t flags);
+
+  // Adds the records in 'iovecs'. Each record is a pair of iovecs: its header
+  // (as encoded by MemcachedUtils::EncodeRecordHeader()) and its value.
+  Status AppendRecords(struct iovec* iovecs, int n_iovecs);
+
+  // Writes out the block being filled, if any. Must be called before finishing
+  // the file.
+  Status Flush();
+
+  Status FileHeader(std::string* out) override;
+  Status FileFooter(std::string* out) override;
+
+ private:
+  // Writes a block of 'num_records' records in 'payload', starting with the one
+  // with key 'first_key'. If the file has a key index, 'key_hashes' has the hash
+  // of every record's key.
+  Status WriteBlock(struct iovec* payload, int n_payload, uint32_t num_records,
+      const std::string& first_key, const std::vector<uint64_t>& key_hashes);
+
+  RotatingFile* file_;
+  uint8_t flags_;
+
+  // The block being filled.
+  std::unique_ptr<char[]> block_;
+  size_t block_len_;
+  uint32_t block_records_;
+  std::string block_first_key_;
+  // Hashes of the keys in the block, if the file has a key index.
+  std::vector<uint64_t> block_key_hashes_;
+
+  // Number of bytes written to the current file.
+  uint64_t file_offset_;
+
+  // Offset and first key of every block in the current file.
+  struct IndexEntry {
+    uint64_t offset;
+    std::string first_key;
+  };
+  std::vector<IndexEntry> index_;
+};
+
+} // namespace memcachedumper
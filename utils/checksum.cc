@@ -0,0 +1,288 @@
+/**
+ *
+ *  Copyright 2021 Netflix, Inc.
+ *
+ *     Licensed under the Apache License, Version 2.0 (the "License");
+ *     you may not use this file except in compliance with the License.
+ *     You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *     Unless required by applicable law or agreed to in writing, software
+ *     distributed under the License is distributed on an "AS IS" BASIS,
+ *     WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *     See the License for the specific language governing permissions and
+ *     limitations under the License.
+ *
+ */
+
+#include "utils/checksum.h"
+
+#include <openssl/evp.h>
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+#ifdef HAVE_XXHASH
+#define XXH_INLINE_ALL
+#include <xxhash.h>
+#endif
+
+#include <string.h>
+
+#include <fstream>
+#include <vector>
+
+namespace memcachedumper {
+
+namespace {
+
+// Appends the 'nbytes' low order bytes of 'val' to 'out' as upper case hex, most
+// significant first.
+void AppendHex(uint64_t val, int nbytes, std::string* out) {
+  for (int i = nbytes * 2 - 1; i >= 0; --i) {
+    out->push_back("0123456789ABCDEF"[(val >> (i * 4)) & 0xF]);
+  }
+}
+
+class MD5Checksum : public Checksum {
+ public:
+  MD5Checksum() : ctx_(EVP_MD_CTX_new()) {}
+  ~MD5Checksum() override { EVP_MD_CTX_free(ctx_); }
+
+  Status Reset() override {
+    if (ctx_ == nullptr || EVP_DigestInit_ex(ctx_, EVP_md5(), nullptr) != 1) {
+      return Status::IOError("EVP_DigestInit_ex failed");
+    }
+    return Status::OK();
+  }
+
+  Status Update(const void* data, size_t len) override {
+    if (EVP_DigestUpdate(ctx_, data, len) != 1) {
+      return Status::IOError("EVP_DigestUpdate failed");
+    }
+    return Status::OK();
+  }
+
+  Status Final(std::string* out_hex) override {
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int digest_len = 0;
+    if (EVP_DigestFinal_ex(ctx_, digest, &digest_len) != 1) {
+      return Status::IOError("EVP_DigestFinal_ex failed");
+    }
+
+    out_hex->clear();
+    for (unsigned int i = 0; i < digest_len; ++i) {
+      AppendHex(digest[i], 1, out_hex);
+    }
+    return Status::OK();
+  }
+
+ private:
+  EVP_MD_CTX* ctx_;
+};
+
+// Software CRC32C (Castagnoli), one byte at a time. Only used if the CPU lacks
+// a CRC32 instruction.
+class Crc32cTable {
+ public:
+  Crc32cTable() {
+    for (uint32_t i = 0; i < 256; ++i) {
+      uint32_t crc = i;
+      for (int j = 0; j < 8; ++j) {
+        crc = (crc >> 1) ^ ((crc & 1) ? 0x82F63B78 : 0);
+      }
+      table_[i] = crc;
+    }
+  }
+
+  uint32_t Extend(uint32_t crc, const uint8_t* data, size_t len) const {
+    for (size_t i = 0; i < len; ++i) {
+      crc = table_[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+  }
+
+ private:
+  uint32_t table_[256];
+};
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+uint32_t Crc32cHardware(uint32_t crc, const uint8_t* data, size_t len) {
+  uint64_t crc64 = crc;
+  while (len >= 8) {
+    uint64_t word;
+    memcpy(&word, data, 8);
+    crc64 = _mm_crc32_u64(crc64, word);
+    data += 8;
+    len -= 8;
+  }
+  crc = static_cast<uint32_t>(crc64);
+  while (len > 0) {
+    crc = _mm_crc32_u8(crc, *data++);
+    --len;
+  }
+  return crc;
+}
+
+bool HaveHardwareCrc32c() { return __builtin_cpu_supports("sse4.2"); }
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+uint32_t Crc32cHardware(uint32_t crc, const uint8_t* data, size_t len) {
+  while (len >= 8) {
+    uint64_t word;
+    memcpy(&word, data, 8);
+    crc = __crc32cd(crc, word);
+    data += 8;
+    len -= 8;
+  }
+  while (len > 0) {
+    crc = __crc32cb(crc, *data++);
+    --len;
+  }
+  return crc;
+}
+
+bool HaveHardwareCrc32c() { return true; }
+#else
+uint32_t Crc32cHardware(uint32_t crc, const uint8_t* data, size_t len) { return crc; }
+
+bool HaveHardwareCrc32c() { return false; }
+#endif
+
+const Crc32cTable crc32c_table;
+
+class Crc32cChecksum : public Checksum {
+ public:
+  Crc32cChecksum() : hardware_(HaveHardwareCrc32c()), crc_(0) {}
+
+  Status Reset() override {
+    crc_ = 0xFFFFFFFF;
+    return Status::OK();
+  }
+
+  Status Update(const void* data, size_t len) override {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    crc_ = hardware_ ? Crc32cHardware(crc_, bytes, len) : crc32c_table.Extend(crc_, bytes, len);
+    return Status::OK();
+  }
+
+  Status Final(std::string* out_hex) override {
+    out_hex->clear();
+    AppendHex(crc_ ^ 0xFFFFFFFF, 4, out_hex);
+    return Status::OK();
+  }
+
+ private:
+  const bool hardware_;
+  uint32_t crc_;
+};
+
+#ifdef HAVE_XXHASH
+class Xxh3Checksum : public Checksum {
+ public:
+  Xxh3Checksum() : state_(XXH3_createState()) {}
+  ~Xxh3Checksum() { XXH3_freeState(state_); }
+
+  Status Reset() override {
+    if (state_ == nullptr || XXH3_64bits_reset(state_) != XXH_OK) {
+      return Status::IOError("XXH3_64bits_reset failed");
+    }
+    return Status::OK();
+  }
+
+  Status Update(const void* data, size_t len) override {
+    if (XXH3_64bits_update(state_, data, len) != XXH_OK) {
+      return Status::IOError("XXH3_64bits_update failed");
+    }
+    return Status::OK();
+  }
+
+  Status Final(std::string* out_hex) override {
+    out_hex->clear();
+    AppendHex(XXH3_64bits_digest(state_), 8, out_hex);
+    return Status::OK();
+  }
+
+ private:
+  XXH3_state_t* state_;
+};
+#endif
+
+} // anonymous namespace
+
+uint32_t Crc32cExtend(uint32_t crc, const void* data, size_t len) {
+  static const bool hardware = HaveHardwareCrc32c();
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  crc ^= 0xFFFFFFFF;
+  crc = hardware ? Crc32cHardware(crc, bytes, len) : crc32c_table.Extend(crc, bytes, len);
+  return crc ^ 0xFFFFFFFF;
+}
+
+Status Checksum::Create(ChecksumType type, std::unique_ptr<Checksum>* out) {
+  switch (type) {
+    case ChecksumType::MD5:
+      out->reset(new MD5Checksum());
+      break;
+    case ChecksumType::CRC32C:
+      out->reset(new Crc32cChecksum());
+      break;
+    case ChecksumType::XXH3:
+#ifdef HAVE_XXHASH
+      out->reset(new Xxh3Checksum());
+      break;
+#else
+      return Status::NotSupported("Not built with xxHash support");
+#endif
+  }
+  return (*out)->Reset();
+}
+
+Status Checksum::ParseType(const std::string& name, ChecksumType* out_type) {
+  if (name == "md5") {
+    *out_type = ChecksumType::MD5;
+  } else if (name == "crc32c") {
+    *out_type = ChecksumType::CRC32C;
+  } else if (name == "xxh3") {
+    *out_type = ChecksumType::XXH3;
+  } else {
+    return Status::InvalidArgument("Unknown checksum type", name);
+  }
+  return Status::OK();
+}
+
+const char* Checksum::TypeName(ChecksumType type) {
+  switch (type) {
+    case ChecksumType::MD5: return "MD5";
+    case ChecksumType::CRC32C: return "CRC32C";
+    case ChecksumType::XXH3: return "XXH3";
+  }
+  return "UNKNOWN";
+}
+
+bool Checksum::Supported(ChecksumType type) {
+#ifndef HAVE_XXHASH
+  if (type == ChecksumType::XXH3) return false;
+#endif
+  return true;
+}
+
+Status Checksum::OfFile(ChecksumType type, const std::string& path,
+    std::string* out_hex) {
+  std::unique_ptr<Checksum> checksum;
+  RETURN_ON_ERROR(Create(type, &checksum));
+
+  std::ifstream in(path, std::ios_base::in | std::ios_base::binary);
+  if (!in.is_open()) return Status::IOError("Could not open " + path);
+  std::vector<char> buf(1024 * 1024);
+  while (in.read(buf.data(), buf.size()) || in.gcount() > 0) {
+    RETURN_ON_ERROR(checksum->Update(buf.data(), in.gcount()));
+  }
+  if (in.bad()) return Status::IOError("Could not read " + path);
+  return checksum->Final(out_hex);
+}
+
+} // namespace memcachedumper
@@ -0,0 +1,74 @@
+/**
+ *
+ *  Copyright 2021 Netflix, Inc.
+ *
+ *     Licensed under the Apache License, Version 2.0 (the "License");
+ *     you may not use this file except in compliance with the License.
+ *     You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *     Unless required by applicable law or agreed to in writing, software
+ *     distributed under the License is distributed on an "AS IS" BASIS,
+ *     WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *     See the License for the specific language governing permissions and
+ *     limitations under the License.
+ *
+ */
+
+#pragma once
+
+#include "utils/status.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+
+namespace memcachedumper {
+
+// The checksums that data files can be named with.
+enum class ChecksumType {
+  MD5,
+  CRC32C,
+  XXH3
+};
+
+/// Interface for a running checksum over a file's contents. The final digest
+/// is suffixed to the file's name as upper case hex.
+class Checksum {
+ public:
+  virtual ~Checksum() = default;
+
+  // Creates a checksum of type 'type' in 'out'. Returns an error if 'type' isn't
+  // supported by this build.
+  static Status Create(ChecksumType type, std::unique_ptr<Checksum>* out);
+
+  // Parses a checksum name as used in the configuration ("md5", "crc32c", "xxh3").
+  static Status ParseType(const std::string& name, ChecksumType* out_type);
+
+  // Returns the name of 'type' as it appears in the dump's metadata.
+  static const char* TypeName(ChecksumType type);
+
+  // Returns 'true' if this build can compute checksums of type 'type'.
+  static bool Supported(ChecksumType type);
+
+  // Returns in 'out_hex' the checksum of type 'type' of the file at 'path'.
+  static Status OfFile(ChecksumType type, const std::string& path, std::string* out_hex);
+
+  // (Re)starts the checksum from scratch.
+  virtual Status Reset() = 0;
+
+  virtual Status Update(const void* data, size_t len) = 0;
+
+  // Returns the digest of everything passed to Update() since the last Reset()
+  // in 'out_hex'.
+  virtual Status Final(std::string* out_hex) = 0;
+};
+
+// Extends the CRC32C 'crc' of some data with 'len' more bytes of 'data'. Pass 0
+// as 'crc' to start a new one.
+uint32_t Crc32cExtend(uint32_t crc, const void* data, size_t len);
+
+} // namespace memcachedumper
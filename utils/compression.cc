@@ -0,0 +1,302 @@
+/**
+ *
+ *  Copyright 2021 Netflix, Inc.
+ *
+ *     Licensed under the Apache License, Version 2.0 (the "License");
+ *     you may not use this file except in compliance with the License.
+ *     You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *     Unless required by applicable law or agreed to in writing, software
+ *     distributed under the License is distributed on an "AS IS" BASIS,
+ *     WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *     See the License for the specific language governing permissions and
+ *     limitations under the License.
+ *
+ */
+
+#include "utils/compression.h"
+#include "utils/file_finisher.h"
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef HAVE_LZ4
+#include <lz4frame.h>
+#endif
+
+#include <assert.h>
+#include <string.h>
+
+#include <algorithm>
+
+namespace memcachedumper {
+
+namespace {
+
+// Appends 'val' to 'out' as 'nbytes' little endian bytes.
+void AppendLE(uint64_t val, int nbytes, std::string* out) {
+  for (int i = 0; i < nbytes; ++i) {
+    out->push_back(static_cast<char>((val >> (i * 8)) & 0xFF));
+  }
+}
+
+#ifdef HAVE_ZSTD
+class ZstdCompressor : public Compressor {
+ public:
+  ZstdCompressor(int level) : level_(level), cctx_(ZSTD_createCCtx()) {}
+  ~ZstdCompressor() { ZSTD_freeCCtx(cctx_); }
+
+  CompressionType type() override { return CompressionType::ZSTD; }
+
+  size_t MaxCompressedLen(size_t len) override { return ZSTD_compressBound(len); }
+
+  Status CompressBlock(const uint8_t* src, size_t src_len, uint8_t* dst,
+      size_t dst_cap, size_t* out_len) override {
+    if (cctx_ == nullptr) return Status::OutOfMemoryError("ZSTD_createCCtx failed");
+    size_t ret = ZSTD_compressCCtx(cctx_, dst, dst_cap, src, src_len, level_);
+    if (ZSTD_isError(ret)) {
+      return Status::IOError("ZSTD_compressCCtx failed", ZSTD_getErrorName(ret));
+    }
+    *out_len = ret;
+    return Status::OK();
+  }
+
+ private:
+  int level_;
+  ZSTD_CCtx* cctx_;
+};
+#endif
+
+#ifdef HAVE_LZ4
+class Lz4Compressor : public Compressor {
+ public:
+  Lz4Compressor(int level) {
+    memset(&prefs_, 0, sizeof(prefs_));
+    prefs_.frameInfo.blockSizeID = LZ4F_max4MB;
+    prefs_.compressionLevel = level;
+  }
+
+  CompressionType type() override { return CompressionType::LZ4; }
+
+  size_t MaxCompressedLen(size_t len) override {
+    return LZ4F_compressFrameBound(len, &prefs_);
+  }
+
+  Status CompressBlock(const uint8_t* src, size_t src_len, uint8_t* dst,
+      size_t dst_cap, size_t* out_len) override {
+    // Record the block's size in its frame header.
+    prefs_.frameInfo.contentSize = src_len;
+    size_t ret = LZ4F_compressFrame(dst, dst_cap, src, src_len, &prefs_);
+    if (LZ4F_isError(ret)) {
+      return Status::IOError("LZ4F_compressFrame failed", LZ4F_getErrorName(ret));
+    }
+    *out_len = ret;
+    return Status::OK();
+  }
+
+ private:
+  LZ4F_preferences_t prefs_;
+};
+#endif
+
+} // anonymous namespace
+
+Status Compressor::Create(CompressionType type, int level,
+    std::unique_ptr<Compressor>* out) {
+  switch (type) {
+    case CompressionType::NONE:
+      return Status::InvalidArgument("No compressor for compression type NONE");
+    case CompressionType::ZSTD:
+#ifdef HAVE_ZSTD
+      out->reset(new ZstdCompressor(level));
+      break;
+#else
+      return Status::NotSupported("Not built with zstd support");
+#endif
+    case CompressionType::LZ4:
+#ifdef HAVE_LZ4
+      out->reset(new Lz4Compressor(level));
+      break;
+#else
+      return Status::NotSupported("Not built with LZ4 support");
+#endif
+  }
+  return Status::OK();
+}
+
+Status Compressor::ParseType(const std::string& name, CompressionType* out_type) {
+  if (name == "none") {
+    *out_type = CompressionType::NONE;
+  } else if (name == "zstd") {
+    *out_type = CompressionType::ZSTD;
+  } else if (name == "lz4") {
+    *out_type = CompressionType::LZ4;
+  } else {
+    return Status::InvalidArgument("Unknown compression type", name);
+  }
+  return Status::OK();
+}
+
+const char* Compressor::TypeName(CompressionType type) {
+  switch (type) {
+    case CompressionType::NONE: return "NONE";
+    case CompressionType::ZSTD: return "ZSTD";
+    case CompressionType::LZ4: return "LZ4";
+  }
+  return "UNKNOWN";
+}
+
+const char* Compressor::FileExtension(CompressionType type) {
+  switch (type) {
+    case CompressionType::NONE: return "";
+    case CompressionType::ZSTD: return ".zst";
+    case CompressionType::LZ4: return ".lz4";
+  }
+  return "";
+}
+
+bool Compressor::Supported(CompressionType type) {
+#ifndef HAVE_ZSTD
+  if (type == CompressionType::ZSTD) return false;
+#endif
+#ifndef HAVE_LZ4
+  if (type == CompressionType::LZ4) return false;
+#endif
+  return true;
+}
+
+CompressedFileBuilder::CompressedFileBuilder(CompressionType type, int level,
+    const std::vector<uint8_t*>& buffers, size_t buffer_size, FileFinisher* pool,
+    EmitFn emit)
+  : type_(type),
+    level_(level),
+    buffer_size_(buffer_size),
+    pool_(pool),
+    emit_(std::move(emit)),
+    cur_slot_(0),
+    nemitted_(0),
+    uncompressed_size_(0) {
+  for (uint8_t* buf : buffers) {
+    std::unique_ptr<Slot> slot(new Slot());
+    slot->block = buf;
+    slot->block_len = 0;
+    slot->frame = buf + COMPRESSION_BLOCK_SIZE;
+    slot->frame_len = 0;
+    slot->in_flight = false;
+    slots_.push_back(std::move(slot));
+  }
+}
+
+CompressedFileBuilder::~CompressedFileBuilder() {
+  for (auto& slot : slots_) {
+    if (slot->in_flight) slot->compressed_status.wait();
+  }
+}
+
+Status CompressedFileBuilder::Init() {
+  if (slots_.empty()) return Status::InvalidArgument("No buffers to compress blocks in");
+  for (auto& slot : slots_) {
+    RETURN_ON_ERROR(Compressor::Create(type_, level_, &slot->compressor));
+    if (buffer_size_ < COMPRESSION_BLOCK_SIZE +
+        slot->compressor->MaxCompressedLen(COMPRESSION_BLOCK_SIZE)) {
+      return Status::InvalidArgument("Buffers are too small for a block and its frame");
+    }
+  }
+  return Status::OK();
+}
+
+Status CompressedFileBuilder::Append(const uint8_t* data, size_t len) {
+  while (len > 0) {
+    Slot* slot = slots_[cur_slot_].get();
+    size_t n_copy = std::min(len, COMPRESSION_BLOCK_SIZE - slot->block_len);
+    memcpy(slot->block + slot->block_len, data, n_copy);
+    slot->block_len += n_copy;
+    data += n_copy;
+    len -= n_copy;
+
+    if (slot->block_len == COMPRESSION_BLOCK_SIZE) RETURN_ON_ERROR(SubmitBlock());
+  }
+  return Status::OK();
+}
+
+Status CompressedFileBuilder::SubmitBlock() {
+  Slot* slot = slots_[cur_slot_].get();
+  slot->in_flight = true;
+  slot->compressed = std::promise<Status>();
+  slot->compressed_status = slot->compressed.get_future();
+  size_t frame_cap = buffer_size_ - COMPRESSION_BLOCK_SIZE;
+  auto compress = [slot, frame_cap]() {
+    slot->compressed.set_value(slot->compressor->CompressBlock(slot->block,
+        slot->block_len, slot->frame, frame_cap, &slot->frame_len));
+    // The writer gets the outcome through 'compressed_status'.
+    return Status::OK();
+  };
+  if (pool_ != nullptr) {
+    pool_->Submit(compress, nullptr);
+  } else {
+    compress();
+  }
+
+  // The next block goes where the oldest one in flight was.
+  cur_slot_ = (cur_slot_ + 1) % slots_.size();
+  Slot* next = slots_[cur_slot_].get();
+  if (next->in_flight) return EmitFrame(next);
+  return Status::OK();
+}
+
+Status CompressedFileBuilder::EmitFrame(Slot* slot) {
+  Status s = slot->compressed_status.get();
+  slot->in_flight = false;
+  RETURN_ON_ERROR(s);
+  RETURN_ON_ERROR(emit_(slot->frame, slot->frame_len));
+
+  frame_offsets_.push_back(nemitted_);
+  nemitted_ += slot->frame_len;
+  uncompressed_size_ += slot->block_len;
+  slot->block_len = 0;
+  return Status::OK();
+}
+
+Status CompressedFileBuilder::Finish() {
+  if (slots_[cur_slot_]->block_len > 0) RETURN_ON_ERROR(SubmitBlock());
+  // The slots after the current one were handed off oldest first.
+  for (size_t i = 0; i < slots_.size(); ++i) {
+    Slot* slot = slots_[(cur_slot_ + i) % slots_.size()].get();
+    if (slot->in_flight) RETURN_ON_ERROR(EmitFrame(slot));
+  }
+
+  // The footer: a skippable frame that indexes the blocks and ends with a fixed
+  // size trailer, so that a reader can find it from the end of the file. All
+  // little endian.
+  std::string payload;
+  payload.append(COMPRESSION_FOOTER_MAGIC);
+  AppendLE(COMPRESSION_FOOTER_VERSION, 1, &payload);
+  AppendLE(static_cast<uint64_t>(type_), 1, &payload);
+  AppendLE(0, 2, &payload);
+  AppendLE(COMPRESSION_BLOCK_SIZE, 4, &payload);
+  AppendLE(frame_offsets_.size(), 4, &payload);
+  AppendLE(uncompressed_size_, 8, &payload);
+  for (uint64_t offset : frame_offsets_) {
+    AppendLE(offset, 8, &payload);
+  }
+  size_t footer_len = 8 + payload.size() + COMPRESSION_TRAILER_LEN;
+  AppendLE(footer_len, 4, &payload);
+  AppendLE(frame_offsets_.size(), 4, &payload);
+  payload.append(COMPRESSION_FOOTER_MAGIC);
+
+  std::string footer;
+  AppendLE(COMPRESSION_FOOTER_FRAME_MAGIC, 4, &footer);
+  AppendLE(payload.size(), 4, &footer);
+  footer.append(payload);
+  assert(footer.size() == footer_len);
+
+  Status s = emit_(reinterpret_cast<const uint8_t*>(footer.data()), footer.size());
+  frame_offsets_.clear();
+  nemitted_ = 0;
+  uncompressed_size_ = 0;
+  return s;
+}
+
+} // namespace memcachedumper
@@ -0,0 +1,174 @@
+/**
+ *
+ *  Copyright 2021 Netflix, Inc.
+ *
+ *     Licensed under the Apache License, Version 2.0 (the "License");
+ *     you may not use this file except in compliance with the License.
+ *     You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *     Unless required by applicable law or agreed to in writing, software
+ *     distributed under the License is distributed on an "AS IS" BASIS,
+ *     WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *     See the License for the specific language governing permissions and
+ *     limitations under the License.
+ *
+ */
+
+#pragma once
+
+#include "utils/status.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Size of the independently decodable blocks that data files are compressed in.
+#define COMPRESSION_BLOCK_SIZE (4 * 1024 * 1024)
+
+// Magic number of the skippable frame at the end of a compressed data file that
+// holds its block index. zstd and LZ4 both skip frames with this magic.
+#define COMPRESSION_FOOTER_FRAME_MAGIC 0x184D2A5E
+#define COMPRESSION_FOOTER_MAGIC "MCDC"
+#define COMPRESSION_FOOTER_VERSION 2
+
+// Size of the trailer that ends the footer frame, and so the file:
+// <footer len (4-bytes)> <num blocks (4-bytes)> <magic "MCDC" (4-bytes)>
+#define COMPRESSION_TRAILER_LEN 12
+
+// Number of blocks of a file in flight at once: one being filled while the
+// others are compressed.
+#define COMPRESSION_BLOCKS_IN_FLIGHT 2
+
+// Size of the buffer each block in flight needs: room for the block followed by
+// its frame. Neither codec grows a block by anywhere near 64KB.
+#define COMPRESSION_BUFFER_SIZE (2 * COMPRESSION_BLOCK_SIZE + 64 * 1024)
+
+namespace memcachedumper {
+
+class FileFinisher;
+
+// The codecs that data files can be compressed with.
+enum class CompressionType {
+  NONE,
+  ZSTD,
+  LZ4
+};
+
+/// Interface for compressing data files one block at a time. Every block is
+/// written out as a separate zstd or LZ4 frame, so a compressed file can be
+/// read with the standard tools, or one block at a time using the index in its
+/// footer (see CompressedFileBuilder).
+class Compressor {
+ public:
+  virtual ~Compressor() = default;
+
+  // Creates a compressor of type 'type' in 'out'. A 'level' of 0 picks the
+  // codec's default. Returns an error if 'type' isn't supported by this build.
+  static Status Create(CompressionType type, int level, std::unique_ptr<Compressor>* out);
+
+  // Parses a compression name as used in the configuration ("none", "zstd", "lz4").
+  static Status ParseType(const std::string& name, CompressionType* out_type);
+
+  // Returns the name of 'type' as it appears in the dump's metadata.
+  static const char* TypeName(CompressionType type);
+
+  // Returns the extension that files compressed with 'type' are named with.
+  static const char* FileExtension(CompressionType type);
+
+  // Returns 'true' if this build can compress with 'type'.
+  static bool Supported(CompressionType type);
+
+  virtual CompressionType type() = 0;
+
+  // Returns the largest size that 'len' bytes can compress to.
+  virtual size_t MaxCompressedLen(size_t len) = 0;
+
+  // Compresses 'src_len' bytes of 'src' into a single frame in 'dst', which has
+  // room for 'dst_cap' bytes. Returns the size of the frame in 'out_len'.
+  virtual Status CompressBlock(const uint8_t* src, size_t src_len, uint8_t* dst,
+      size_t dst_cap, size_t* out_len) = 0;
+};
+
+/// Compresses a file as it is written: the data is cut into blocks of
+/// COMPRESSION_BLOCK_SIZE, and each block is handed off to be compressed into a
+/// frame as soon as it fills up. The frames are emitted in order, each once the
+/// buffer its block is in is needed again. Once the file is done, the footer
+/// indexing the frames follows.
+class CompressedFileBuilder {
+ public:
+  // Called with every frame and the footer, in file order, on the thread calling
+  // Append() or Finish().
+  using EmitFn = std::function<Status(const uint8_t* data, size_t len)>;
+
+  // Compresses with 'type' at 'level' (see Compressor::Create()), one block in
+  // flight per buffer in 'buffers', which are 'buffer_size' bytes each and must
+  // outlive this object. The blocks are compressed on 'pool' if given, and on the
+  // calling thread otherwise.
+  CompressedFileBuilder(CompressionType type, int level,
+      const std::vector<uint8_t*>& buffers, size_t buffer_size, FileFinisher* pool,
+      EmitFn emit);
+
+  // Waits for the blocks still being compressed, so that 'buffers' can go.
+  ~CompressedFileBuilder();
+
+  // Creates the compressors. Returns an error if the buffers can't hold a block
+  // and its frame.
+  Status Init();
+
+  CompressionType type() { return type_; }
+
+  // Adds 'len' bytes of 'data' to the file, handing off every block that fills
+  // up.
+  Status Append(const uint8_t* data, size_t len);
+
+  // Emits the frames of the blocks still in flight, including the last, partial
+  // one, and the footer. Starts over with a new file after.
+  Status Finish();
+
+ private:
+  // A block and its frame. Each has its own compressor, since blocks are
+  // compressed concurrently.
+  struct Slot {
+    std::unique_ptr<Compressor> compressor;
+    uint8_t* block;
+    size_t block_len;
+    uint8_t* frame;
+    size_t frame_len;
+    // Set from when the block is handed off until its frame is emitted.
+    bool in_flight;
+    std::promise<Status> compressed;
+    std::future<Status> compressed_status;
+  };
+
+  // Hands off the block being filled and moves on to the next slot, emitting
+  // the frame that was in it.
+  Status SubmitBlock();
+
+  // Waits for the block in 'slot' to be compressed and emits its frame.
+  Status EmitFrame(Slot* slot);
+
+  const CompressionType type_;
+  const int level_;
+  const size_t buffer_size_;
+  FileFinisher* pool_;
+  EmitFn emit_;
+
+  std::vector<std::unique_ptr<Slot>> slots_;
+  // The slot being filled. The ones after it were handed off in order.
+  size_t cur_slot_;
+
+  // Offsets of the frames emitted so far, and the number of bytes emitted.
+  std::vector<uint64_t> frame_offsets_;
+  uint64_t nemitted_;
+  // Number of bytes in the frames emitted so far, before compression.
+  uint64_t uncompressed_size_;
+};
+
+} // namespace memcachedumper
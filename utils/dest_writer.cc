@@ -0,0 +1,197 @@
+/**
+ *
+ *  Copyright 2021 Netflix, Inc.
+ *
+ *     Licensed under the Apache License, Version 2.0 (the "License");
+ *     you may not use this file except in compliance with the License.
+ *     You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *     Unless required by applicable law or agreed to in writing, software
+ *     distributed under the License is distributed on an "AS IS" BASIS,
+ *     WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *     See the License for the specific language governing permissions and
+ *     limitations under the License.
+ *
+ */
+
+#include "common/logger.h"
+#include "utils/dest_writer.h"
+#include "utils/memcache_utils.h"
+#include "utils/sockaddr.h"
+#include "utils/socket.h"
+
+#include <sys/uio.h>
+
+#include <charconv>
+
+// We send 3 iovecs per key: the command line, the value and the trailing "\r\n".
+// Keep every writev() within IOV_MAX.
+#define IOVECS_PER_SET 3
+#define MAX_SETS_PER_SEND (1024 / IOVECS_PER_SET)
+
+#define MC_VERSION_CMD "version\r\n"
+#define MC_VERSION_REPLY "VERSION "
+
+namespace memcachedumper {
+
+namespace {
+
+inline void AppendInt(std::string* str, int64_t val) {
+  char buf[24];
+  auto res = std::to_chars(buf, buf + sizeof(buf), val);
+  str->append(buf, res.ptr - buf);
+}
+
+} // anonymous namespace
+
+DestinationWriter::DestinationWriter(const std::vector<std::string>& targets)
+  : num_keys_sent_(0) {
+  targets_.resize(targets.size());
+  for (size_t i = 0; i < targets.size(); ++i) {
+    targets_[i].host_port = targets[i];
+    targets_[i].unacked = false;
+  }
+}
+
+DestinationWriter::~DestinationWriter() {
+  for (auto& target : targets_) {
+    if (target.sock) IGNORE_RET_VAL(target.sock->Close());
+  }
+}
+
+Status DestinationWriter::Init() {
+  for (auto& target : targets_) {
+    size_t colon_pos = target.host_port.rfind(':');
+    if (colon_pos == std::string::npos) {
+      return Status::InvalidArgument("Destination must be of the form IP:port",
+          target.host_port);
+    }
+
+    Sockaddr addr;
+    RETURN_ON_ERROR(addr.ResolveAndPopulateSockaddr(
+        target.host_port.substr(0, colon_pos),
+        std::stoi(target.host_port.substr(colon_pos + 1))));
+
+    target.sock.reset(new Socket());
+    RETURN_ON_ERROR(target.sock->Create());
+    // TODO: Make configurable if necessary.
+    RETURN_ON_ERROR(target.sock->SetRecvTimeout(2));
+    RETURN_ON_ERROR(target.sock->Connect(addr));
+  }
+  return Status::OK();
+}
+
+Status DestinationWriter::Queue(McData* mcdata) {
+  int32_t dest_idx = MemcachedUtils::DestIndexForKey(mcdata->key());
+  if (dest_idx < 0 || static_cast<size_t>(dest_idx) >= targets_.size()) {
+    return Status::InvalidArgument("Key does not map to a destination", mcdata->key());
+  }
+  Target& target = targets_[dest_idx];
+
+  // set <key> <flags> <exptime> <bytes> noreply\r\n
+  // Metadump reports an expiry of -1 for keys that never expire.
+  size_t header_offset = target.headers.length();
+  target.headers.append("set ");
+  target.headers.append(mcdata->key());
+  target.headers.push_back(' ');
+  AppendInt(&target.headers, mcdata->flags());
+  target.headers.push_back(' ');
+  AppendInt(&target.headers, mcdata->expiry() < 0 ? 0 : mcdata->expiry());
+  target.headers.push_back(' ');
+  AppendInt(&target.headers, mcdata->ValueLength());
+  target.headers.append(" noreply\r\n");
+
+  target.pending.push_back({header_offset, target.headers.length() - header_offset,
+      mcdata->Value(), mcdata->ValueLength()});
+  return Status::OK();
+}
+
+Status DestinationWriter::FlushTarget(Target* target) {
+  if (target->pending.empty()) return Status::OK();
+
+  struct iovec iovecs[MAX_SETS_PER_SEND * IOVECS_PER_SET];
+  size_t n_sets = 0;
+  int iovec_idx = 0;
+  for (auto& pending_set : target->pending) {
+    // Safe to point into 'headers' now since it won't grow until we're done here.
+    iovecs[iovec_idx].iov_base = &target->headers[pending_set.header_offset];
+    iovecs[iovec_idx].iov_len = pending_set.header_len;
+    iovecs[iovec_idx + 1].iov_base = const_cast<char*>(pending_set.value);
+    iovecs[iovec_idx + 1].iov_len = pending_set.value_len;
+    iovecs[iovec_idx + 2].iov_base = const_cast<char*>("\r\n");
+    iovecs[iovec_idx + 2].iov_len = 2;
+    iovec_idx += IOVECS_PER_SET;
+    ++n_sets;
+
+    if (n_sets == MAX_SETS_PER_SEND) {
+      RETURN_ON_ERROR(target->sock->SendV(iovecs, iovec_idx));
+      iovec_idx = 0;
+      n_sets = 0;
+    }
+  }
+  if (iovec_idx > 0) {
+    RETURN_ON_ERROR(target->sock->SendV(iovecs, iovec_idx));
+  }
+
+  num_keys_sent_ += target->pending.size();
+  target->unacked = true;
+  target->pending.clear();
+  target->headers.clear();
+  return Status::OK();
+}
+
+Status DestinationWriter::Flush() {
+  for (auto& target : targets_) {
+    Status s = FlushTarget(&target);
+    if (!s.ok()) {
+      return Status::NetworkError("Could not send to " + target.host_port, s.ToString());
+    }
+  }
+  return Status::OK();
+}
+
+Status DestinationWriter::AwaitTarget(Target* target) {
+  int32_t unused;
+  RETURN_ON_ERROR(target->sock->Send(
+      reinterpret_cast<const uint8_t*>(MC_VERSION_CMD), strlen(MC_VERSION_CMD), &unused));
+
+  // 'noreply' suppresses replies to our sets, so anything before the VERSION line
+  // is an error reported by the target.
+  std::string reply;
+  uint8_t buf[4096];
+  while (true) {
+    int32_t nread = 0;
+    RETURN_ON_ERROR(target->sock->Recv(buf, sizeof(buf), &nread));
+    reply.append(reinterpret_cast<char*>(buf), nread);
+
+    size_t version_pos = reply.find(MC_VERSION_REPLY);
+    if (version_pos != std::string::npos &&
+        reply.find("\r\n", version_pos) != std::string::npos) {
+      if (version_pos > 0) {
+        LOG_ERROR("Errors reported by destination {0}: {1}", target->host_port,
+            reply.substr(0, version_pos));
+      }
+      break;
+    }
+  }
+
+  target->unacked = false;
+  return Status::OK();
+}
+
+Status DestinationWriter::Finish() {
+  RETURN_ON_ERROR(Flush());
+  for (auto& target : targets_) {
+    if (!target.unacked) continue;
+    Status s = AwaitTarget(&target);
+    if (!s.ok()) {
+      return Status::NetworkError("Destination did not respond: " + target.host_port,
+          s.ToString());
+    }
+  }
+  return Status::OK();
+}
+
+} // namespace memcachedumper
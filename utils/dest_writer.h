@@ -0,0 +1,93 @@
+/**
+ *
+ *  Copyright 2021 Netflix, Inc.
+ *
+ *     Licensed under the Apache License, Version 2.0 (the "License");
+ *     you may not use this file except in compliance with the License.
+ *     You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *     Unless required by applicable law or agreed to in writing, software
+ *     distributed under the License is distributed on an "AS IS" BASIS,
+ *     WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *     See the License for the specific language governing permissions and
+ *     limitations under the License.
+ *
+ */
+
+#pragma once
+
+#include "utils/status.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace memcachedumper {
+
+class McData;
+class Socket;
+
+/// The 'DestinationWriter' streams dumped key/value pairs straight into the
+/// memcached instances of a destination replica, as pipelined 'set ... noreply'
+/// commands. Every key is routed to the target that it hashes to on the ketama
+/// ring of 'dest_ips' (see KeyFilter).
+///
+/// Not thread-safe. Each KeyValueWriter owns one, along with its own connection
+/// to every target.
+class DestinationWriter {
+ public:
+  // 'targets' are "IP:port" strings, in the same order as 'dest_ips'.
+  DestinationWriter(const std::vector<std::string>& targets);
+  ~DestinationWriter();
+
+  // Connects to all the targets.
+  Status Init();
+
+  // Queues a 'set' for 'mcdata' to the target its key hashes to.
+  // The value of 'mcdata' must remain valid until the next call to Flush().
+  Status Queue(McData* mcdata);
+
+  // Sends all the queued commands to their targets.
+  Status Flush();
+
+  // Flushes, and waits for every target to process all the commands we've sent it.
+  Status Finish();
+
+  uint64_t num_keys_sent() { return num_keys_sent_; }
+
+ private:
+  // A 'set' command waiting to be sent.
+  struct PendingSet {
+    // Position of the command line in 'Target::headers'.
+    size_t header_offset;
+    size_t header_len;
+    // The value to send along.
+    const char* value;
+    size_t value_len;
+  };
+
+  struct Target {
+    // "IP:port" of the target.
+    std::string host_port;
+    std::unique_ptr<Socket> sock;
+    // Command lines of the pending sets, back to back. Reused across flushes.
+    std::string headers;
+    std::vector<PendingSet> pending;
+    // 'true' if we've sent commands since the last call to Finish().
+    bool unacked;
+  };
+
+  Status FlushTarget(Target* target);
+
+  // Sends a no-op to 'target' and waits for its reply, so that we know it's
+  // processed everything sent before it.
+  Status AwaitTarget(Target* target);
+
+  std::vector<Target> targets_;
+
+  uint64_t num_keys_sent_;
+};
+
+} // namespace memcachedumper
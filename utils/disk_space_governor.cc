@@ -0,0 +1,117 @@
+/**
+ *
+ *  Copyright 2021 Netflix, Inc.
+ *
+ *     Licensed under the Apache License, Version 2.0 (the "License");
+ *     you may not use this file except in compliance with the License.
+ *     You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *     Unless required by applicable law or agreed to in writing, software
+ *     distributed under the License is distributed on an "AS IS" BASIS,
+ *     WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *     See the License for the specific language governing permissions and
+ *     limitations under the License.
+ *
+ */
+
+#include "utils/disk_space_governor.h"
+
+#include "common/logger.h"
+#include "utils/file_finisher.h"
+#include "utils/file_util.h"
+#include "utils/memcache_utils.h"
+#include "utils/output_volumes.h"
+
+#include <sys/stat.h>
+
+#include <string>
+#include <thread>
+#include <unordered_set>
+
+namespace memcachedumper {
+
+DiskSpaceGovernor::DiskSpaceGovernor(OutputVolumes* volumes, uint64_t low_watermark,
+    uint64_t critical_watermark)
+  : volumes_(volumes),
+    low_watermark_(low_watermark),
+    critical_watermark_(critical_watermark),
+    free_space_(0) {
+}
+
+uint64_t DiskSpaceGovernor::FreeSpace() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto now = std::chrono::steady_clock::now();
+  if (last_poll_.time_since_epoch().count() == 0 ||
+      now - last_poll_ >= std::chrono::milliseconds(DISK_SPACE_POLL_MS)) {
+    uint64_t free_space = 0;
+    std::unordered_set<dev_t> devices;
+    for (int i = 0; i < volumes_->size(); ++i) {
+      struct stat st;
+      // Volumes on the same filesystem share its free space.
+      if (stat(volumes_->dir_path(i).c_str(), &st) == 0 &&
+          !devices.insert(st.st_dev).second) {
+        continue;
+      }
+      free_space += FileUtils::GetSpaceAvailable(volumes_->dir_path(i));
+    }
+    free_space_ = free_space;
+    last_poll_ = now;
+  }
+  return free_space_;
+}
+
+bool DiskSpaceGovernor::Reclaiming() {
+  // Files are only deleted once they're uploaded.
+  if (MemcachedUtils::GetStorageSink() == nullptr) return false;
+
+  FileFinisher* finisher = MemcachedUtils::GetFileFinisher();
+  FileFinisher* uploader = MemcachedUtils::GetFileUploader();
+  return (uploader != nullptr && uploader->Busy()) ||
+      (finisher != nullptr && finisher->Busy());
+}
+
+Status DiskSpaceGovernor::WaitForSpace(uint64_t watermark) {
+  bool waited = false;
+  uint64_t free_space;
+  while ((free_space = FreeSpace()) < watermark) {
+    if (!Reclaiming()) {
+      if (free_space < critical_watermark_) {
+        return Status::IOError("Out of disk space with no uploads left to free any",
+            std::to_string(free_space / 1024 / 1024) + " MB free");
+      }
+      break;
+    }
+    if (!waited) {
+      LOG("Disk space low ({0} MB free). Waiting for uploads to free some up.",
+          free_space / 1024 / 1024);
+      waited = true;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(DISK_SPACE_POLL_MS));
+  }
+  if (waited) {
+    LOG("Done waiting for disk space ({0} MB free).", free_space / 1024 / 1024);
+  }
+  return Status::OK();
+}
+
+Status DiskSpaceGovernor::WaitToAdmitTask() {
+  return WaitForSpace(low_watermark_);
+}
+
+Status DiskSpaceGovernor::ThrottleWrite() {
+  uint64_t free_space = FreeSpace();
+  if (free_space >= low_watermark_) return Status::OK();
+
+  if (free_space >= critical_watermark_) {
+    // Give the uploads a head start on freeing space.
+    if (Reclaiming()) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(DISK_SPACE_THROTTLE_MS));
+    }
+    return Status::OK();
+  }
+  return WaitForSpace(critical_watermark_);
+}
+
+} // namespace memcachedumper
@@ -0,0 +1,84 @@
+/**
+ *
+ *  Copyright 2021 Netflix, Inc.
+ *
+ *     Licensed under the Apache License, Version 2.0 (the "License");
+ *     you may not use this file except in compliance with the License.
+ *     You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *     Unless required by applicable law or agreed to in writing, software
+ *     distributed under the License is distributed on an "AS IS" BASIS,
+ *     WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *     See the License for the specific language governing permissions and
+ *     limitations under the License.
+ *
+ */
+
+#pragma once
+
+#include "utils/status.h"
+
+#include <stdint.h>
+
+#include <chrono>
+#include <mutex>
+
+// How often we look at the free space on the output volumes, at most.
+#define DISK_SPACE_POLL_MS 100
+
+// How long writers back off for before every write while space is low.
+#define DISK_SPACE_THROTTLE_MS 10
+
+namespace memcachedumper {
+
+class OutputVolumes;
+
+/// Keeps a dump from running out of disk space while there's still a way to get
+/// some back. Only uploading a finished file to the storage sink frees space, as
+/// the file is deleted afterwards; compressing, fsyncing or renaming it doesn't.
+///
+/// Below 'low_watermark' bytes free across all the output filesystems, new key
+/// files aren't picked up and writers slow down, for as long as files are on
+/// their way to be uploaded. Below 'critical_watermark', writers stop until the
+/// uploads free up space, and fail right away if there's nothing left to upload.
+class DiskSpaceGovernor {
+ public:
+  DiskSpaceGovernor(OutputVolumes* volumes, uint64_t low_watermark,
+      uint64_t critical_watermark);
+
+  // Number of bytes free across all the filesystems the output volumes are on,
+  // as of at most DISK_SPACE_POLL_MS ago. Volumes on the same filesystem are
+  // only counted once.
+  uint64_t FreeSpace();
+
+  // Called before starting on a new key file. Waits while space is low.
+  Status WaitToAdmitTask();
+
+  // Called before every write of data files. Slows down the caller while space
+  // is low, and waits while it's critical.
+  Status ThrottleWrite();
+
+ private:
+  // Waits for as long as there are fewer than 'watermark' bytes free and uploads
+  // may still free some. Returns an error if there are fewer than
+  // 'critical_watermark_' bytes free and no uploads left to wait on.
+  Status WaitForSpace(uint64_t watermark);
+
+  // Returns 'true' if there are finished files that will be uploaded and
+  // deleted, either waiting on the uploader threads, or on the finisher threads
+  // which then hand them to the uploader.
+  static bool Reclaiming();
+
+  OutputVolumes* volumes_;
+  const uint64_t low_watermark_;
+  const uint64_t critical_watermark_;
+
+  std::mutex mutex_;
+  // Protected by 'mutex_'.
+  uint64_t free_space_;
+  std::chrono::steady_clock::time_point last_poll_;
+};
+
+} // namespace memcachedumper
@@ -0,0 +1,155 @@
+/**
+ *
+ *  Copyright 2021 Netflix, Inc.
+ *
+ *     Licensed under the Apache License, Version 2.0 (the "License");
+ *     you may not use this file except in compliance with the License.
+ *     You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *     Unless required by applicable law or agreed to in writing, software
+ *     distributed under the License is distributed on an "AS IS" BASIS,
+ *     WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *     See the License for the specific language governing permissions and
+ *     limitations under the License.
+ *
+ */
+
+#include "common/logger.h"
+#include "utils/file_finisher.h"
+#include "utils/file_util.h"
+
+namespace memcachedumper {
+
+FinishGroup::FinishGroup()
+  : pending_(1) {
+}
+
+void FinishGroup::JobAdded() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  ++pending_;
+}
+
+void FinishGroup::JobDone(const Status& status) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!status.ok() && first_error_.ok()) first_error_ = status;
+  }
+  Release();
+}
+
+void FinishGroup::Seal() {
+  Release();
+}
+
+void FinishGroup::Release() {
+  std::function<void(Status)> on_complete;
+  Status status;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (--pending_ > 0) return;
+    on_complete = on_complete_;
+    status = first_error_;
+  }
+  if (on_complete) on_complete(status);
+}
+
+FileFinisher::FileFinisher(int num_threads, size_t max_queued)
+  : num_threads_(num_threads),
+    max_queued_(max_queued),
+    num_running_(0),
+    shutting_down_(false) {
+}
+
+FileFinisher::~FileFinisher() {
+  {
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    shutting_down_ = true;
+  }
+  queue_cv_.notify_all();
+  for (auto& thread : threads_) {
+    if (thread.joinable()) thread.join();
+  }
+}
+
+void FileFinisher::Start() {
+  for (int i = 0; i < num_threads_; ++i) {
+    threads_.emplace_back(&FileFinisher::WorkerLoop, this);
+  }
+}
+
+void FileFinisher::Submit(std::function<Status()> job, std::shared_ptr<FinishGroup> group) {
+  if (group) group->JobAdded();
+
+  std::unique_lock<std::mutex> lock(queue_mutex_);
+  space_cv_.wait(lock, [this] { return queue_.size() < max_queued_; });
+  queue_.push({std::move(job), std::move(group)});
+  lock.unlock();
+  queue_cv_.notify_one();
+}
+
+void FileFinisher::WaitUntilIdle() {
+  std::unique_lock<std::mutex> lock(queue_mutex_);
+  space_cv_.wait(lock, [this] { return queue_.empty() && num_running_ == 0; });
+}
+
+bool FileFinisher::Busy() {
+  std::lock_guard<std::mutex> lock(queue_mutex_);
+  return !queue_.empty() || num_running_ > 0;
+}
+
+void FileFinisher::WorkerLoop() {
+  while (true) {
+    Job job;
+    {
+      std::unique_lock<std::mutex> lock(queue_mutex_);
+      queue_cv_.wait(lock, [this] { return shutting_down_ || !queue_.empty(); });
+      // Drain the queue before shutting down.
+      if (queue_.empty()) return;
+
+      job = std::move(queue_.front());
+      queue_.pop();
+      ++num_running_;
+    }
+    space_cv_.notify_all();
+
+    Status s = job.fn();
+    if (!s.ok()) {
+      LOG_ERROR("Could not finish file. (Status: {0})", s.ToString());
+    }
+    if (job.group) job.group->JobDone(s);
+
+    {
+      std::lock_guard<std::mutex> lock(queue_mutex_);
+      --num_running_;
+    }
+    space_cv_.notify_all();
+  }
+}
+
+Status FileFinisher::SyncDir(const std::string& dir_path) {
+  DirSyncState* state;
+  {
+    std::lock_guard<std::mutex> lock(dir_states_mutex_);
+    std::unique_ptr<DirSyncState>& entry = dir_states_[dir_path];
+    if (!entry) entry.reset(new DirSyncState());
+    state = entry.get();
+  }
+
+  // Callers have completed their rename before taking a ticket.
+  uint64_t my_ticket = ++state->next_ticket;
+
+  std::lock_guard<std::mutex> lock(state->mutex);
+  // Someone else's fsync() started after our rename; nothing more to do.
+  if (state->synced_upto_ticket >= my_ticket) return Status::OK();
+
+  // This fsync() covers everyone that has taken a ticket so far.
+  uint64_t covers_upto = state->next_ticket;
+
+  RETURN_ON_ERROR(FileUtils::FsyncDirectory(dir_path));
+  state->synced_upto_ticket = covers_upto;
+  return Status::OK();
+}
+
+} // namespace memcachedumper
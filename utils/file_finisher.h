@@ -0,0 +1,137 @@
+/**
+ *
+ *  Copyright 2021 Netflix, Inc.
+ *
+ *     Licensed under the Apache License, Version 2.0 (the "License");
+ *     you may not use this file except in compliance with the License.
+ *     You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *     Unless required by applicable law or agreed to in writing, software
+ *     distributed under the License is distributed on an "AS IS" BASIS,
+ *     WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *     See the License for the specific language governing permissions and
+ *     limitations under the License.
+ *
+ */
+
+#pragma once
+
+#include "utils/status.h"
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Max. number of files waiting to be finished before the writers block.
+#define FINISHER_MAX_QUEUED_FILES 32
+
+// Max. number of files waiting to be uploaded before the finisher threads block.
+#define UPLOADER_MAX_QUEUED_FILES 16
+
+// Max. number of blocks waiting to be compressed before the writers block.
+#define COMPRESSOR_MAX_QUEUED_BLOCKS 32
+
+namespace memcachedumper {
+
+/// Tracks a set of jobs submitted to the FileFinisher, and runs a callback once
+/// all of them are done and the group is sealed.
+class FinishGroup {
+ public:
+  FinishGroup();
+
+  // Called with the first error seen by any job (or OK) once every job in the
+  // group has run. Must be set before Seal().
+  void set_on_complete(std::function<void(Status)> on_complete) {
+    on_complete_ = on_complete;
+  }
+
+  // Indicates that no more jobs will be added to the group.
+  void Seal();
+
+  void JobAdded();
+  void JobDone(const Status& status);
+
+ private:
+  void Release();
+
+  std::mutex mutex_;
+  // Number of jobs yet to complete, plus one until the group is sealed.
+  int pending_;
+  Status first_error_;
+  std::function<void(Status)> on_complete_;
+};
+
+/// The 'FileFinisher' is a pool of threads that does the slow work of completing
+/// a data file (fsync, close, rename, S3 upload) off of the task threads.
+/// A second one uploads to S3 if there are upload threads, so that a slow S3
+/// doesn't hold up the local work, and a third one compresses the blocks of
+/// compressed data files (see CompressedFileBuilder).
+/// Submissions block only once 'max_queued' jobs are waiting, so that a slow disk
+/// or S3 eventually pushes back on the task threads.
+class FileFinisher {
+ public:
+  FileFinisher(int num_threads, size_t max_queued);
+  ~FileFinisher();
+
+  void Start();
+
+  // Queues 'job' to run on a finisher thread, and accounts it to 'group' if given.
+  void Submit(std::function<Status()> job, std::shared_ptr<FinishGroup> group);
+
+  // Waits until every job submitted so far has run.
+  void WaitUntilIdle();
+
+  // Returns 'true' if any job is queued or running.
+  bool Busy();
+
+  // fsync()s 'dir_path' to make a rename into it durable. Concurrent callers
+  // share a single fsync() where possible, so a burst of files completing
+  // together costs one directory fsync.
+  Status SyncDir(const std::string& dir_path);
+
+ private:
+  struct Job {
+    std::function<Status()> fn;
+    std::shared_ptr<FinishGroup> group;
+  };
+
+  void WorkerLoop();
+
+  int num_threads_;
+  size_t max_queued_;
+  std::vector<std::thread> threads_;
+
+  std::mutex queue_mutex_;
+  // Signalled when a job is queued or we're shutting down.
+  std::condition_variable queue_cv_;
+  // Signalled when a job is dequeued or completed.
+  std::condition_variable space_cv_;
+  std::queue<Job> queue_;
+  // Number of jobs dequeued but not yet completed.
+  int num_running_;
+  bool shutting_down_;
+
+  // Directory fsyncs are batched: every SyncDir() call takes a ticket, and an
+  // fsync() of the directory started after a ticket was taken covers it.
+  struct DirSyncState {
+    std::mutex mutex;
+    std::atomic<uint64_t> next_ticket{0};
+    // Protected by 'mutex'.
+    uint64_t synced_upto_ticket = 0;
+  };
+  std::mutex dir_states_mutex_;
+  std::unordered_map<std::string, std::unique_ptr<DirSyncState>> dir_states_;
+};
+
+} // namespace memcachedumper
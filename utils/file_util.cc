@@ -18,8 +18,15 @@
 
 #include "common/logger.h"
 #include "tasks/s3_upload_task.h"
+#include "utils/file_finisher.h"
 #include "utils/file_util.h"
 #include "utils/memcache_utils.h"
+#include "utils/multipart_upload.h"
+#include "utils/output_volumes.h"
+#include "utils/upload_journal.h"
+#ifdef USE_IO_URING
+#include "utils/uring_writer.h"
+#endif
 
 #include <errno.h>
 #include <fcntl.h>
@@ -27,6 +34,7 @@
 #include <sys/stat.h>
 #include <unistd.h>
 
+#include <algorithm>
 #include <experimental/filesystem>
 #include <iostream>
 
@@ -75,6 +83,25 @@ bool FileUtils::FileExists(std::string path) {
   return fs::exists(path) ? true : false;
 }
 
+Status FileUtils::FsyncDirectory(const std::string& dir_path) {
+  int dir_fd = open(dir_path.c_str(), O_RDONLY);
+  if (dir_fd < 0) {
+    return Status::IOError(dir_path, strerror(errno));
+  }
+
+  if (fsync(dir_fd) < 0) {
+    int err = errno;
+    close(dir_fd);
+    return Status::IOError("Could not fsync() directory " + dir_path, strerror(err));
+  }
+
+  if (close(dir_fd) < 0) {
+    return Status::IOError(dir_path, strerror(errno));
+  }
+
+  return Status::OK();
+}
+
 uint64_t FileUtils::CountNumLines(std::string path) {
   std::ifstream ifile(path);
   // No need to explicitly close() because RAII
@@ -82,12 +109,15 @@ uint64_t FileUtils::CountNumLines(std::string path) {
                     std::istreambuf_iterator<char>(), '\n');
 }
 
-PosixFile::PosixFile(std::string filename)
-  : filename_(filename) {
+PosixFile::PosixFile(std::string filename, bool direct_io)
+  : filename_(filename),
+    direct_io_(direct_io) {
 }
 
 Status PosixFile::Open() {
-  int fd = open(filename_.c_str(), O_CREAT | O_RDWR, 0666);
+  int flags = O_CREAT | O_RDWR;
+  if (direct_io_) flags |= O_DIRECT;
+  int fd = open(filename_.c_str(), flags, 0666);
   if (fd < 0) {
     return Status::IOError(filename_, strerror(errno));
   }
@@ -107,6 +137,36 @@ Status PosixFile::WriteV(struct iovec* iovecs, int n_iovecs, ssize_t* nwritten)
   return Status::OK();
 }
 
+Status PosixFile::PWrite(const uint8_t* buf, size_t len, off_t offset) {
+  while (len > 0) {
+    ssize_t nwritten = pwrite(fd_, buf, len, offset);
+    if (nwritten < 0) {
+      if (errno == EINTR) continue;
+      return Status::IOError(filename_, strerror(errno));
+    }
+    buf += nwritten;
+    len -= nwritten;
+    offset += nwritten;
+  }
+  return Status::OK();
+}
+
+Status PosixFile::DisableDirectIO() {
+  int flags = fcntl(fd_, F_GETFL);
+  if (flags < 0 || fcntl(fd_, F_SETFL, flags & ~O_DIRECT) < 0) {
+    return Status::IOError(filename_, strerror(errno));
+  }
+  direct_io_ = false;
+  return Status::OK();
+}
+
+Status PosixFile::Fsync() {
+  if (fsync(fd_) < 0) {
+    return Status::IOError("Could not fsync() file " + filename_, strerror(errno));
+  }
+  return Status::OK();
+}
+
 Status PosixFile::Close() {
   if (!is_open_) return Status::IOError("File is not open. Cannot close ", filename_);
 
@@ -126,9 +186,20 @@ RotatingFile::RotatingFile(std::string file_path, std::string file_prefix,
     optional_dest_path_(""),
     suffix_checksum_(suffix_checksum),
     s3_upload_on_close_(s3_upload_on_close),
+    format_hooks_(nullptr),
+    volumes_(nullptr),
+    cur_volume_(-1),
+    key_index_(false),
+    staged_writes_(false),
+    direct_io_(false),
+    staging_buffer_size_(0),
+    staging_buf_idx_(-1),
+    staging_len_(0),
+    nsubmitted_current_(0),
     cur_file_(nullptr),
     nfiles_(0),
     nwritten_current_(0),
+    cur_file_offset_(0),
     nwritten_total_(0) {
 }
 
@@ -141,116 +212,368 @@ RotatingFile::RotatingFile(std::string file_path, std::string file_prefix,
     optional_dest_path_(optional_dest_path),
     suffix_checksum_(suffix_checksum),
     s3_upload_on_close_(s3_upload_on_close),
+    format_hooks_(nullptr),
+    volumes_(nullptr),
+    cur_volume_(-1),
+    key_index_(false),
+    staged_writes_(false),
+    direct_io_(false),
+    staging_buffer_size_(0),
+    staging_buf_idx_(-1),
+    staging_len_(0),
+    nsubmitted_current_(0),
     cur_file_(nullptr),
     nfiles_(0),
     nwritten_current_(0),
+    cur_file_offset_(0),
     nwritten_total_(0) {
 }
 
-Status RotatingFile::Init() {
+RotatingFile::~RotatingFile() {
+  if (!part_buffers_) return;
 
-  staging_file_name_ = file_prefix_ + "_" + std::to_string(nfiles_);
-  cur_file_.reset(new PosixFile(
-      std::string(file_path_ + staging_file_name_)));
-  RETURN_ON_ERROR(cur_file_->Open());
+  // Whatever is still being streamed is of no use any more, but the parts in
+  // flight have to be done with the staging buffers before they go away.
+  if (staging_buf_idx_ >= 0) part_buffers_->Release(staging_buf_idx_);
+  if (cur_upload_) cur_upload_->Abort();
+  part_buffers_->WaitAllReleased();
+}
 
-  if (suffix_checksum_) {
-    md5_ctx_.reset(new MD5_CTX());
-    int ret = MD5_Init(md5_ctx_.get());
-    if (ret != 1) return Status::IOError("MD5_Init failed");
+Status RotatingFile::EnableStagedWrites(const std::vector<uint8_t*>& buffers,
+    size_t buffer_size, bool async, bool direct_io) {
+  if (direct_io) {
+    // Only whole blocks can be written with O_DIRECT.
+    buffer_size -= buffer_size % DIRECT_IO_ALIGNMENT;
+    if (buffer_size == 0) {
+      return Status::InvalidArgument("Staging buffers are too small for direct I/O");
+    }
+    for (uint8_t* buf : buffers) {
+      if (reinterpret_cast<uintptr_t>(buf) % DIRECT_IO_ALIGNMENT != 0) {
+        return Status::InvalidArgument("Staging buffers are not aligned for direct I/O");
+      }
+    }
   }
 
+  staging_buffers_ = buffers;
+  staging_buffer_size_ = buffer_size;
+  direct_io_ = direct_io;
+  staging_buf_idx_ = 0;
+  if (async) {
+#ifdef USE_IO_URING
+    uring_writer_.reset(new UringWriter());
+    RETURN_ON_ERROR(uring_writer_->Init(buffers, buffer_size));
+    RETURN_ON_ERROR(uring_writer_->AcquireBuffer(&staging_buf_idx_));
+#else
+    return Status::NotSupported("Not built with io_uring support");
+#endif
+  }
+  staged_writes_ = true;
   return Status::OK();
 }
 
-Status RotatingFile::Fsync() {
-  int ret = fsync(cur_file_->fd());
-  if (ret < 0) {
-    int err = errno;
-    return Status::IOError("Could not fsync() file " + staging_file_name_, strerror(err));
+Status RotatingFile::EnableStreamingUpload(const std::vector<uint8_t*>& buffers,
+    size_t buffer_size) {
+  if (buffer_size < S3_MIN_PART_SIZE) {
+    return Status::InvalidArgument("Staging buffers are too small for S3 upload parts");
   }
-
+  staging_buffers_ = buffers;
+  staging_buffer_size_ = buffer_size;
+  part_buffers_ = std::make_shared<PartBufferPool>(buffers);
+  staged_writes_ = true;
   return Status::OK();
 }
 
+Status RotatingFile::EnableCompression(const std::vector<uint8_t*>& buffers,
+    size_t buffer_size) {
+  // The frames go out through the staging buffers like any other write.
+  compressed_.reset(new CompressedFileBuilder(MemcachedUtils::GetCompressionType(),
+      MemcachedUtils::GetCompressionLevel(), buffers, buffer_size,
+      MemcachedUtils::GetBlockCompressor(),
+      [this](const uint8_t* data, size_t len) {
+        struct iovec iov;
+        iov.iov_base = const_cast<uint8_t*>(data);
+        iov.iov_len = len;
+        ssize_t nwritten = 0;
+        return WriteOut(&iov, 1, &nwritten);
+      }));
+  return compressed_->Init();
+}
 
-Status RotatingFile::FsyncDestDir() {
-  std::string dest_dir = MemcachedUtils::GetDataFinalPath();
-  int dir_fd = open(dest_dir.c_str(), O_RDONLY);
-  if (dir_fd < 0) {
-    return Status::IOError(dest_dir, strerror(errno));
+Status RotatingFile::Init() {
+
+  finish_group_ = std::make_shared<FinishGroup>();
+
+  if (suffix_checksum_) {
+    RETURN_ON_ERROR(Checksum::Create(MemcachedUtils::GetChecksumType(), &checksum_));
   }
 
-  if (fsync(dir_fd) < 0) {
-    return Status::IOError("Could not fsync() directory " + dest_dir, strerror(errno));
+  return OpenNextFile();
+}
+
+Status RotatingFile::OpenNextFile() {
+  // Streamed files never touch the volumes.
+  if (volumes_ && !part_buffers_) {
+    cur_volume_ = volumes_->Acquire();
+    file_path_ = volumes_->DataStagingPath(cur_volume_);
+    if (!optional_dest_path_.empty()) {
+      optional_dest_path_ = volumes_->DataFinalPath(cur_volume_);
+    }
   }
 
-  if (close(dir_fd) < 0) {
-    return Status::IOError(dest_dir, strerror(errno));
+  staging_file_name_ = file_prefix_ + "_" + std::to_string(nfiles_);
+  if (part_buffers_) {
+    // The parts go to a temporary object, named like the file would be without
+    // a checksum.
+    cur_upload_ = std::make_shared<MultipartUpload>("_" + staging_file_name_ + ".part",
+        part_buffers_);
+    RETURN_ON_ERROR(cur_upload_->Begin());
+    staging_buf_idx_ = part_buffers_->Acquire();
+  } else {
+    cur_file_.reset(new PosixFile(
+        std::string(file_path_ + staging_file_name_), direct_io_));
+    RETURN_ON_ERROR(cur_file_->Open());
   }
+  cur_file_offset_ = 0;
+  if (key_index_) key_index_entries_ = std::make_shared<std::vector<KeyIndexEntry>>();
 
+  if (format_hooks_) {
+    std::string header;
+    RETURN_ON_ERROR(format_hooks_->FileHeader(&header));
+    RETURN_ON_ERROR(WriteFraming(header));
+  }
   return Status::OK();
 }
 
+Status RotatingFile::WriteFraming(const std::string& framing) {
+  if (framing.empty()) return Status::OK();
+
+  struct iovec iov;
+  iov.iov_base = const_cast<char*>(framing.data());
+  iov.iov_len = framing.size();
+  ssize_t nwritten = 0;
+  RETURN_ON_ERROR(WriteRaw(&iov, 1, &nwritten));
+  nwritten_total_ += nwritten;
+  return Status::OK();
+}
 
 Status RotatingFile::FinalizeCurrentFile() {
-  std::string final_filename_only;
-  std::string final_filename_fq;
+  if (format_hooks_) {
+    std::string footer;
+    RETURN_ON_ERROR(format_hooks_->FileFooter(&footer));
+    RETURN_ON_ERROR(WriteFraming(footer));
+  }
+  if (compressed_) RETURN_ON_ERROR(compressed_->Finish());
 
-  // If requested, append the file checksum to the filename.
-  if (suffix_checksum_) {
-    unsigned char digest[MD5_DIGEST_LENGTH];
-    int ret = MD5_Final(digest, md5_ctx_.get());
-    if (ret != 1) return Status::IOError("MD5_Final failed");
+  PendingFile pending;
+  pending.dest_path = optional_dest_path_;
+  pending.s3_upload = s3_upload_on_close_;
+  pending.drop_cache = direct_io_;
+  pending.key_index = std::move(key_index_entries_);
+  pending.volumes = part_buffers_ ? nullptr : volumes_;
+  pending.volume = cur_volume_;
+  pending.staging_path = file_path_ + staging_file_name_;
 
+  if (suffix_checksum_) {
+    // If requested, append the file checksum to the filename.
     std::string digest_hex;
-    digest_hex.reserve(MD5_DIGEST_LENGTH);
+    RETURN_ON_ERROR(checksum_->Final(&digest_hex));
+    RETURN_ON_ERROR(checksum_->Reset());
 
-    for (std::size_t i = 0; i != 16; ++i) {
-      digest_hex += "0123456789ABCDEF"[digest[i] / 16];
-      digest_hex += "0123456789ABCDEF"[digest[i] % 16];
-    }
+    pending.final_filename_only = file_prefix_ + "_" + digest_hex;
+    pending.checksum_hex = digest_hex;
+  } else {
+    // Use the staging file name if a checksum wasn't requested.
+    pending.final_filename_only = "_" + staging_file_name_;
+  }
+  if (compressed_) {
+    pending.final_filename_only += Compressor::FileExtension(compressed_->type());
+  }
+  pending.final_filename_fq = optional_dest_path_ + pending.final_filename_only;
+
+  FileFinisher* finisher = MemcachedUtils::GetFileFinisher();
+
+  // The staging buffers are reused for the next file, so their writes have to
+  // be done with here. The fsync() can wait for the finisher, if we have one.
+  bool synced = false;
+  RETURN_ON_ERROR(FlushStagedWrites(finisher == nullptr, &synced));
+  pending.needs_fsync = !synced;
+  pending.file = std::move(cur_file_);
+  pending.upload = std::move(cur_upload_);
+
+  if (finisher == nullptr) {
+    finish_group_->JobAdded();
+    Status s = CompleteAndReleaseFile(pending, nullptr, finish_group_);
+    finish_group_->JobDone(s);
+    return s;
+  }
+
+  std::shared_ptr<FinishGroup> group = finish_group_;
+  finisher->Submit(
+      [pending, finisher, group]() {
+        return CompleteAndReleaseFile(pending, finisher, group);
+      },
+      finish_group_);
+  return Status::OK();
+}
 
-    md5_ctx_.reset(new MD5_CTX());
-    ret = MD5_Init(md5_ctx_.get());
-    if (ret != 1) return Status::IOError("MD5_Init failed");
+Status RotatingFile::CompleteAndReleaseFile(PendingFile pending, FileFinisher* finisher,
+    std::shared_ptr<FinishGroup> group) {
+  if (pending.upload) return CompleteStreamedFile(pending, group);
 
-    final_filename_only = file_prefix_ + "_" + digest_hex;
-    final_filename_fq = optional_dest_path_ + final_filename_only;
-  } else {
+  Status s = CompleteFile(&pending, finisher);
+  if (!s.ok() || !pending.s3_upload) {
+    ReleaseVolume(pending);
+    return s;
+  }
 
-    final_filename_only = "_" + staging_file_name_;
-    // Use the staging file name if a checksum wasn't requested.
-    final_filename_fq = optional_dest_path_ + final_filename_only;
+  // Once the file is journaled, a resumed dump finishes its upload if this one
+  // doesn't, so the key file it came from needn't wait for the upload.
+  UploadJournal* journal = MemcachedUtils::GetUploadJournal();
+  if (journal != nullptr) {
+    if (pending.key_index) {
+      s = journal->RecordCompleted(pending.final_filename_only + KEY_INDEX_FILE_SUFFIX,
+          pending.key_index_path);
+    }
+    if (s.ok()) {
+      s = journal->RecordCompleted(pending.final_filename_only, pending.final_filename_fq);
+    }
+    if (!s.ok()) {
+      ReleaseVolume(pending);
+      return s;
+    }
+    group = nullptr;
+  }
+
+  // The volume is only released once the upload has freed up its space.
+  FileFinisher* uploader = MemcachedUtils::GetFileUploader();
+  if (uploader != nullptr) {
+    uploader->Submit([pending, group]() {
+          Status s = UploadFile(pending, group);
+          ReleaseVolume(pending);
+          // Without a group, the failure has to fail the dump from here.
+          if (!s.ok() && !group) MemcachedUtils::RecordFileError(s);
+          return s;
+        }, group);
+    return Status::OK();
+  }
+
+  s = UploadFile(pending, group);
+  ReleaseVolume(pending);
+  if (!s.ok() && journal != nullptr) {
+    // The key file is done with, but the dump isn't complete until a resumed
+    // run retries the upload.
+    LOG_ERROR("Could not upload {0}. It's retried when resuming. (Status: {1})",
+        pending.final_filename_only, s.ToString());
+    MemcachedUtils::RecordFileError(s);
+    return Status::OK();
   }
+  return s;
+}
 
+void RotatingFile::ReleaseVolume(const PendingFile& pending) {
+  if (pending.volumes) pending.volumes->Release(pending.volume);
+}
+
+Status RotatingFile::CompleteFile(PendingFile* pending, FileFinisher* finisher) {
   // Explicitly fsync()
-  RETURN_ON_ERROR(Fsync());
-  RETURN_ON_ERROR(cur_file_->Close());
+  if (pending->needs_fsync) RETURN_ON_ERROR(pending->file->Fsync());
+
+  // Drop the pages that went through the page cache.
+  if (pending->drop_cache) {
+    IGNORE_RET_VAL(posix_fadvise(pending->file->fd(), 0, 0, POSIX_FADV_DONTNEED));
+  }
+  RETURN_ON_ERROR(pending->file->Close());
+
+  // The sidecar goes first, so that it's there by the time the file shows up.
+  if (pending->key_index) {
+    RETURN_ON_ERROR(WriteKeyIndex(*pending, &pending->key_index_path));
+  }
 
   // If requested, move the file to the final path.
-  if (!optional_dest_path_.empty()) {
-    FileUtils::MoveFile(cur_file_->filename(), final_filename_fq);
-    LOG("File: {0} complete.", final_filename_fq);
-    RETURN_ON_ERROR(FsyncDestDir());
+  if (!pending->dest_path.empty()) {
+    FileUtils::MoveFile(pending->file->filename(), pending->final_filename_fq);
+    LOG("File: {0} complete.", pending->final_filename_fq);
+    if (finisher != nullptr) {
+      RETURN_ON_ERROR(finisher->SyncDir(pending->dest_path));
+    } else {
+      RETURN_ON_ERROR(FileUtils::FsyncDirectory(pending->dest_path));
+    }
   }
 
-  // TODO: This isn't where we would do the upload ideally.
-  // Find a better way to do it.
-  if (s3_upload_on_close_) {
+  return Status::OK();
+}
 
-    // Upload file to S3 and send a SQS notification.
-    S3UploadFileTask s3_task(final_filename_fq, final_filename_only);
-    s3_task.Execute();
+Status RotatingFile::UploadFile(const PendingFile& pending,
+    std::shared_ptr<FinishGroup> group) {
+  bool journaled = MemcachedUtils::GetUploadJournal() != nullptr;
+  if (pending.key_index) {
+    S3UploadFileTask index_task(pending.key_index_path,
+        pending.final_filename_only + KEY_INDEX_FILE_SUFFIX, group);
+    index_task.set_journaled(journaled);
+    index_task.Execute();
+    RETURN_ON_ERROR(index_task.GetUploadStatus());
+    RETURN_ON_ERROR(FileUtils::RemoveFile(pending.key_index_path));
+  }
 
-    // If the file upload was a failure, return the error.
-    // TODO: Add a retry loop if necessary.
-    RETURN_ON_ERROR(s3_task.GetUploadStatus());
+  // Upload file to S3 and send a SQS notification.
+  S3UploadFileTask s3_task(pending.final_filename_fq, pending.final_filename_only,
+      group);
+  s3_task.set_journaled(journaled);
+  s3_task.set_checksum(pending.checksum_hex);
+  s3_task.Execute();
 
-    // Since we've uploaded it to S3, delete it from the local FS.
-    RETURN_ON_ERROR(FileUtils::RemoveFile(final_filename_fq));
+  // If the file upload was a failure, return the error.
+  // TODO: Add a retry loop if necessary.
+  RETURN_ON_ERROR(s3_task.GetUploadStatus());
+
+  // Since we've uploaded it to S3, delete it from the local FS.
+  return FileUtils::RemoveFile(pending.final_filename_fq);
+}
+
+Status RotatingFile::CompleteStreamedFile(const PendingFile& pending,
+    std::shared_ptr<FinishGroup> group) {
+  if (pending.key_index) {
+    std::string index_path = pending.staging_path + KEY_INDEX_FILE_SUFFIX;
+    Status s = WriteKeyIndexFile(pending.key_index.get(), index_path);
+    if (s.ok()) {
+      S3UploadFileTask index_task(index_path,
+          pending.final_filename_only + KEY_INDEX_FILE_SUFFIX, group);
+      index_task.Execute();
+      s = index_task.GetUploadStatus();
+    }
+    if (s.ok()) s = FileUtils::RemoveFile(index_path);
+    if (!s.ok()) {
+      pending.upload->Abort();
+      return s;
+    }
   }
 
+  return pending.upload->Complete(pending.final_filename_only, pending.checksum_hex,
+      group);
+}
+
+Status RotatingFile::WriteKeyIndexFile(std::vector<KeyIndexEntry>* entries,
+    const std::string& path) {
+  std::string sidecar;
+  KeyIndex::Build(entries, &sidecar);
+
+  PosixFile index_file(path);
+  RETURN_ON_ERROR(index_file.Open());
+  RETURN_ON_ERROR(index_file.PWrite(reinterpret_cast<const uint8_t*>(sidecar.data()),
+      sidecar.size(), 0));
+  RETURN_ON_ERROR(index_file.Fsync());
+  return index_file.Close();
+}
+
+Status RotatingFile::WriteKeyIndex(const PendingFile& pending, std::string* out_path) {
+  *out_path = pending.file->filename() + KEY_INDEX_FILE_SUFFIX;
+  RETURN_ON_ERROR(WriteKeyIndexFile(pending.key_index.get(), *out_path));
+
+  if (!pending.dest_path.empty()) {
+    std::string index_path = *out_path;
+    *out_path = pending.final_filename_fq + KEY_INDEX_FILE_SUFFIX;
+    FileUtils::MoveFile(index_path, *out_path);
+  }
   return Status::OK();
 }
 
@@ -259,25 +582,40 @@ Status RotatingFile::RotateFile() {
   RETURN_ON_ERROR(FinalizeCurrentFile());
   ++nfiles_;
 
-  staging_file_name_ = file_prefix_ + "_" + std::to_string(nfiles_);
-  cur_file_.reset(new PosixFile(
-      std::string(file_path_ + staging_file_name_)));
-  RETURN_ON_ERROR(cur_file_->Open());
-  return Status::OK();
+  return OpenNextFile();
 }
 
-Status RotatingFile::WriteV(struct iovec* iovecs, int n_iovecs, ssize_t* nwritten) {
+Status RotatingFile::WriteRaw(struct iovec* iovecs, int n_iovecs, ssize_t* nwritten) {
+  if (compressed_) {
+    // Only the frames of full blocks make it out of here.
+    *nwritten = 0;
+    for (int i = 0; i < n_iovecs; ++i) {
+      RETURN_ON_ERROR(compressed_->Append(
+          static_cast<const uint8_t*>(iovecs[i].iov_base), iovecs[i].iov_len));
+      *nwritten += iovecs[i].iov_len;
+    }
+  } else {
+    RETURN_ON_ERROR(WriteOut(iovecs, n_iovecs, nwritten));
+  }
+  assert(*nwritten >= 0);
+  cur_file_offset_ += *nwritten;
+  return Status::OK();
+}
 
+Status RotatingFile::WriteOut(struct iovec* iovecs, int n_iovecs, ssize_t* nwritten) {
   if (suffix_checksum_) {
     for (int i = 0; i < n_iovecs; ++i) {
-
-      int ret = MD5_Update(md5_ctx_.get(), iovecs[i].iov_base, iovecs[i].iov_len);
-      if (ret != 1) return Status::IOError("MD5_Update failed");
+      RETURN_ON_ERROR(checksum_->Update(iovecs[i].iov_base, iovecs[i].iov_len));
     }
   }
 
-  RETURN_ON_ERROR(cur_file_->WriteV(iovecs, n_iovecs, nwritten));
-  assert(nwritten >= 0);
+  if (staged_writes_) return StageWriteV(iovecs, n_iovecs, nwritten);
+  return cur_file_->WriteV(iovecs, n_iovecs, nwritten);
+}
+
+Status RotatingFile::WriteV(struct iovec* iovecs, int n_iovecs, ssize_t* nwritten) {
+
+  RETURN_ON_ERROR(WriteRaw(iovecs, n_iovecs, nwritten));
 
   nwritten_current_ += *nwritten;
   nwritten_total_ += *nwritten;
@@ -293,10 +631,103 @@ Status RotatingFile::WriteV(struct iovec* iovecs, int n_iovecs, ssize_t* nwritte
   return Status::OK();
 }
 
-Status RotatingFile::Finish() {
+Status RotatingFile::StageWriteV(struct iovec* iovecs, int n_iovecs, ssize_t* nwritten) {
+  *nwritten = 0;
+  for (int i = 0; i < n_iovecs; ++i) {
+    const uint8_t* src = static_cast<const uint8_t*>(iovecs[i].iov_base);
+    size_t remaining = iovecs[i].iov_len;
+    while (remaining > 0) {
+      size_t n_copy = std::min(remaining, staging_buffer_size_ - staging_len_);
+      memcpy(staging_buffers_[staging_buf_idx_] + staging_len_, src, n_copy);
+      staging_len_ += n_copy;
+      src += n_copy;
+      remaining -= n_copy;
+
+      if (staging_len_ == staging_buffer_size_) {
+        RETURN_ON_ERROR(SubmitStagingBuffer());
+      }
+    }
+    *nwritten += iovecs[i].iov_len;
+  }
+  return Status::OK();
+}
 
-  RETURN_ON_ERROR(FinalizeCurrentFile());
+Status RotatingFile::SubmitStagingBuffer() {
+  if (part_buffers_) {
+    // The buffer belongs to the upload until the part is in.
+    int buf_idx = staging_buf_idx_;
+    size_t len = staging_len_;
+    staging_buf_idx_ = -1;
+    staging_len_ = 0;
+    RETURN_ON_ERROR(cur_upload_->SubmitPart(buf_idx, len, finish_group_));
+    staging_buf_idx_ = part_buffers_->Acquire();
+    return Status::OK();
+  }
+#ifdef USE_IO_URING
+  if (uring_writer_) {
+    RETURN_ON_ERROR(uring_writer_->SubmitWrite(cur_file_->fd(), staging_buf_idx_,
+        staging_len_, nsubmitted_current_));
+    nsubmitted_current_ += staging_len_;
+    staging_len_ = 0;
+    return uring_writer_->AcquireBuffer(&staging_buf_idx_);
+  }
+#endif
+  RETURN_ON_ERROR(cur_file_->PWrite(staging_buffers_[staging_buf_idx_], staging_len_,
+      nsubmitted_current_));
+  nsubmitted_current_ += staging_len_;
+  staging_len_ = 0;
   return Status::OK();
 }
 
+Status RotatingFile::FlushStagedWrites([[maybe_unused]] bool fsync, bool* synced) {
+  *synced = false;
+  if (!staged_writes_) return Status::OK();
+
+  if (part_buffers_) {
+    // The last part may be short. An empty file still needs one part.
+    int buf_idx = staging_buf_idx_;
+    size_t len = staging_len_;
+    staging_buf_idx_ = -1;
+    staging_len_ = 0;
+    if (len > 0 || cur_upload_->num_parts() == 0) {
+      return cur_upload_->SubmitPart(buf_idx, len, finish_group_);
+    }
+    part_buffers_->Release(buf_idx);
+    return Status::OK();
+  }
+
+#ifdef USE_IO_URING
+  if (uring_writer_ && fsync && !direct_io_) {
+    // Write out the partially filled buffer along with the fsync(), and wait for
+    // the file to be complete on disk.
+    RETURN_ON_ERROR(uring_writer_->SubmitWriteAndFsync(cur_file_->fd(), staging_buf_idx_,
+        staging_len_, nsubmitted_current_));
+    RETURN_ON_ERROR(uring_writer_->WaitAll());
+    nsubmitted_current_ = 0;
+    staging_len_ = 0;
+    *synced = true;
+    return Status::OK();
+  }
+  if (uring_writer_) RETURN_ON_ERROR(uring_writer_->WaitAll());
+#endif
+
+  if (staging_len_ > 0) {
+    // The tail is unlikely to be a whole number of blocks, so it goes through the
+    // page cache.
+    if (direct_io_) RETURN_ON_ERROR(cur_file_->DisableDirectIO());
+    RETURN_ON_ERROR(cur_file_->PWrite(staging_buffers_[staging_buf_idx_], staging_len_,
+        nsubmitted_current_));
+  }
+  nsubmitted_current_ = 0;
+  staging_len_ = 0;
+  return Status::OK();
+}
+
+Status RotatingFile::Finish(std::function<void(Status)> on_complete) {
+
+  RETURN_ON_ERROR(FinalizeCurrentFile());
+  finish_group_->set_on_complete(on_complete);
+  finish_group_->Seal();
+  return Status::OK();
+}
 } // namespace memcachedumper
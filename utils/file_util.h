@@ -18,19 +18,37 @@
 
 #pragma once
 
+#include "utils/checksum.h"
+#include "utils/compression.h"
+#include "utils/key_index.h"
 #include "utils/status.h"
 
 #include <stdio.h>
 #include <sys/uio.h>
 #include <unistd.h>
 
+#include <functional>
 #include <memory>
 #include <string>
+#include <vector>
 
-#include <openssl/md5.h>
+// Number of buffers each RotatingFile stages its writes in when writing
+// asynchronously.
+#define ASYNC_WRITE_STAGING_BUFFERS 4
+
+// Alignment of buffers, offsets and lengths for writes to files opened with
+// O_DIRECT.
+#define DIRECT_IO_ALIGNMENT 4096
 
 namespace memcachedumper {
 
+class FileFinisher;
+class FinishGroup;
+class MultipartUpload;
+class OutputVolumes;
+class PartBufferPool;
+class UringWriter;
+
 class FileUtils {
  public:
   static void MoveFile(std::string file_path, std::string dest_path);
@@ -39,6 +57,8 @@ class FileUtils {
   static Status RemoveDirectoryAndContents(std::string dir_path);
   static uint64_t GetSpaceAvailable(std::string path);
   static bool FileExists(std::string path);
+  // fsync()s the directory at 'dir_path', eg. to make a rename into it durable.
+  static Status FsyncDirectory(const std::string& dir_path);
 
   // This call opens the file and counts the number of lines.
   // Could be expensive for large files. Use only if necessary.
@@ -47,7 +67,8 @@ class FileUtils {
 
 class PosixFile {
  public:
-  PosixFile(std::string filename);
+  // If 'direct_io' is true, the file is opened with O_DIRECT.
+  PosixFile(std::string filename, bool direct_io = false);
 
   const std::string filename() { return filename_; }
   int fd() { return fd_; }
@@ -56,16 +77,40 @@ class PosixFile {
 
   Status WriteV(struct iovec* iovecs, int n_iovecs, ssize_t* nwritten);
 
+  // Writes all 'len' bytes of 'buf' at 'offset'.
+  Status PWrite(const uint8_t* buf, size_t len, off_t offset);
+
+  // Turns off O_DIRECT for the rest of the writes, eg. for an unaligned tail.
+  Status DisableDirectIO();
+
+  Status Fsync();
+
   Status Close();
 
  private:
   const std::string filename_;
+  bool direct_io_;
   int fd_;
   bool is_open_;
   bool is_closed_;
 };
 
 
+/// Lets a file format frame every file written by a RotatingFile, eg. with a
+/// header and a footer.
+class FileFormatHooks {
+ public:
+  virtual ~FileFormatHooks() = default;
+
+  // Called when a new file is opened. Whatever is put in 'out' is written at
+  // its start.
+  virtual Status FileHeader(std::string* out) = 0;
+
+  // Called once everything is written to a file. Whatever is put in 'out' is
+  // written at its end.
+  virtual Status FileFooter(std::string* out) = 0;
+};
+
 /// Wrapper around PosixFile that automatically rotates files when size threshold
 /// is met.
 class RotatingFile {
@@ -77,14 +122,71 @@ class RotatingFile {
       uint64_t max_file_size, std::string optional_dest_path,
       bool suffix_checksum, bool s3_upload_on_close);
 
+  ~RotatingFile();
+
+  // Copy all writes into 'buffers' of 'buffer_size' bytes each, and write them out
+  // one full buffer at a time. Must be called before Init(). 'buffers' must
+  // outlive this object.
+  //
+  // If 'async' is true, the buffers are written out through io_uring without
+  // waiting for them. Returns an error if we weren't built with io_uring support.
+  //
+  // If 'direct_io' is true, files are opened with O_DIRECT so that they bypass the
+  // page cache. 'buffers' must be aligned to DIRECT_IO_ALIGNMENT.
+  Status EnableStagedWrites(const std::vector<uint8_t*>& buffers, size_t buffer_size,
+      bool async, bool direct_io);
+
+  // Like EnableStagedWrites(), but instead of writing files to disk, stream them
+  // to S3 as multipart uploads with one part per buffer (see MultipartUpload).
+  // Only the key index sidecars, if any, go through local disk. 'buffer_size'
+  // must be at least S3_MIN_PART_SIZE.
+  Status EnableStreamingUpload(const std::vector<uint8_t*>& buffers, size_t buffer_size);
+
+  // Compress every file as it's written, with the codec and level picked by
+  // MemcachedUtils::GetCompressionType(), holding the blocks in flight in 'buffers'
+  // (see CompressedFileBuilder). The blocks are compressed by
+  // MemcachedUtils::GetBlockCompressor() if set. Must be called before Init().
+  // 'buffers' must outlive this object.
+  Status EnableCompression(const std::vector<uint8_t*>& buffers, size_t buffer_size);
+
+  // Frame every file with 'hooks', which must outlive this object. Must be called
+  // before Init().
+  void set_format_hooks(FileFormatHooks* hooks) { format_hooks_ = hooks; }
+
+  // Spread the files across 'volumes' instead of writing them all to 'file_path',
+  // and moving them to 'optional_dest_path' if given. 'volumes' must outlive this
+  // object. Must be called before Init().
+  void set_output_volumes(OutputVolumes* volumes) { volumes_ = volumes; }
+
+  // Write a key index sidecar (see KeyIndex) next to every file. Callers must
+  // IndexKey() every record they write. Must be called before Init().
+  void EnableKeyIndex() { key_index_ = true; }
+  bool key_index_enabled() { return key_index_; }
+
+  // Notes that the record of the key with hash 'key_hash' starts at 'offset' in
+  // the current file.
+  void IndexKey(uint64_t key_hash, uint64_t offset) {
+    key_index_entries_->push_back({key_hash, offset});
+  }
+
+  // Number of bytes written to the current file so far.
+  uint64_t current_file_offset() { return cur_file_offset_; }
+
+  // Sequence number of the current file. Changes every time we rotate.
+  int file_number() { return nfiles_; }
+
   // Initialize by creating the first file.
   Status Init();
 
   Status WriteV(struct iovec* iovecs, int n_iovecs, ssize_t* nwritten);
-  Status Fsync();
-  Status FsyncDestDir();
 
-  Status Finish();
+  // Finalizes the last file. 'on_complete' (if given) is called with the first
+  // error seen, once every file written by this object has been made durable,
+  // moved to its final path and uploaded. That happens on a finisher thread if
+  // there is one (see MemcachedUtils::GetFileFinisher()), and the upload on an
+  // uploader thread if there is one (see MemcachedUtils::GetFileUploader()),
+  // possibly after this returns.
+  Status Finish(std::function<void(Status)> on_complete = nullptr);
 
  private:
   std::string file_path_;
@@ -100,15 +202,31 @@ class RotatingFile {
   // If 'true', uploads every file created after Close().
   bool s3_upload_on_close_;
 
-  // Used for calculating the checksum of the current file.
-  // Used a unique pointer here so we can reset it for every new file after
-  // every call to RotateFile().
-  std::unique_ptr<MD5_CTX> md5_ctx_;
+  // Used for calculating the checksum of the current file. The algorithm is
+  // picked by MemcachedUtils::GetChecksumType(). When compressing, it's over
+  // the compressed file.
+  std::unique_ptr<Checksum> checksum_;
+
+  // Compresses every file as it's written, if EnableCompression() was called.
+  std::unique_ptr<CompressedFileBuilder> compressed_;
+
+  // Frames every file if set.
+  FileFormatHooks* format_hooks_;
+
+  // Picks the directories of every file if set.
+  OutputVolumes* volumes_;
+  // The volume the current file is on.
+  int cur_volume_;
+
+  // Writes a key index sidecar for every file if set.
+  bool key_index_;
+  // The keys written to the current file so far.
+  std::shared_ptr<std::vector<KeyIndexEntry>> key_index_entries_;
 
   // 'Epilogue' of current file, where we take all necessary actions before
   // before it is ready for closing.
   //
-  // For now, we calculate the md5 hash (if suffix_checksum_ == true) and
+  // For now, we calculate the checksum (if suffix_checksum_ == true) and
   // move the file to the 'optional_dest_path_' if provided.
   //
   // Must be called AFTER all writes to file are done but BEFORE closing it.
@@ -117,14 +235,119 @@ class RotatingFile {
   // Closes the current file and opens a new one.
   Status RotateFile();
 
+  // Opens the next file and writes its header, if any.
+  Status OpenNextFile();
+
+  // Writes to the current file without counting towards rotating it.
+  Status WriteRaw(struct iovec* iovecs, int n_iovecs, ssize_t* nwritten);
+
+  // Writes 'iovecs' out to the current file as they are, ie. after compression.
+  Status WriteOut(struct iovec* iovecs, int n_iovecs, ssize_t* nwritten);
+
+  // Writes what 'format_hooks_' put in 'framing' to the current file.
+  Status WriteFraming(const std::string& framing);
+
+  // Copies 'iovecs' into the staging buffers, writing out each one that fills up.
+  Status StageWriteV(struct iovec* iovecs, int n_iovecs, ssize_t* nwritten);
+
+  // Writes out the full staging buffer and moves on to the next one.
+  Status SubmitStagingBuffer();
+
+  // Writes out what's left in the staging buffers for the current file and waits
+  // for all its writes to complete. If 'fsync' is true, also makes the file
+  // durable; that is folded into the last write when using io_uring.
+  // Returns 'true' in 'synced' if the file was fsync()ed.
+  Status FlushStagedWrites(bool fsync, bool* synced);
+
+  // Everything needed to complete a file once all its data is written.
+  struct PendingFile {
+    std::shared_ptr<PosixFile> file;
+    std::string final_filename_only;
+    std::string final_filename_fq;
+    // Checksum of the file's contents, if 'suffix_checksum_'.
+    std::string checksum_hex;
+    std::string dest_path;
+    bool needs_fsync;
+    // Drop the file's pages from the page cache once it's durable.
+    bool drop_cache;
+    bool s3_upload;
+    // The keys in the file, if it gets a key index sidecar.
+    std::shared_ptr<std::vector<KeyIndexEntry>> key_index;
+    // Where the sidecar ended up, once written.
+    std::string key_index_path;
+    // The volume the file is on, to Release() once complete.
+    OutputVolumes* volumes;
+    int volume;
+    // The upload of the file if it was streamed, in which case 'file' is unset
+    // and 'staging_path' is where its key index sidecar is written.
+    std::shared_ptr<MultipartUpload> upload;
+    std::string staging_path;
+  };
+
+  // Completes 'pending' (see CompleteFile()), uploads it if requested and
+  // releases its volume. The upload is handed off to the uploader threads if
+  // there are any, and accounted to 'group' unless it's in the upload journal.
+  static Status CompleteAndReleaseFile(PendingFile pending, FileFinisher* finisher,
+      std::shared_ptr<FinishGroup> group);
+
+  // Makes 'pending' durable, closes it and moves it to its final path. Uses
+  // 'finisher' to batch directory fsyncs if given.
+  static Status CompleteFile(PendingFile* pending, FileFinisher* finisher);
+
+  // Uploads the completed file in 'pending' (and its sidecar) to S3, sends the
+  // SQS notification and removes the local copy. A batched notification is
+  // accounted to 'group'.
+  static Status UploadFile(const PendingFile& pending, std::shared_ptr<FinishGroup> group);
+
+  // Releases the volume of 'pending', if any.
+  static void ReleaseVolume(const PendingFile& pending);
+
+  // Writes the key index sidecar of 'pending' and moves it next to where the file
+  // is going. Returns the sidecar's final path in 'out_path'.
+  static Status WriteKeyIndex(const PendingFile& pending, std::string* out_path);
+
+  // Writes a key index sidecar of 'entries' to 'path' and makes it durable.
+  static Status WriteKeyIndexFile(std::vector<KeyIndexEntry>* entries,
+      const std::string& path);
+
+  // Completes the multipart upload of a streamed file, after uploading its key
+  // index sidecar.
+  static Status CompleteStreamedFile(const PendingFile& pending,
+      std::shared_ptr<FinishGroup> group);
+
+  // Tracks the files handed off to the finisher threads.
+  std::shared_ptr<FinishGroup> finish_group_;
+
+  // 'true' if writes are copied into staging buffers before being written out.
+  bool staged_writes_;
+  // 'true' if files are opened with O_DIRECT.
+  bool direct_io_;
+  std::vector<uint8_t*> staging_buffers_;
+  size_t staging_buffer_size_;
+#ifdef USE_IO_URING
+  // Writes out the staging buffers asynchronously if set.
+  std::unique_ptr<UringWriter> uring_writer_;
+#endif
+  // Set if files are streamed to S3 instead. The staging buffers are handed out
+  // by 'part_buffers_', and 'cur_upload_' is the upload of the current file.
+  std::shared_ptr<PartBufferPool> part_buffers_;
+  std::shared_ptr<MultipartUpload> cur_upload_;
+  // Index of the staging buffer being filled and the number of bytes in it.
+  int staging_buf_idx_;
+  size_t staging_len_;
+  // Number of bytes of the current file written out from the staging buffers.
+  uint64_t nsubmitted_current_;
+
   // The filname of the file before moving it to 'optional_dest_path_'.
   std::string staging_file_name_;
-  // Current file handler.
-  std::unique_ptr<PosixFile> cur_file_;
+  // Current file handler. Shared with the finisher once the file is complete.
+  std::shared_ptr<PosixFile> cur_file_;
   // Number of files written to totally.
   int nfiles_;
   // Number of bytes written to the current file.
   uint64_t nwritten_current_;
+  // Same, including what 'format_hooks_' wrote.
+  uint64_t cur_file_offset_;
   // Number of bytes written in total.
   uint64_t nwritten_total_;
 };
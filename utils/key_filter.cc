@@ -37,7 +37,7 @@ Status KeyFilter::Init() {
     // want to filter keys for.
     for (uint32_t j = 0; j < dest_ips_.size(); ++j) {
       if (hostname.compare(dest_ips_[j]) == 0) {
-        filtered_instance_idxs_.insert(i);
+        filtered_instance_idxs_.emplace(i, j);
       }
     }
   }
@@ -56,4 +56,9 @@ bool KeyFilter::FilterKey(const std::string& key) {
     true : false;
 }
 
+int32_t KeyFilter::DestIndexForKey(const std::string& key) {
+  auto it = filtered_instance_idxs_.find((*hasher_)(key));
+  return (it == filtered_instance_idxs_.end()) ? -1 : it->second;
+}
+
 } // namespace memcachedumper
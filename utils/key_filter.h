@@ -22,7 +22,7 @@
 #include "utils/status.h"
 #include "utils/string_util.h"
 
-#include <unordered_set>
+#include <unordered_map>
 
 class KetamaHasher;
 
@@ -47,6 +47,10 @@ class KeyFilter {
   // Returns 'true' if 'key' should be filtered out; 'false' otherwise.
   bool FilterKey(const std::string& key);
 
+  // Returns the index into 'dest_ips_' of the host that 'key' hashes to, or -1 if
+  // it hashes to a host that isn't one of 'dest_ips_'.
+  int32_t DestIndexForKey(const std::string& key);
+
  private:
   // List of all IP addresses in our target ASG.
   std::vector<std::string> all_ips_;
@@ -57,9 +61,9 @@ class KeyFilter {
 
   KetamaHasher* hasher_;
 
-  // Set containing indicies of instances that we want to
-  // filter for.
-  std::unordered_set<uint32_t> filtered_instance_idxs_;
+  // Map of indices of instances that we want to filter for, to their
+  // index in 'dest_ips_'.
+  std::unordered_map<uint32_t, uint32_t> filtered_instance_idxs_;
 };
 
 } // namespace memcachedumper
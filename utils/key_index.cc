@@ -0,0 +1,104 @@
+/**
+ *
+ *  Copyright 2021 Netflix, Inc.
+ *
+ *     Licensed under the Apache License, Version 2.0 (the "License");
+ *     you may not use this file except in compliance with the License.
+ *     You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *     Unless required by applicable law or agreed to in writing, software
+ *     distributed under the License is distributed on an "AS IS" BASIS,
+ *     WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *     See the License for the specific language governing permissions and
+ *     limitations under the License.
+ *
+ */
+
+#include "utils/checksum.h"
+#include "utils/key_index.h"
+
+#include <algorithm>
+
+namespace memcachedumper {
+
+namespace {
+
+// Appends the low 'nbytes' bytes of 'val' to 'out' in big-endian order.
+void AppendBE(uint64_t val, int nbytes, std::string* out) {
+  for (int i = nbytes - 1; i >= 0; --i) {
+    out->push_back(static_cast<char>((val >> (i * 8)) & 0xFF));
+  }
+}
+
+// Bit to set for probe 'i' of 'key_hash' in a filter of 'nbits' bits, using
+// double hashing on the two halves of the hash.
+inline uint64_t BloomBit(uint64_t key_hash, int i, uint64_t nbits) {
+  uint64_t h1 = key_hash & 0xFFFFFFFF;
+  uint64_t h2 = key_hash >> 32;
+  return (h1 + i * h2) % nbits;
+}
+
+} // anonymous namespace
+
+uint64_t KeyIndex::HashKey(const char* key, size_t len) {
+  uint64_t hash = 0xCBF29CE484222325ULL;
+  for (size_t i = 0; i < len; ++i) {
+    hash ^= static_cast<uint8_t>(key[i]);
+    hash *= 0x100000001B3ULL;
+  }
+  return hash;
+}
+
+uint64_t KeyIndex::HashRecordKey(const struct iovec& header) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(header.iov_base);
+  size_t keylen = (static_cast<size_t>(bytes[0]) << 8) | bytes[1];
+  return HashKey(reinterpret_cast<const char*>(bytes + 2), keylen);
+}
+
+void KeyIndex::Build(std::vector<KeyIndexEntry>* entries, std::string* out) {
+  std::sort(entries->begin(), entries->end(),
+      [](const KeyIndexEntry& a, const KeyIndexEntry& b) {
+        return a.key_hash < b.key_hash ||
+            (a.key_hash == b.key_hash && a.offset < b.offset);
+      });
+
+  size_t bloom_len = std::max<size_t>(8,
+      (entries->size() * KEY_INDEX_BLOOM_BITS_PER_KEY + 7) / 8);
+  std::string bloom(bloom_len, '\0');
+  for (const KeyIndexEntry& entry : *entries) {
+    for (int i = 0; i < KEY_INDEX_BLOOM_NUM_PROBES; ++i) {
+      uint64_t bit = BloomBit(entry.key_hash, i, bloom_len * 8);
+      bloom[bit / 8] |= static_cast<char>(1 << (bit % 8));
+    }
+  }
+
+  out->clear();
+  out->reserve(KEY_INDEX_HEADER_LEN + bloom_len + entries->size() * 16 + 4);
+  out->append(KEY_INDEX_MAGIC);
+  AppendBE(KEY_INDEX_VERSION, 1, out);
+  AppendBE(KEY_INDEX_HASH_FNV1A_64, 1, out);
+  AppendBE(KEY_INDEX_BLOOM_NUM_PROBES, 1, out);
+  AppendBE(0, 1, out);
+  AppendBE(entries->size(), 4, out);
+  AppendBE(bloom_len, 4, out);
+  out->append(bloom);
+  for (const KeyIndexEntry& entry : *entries) {
+    AppendBE(entry.key_hash, 8, out);
+    AppendBE(entry.offset, 8, out);
+  }
+  AppendBE(Crc32cExtend(0, out->data(), out->size()), 4, out);
+}
+
+bool KeyIndex::BloomMayContain(const uint8_t* bloom, size_t bloom_len,
+    uint64_t key_hash) {
+  if (bloom_len == 0) return false;
+  for (int i = 0; i < KEY_INDEX_BLOOM_NUM_PROBES; ++i) {
+    uint64_t bit = BloomBit(key_hash, i, bloom_len * 8);
+    if (!(bloom[bit / 8] & (1 << (bit % 8)))) return false;
+  }
+  return true;
+}
+
+} // namespace memcachedumper
@@ -0,0 +1,67 @@
+/**
+ *
+ *  Copyright 2021 Netflix, Inc.
+ *
+ *     Licensed under the Apache License, Version 2.0 (the "License");
+ *     you may not use this file except in compliance with the License.
+ *     You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *     Unless required by applicable law or agreed to in writing, software
+ *     distributed under the License is distributed on an "AS IS" BASIS,
+ *     WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *     See the License for the specific language governing permissions and
+ *     limitations under the License.
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include <string>
+#include <vector>
+
+// See "Key index sidecars" in docs/dump-format-V0.md.
+#define KEY_INDEX_MAGIC "MCDI"
+#define KEY_INDEX_VERSION 1
+// Hash function of the keys: 64-bit FNV-1a.
+#define KEY_INDEX_HASH_FNV1A_64 1
+// <magic (4-bytes)> <version (1-byte)> <hash fn (1-byte)> <bloom probes (1-byte)>
+// <reserved (1-byte)> <num entries (4-bytes)> <bloom len (4-bytes)>
+#define KEY_INDEX_HEADER_LEN 16
+#define KEY_INDEX_BLOOM_BITS_PER_KEY 10
+#define KEY_INDEX_BLOOM_NUM_PROBES 7
+#define KEY_INDEX_FILE_SUFFIX ".idx"
+
+namespace memcachedumper {
+
+// Where the record of a key starts in a data file.
+struct KeyIndexEntry {
+  uint64_t key_hash;
+  uint64_t offset;
+};
+
+/// Builds the key index sidecar of a data file: a Bloom filter and a sorted
+/// table of key hashes to record offsets, so that finding a key in a dump
+/// doesn't need scanning its data files.
+class KeyIndex {
+ public:
+  static uint64_t HashKey(const char* key, size_t len);
+
+  // Hashes the key of the record whose header (as encoded by
+  // MemcachedUtils::EncodeRecordHeader()) is in 'header'.
+  static uint64_t HashRecordKey(const struct iovec& header);
+
+  // Serializes the sidecar for 'entries' into 'out'. Sorts 'entries'.
+  static void Build(std::vector<KeyIndexEntry>* entries, std::string* out);
+
+  // Returns 'false' if the key with hash 'key_hash' is definitely not in the
+  // Bloom filter 'bloom' of 'bloom_len' bytes.
+  static bool BloomMayContain(const uint8_t* bloom, size_t bloom_len, uint64_t key_hash);
+};
+
+} // namespace memcachedumper
@@ -17,22 +17,27 @@
  */
 
 #include "common/logger.h"
-#include "utils/aws_utils.h"
+#include "utils/block_format.h"
+#include "utils/disk_space_governor.h"
 #include "utils/file_util.h"
+#include "utils/key_index.h"
 #include "utils/key_value_writer.h"
+#include "utils/mem_mgr.h"
+#include "utils/metrics.h"
+#include "utils/record_compressor.h"
 #include "utils/socket.h"
 #include "utils/stopwatch.h"
+#include "utils/value_dedup.h"
 
 #include <stdio.h>
 #include <sys/uio.h>
 #include <unistd.h>
 
+#include <charconv>
 #include <iostream>
 #include <sstream>
 #include <string>
 
-#define MC_VALUE_DELIM "VALUE "
-
 #define INJECT_EAGAIN_EVERY_N 0
 
 #if INJECT_EAGAIN_EVERY_N
@@ -43,11 +48,26 @@ static int32_t inject_every_n = INJECT_EAGAIN_EVERY_N;
 // <key> <expiry> <flags> <datalen> <data>
 #define PER_KEY_DATAPOINTS 5
 
+// Max. iovecs per WriteV() call. We use 2 per key: the header and the value.
+#define MAX_WRITE_IOVECS 1024
+
+// Memcached doesn't allow keys longer than this.
+#define MC_MAX_KEY_LEN 250
+
+// Enough to hold the headers of a full batch of iovecs with the longest keys.
+#define HEADER_ARENA_SIZE ((MAX_WRITE_IOVECS / 2) * \
+    (V0_RECORD_HEADER_LEN + RECORD_COMPRESSION_HEADER_LEN + MC_MAX_KEY_LEN + DEDUP_REF_LEN))
+
+// Size of the scratch space that values are compressed into when compressing
+// records. Values that can't fit are stored as is.
+#define VALUE_ARENA_SIZE (2 * 1024 * 1024)
+
 namespace memcachedumper {
 
 KeyValueWriter::KeyValueWriter(std::string data_file_prefix,
     std::string owning_thread_name, uint8_t* buffer,
-    size_t capacity, uint64_t max_file_size, Socket* mc_sock)
+    size_t capacity, uint64_t max_file_size, Socket* mc_sock,
+    MemoryManager* staging_mem_mgr, MemoryManager* compression_mem_mgr)
   : data_file_prefix_(data_file_prefix),
     owning_thread_name_(owning_thread_name),
     buffer_begin_(buffer),
@@ -61,24 +81,87 @@ KeyValueWriter::KeyValueWriter(std::string data_file_prefix,
     total_keys_to_process_(0),
     num_processed_keys_(0),
     num_missing_keys_(0),
-    need_drain_socket_(false) {
+    broken_buffer_state_(DataBufferSlice::ResponseFormatState::VALUE_DELIM),
+    broken_item_begin_(nullptr),
+    broken_item_len_(0),
+    bytes_to_skip_(0),
+    need_drain_socket_(false),
+    staging_mem_mgr_(staging_mem_mgr),
+    compression_mem_mgr_(compression_mem_mgr),
+    header_arena_(new char[HEADER_ARENA_SIZE]),
+    value_dedup_file_number_(-1) {
   mcdata_entries_pending_.reserve(MemcachedUtils::BulkGetThreshold());
 }
 
-void stupid_debug_func() {
-  printf("Stupid debug func\n");
+KeyValueWriter::~KeyValueWriter() {
+  // Make sure no writes are in flight from the staging buffers before giving
+  // them back.
+  rotating_data_files_.reset();
+  block_writer_.reset();
+  for (uint8_t* buf : staging_buffers_) {
+    staging_mem_mgr_->ReturnBuffer(buf);
+  }
+  for (uint8_t* buf : compression_buffers_) {
+    compression_mem_mgr_->ReturnBuffer(buf);
+  }
 }
 
 Status KeyValueWriter::Init() {
-  rotating_data_files_.reset(
-      new RotatingFile(
-        MemcachedUtils::GetDataStagingPath(),
-        data_file_prefix_,
-        max_file_size_,
-        MemcachedUtils::GetDataFinalPath(),
-        true /* suffix checksum */,
-	AwsUtils::GetS3Bucket().empty() ? false : true /* Upload each file to S3 on close */));
-  RETURN_ON_ERROR(rotating_data_files_->Init());
+  if (MemcachedUtils::WriteDataFiles()) {
+    rotating_data_files_.reset(
+        new RotatingFile(
+          MemcachedUtils::GetDataStagingPath(),
+          data_file_prefix_,
+          max_file_size_,
+          MemcachedUtils::GetDataFinalPath(),
+          true /* suffix checksum */,
+          MemcachedUtils::GetStorageSink() != nullptr /* Upload each file on close */));
+
+    if (staging_mem_mgr_) {
+      for (int i = 0; i < MemcachedUtils::StagingBuffersPerWriter(); ++i) {
+        uint8_t* buf = staging_mem_mgr_->GetBuffer();
+        if (buf == nullptr) return Status::OutOfMemoryError("No staging buffers left");
+        staging_buffers_.push_back(buf);
+      }
+      if (MemcachedUtils::StreamUpload()) {
+        RETURN_ON_ERROR(rotating_data_files_->EnableStreamingUpload(
+            staging_buffers_, staging_mem_mgr_->chunk_size()));
+      } else {
+        RETURN_ON_ERROR(rotating_data_files_->EnableStagedWrites(
+            staging_buffers_, staging_mem_mgr_->chunk_size(),
+            MemcachedUtils::UseIoUring(), MemcachedUtils::DirectIO()));
+      }
+    }
+    if (compression_mem_mgr_) {
+      for (int i = 0; i < COMPRESSION_BLOCKS_IN_FLIGHT; ++i) {
+        uint8_t* buf = compression_mem_mgr_->GetBuffer();
+        if (buf == nullptr) return Status::OutOfMemoryError("No compression buffers left");
+        compression_buffers_.push_back(buf);
+      }
+      RETURN_ON_ERROR(rotating_data_files_->EnableCompression(
+          compression_buffers_, compression_mem_mgr_->chunk_size()));
+    }
+    rotating_data_files_->set_output_volumes(MemcachedUtils::GetOutputVolumes());
+    if (MemcachedUtils::KeyIndexEnabled()) rotating_data_files_->EnableKeyIndex();
+    if (MemcachedUtils::DumpFormatVersion() == 1) {
+      block_writer_.reset(new BlockWriter(rotating_data_files_.get(),
+          MemcachedUtils::RecordCompression() ? V1_FLAG_RECORD_COMPRESSION : 0));
+    }
+    RETURN_ON_ERROR(rotating_data_files_->Init());
+
+    if (MemcachedUtils::RecordCompression()) {
+      record_compressor_.reset(new RecordCompressor(MemcachedUtils::GetRecordDictTrainer()));
+      value_arena_.reset(new char[VALUE_ARENA_SIZE]);
+    }
+    if (MemcachedUtils::ValueDedup()) {
+      value_dedup_.reset(new ValueDedupTable());
+    }
+  }
+
+  if (MemcachedUtils::LiveMigrate()) {
+    dest_writer_.reset(new DestinationWriter(MemcachedUtils::GetLiveMigrateTargets()));
+    RETURN_ON_ERROR(dest_writer_->Init());
+  }
   return Status::OK();
 }
 
@@ -87,17 +170,53 @@ Status KeyValueWriter::WriteCompletedEntries() {
   MonotonicStopWatch total_msw;
 
   total_msw.Start();
-  uint32_t n_iovecs = std::min(
-      static_cast<uint32_t>(1024), n_unwritten_processed_keys_ * 2);
-  struct iovec iovecs[n_iovecs];
-
-  // We allocate memory on the stack to hold the key metadata strings until
-  // we've written it our through WriteV().
-  std::string key_mds[n_iovecs / 2];
+  struct iovec iovecs[MAX_WRITE_IOVECS];
+
+  // Record headers are encoded back to back into 'header_arena_' and stay there
+  // until the batch referencing them is written out through WriteV().
+  char* arena_pos = header_arena_.get();
+  char* arena_end = arena_pos + HEADER_ARENA_SIZE;
+
+  // Same for the compressed values, if we're compressing records.
+  char* value_pos = value_arena_.get();
+  char* value_end = value_pos + (value_arena_ ? VALUE_ARENA_SIZE : 0);
+  RecordDictTrainer* dict_trainer = MemcachedUtils::GetRecordDictTrainer();
+  if (record_compressor_) record_compressor_->UpdateDictionary();
+
+  // Let the uploads catch up if we're running out of disk space.
+  if (rotating_data_files_ && MemcachedUtils::GetDiskSpaceGovernor() != nullptr) {
+    RETURN_ON_ERROR(MemcachedUtils::GetDiskSpaceGovernor()->ThrottleWrite());
+  }
 
   McDataMap::iterator it = mcdata_entries_processing_.begin();
 
   uint32_t iovec_idx = 0;
+  // Number of bytes in the batch so far.
+  uint64_t batch_len = 0;
+  uint64_t num_dedup_refs = 0;
+
+  auto write_batch = [&]() -> Status {
+    if (block_writer_) {
+      RETURN_ON_ERROR(block_writer_->AppendRecords(iovecs, iovec_idx));
+    } else {
+      if (rotating_data_files_->key_index_enabled()) {
+        // The whole batch goes to the current file; it only rotates afterwards.
+        uint64_t offset = rotating_data_files_->current_file_offset();
+        for (uint32_t i = 0; i < iovec_idx; i += 2) {
+          rotating_data_files_->IndexKey(KeyIndex::HashRecordKey(iovecs[i]), offset);
+          offset += iovecs[i].iov_len + iovecs[i + 1].iov_len;
+        }
+      }
+      ssize_t nwritten = 0;
+      RETURN_ON_ERROR(rotating_data_files_->WriteV(iovecs, iovec_idx, &nwritten));
+    }
+    n_unwritten_processed_keys_ -= (iovec_idx / 2);
+    iovec_idx = 0;
+    batch_len = 0;
+    arena_pos = header_arena_.get();
+    value_pos = value_arena_.get();
+    return Status::OK();
+  };
 
   while (it != mcdata_entries_processing_.end()) {
 
@@ -108,36 +227,105 @@ Status KeyValueWriter::WriteCompletedEntries() {
       continue;
     }
 
-    int key_mds_idx = iovec_idx / 2;
-    key_mds[key_mds_idx] = MemcachedUtils::CraftMetadataString(mcdata_entry);
-    iovecs[iovec_idx].iov_base = const_cast<char*>(key_mds[key_mds_idx].c_str());
-    iovecs[iovec_idx].iov_len = key_mds[key_mds_idx].length();
+    if (dest_writer_) {
+      RETURN_ON_ERROR(dest_writer_->Queue(mcdata_entry));
+    }
 
+    if (!rotating_data_files_) {
+      ++num_processed_keys_;
+      ++it;
+      --n_unwritten_processed_keys_;
+      continue;
+    }
+
+    // Values too large for the value arena are stored as is.
+    size_t max_value_len = 0;
+    if (record_compressor_) {
+      max_value_len = record_compressor_->MaxCompressedLen(mcdata_entry->ValueLength());
+      if (max_value_len > VALUE_ARENA_SIZE) max_value_len = 0;
+    }
+
+    // Only an oversized key could overflow the arena before the iovecs fill up.
+    // Leaves room for a back-reference in case the value is a repeat.
+    size_t header_len = MemcachedUtils::RecordHeaderLength(mcdata_entry);
+    size_t max_header_len = header_len + (value_dedup_ ? DEDUP_REF_LEN : 0);
+    if (max_header_len > static_cast<size_t>(arena_end - arena_pos) ||
+        max_value_len > static_cast<size_t>(value_end - value_pos)) {
+      RETURN_ON_ERROR(write_batch());
+      if (max_header_len > HEADER_ARENA_SIZE) {
+        return Status::InvalidArgument("Key too long", mcdata_entry->key());
+      }
+    }
+
+    // A repeated value is written as a reference to the record it was first
+    // written in. Only records in the same file are referred to, so that every
+    // file can be read on its own.
+    bool is_dedup_ref = false;
+    uint64_t ref_offset = 0;
+    if (value_dedup_ && mcdata_entry->ValueLength() >= DEDUP_MIN_VALUE_LEN) {
+      if (rotating_data_files_->file_number() != value_dedup_file_number_) {
+        value_dedup_->Clear();
+        value_dedup_file_number_ = rotating_data_files_->file_number();
+      }
+      // The whole batch goes to the current file; it only rotates afterwards.
+      uint64_t offset = rotating_data_files_->current_file_offset() + batch_len;
+      is_dedup_ref = value_dedup_->FindOrInsert(mcdata_entry->Value(),
+          mcdata_entry->ValueLength(), offset, &ref_offset);
+    }
+
+    iovecs[iovec_idx].iov_base = arena_pos;
+    iovecs[iovec_idx].iov_len = header_len;
     iovecs[iovec_idx + 1].iov_base = mcdata_entry->Value();
     iovecs[iovec_idx + 1].iov_len = mcdata_entry->ValueLength();
+
+    if (is_dedup_ref) {
+      iovecs[iovec_idx].iov_len += DEDUP_REF_LEN;
+      iovecs[iovec_idx + 1].iov_len = 0;
+      arena_pos = MemcachedUtils::EncodeDedupRefRecord(mcdata_entry, ref_offset, arena_pos);
+      ++num_dedup_refs;
+    } else if (record_compressor_) {
+      if (dict_trainer->sampling()) {
+        dict_trainer->AddSample(mcdata_entry->Value(), mcdata_entry->ValueLength());
+      }
+
+      uint32_t dict_id = 0;
+      if (max_value_len > 0) {
+        size_t compressed_len;
+        RETURN_ON_ERROR(record_compressor_->Compress(mcdata_entry->Value(),
+            mcdata_entry->ValueLength(), value_pos, value_end - value_pos, &dict_id,
+            &compressed_len));
+        if (dict_id != 0) {
+          iovecs[iovec_idx + 1].iov_base = value_pos;
+          iovecs[iovec_idx + 1].iov_len = compressed_len;
+          value_pos += compressed_len;
+        }
+      }
+      arena_pos = MemcachedUtils::EncodeCompressedRecordHeader(mcdata_entry, dict_id,
+          iovecs[iovec_idx + 1].iov_len, arena_pos);
+    } else {
+      arena_pos = MemcachedUtils::EncodeRecordHeader(mcdata_entry, arena_pos);
+    }
+    batch_len += iovecs[iovec_idx].iov_len + iovecs[iovec_idx + 1].iov_len;
     ++num_processed_keys_;
     ++it;
     iovec_idx += 2;
 
-    if (iovec_idx == n_iovecs) {
-      ssize_t nwritten = 0;
+    if (iovec_idx == MAX_WRITE_IOVECS) {
       MonotonicStopWatch msw;
-
-      {
-        SCOPED_STOP_WATCH(&msw);
-        RETURN_ON_ERROR(rotating_data_files_->WriteV(iovecs, iovec_idx, &nwritten));
-      }
-
-      iovec_idx = 0;
-      n_unwritten_processed_keys_ -= (n_iovecs / 2);
+      SCOPED_STOP_WATCH(&msw);
+      RETURN_ON_ERROR(write_batch());
     }
   }
 
   // Flush remaining entries.
   if (iovec_idx > 0) {
-    ssize_t nwritten = 0;
-    RETURN_ON_ERROR(rotating_data_files_->WriteV(iovecs, iovec_idx, &nwritten));
-    n_unwritten_processed_keys_ -= (iovec_idx / 2);
+    RETURN_ON_ERROR(write_batch());
+  }
+  if (num_dedup_refs > 0) DumpMetrics::increment_total_dedup_refs(num_dedup_refs);
+
+  // Values point into our buffer, so they need to go out before it's reused.
+  if (dest_writer_) {
+    RETURN_ON_ERROR(dest_writer_->Flush());
   }
 
   // TODO: Find better way to erase written entries from map.
@@ -169,27 +357,40 @@ uint32_t KeyValueWriter::ProcessBulkResponse() {
   DataBufferSlice response_slice(reinterpret_cast<char*>(process_from_),
       buffer_current_ - process_from_);
 
+  // Discard what's left of a value that was too large to fit in our buffer.
+  if (bytes_to_skip_ > 0) {
+    bytes_to_skip_ -= response_slice.skip(bytes_to_skip_);
+    if (bytes_to_skip_ > 0) return 0;
+  }
+
+  broken_buffer_state_ = DataBufferSlice::ResponseFormatState::VALUE_DELIM;
+  broken_item_begin_ = nullptr;
+  broken_item_len_ = 0;
+
   uint32_t n_complete_entries = 0;
-  const char* newline_after_data = nullptr;
-  do {
+  while (response_slice.bytes_pending() > 0) {
 
     const char* value_delim_pos = response_slice.next_value_delim();
     if (value_delim_pos == nullptr) {
+      // The tail of the buffer could be the start of the next delimiter.
+      size_t n_tail = std::min(response_slice.bytes_pending(),
+          static_cast<size_t>(MC_VALUE_DELIM_LEN - 1));
+      broken_item_begin_ = reinterpret_cast<char*>(buffer_current_) - n_tail;
       break;
     }
+    // From here on, if we run out of bytes, this is where the truncated item begins.
+    broken_item_begin_ = value_delim_pos;
 
     const char* whitespace_after_key = response_slice.next_whitespace();
     if (whitespace_after_key == nullptr) {
-      //stupid_debug_func();
-
-      // TODO: Handle partial buffer case.
       broken_buffer_state_ = response_slice.parse_state();
       break;
     }
 
-    cur_key_ = std::string(value_delim_pos + 6, whitespace_after_key - value_delim_pos - 6);
+    const char* key_begin = value_delim_pos + MC_VALUE_DELIM_LEN;
+    cur_key_.assign(key_begin, whitespace_after_key - key_begin);
 
-    auto entry = mcdata_entries_processing_.find(cur_key_.c_str());
+    auto entry = mcdata_entries_processing_.find(cur_key_);
     if (entry == mcdata_entries_processing_.end()) {
       LOG_ERROR("COULD NOT FIND KEY: {0}", cur_key_.c_str());
       assert(entry != mcdata_entries_processing_.end());
@@ -203,10 +404,13 @@ uint32_t KeyValueWriter::ProcessBulkResponse() {
     }
 
     McData* mcdata_entry = entry->second.get();
-    uint16_t flags = std::stoul(
-        std::string(whitespace_after_key + 1,
-            whitespace_after_flags - whitespace_after_key - 1));
-    mcdata_entry->setFlags(flags);
+    uint32_t flags = 0;
+    auto flags_res = std::from_chars(whitespace_after_key + 1, whitespace_after_flags, flags);
+    if (flags_res.ec != std::errc()) {
+      LOG_ERROR("Malformed flags in response for key: {0}", cur_key_.c_str());
+      abort();
+    }
+    mcdata_entry->setFlags(static_cast<uint16_t>(flags));
 
     const char* newline_after_datalen = response_slice.next_crlf();
     if (newline_after_datalen == nullptr) {
@@ -214,14 +418,19 @@ uint32_t KeyValueWriter::ProcessBulkResponse() {
       break;
     }
 
-    int32_t datalen = std::stoi(
-        std::string(whitespace_after_flags + 1,
-            newline_after_datalen - whitespace_after_flags - 1));
+    uint32_t datalen = 0;
+    auto datalen_res = std::from_chars(
+        whitespace_after_flags + 1, newline_after_datalen, datalen);
+    if (datalen_res.ec != std::errc()) {
+      LOG_ERROR("Malformed data length in response for key: {0}", cur_key_.c_str());
+      abort();
+    }
     mcdata_entry->setValueLength(datalen);
 
-    newline_after_data = response_slice.process_value(datalen);
+    const char* newline_after_data = response_slice.process_value(datalen);
     if (newline_after_data == nullptr) {
       broken_buffer_state_ = response_slice.parse_state();
+      broken_item_len_ = (newline_after_datalen + 2 - value_delim_pos) + datalen + 2;
       break;
     }
 
@@ -229,14 +438,45 @@ uint32_t KeyValueWriter::ProcessBulkResponse() {
 
     mcdata_entry->MarkComplete();
     ++n_complete_entries;
-
-  } while (response_slice.bytes_pending() > 0); // TODO: Redundant loop condition; change.
+    broken_item_begin_ = nullptr;
+  }
 
   total_msw.Stop();
 
   return n_complete_entries;
 }
 
+void KeyValueWriter::RecycleBuffer(bool carry_over) {
+  uint8_t* carry_from = reinterpret_cast<uint8_t*>(const_cast<char*>(broken_item_begin_));
+  size_t n_carry = (carry_from == nullptr) ? 0 : buffer_current_ - carry_from;
+
+  buffer_current_ = buffer_begin_;
+  process_from_ = buffer_begin_;
+  broken_item_begin_ = nullptr;
+
+  if (!carry_over) {
+    // Whatever's left of the response is lost with the connection.
+    bytes_to_skip_ = 0;
+    return;
+  }
+
+  if (n_carry == 0) return;
+
+  if (carry_from == buffer_begin_) {
+    // The item doesn't fit in the buffer at all. Skip over the rest of it; the key
+    // will be retried and eventually be accounted as missing.
+    if (broken_buffer_state_ == DataBufferSlice::ResponseFormatState::DATA) {
+      LOG_ERROR("Value for key {0} ({1} bytes) does not fit in a buffer of {2} bytes."
+          " Skipping it.", cur_key_, broken_item_len_, capacity_);
+      bytes_to_skip_ = broken_item_len_ - n_carry;
+    }
+    return;
+  }
+
+  memmove(buffer_begin_, carry_from, n_carry);
+  buffer_current_ = buffer_begin_ + n_carry;
+}
+
 Status KeyValueWriter::RecvFromMemcached(uint8_t *buf, int32_t size, int32_t *nread,
     bool* broken_connection) {
   Status recv_status = Status::OK();
@@ -294,6 +534,7 @@ void KeyValueWriter::DemoteKeysToPending() {
       // map.
       if (it->second->PossiblyEvicted()) {
         ++num_missing_keys_;
+        missing_keys_.insert(it->second->key());
       } else {
         ++n_keys_pending_;
         McDataMap::iterator entry_in_pending = mcdata_entries_pending_.emplace(
@@ -310,6 +551,11 @@ void KeyValueWriter::DemoteKeysToPending() {
 
 Status KeyValueWriter::BulkGetKeys(bool* broken_connection) {
 
+  // Time from sending a command to the first bytes of its response, ie. how long
+  // memcached took to serve it.
+  MonotonicStopWatch response_msw;
+  bool awaiting_response = false;
+
   // Skip sending a command if we're yet to finish processing the response to a
   // previous command.
   if (need_drain_socket_ == false) {
@@ -325,6 +571,8 @@ Status KeyValueWriter::BulkGetKeys(bool* broken_connection) {
     RETURN_ON_ERROR(mc_sock_->Send(
         reinterpret_cast<const uint8_t*>(bulk_get_cmd.c_str()),
         bulk_get_cmd.length(), &unused));
+    response_msw.Start();
+    awaiting_response = true;
   }
 
   bool reached_end = false;
@@ -337,6 +585,10 @@ Status KeyValueWriter::BulkGetKeys(bool* broken_connection) {
       RETURN_ON_ERROR(RecvFromMemcached(buffer_current_, remaining_space, &nread,
           broken_connection));
     }
+    if (awaiting_response) {
+      DumpMetrics::record_memcached_wait(response_msw.ElapsedTime() / 1000);
+      awaiting_response = false;
+    }
 
     assert(nread > 0);
     buffer_current_ = buffer_current_ + nread;
@@ -345,17 +597,16 @@ Status KeyValueWriter::BulkGetKeys(bool* broken_connection) {
     // Nothing to process.
     // TODO: Is this even possible? See assert(nread > 0) above.
     if (remaining_space == capacity_) {
-      LOG("WTF???");
       return Status::OK();
     }
 
     // Return here since there's more free space in the buffer that we can fill up
     // before processing the buffer; unless we've been instructed to flush.
-    reached_end = !strncmp(const_cast<char*>(
-        reinterpret_cast<char*>(buffer_current_)) - 5, "END\r\n", 5);
+    reached_end = (buffer_current_ - buffer_begin_ >= 5) && !strncmp(
+        reinterpret_cast<char*>(buffer_current_) - 5, "END\r\n", 5);
 
     if (remaining_space == 0) {
-      if (!reached_end) need_drain_socket_ = true;
+      need_drain_socket_ = !reached_end;
       return Status::OK();
     }
 
@@ -408,9 +659,9 @@ void KeyValueWriter::ProcessKeys(bool flush) {
     }
     did_write = true;
 
-    // Reset the buffer.
-    buffer_current_ = buffer_begin_;
-    process_from_ = buffer_begin_;
+    // Reset the buffer. If we have more of this response to receive, hang on to
+    // the item that got cut off at the end of the buffer.
+    RecycleBuffer(need_drain_socket_ && !broken_connection);
 
     if (broken_connection) break;
   // If we're yet to complete draining the socket, go back and complete the cycle.
@@ -460,7 +711,7 @@ void KeyValueWriter::QueueForProcessing(McData* mc_key) {
   }
 }
 
-Status KeyValueWriter::Finalize() {
+Status KeyValueWriter::Finalize(std::function<void(Status)> on_complete) {
   ProcessKeys(true);
 
   // In case we couldn't flush a few keys.
@@ -472,7 +723,17 @@ Status KeyValueWriter::Finalize() {
     ProcessKeys(true);
   }
 
-  RETURN_ON_ERROR(rotating_data_files_->Finish());
+  if (dest_writer_) {
+    RETURN_ON_ERROR(dest_writer_->Finish());
+  }
+  if (block_writer_) {
+    RETURN_ON_ERROR(block_writer_->Flush());
+  }
+  if (rotating_data_files_) {
+    RETURN_ON_ERROR(rotating_data_files_->Finish(on_complete));
+  } else if (on_complete) {
+    on_complete(Status::OK());
+  }
 
   if (total_keys_to_process_ != num_processed_keys_) {
     LOG("MISMATCH! Finalized. Total keys given: {0} Total keys processed + missing: {1}",
@@ -18,28 +18,40 @@
 
 #pragma once
 
+#include "utils/dest_writer.h"
 #include "utils/file_util.h"
 #include "utils/memcache_utils.h"
 
+#include <functional>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 
 namespace memcachedumper {
 
 // Forward declarations.
+class BlockWriter;
+class MemoryManager;
+class RecordCompressor;
 class Socket;
+class ValueDedupTable;
 
 class KeyValueWriter {
  public:
   KeyValueWriter(std::string data_file_prefix, std::string owning_thread_name,
-      uint8_t* buffer, size_t capacity, uint64_t max_file_size, Socket* mc_sock);
+      uint8_t* buffer, size_t capacity, uint64_t max_file_size, Socket* mc_sock,
+      MemoryManager* staging_mem_mgr = nullptr,
+      MemoryManager* compression_mem_mgr = nullptr);
+  ~KeyValueWriter();
 
   // Initialize the KeyValueWriter.
   Status Init();
 
   // Tears down any state and flushes pending keys for bulk get and writing, if any,
   // from the mcdata_entries_.
-  Status Finalize();
+  // 'on_complete' is called once all our data files are durable (and uploaded),
+  // possibly from a finisher thread after this returns.
+  Status Finalize(std::function<void(Status)> on_complete = nullptr);
 
   // Adds 'mc_key' to the entries to get the value for and write to a file.
   void QueueForProcessing(McData* mc_key);
@@ -48,6 +60,8 @@ class KeyValueWriter {
 
   uint64_t num_processed_keys() { return num_processed_keys_; }
   uint64_t num_missing_keys() { return num_missing_keys_; }
+  // The keys accounted in num_missing_keys().
+  const std::unordered_set<std::string>& missing_keys() { return missing_keys_; }
 
  private:
 
@@ -79,6 +93,12 @@ class KeyValueWriter {
   // mcdata_entries_pending_ map.
   void DemoteKeysToPending();
 
+  // Resets the buffer once its completed entries are written out. If 'carry_over'
+  // is true, the item that was truncated at the end of the buffer (if any) is moved
+  // to the start of the buffer so that we can finish parsing it once the rest of it
+  // arrives from Memcached.
+  void RecycleBuffer(bool carry_over);
+
   inline uint64_t buffer_free_bytes() {
     return buffer_begin_ + capacity_ - buffer_current_;
   }
@@ -124,24 +144,73 @@ class KeyValueWriter {
   // Number of keys we've tried to repeatedly call "get" on but received no data
   // back for.
   uint64_t num_missing_keys_;
+  std::unordered_set<std::string> missing_keys_;
 
   // While parsing responses from Memcached, this keeps track of the current key
   // being processed.
-  // We keep track of this since the response for a key can be truncated at the end of
-  // 'buffer_', and we need to continue processing the same key after obtaining relevant
-  // information from the next batch of bytes from Memcached.
+  // It's reused across keys so that looking up a key in 'mcdata_entries_processing_'
+  // doesn't need a new allocation every time.
   std::string cur_key_;
 
   // This is the last state seen in a buffer being processed. It's used to find out where
   // our buffer got truncated, so we can continue from there.
   DataBufferSlice::ResponseFormatState broken_buffer_state_;
 
+  // Points to the beginning of the item that got truncated at the end of the buffer.
+  // 'nullptr' if the buffer ended on an item boundary.
+  const char* broken_item_begin_;
+
+  // Total length of the truncated item (header, value and trailing '\r\n'). Only
+  // valid if 'broken_buffer_state_' is DATA, i.e. we managed to parse its header.
+  size_t broken_item_len_;
+
+  // Number of bytes of a value too large to fit in our buffer that we have yet to
+  // receive and discard.
+  size_t bytes_to_skip_;
+
   // If our buffer filled up before we could receive all the data for a command,
   // we need to make sure to drain the socket before sending the next command.
   bool need_drain_socket_;
 
+  // If set, data files are written through staging buffers from this memory
+  // manager.
+  MemoryManager* staging_mem_mgr_;
+  // Staging buffers obtained from 'staging_mem_mgr_'. Returned on destruction.
+  std::vector<uint8_t*> staging_buffers_;
+
+  // If set, data files are compressed, with the blocks in flight held in buffers
+  // from this memory manager.
+  MemoryManager* compression_mem_mgr_;
+  // Buffers obtained from 'compression_mem_mgr_'. Returned on destruction.
+  std::vector<uint8_t*> compression_buffers_;
+
   // Responsible for managing all the files that we will write data to.
+  // 'nullptr' if we're not writing data files.
   std::unique_ptr<RotatingFile> rotating_data_files_;
+
+  // Packs records into blocks in 'rotating_data_files_' when writing the V1 dump
+  // format. 'nullptr' otherwise.
+  std::unique_ptr<BlockWriter> block_writer_;
+
+  // Streams the data to the destination instances if we're live migrating.
+  // 'nullptr' otherwise.
+  std::unique_ptr<DestinationWriter> dest_writer_;
+
+  // Scratch space to encode the record headers of a batch of entries into, so that
+  // writing them out needs no allocations per key.
+  std::unique_ptr<char[]> header_arena_;
+
+  // Compresses the values we write if we're compressing records. 'nullptr'
+  // otherwise.
+  std::unique_ptr<RecordCompressor> record_compressor_;
+  // Scratch space for the compressed values of a batch of entries.
+  std::unique_ptr<char[]> value_arena_;
+
+  // Values written to the current data file, if we're deduplicating values.
+  // 'nullptr' otherwise.
+  std::unique_ptr<ValueDedupTable> value_dedup_;
+  // The data file that 'value_dedup_' has values of.
+  int value_dedup_file_number_;
 };
 
 } // namespace memcachedumper
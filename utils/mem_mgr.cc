@@ -18,30 +18,82 @@
 
 #include "common/logger.h"
 #include "utils/mem_mgr.h"
+#include "utils/numa_topology.h"
 
+#include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <iostream>
+#include <thread>
 
 namespace memcachedumper {
 
-MemoryManager::MemoryManager(uint64_t chunk_size, int num_chunks)
+MemoryManager::MemoryManager(uint64_t chunk_size, int num_chunks, size_t alignment)
   : chunk_size_(chunk_size),
-    num_chunks_(num_chunks) {
+    num_chunks_(num_chunks),
+    alignment_(alignment),
+    numa_(nullptr) {
+  pools_.push_back(std::make_unique<Pool>());
+  pools_[0]->num_chunks = num_chunks_;
+}
+
+void MemoryManager::SetNumaTopology(NumaTopology* topology) {
+  numa_ = topology;
+  int num_nodes = numa_->num_nodes();
+  pools_.clear();
+  for (int i = 0; i < num_nodes; ++i) {
+    pools_.push_back(std::make_unique<Pool>());
+    pools_[i]->num_chunks = num_chunks_ / num_nodes +
+        (static_cast<size_t>(i) < num_chunks_ % num_nodes ? 1 : 0);
+  }
 }
 
 Status MemoryManager::PreallocateChunks() {
+  if (numa_ == nullptr) return AllocatePool(pools_[0].get());
+
+  // Allocate every node's pool from a thread running on it, all at once.
+  std::vector<Status> statuses(pools_.size());
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < pools_.size(); ++i) {
+    threads.emplace_back([this, i, &statuses] {
+      statuses[i] = numa_->PinToNode(i);
+      if (statuses[i].ok()) statuses[i] = AllocatePool(pools_[i].get());
+    });
+  }
+  for (auto& t : threads) t.join();
+  for (const Status& s : statuses) {
+    RETURN_ON_ERROR(s);
+  }
+  return Status::OK();
+}
 
-  uint8_t* main_buff = static_cast<uint8_t*>(malloc(chunk_size_ * num_chunks_));
+Status MemoryManager::AllocatePool(Pool* pool) {
+  if (pool->num_chunks == 0) return Status::OK();
+
+  // Every chunk has a spare byte at the end, which callers may use to
+  // null-terminate a full buffer.
+  uint64_t stride = chunk_size_ + 1;
+  uint8_t* main_buff = nullptr;
+  if (alignment_ > 0) {
+    stride = (stride + alignment_ - 1) / alignment_ * alignment_;
+    main_buff = static_cast<uint8_t*>(aligned_alloc(alignment_, stride * pool->num_chunks));
+  } else {
+    main_buff = static_cast<uint8_t*>(malloc(stride * pool->num_chunks));
+  }
 
   if (main_buff == nullptr) {
       return Status::OutOfMemoryError("Could not pre-allocate chunks");
   }
+  // Pages are placed on the node of the thread that first touches them.
+  if (numa_ != nullptr) memset(main_buff, 0, stride * pool->num_chunks);
 
-  for (size_t i = 0; i < num_chunks_; ++i) {
+  pool->begin = main_buff;
+  pool->end = main_buff + stride * pool->num_chunks;
+  for (size_t i = 0; i < pool->num_chunks; ++i) {
     uint8_t *buf = main_buff;
-    free_buffers_.push_back(buf);
-    main_buff += chunk_size_ + 1;
+    pool->free_buffers.push_back(buf);
+    main_buff += stride;
   }
 
   return Status::OK();
@@ -50,19 +102,34 @@ Status MemoryManager::PreallocateChunks() {
 MemoryManager::~MemoryManager() = default;
 
 uint8_t* MemoryManager::GetBuffer() {
-  std::lock_guard<std::mutex> lock(list_mutex_);
-
-  if (free_buffers_.empty()) return nullptr;
-
-  uint8_t *buf = free_buffers_.back();
-  free_buffers_.pop_back();
-  return buf;
+  // Another node's chunk is better than none at all.
+  int node = numa_ != nullptr ? NumaTopology::CurrentNode() : 0;
+  if (node < 0 || node >= static_cast<int>(pools_.size())) node = 0;
+  for (size_t i = 0; i < pools_.size(); ++i) {
+    Pool* pool = pools_[(node + i) % pools_.size()].get();
+    std::lock_guard<std::mutex> lock(pool->list_mutex);
+    if (pool->free_buffers.empty()) continue;
+
+    uint8_t *buf = pool->free_buffers.back();
+    pool->free_buffers.pop_back();
+    return buf;
+  }
+  return nullptr;
 }
 
 void MemoryManager::ReturnBuffer(uint8_t *buf) {
-  std::lock_guard<std::mutex> lock(list_mutex_);
-  assert(free_buffers_.size() < num_chunks_);
-  free_buffers_.push_back(buf);
+  Pool* pool = PoolOf(buf);
+  std::lock_guard<std::mutex> lock(pool->list_mutex);
+  assert(pool->free_buffers.size() < pool->num_chunks);
+  pool->free_buffers.push_back(buf);
+}
+
+MemoryManager::Pool* MemoryManager::PoolOf(uint8_t* buf) {
+  for (auto& pool : pools_) {
+    if (buf >= pool->begin && buf < pool->end) return pool.get();
+  }
+  assert(false);
+  return pools_[0].get();
 }
 
 } // namespace memcachedumper
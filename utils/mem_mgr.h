@@ -24,21 +24,34 @@
 
 #include <mutex>
 #include <list>
+#include <memory>
+#include <vector>
 
 namespace memcachedumper {
 
+class NumaTopology;
+
+/// Hands out fixed size chunks from memory allocated up front. The chunks may be
+/// split into a pool per NUMA node, allocated on that node, in which case a thread
+/// pinned to a node gets chunks from its own node for as long as it has any.
 class MemoryManager {
  public:
-  MemoryManager(uint64_t chunk_size, int num_chunks);
+  // If 'alignment' is non-zero, every chunk starts at a multiple of it.
+  MemoryManager(uint64_t chunk_size, int num_chunks, size_t alignment = 0);
 
   ~MemoryManager();
 
   uint64_t chunk_size() { return chunk_size_; }
 
+  // Splits the chunks evenly between the nodes of 'topology'. Must be called
+  // before PreallocateChunks().
+  void SetNumaTopology(NumaTopology* topology);
+
   // Preallocates all the free buffers.
   Status PreallocateChunks();
 
-  // Obtain a single chunk. Returns 'nullptr' if none are available.
+  // Obtain a single chunk, from the calling thread's node if it has any left.
+  // Returns 'nullptr' if none are available.
   uint8_t* GetBuffer();
 
   // Return a buffer back into the free list.
@@ -52,11 +65,36 @@ class MemoryManager {
   // Total number of chunks in this allocator.
   size_t num_chunks_;
 
-  // A list of free buffers
-  std::list<uint8_t*> free_buffers_;
+  // Alignment of each chunk. 0 if we don't care.
+  size_t alignment_;
+
+  // Chunks allocated in one go, on one NUMA node if there are pools per node.
+  struct Pool {
+    size_t num_chunks = 0;
+    // The memory the chunks are carved out of.
+    uint8_t* begin = nullptr;
+    uint8_t* end = nullptr;
+
+    // A list of free buffers
+    std::list<uint8_t*> free_buffers;
+
+    // Mutex to protect 'free_buffers' list.
+    std::mutex list_mutex;
+  };
+
+  // Allocates the memory of 'pool' and fills its free list. With pools per node,
+  // the memory is touched so that the kernel places it on the calling thread's
+  // node.
+  Status AllocatePool(Pool* pool);
+
+  // Returns the pool that 'buf' was carved out of.
+  Pool* PoolOf(uint8_t* buf);
+
+  // Where the pools are allocated, if there's one per node.
+  NumaTopology* numa_;
 
-  // Mutex to protect 'free_buffers_' list.
-  std::mutex list_mutex_;
+  // Indexed by node, or a single pool without NUMA.
+  std::vector<std::unique_ptr<Pool>> pools_;
 };
 
 } // namespace memcachedumper
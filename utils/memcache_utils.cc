@@ -17,9 +17,20 @@
  */
 
 #include "common/logger.h"
+#include "utils/aws_utils.h"
+#include "utils/base_dump_index.h"
+#include "utils/disk_space_governor.h"
+#include "utils/file_finisher.h"
+#include "utils/file_util.h"
 #include "utils/key_filter.h"
 #include "utils/memcache_utils.h"
+#include "utils/multipart_upload.h"
 #include "utils/net_util.h"
+#include "utils/numa_topology.h"
+#include "utils/output_volumes.h"
+#include "utils/record_compressor.h"
+#include "utils/sqs_notifier.h"
+#include "utils/upload_journal.h"
 
 #include <iostream>
 #include <sstream>
@@ -56,18 +67,42 @@ void McData::printValue() {
 // Static member declarations
 std::string MemcachedUtils::req_id_;
 std::string MemcachedUtils::output_dir_path_;
+OutputVolumes* MemcachedUtils::output_volumes_ = nullptr;
+DiskSpaceGovernor* MemcachedUtils::disk_space_governor_ = nullptr;
+NumaTopology* MemcachedUtils::numa_topology_ = nullptr;
 uint32_t MemcachedUtils::bulk_get_threshold_ = DEFAULT_BULK_GET_THRESHOLD;
 uint64_t MemcachedUtils::max_data_file_size_;
 int MemcachedUtils::only_expire_after_;
 std::vector<std::string> MemcachedUtils::dest_ips_;
 std::vector<std::string> MemcachedUtils::all_ips_;
+std::vector<std::string> MemcachedUtils::live_migrate_targets_;
+bool MemcachedUtils::write_data_files_ = true;
+bool MemcachedUtils::use_io_uring_ = false;
+bool MemcachedUtils::direct_io_ = false;
+bool MemcachedUtils::stream_upload_ = false;
+ChecksumType MemcachedUtils::checksum_type_ = ChecksumType::MD5;
+CompressionType MemcachedUtils::compression_type_ = CompressionType::NONE;
+int MemcachedUtils::compression_level_ = 0;
+int MemcachedUtils::dump_format_version_ = 0;
+bool MemcachedUtils::key_index_ = false;
+bool MemcachedUtils::value_dedup_ = false;
+FileFinisher* MemcachedUtils::file_finisher_ = nullptr;
+FileFinisher* MemcachedUtils::file_uploader_ = nullptr;
+FileFinisher* MemcachedUtils::block_compressor_ = nullptr;
+StorageSink* MemcachedUtils::storage_sink_ = nullptr;
+UploadJournal* MemcachedUtils::upload_journal_ = nullptr;
+RecordDictTrainer* MemcachedUtils::record_dict_trainer_ = nullptr;
+std::mutex MemcachedUtils::file_error_mutex_;
+Status MemcachedUtils::first_file_error_;
 KeyFilter* MemcachedUtils::kf_;
+BaseDumpIndex* MemcachedUtils::base_index_;
 
 void MemcachedUtils::SetReqId(std::string req_id) {
   MemcachedUtils::req_id_ = req_id;
 }
-void MemcachedUtils::SetOutputDirPath(std::string output_dir_path) {
-  MemcachedUtils::output_dir_path_ = output_dir_path;
+void MemcachedUtils::SetOutputDirPaths(const std::vector<std::string>& output_dir_paths) {
+  MemcachedUtils::output_dir_path_ = output_dir_paths[0];
+  MemcachedUtils::output_volumes_ = new OutputVolumes(output_dir_paths);
 }
 void MemcachedUtils::SetBulkGetThreshold(uint32_t bulk_get_threshold) {
   if (bulk_get_threshold == 0) {
@@ -89,6 +124,123 @@ void MemcachedUtils::SetDestIps(const std::vector<std::string>& dest_ips) {
 void MemcachedUtils::SetAllIps(const std::vector<std::string>& all_ips) {
   MemcachedUtils::all_ips_ = all_ips;
 }
+void MemcachedUtils::SetLiveMigrateTargets(const std::vector<std::string>& targets) {
+  MemcachedUtils::live_migrate_targets_ = targets;
+}
+void MemcachedUtils::SetWriteDataFiles(bool write_data_files) {
+  MemcachedUtils::write_data_files_ = write_data_files;
+}
+void MemcachedUtils::SetUseIoUring(bool use_io_uring) {
+  MemcachedUtils::use_io_uring_ = use_io_uring;
+}
+void MemcachedUtils::SetDirectIO(bool direct_io) {
+  MemcachedUtils::direct_io_ = direct_io;
+}
+void MemcachedUtils::SetStreamUpload(bool stream_upload) {
+  MemcachedUtils::stream_upload_ = stream_upload;
+}
+
+void MemcachedUtils::SetChecksumType(ChecksumType checksum_type) {
+  MemcachedUtils::checksum_type_ = checksum_type;
+}
+
+void MemcachedUtils::SetCompression(CompressionType compression_type,
+    int compression_level) {
+  MemcachedUtils::compression_type_ = compression_type;
+  MemcachedUtils::compression_level_ = compression_level;
+}
+
+void MemcachedUtils::SetDumpFormatVersion(int dump_format_version) {
+  MemcachedUtils::dump_format_version_ = dump_format_version;
+}
+
+void MemcachedUtils::SetKeyIndex(bool key_index) {
+  MemcachedUtils::key_index_ = key_index;
+}
+
+void MemcachedUtils::SetValueDedup(bool value_dedup) {
+  MemcachedUtils::value_dedup_ = value_dedup;
+}
+
+void MemcachedUtils::InitFileFinisher(int num_threads) {
+  MemcachedUtils::file_finisher_ = new FileFinisher(num_threads, FINISHER_MAX_QUEUED_FILES);
+  MemcachedUtils::file_finisher_->Start();
+}
+
+void MemcachedUtils::InitFileUploader(int num_threads) {
+  MemcachedUtils::file_uploader_ = new FileFinisher(num_threads, UPLOADER_MAX_QUEUED_FILES);
+  MemcachedUtils::file_uploader_->Start();
+}
+
+void MemcachedUtils::InitBlockCompressor(int num_threads) {
+  MemcachedUtils::block_compressor_ = new FileFinisher(num_threads,
+      COMPRESSOR_MAX_QUEUED_BLOCKS);
+  MemcachedUtils::block_compressor_->Start();
+}
+
+void MemcachedUtils::SetStorageSink(StorageSink* storage_sink) {
+  MemcachedUtils::storage_sink_ = storage_sink;
+}
+
+Status MemcachedUtils::InitUploadJournal(bool keep_existing) {
+  UploadJournal* journal = new UploadJournal(
+      MemcachedUtils::GetKeyFilePath() + UPLOAD_JOURNAL_FILENAME);
+  Status s = journal->Open(keep_existing);
+  if (!s.ok()) {
+    delete journal;
+    return s;
+  }
+  MemcachedUtils::upload_journal_ = journal;
+  return Status::OK();
+}
+
+void MemcachedUtils::WaitUntilFilesComplete() {
+  // Uploads are queued by the finisher threads, so those have to be done first.
+  if (MemcachedUtils::file_finisher_ != nullptr) {
+    MemcachedUtils::file_finisher_->WaitUntilIdle();
+  }
+  if (MemcachedUtils::file_uploader_ != nullptr) {
+    MemcachedUtils::file_uploader_->WaitUntilIdle();
+  }
+  // Then the notifications the uploads queued.
+  if (AwsUtils::GetSQSNotifier() != nullptr) {
+    AwsUtils::GetSQSNotifier()->WaitUntilIdle();
+  }
+}
+
+void MemcachedUtils::RecordFileError(const Status& status) {
+  std::lock_guard<std::mutex> lock(MemcachedUtils::file_error_mutex_);
+  if (MemcachedUtils::first_file_error_.ok()) MemcachedUtils::first_file_error_ = status;
+}
+
+Status MemcachedUtils::FileErrorStatus() {
+  std::lock_guard<std::mutex> lock(MemcachedUtils::file_error_mutex_);
+  return MemcachedUtils::first_file_error_;
+}
+
+void MemcachedUtils::InitDiskSpaceGovernor(uint64_t min_free_space) {
+  MemcachedUtils::disk_space_governor_ = new DiskSpaceGovernor(
+      MemcachedUtils::output_volumes_, 2 * min_free_space, min_free_space);
+}
+
+Status MemcachedUtils::InitNumaTopology(const std::string& task_cpus,
+    const std::string& excluded_cpus, bool per_node) {
+  std::unique_ptr<NumaTopology> topology;
+  RETURN_ON_ERROR(NumaTopology::Discover(task_cpus, excluded_cpus, per_node, &topology));
+  MemcachedUtils::numa_topology_ = topology.release();
+  return Status::OK();
+}
+
+void MemcachedUtils::InitRecordCompression(int level) {
+  MemcachedUtils::record_dict_trainer_ = new RecordDictTrainer(level);
+}
+
+int MemcachedUtils::StagingBuffersPerWriter() {
+  if (MemcachedUtils::stream_upload_) return STREAM_UPLOAD_PART_BUFFERS;
+  if (MemcachedUtils::use_io_uring_) return ASYNC_WRITE_STAGING_BUFFERS;
+  // Direct I/O writes are synchronous, so one buffer is enough.
+  return MemcachedUtils::direct_io_ ? 1 : 0;
+}
 
 std::string MemcachedUtils::GetKeyFilePath() {
   return MemcachedUtils::output_dir_path_ + "/keyfile/";
@@ -135,6 +287,34 @@ std::string MemcachedUtils::DataFilePrefix() {
   return dprefix;
 }
 
+std::string MemcachedUtils::TombstoneFilePrefix() {
+  std::string* ip_addr = nullptr;
+  Status s = GetIPAddrAsString(&ip_addr);
+  if (!s.ok()) {
+    LOG_ERROR("Could not get IP Address: {0}", s.ToString());
+    return "tombstones_localhost_";
+  }
+  std::string tprefix;
+  tprefix.append("tombstones_");
+  tprefix.append(*ip_addr);
+  tprefix.append("_");
+  return tprefix;
+}
+
+std::string MemcachedUtils::DictFilePrefix() {
+  std::string* ip_addr = nullptr;
+  Status s = GetIPAddrAsString(&ip_addr);
+  if (!s.ok()) {
+    LOG_ERROR("Could not get IP Address: {0}", s.ToString());
+    return "dict_localhost_";
+  }
+  std::string dprefix;
+  dprefix.append("dict_");
+  dprefix.append(*ip_addr);
+  dprefix.append("_");
+  return dprefix;
+}
+
 std::string MemcachedUtils::CraftBulkGetCommand(
     McDataMap* pending_keys) {
   std::stringstream bulk_get_cmd;
@@ -173,4 +353,44 @@ bool MemcachedUtils::FilterKey(const std::string& key) {
   return kf_->FilterKey(key);
 }
 
+int32_t MemcachedUtils::DestIndexForKey(const std::string& key) {
+  if (kf_ == nullptr) return -1;
+  return kf_->DestIndexForKey(key);
+}
+
+Status MemcachedUtils::InitBaseDumpIndex(const std::string& base_keyfile_dir) {
+  std::unique_ptr<BaseDumpIndex> base_index(new BaseDumpIndex(base_keyfile_dir));
+  RETURN_ON_ERROR(base_index->Init());
+
+  base_index_ = base_index.release();
+  return Status::OK();
+}
+
+bool MemcachedUtils::KeyUnchangedSinceBase(std::string_view encoded_key, uint64_t cas,
+    int32_t expiry) {
+  if (base_index_ == nullptr) return false;
+  return base_index_->Unchanged(encoded_key, cas, expiry);
+}
+
+std::string MemcachedUtils::UrlDecode(const std::string& str) {
+  std::ostringstream oss;
+  char ch;
+  int i, ii, len = str.length();
+
+  for (i = 0; i < len; i++) {
+    if (str[i] != '%') {
+      if (str[i] == '+')
+        oss << ' ';
+      else
+        oss << str[i];
+    } else {
+      sscanf(str.substr(i + 1, 2).c_str(), "%x", &ii);
+      ch = static_cast<char>(ii);
+      oss << ch;
+      i = i + 2;
+    }
+  }
+  return oss.str();
+}
+
 } // namespace memcachedumper
@@ -18,12 +18,19 @@
 
 #pragma once
 
+#include "utils/checksum.h"
+#include "utils/compression.h"
 #include "utils/slice.h"
 #include "utils/status.h"
 
+#include <string.h>
+
+#include <algorithm>
 #include <fstream>
 #include <memory>
+#include <mutex>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
@@ -33,11 +40,38 @@
 // Ignore a key if we tried to get it these many times unsuccessfully.
 #define MAX_GET_ATTEMPTS 3
 
+// Delimiter that precedes every value in a response to a 'get' command.
+#define MC_VALUE_DELIM "VALUE "
+#define MC_VALUE_DELIM_LEN 6
+
+// Fixed-width part of a record header in a data file: the 2 byte key length, and
+// the 4 byte expiry, flags and data length.
+#define V0_RECORD_HEADER_LEN 14
+
+// Extra header bytes of every record when compressing records: the 4 byte
+// dictionary ID and uncompressed data length.
+#define RECORD_COMPRESSION_HEADER_LEN 8
+
+// 'datalen' of a record whose value is a back-reference to an earlier record
+// with the same value, when deduplicating values.
+#define DEDUP_REF_DATALEN 0xFFFFFFFF
+// Size of the back-reference: the 8 byte offset of the earlier record.
+#define DEDUP_REF_LEN 8
+
 // Forward declaration.
 class KeyFilter;
 
 namespace memcachedumper {
 
+class BaseDumpIndex;
+class DiskSpaceGovernor;
+class NumaTopology;
+class FileFinisher;
+class OutputVolumes;
+class RecordDictTrainer;
+class StorageSink;
+class UploadJournal;
+
 class McData {
  public:
   McData(char *key, size_t keylen, int32_t expiry);
@@ -88,15 +122,87 @@ typedef std::unordered_map<std::string, std::unique_ptr<McData>> McDataMap;
 class MemcachedUtils {
  public:
   static void SetReqId(std::string req_id);
-  static void SetOutputDirPath(std::string output_dir_path);
+  // The first of 'output_dir_paths' is the primary volume (see OutputVolumes).
+  static void SetOutputDirPaths(const std::vector<std::string>& output_dir_paths);
   static void SetBulkGetThreshold(uint32_t bulk_get_threshold);
   static void SetMaxDataFileSize(uint64_t max_data_file_size);
   static void SetOnlyExpireAfter(int only_expire_after);
   static void SetDestIps(const std::vector<std::string>& dest_ips);
   static void SetAllIps(const std::vector<std::string>& all_ips);
+  static void SetLiveMigrateTargets(const std::vector<std::string>& targets);
+  static void SetWriteDataFiles(bool write_data_files);
+  static void SetUseIoUring(bool use_io_uring);
+  static void SetDirectIO(bool direct_io);
+  static void SetStreamUpload(bool stream_upload);
+  static void SetChecksumType(ChecksumType checksum_type);
+  static void SetCompression(CompressionType compression_type, int compression_level);
+  static void SetDumpFormatVersion(int dump_format_version);
+  static void SetKeyIndex(bool key_index);
+  static void SetValueDedup(bool value_dedup);
+
+  // Starts 'num_threads' threads to finish data files in the background. If never
+  // called, files are finished inline by the thread writing them.
+  static void InitFileFinisher(int num_threads);
+  static FileFinisher* GetFileFinisher() { return MemcachedUtils::file_finisher_; }
+
+  // Starts 'num_threads' threads to upload completed data files to S3. If never
+  // called, files are uploaded by the thread that finishes them.
+  static void InitFileUploader(int num_threads);
+  static FileFinisher* GetFileUploader() { return MemcachedUtils::file_uploader_; }
+
+  // Starts 'num_threads' threads to compress the blocks of data files. If never
+  // called, blocks are compressed by the thread writing them.
+  static void InitBlockCompressor(int num_threads);
+  static FileFinisher* GetBlockCompressor() { return MemcachedUtils::block_compressor_; }
+
+  // Where completed files are uploaded to. 'nullptr' if they aren't uploaded.
+  static void SetStorageSink(StorageSink* storage_sink);
+  static StorageSink* GetStorageSink() { return MemcachedUtils::storage_sink_; }
+
+  // Journal uploads in the key file directory, so that a resumed dump can finish
+  // them. If never called, uploads aren't journaled. The previous run's records
+  // are kept if 'keep_existing' is set.
+  static Status InitUploadJournal(bool keep_existing);
+  static UploadJournal* GetUploadJournal() { return MemcachedUtils::upload_journal_; }
+
+  // Waits until every data file handed off so far is finished and uploaded.
+  static void WaitUntilFilesComplete();
+
+  // Records that a key file's data files failed to be written or completed, so
+  // that the dump doesn't report success. Only the first error is kept.
+  static void RecordFileError(const Status& status);
+  // Returns the first error passed to RecordFileError(), or OK if there was none.
+  static Status FileErrorStatus();
+
+  // Compress the value of every record with a dictionary trained on the first
+  // values dumped, at zstd level 'level'.
+  static void InitRecordCompression(int level);
+  static bool RecordCompression() { return MemcachedUtils::record_dict_trainer_ != nullptr; }
+  // Returns nullptr unless InitRecordCompression() was called.
+  static RecordDictTrainer* GetRecordDictTrainer() {
+    return MemcachedUtils::record_dict_trainer_;
+  }
 
   static std::string GetReqId() { return MemcachedUtils::req_id_; }
+  // The primary output directory. The Get*Path() functions return paths on it.
   static std::string OutputDirPath() { return MemcachedUtils::output_dir_path_; }
+  static OutputVolumes* GetOutputVolumes() { return MemcachedUtils::output_volumes_; }
+
+  // Watch the free space on the output volumes, pushing back on the task threads
+  // once fewer than 'min_free_space' bytes (twice as many to start pushing back)
+  // are left. Must be called after SetOutputDirPaths().
+  static void InitDiskSpaceGovernor(uint64_t min_free_space);
+  // Returns nullptr unless InitDiskSpaceGovernor() was called.
+  static DiskSpaceGovernor* GetDiskSpaceGovernor() {
+    return MemcachedUtils::disk_space_governor_;
+  }
+
+  // Pin task threads to 'task_cpus' minus 'excluded_cpus' (see NumaTopology), to
+  // the CPUs of one NUMA node each if 'per_node' is set.
+  static Status InitNumaTopology(const std::string& task_cpus,
+      const std::string& excluded_cpus, bool per_node);
+  // Returns nullptr unless InitNumaTopology() was called.
+  static NumaTopology* GetNumaTopology() { return MemcachedUtils::numa_topology_; }
   static uint32_t BulkGetThreshold() { return MemcachedUtils::bulk_get_threshold_; }
   static uint64_t MaxDataFileSize() { return MemcachedUtils::max_data_file_size_; }
   static uint64_t OnlyExpireAfter() { return MemcachedUtils::only_expire_after_; }
@@ -104,9 +210,36 @@ class MemcachedUtils {
   static std::string GetDataStagingPath();
   static std::string GetDataFinalPath();
   static std::vector<std::string>* GetDestIps();
+  // Returns the "IP:port" of the instances to stream dumped keys to. Empty if we're
+  // not live migrating.
+  static const std::vector<std::string>& GetLiveMigrateTargets() {
+    return MemcachedUtils::live_migrate_targets_;
+  }
+  static bool LiveMigrate() { return !MemcachedUtils::live_migrate_targets_.empty(); }
+  static bool WriteDataFiles() { return MemcachedUtils::write_data_files_; }
+  static bool UseIoUring() { return MemcachedUtils::use_io_uring_; }
+  static bool DirectIO() { return MemcachedUtils::direct_io_; }
+  // Data files are streamed to S3 straight from memory if set.
+  static bool StreamUpload() { return MemcachedUtils::stream_upload_; }
+  // The checksum that data files are suffixed with.
+  static ChecksumType GetChecksumType() { return MemcachedUtils::checksum_type_; }
+  // The codec and level that data files are compressed with.
+  static CompressionType GetCompressionType() { return MemcachedUtils::compression_type_; }
+  static int GetCompressionLevel() { return MemcachedUtils::compression_level_; }
+  // Version of the format data files are written in. See docs/dump-format-V*.md.
+  static int DumpFormatVersion() { return MemcachedUtils::dump_format_version_; }
+  // Whether data files get a key index sidecar.
+  static bool KeyIndexEnabled() { return MemcachedUtils::key_index_; }
+  // Whether repeated values are written as back-references.
+  static bool ValueDedup() { return MemcachedUtils::value_dedup_; }
+  // Number of staging buffers each data file writer needs. 0 if it writes
+  // straight from its response buffer.
+  static int StagingBuffersPerWriter();
 
   static std::string KeyFilePrefix();
   static std::string DataFilePrefix();
+  static std::string TombstoneFilePrefix();
+  static std::string DictFilePrefix();
 
   // Initialize key filtering for use by individual tasks.
   // Must call SetDestIps() and SetAllIps() before using.
@@ -115,22 +248,91 @@ class MemcachedUtils {
   // Returns 'true' if key needs to be filtered out. 'false' otherwise.
   // Always returns 'false' if InitKeyFilter() isn't called before this.
   static bool FilterKey(const std::string& key);
+  // Returns the index in the dest IPs of the instance that 'key' hashes to, or -1
+  // if it doesn't hash to one of them or InitKeyFilter() isn't called before this.
+  static int32_t DestIndexForKey(const std::string& key);
+
+  // Load the key index of a previous dump from 'base_keyfile_dir' to only dump
+  // keys that are new or have changed since then.
+  static Status InitBaseDumpIndex(const std::string& base_keyfile_dir);
+  // Returns 'true' if we're dumping only the changes since a previous dump.
+  static bool IsDeltaDump() { return base_index_ != nullptr; }
+  static BaseDumpIndex* GetBaseDumpIndex() { return base_index_; }
+  // Returns 'true' if 'encoded_key' hasn't changed since the base dump.
+  // Always returns 'false' if InitBaseDumpIndex() isn't called before this.
+  static bool KeyUnchangedSinceBase(std::string_view encoded_key, uint64_t cas,
+      int32_t expiry);
+
+  // Decodes a URL encoded key as found in a metadump.
+  static std::string UrlDecode(const std::string& str);
 
   // Craft a bulk get command with the first 'BulkGetThreshold()' keys in
   // 'pending_keys' to send memcached.
   static std::string CraftBulkGetCommand(McDataMap* pending_keys);
 
-  // Returns a string of the following format for 'key':
+  // Returns the number of bytes EncodeRecordHeader() (or
+  // EncodeCompressedRecordHeader() when compressing records) will write for 'key'.
+  static size_t RecordHeaderLength(McData* key) {
+    return V0_RECORD_HEADER_LEN + key->key().length() +
+        (RecordCompression() ? RECORD_COMPRESSION_HEADER_LEN : 0);
+  }
+
+  // Encodes the record header for 'key' into 'out', which must have at least
+  // RecordHeaderLength(key) bytes available. The header is of the format:
   // <keylen (2-bytes)> <key> <expiry (4-bytes)> <flag (4-bytes)> <datalen (4-bytes)>
-  static std::string CraftMetadataString(McData* key) {
-    std::string final_str;
-    final_str.append(MemcachedUtils::ConvertIntToBytes(key->key().length(), 2));
-    final_str.append(key->key().c_str());
-    final_str.append(MemcachedUtils::ConvertIntToBytes(key->expiry(), 4));
-    final_str.append(MemcachedUtils::ConvertUInt16ToBytes(key->flags(), 4));
-    final_str.append(MemcachedUtils::ConvertIntToBytes(key->ValueLength(), 4));
+  // Returns a pointer past the last byte written.
+  static char* EncodeRecordHeader(McData* key, char* out) {
+    const std::string& key_str = key->key();
+    out = EncodeIntBytes(key_str.length(), 2, out);
+    memcpy(out, key_str.data(), key_str.length());
+    out += key_str.length();
+    out = EncodeIntBytes(key->expiry(), 4, out);
+    out = EncodeIntBytes(key->flags(), 4, out);
+    return EncodeIntBytes(key->ValueLength(), 4, out);
+  }
+
+  // Like EncodeRecordHeader(), for a value stored as 'stored_len' bytes
+  // compressed with dictionary 'dict_id' (0 if stored as is):
+  // <keylen (2-bytes)> <key> <expiry (4-bytes)> <flag (4-bytes)> <datalen (4-bytes)>
+  // <dict id (4-bytes)> <uncompressed datalen (4-bytes)>
+  // where 'datalen' is 'stored_len'.
+  static char* EncodeCompressedRecordHeader(McData* key, uint32_t dict_id,
+      uint32_t stored_len, char* out) {
+    const std::string& key_str = key->key();
+    out = EncodeIntBytes(key_str.length(), 2, out);
+    memcpy(out, key_str.data(), key_str.length());
+    out += key_str.length();
+    out = EncodeIntBytes(key->expiry(), 4, out);
+    out = EncodeIntBytes(key->flags(), 4, out);
+    out = EncodeIntBytes(stored_len, 4, out);
+    out = EncodeIntBytes(dict_id, 4, out);
+    return EncodeIntBytes(key->ValueLength(), 4, out);
+  }
 
-    return final_str;
+  // Encodes a record for 'key' whose value is the same as that of the record at
+  // 'ref_offset' in the same file, into 'out', which must have at least
+  // RecordHeaderLength(key) + DEDUP_REF_LEN bytes available. That's the usual
+  // header with a 'datalen' of DEDUP_REF_DATALEN, followed by:
+  // <ref offset (8-bytes)>
+  // Returns a pointer past the last byte written.
+  static char* EncodeDedupRefRecord(McData* key, uint64_t ref_offset, char* out) {
+    if (RecordCompression()) {
+      out = EncodeCompressedRecordHeader(key, 0, DEDUP_REF_DATALEN, out);
+    } else {
+      char* datalen = EncodeRecordHeader(key, out) - 4;
+      out = EncodeIntBytes(DEDUP_REF_DATALEN, 4, datalen);
+    }
+    out = EncodeIntBytes(static_cast<uint32_t>(ref_offset >> 32), 4, out);
+    return EncodeIntBytes(static_cast<uint32_t>(ref_offset), 4, out);
+  }
+
+  // Writes the low 'out_bytes' bytes of 'int_param' to 'out' in big-endian order.
+  // Returns a pointer past the last byte written.
+  static inline char* EncodeIntBytes(uint32_t int_param, int out_bytes, char* out) {
+    for (int i = 0; i < out_bytes; i++) {
+      out[out_bytes - i - 1] = static_cast<char>(int_param >> (i * 8));
+    }
+    return out + out_bytes;
   }
 
   // Reads 'filename' and extracts IP:Port pairs from the file.
@@ -167,28 +369,40 @@ class MemcachedUtils {
     return s;
   }
 
-  // Converts 'uint16_param' to its byte representation in a string, and returns
-  // a string with 'out_bytes' number of bytes.
-  static std::string ConvertUInt16ToBytes(uint16_t uint16_param, int out_bytes) {
-    std::vector<unsigned char> byte_array(out_bytes);
-    for (int i = 0; i < out_bytes; i++) {
-      byte_array[out_bytes - i - 1] = (uint16_param >> (i * 8));
-    }
-    std::string s(byte_array.begin(), byte_array.end());
-    return s;
-  }
-
  private:
   static std::string req_id_;
   static std::string output_dir_path_;
+  static OutputVolumes* output_volumes_;
+  static DiskSpaceGovernor* disk_space_governor_;
+  static NumaTopology* numa_topology_;
   static uint32_t bulk_get_threshold_;
   static uint64_t max_data_file_size_;
   static int only_expire_after_;
 
   static std::vector<std::string> dest_ips_;
   static std::vector<std::string> all_ips_;
+  static std::vector<std::string> live_migrate_targets_;
+  static bool write_data_files_;
+  static bool use_io_uring_;
+  static bool direct_io_;
+  static bool stream_upload_;
+  static ChecksumType checksum_type_;
+  static CompressionType compression_type_;
+  static int compression_level_;
+  static int dump_format_version_;
+  static bool key_index_;
+  static bool value_dedup_;
+  static FileFinisher* file_finisher_;
+  static FileFinisher* file_uploader_;
+  static FileFinisher* block_compressor_;
+  static StorageSink* storage_sink_;
+  static UploadJournal* upload_journal_;
+  static RecordDictTrainer* record_dict_trainer_;
+  static std::mutex file_error_mutex_;
+  static Status first_file_error_;
 
   static KeyFilter* kf_;
+  static BaseDumpIndex* base_index_;
 };
 
 
@@ -234,6 +448,14 @@ class MetaBufferSlice : public Slice {
     }
     return nullptr;
   }
+  const char* next_cas_pos() {
+    const char* pos = strstr(pending_data_, "cas=");
+    if (pos && pos < slice_end_) {
+      MarkProcessedUntil(pos + 4); // Skip 'cas='
+      return pos;
+    }
+    return nullptr;
+  }
   const char* next_newline() {
     const char* pos = strstr(pending_data_, "\n");
     if (pos && pos < slice_end_) {
@@ -276,7 +498,8 @@ class DataBufferSlice : public Slice {
     : Slice(d, n),
       parse_state_(ResponseFormatState::VALUE_DELIM),
       pending_data_(d),
-      start_copy_pos_(0) {
+      start_copy_pos_(0),
+      slice_end_(d + n) {
 
   }
 
@@ -297,40 +520,73 @@ class DataBufferSlice : public Slice {
     return size() - start_copy_pos_;
   }
 
+  // All the lookups below are bounded by the end of the slice, since the buffer
+  // we wrap is neither NULL terminated nor guaranteed to end on a response boundary.
+  // memchr() and memmem() are vectorized in glibc, so we lean on them for scanning.
+
   const char* next_value_delim() {
-    //const char* pos = strstr(pending_data_, "VALUE ");
-    int32_t n_pending = bytes_pending();
-    const char* pos = static_cast<const char*>(memmem(pending_data_, n_pending, "VALUE ", 6));
-    if (pos) MarkProcessedUntil(pos + 6); // Skip 'VALUE '
+    size_t n_pending = bytes_pending();
+    const char* pos = nullptr;
+    // Values are laid out back to back, so the next delimiter is almost always
+    // right where we left off. Only search for it if something else is in between.
+    if (n_pending >= MC_VALUE_DELIM_LEN &&
+        memcmp(pending_data_, MC_VALUE_DELIM, MC_VALUE_DELIM_LEN) == 0) {
+      pos = pending_data_;
+    } else {
+      pos = static_cast<const char*>(
+          memmem(pending_data_, n_pending, MC_VALUE_DELIM, MC_VALUE_DELIM_LEN));
+    }
+    if (pos) MarkProcessedUntil(pos + MC_VALUE_DELIM_LEN); // Skip 'VALUE '
     return pos;
   }
   const char* next_whitespace() {
-    const char* pos = strstr(pending_data_, " ");
+    const char* pos = static_cast<const char*>(
+        memchr(pending_data_, ' ', bytes_pending()));
     if (pos) MarkProcessedUntil(pos + 1); // Skip ' '
     return pos;
   }
   const char* next_crlf() {
-    const char* pos = strstr(pending_data_, "\r\n");
-    if (pos) MarkProcessedUntil(pos + 2); // Skip '\r\n'
-    return pos;
+    const char* search_from = pending_data_;
+    while (search_from < slice_end_) {
+      const char* pos = static_cast<const char*>(
+          memchr(search_from, '\r', slice_end_ - search_from));
+      // Either there's no '\r' or it's the last byte and we can't see the '\n' yet.
+      if (pos == nullptr || pos + 1 >= slice_end_) return nullptr;
+      if (pos[1] == '\n') {
+        MarkProcessedUntil(pos + 2); // Skip '\r\n'
+        return pos;
+      }
+      search_from = pos + 1;
+    }
+    return nullptr;
   }
   const char* process_value(size_t value_size) {
-    if (pending_data_ + value_size > data() + size()) {
+    // The value must be followed by its '\r\n' for it to be complete.
+    if (value_size + 2 > bytes_pending()) {
       return nullptr;
     }
-    MarkProcessedUntil(pending_data_ + value_size + 2);
-    return pending_data_ + value_size;
+    const char* value_end = pending_data_ + value_size;
+    MarkProcessedUntil(value_end + 2);
+    return value_end;
+  }
+
+  // Discards up to 'n' bytes from the front of the pending data without parsing
+  // them. Returns the number of bytes actually discarded.
+  size_t skip(size_t n) {
+    size_t n_skip = std::min(n, bytes_pending());
+    pending_data_ += n_skip;
+    return n_skip;
   }
 
   const char* pending_data() { return pending_data_; }
 
-  int32_t bytes_pending() { return &data()[size()] - pending_data_; }
+  size_t bytes_pending() { return slice_end_ - pending_data_; }
 
   bool reached_end() {
-    return !strncmp(&data()[size() - 5], "END\r\n", 5);
+    return size() >= 5 && !strncmp(&data()[size() - 5], "END\r\n", 5);
   }
   bool reached_error() {
-    return !strncmp(&data()[size() - 7], "ERROR\r\n", 7);
+    return size() >= 7 && !strncmp(&data()[size() - 7], "ERROR\r\n", 7);
   }
 
   ResponseFormatState parse_state() { return parse_state_; }
@@ -352,6 +608,9 @@ class DataBufferSlice : public Slice {
   ResponseFormatState parse_state_;
   const char* pending_data_;
   uint32_t start_copy_pos_;
+
+  // Points to the end of the slice.
+  const char* const slice_end_;
 };
 
 } // namespace memcachedumper
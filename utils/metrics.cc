@@ -19,7 +19,12 @@
 #include "utils/memcache_utils.h"
 #include "utils/metrics.h"
 
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
 #include <fstream>
+#include <mutex>
 
 #include <rapidjson/document.h>
 #include <rapidjson/stringbuffer.h>
@@ -34,14 +39,31 @@ std::atomic_uint64_t DumpMetrics::total_keys_processed_ = 0;
 std::atomic_uint64_t DumpMetrics::total_keys_ignored_ = 0;
 std::atomic_uint64_t DumpMetrics::total_keys_missing_ = 0;
 std::atomic_uint64_t DumpMetrics::total_keys_filtered_ = 0;
+std::atomic_uint64_t DumpMetrics::total_keys_unchanged_ = 0;
+std::atomic_uint64_t DumpMetrics::total_tombstones_ = 0;
+std::atomic_uint64_t DumpMetrics::total_dedup_refs_ = 0;
+std::atomic_uint64_t DumpMetrics::total_memcached_waits_ = 0;
+std::atomic_uint64_t DumpMetrics::total_memcached_wait_us_ = 0;
+
+Status DumpMetrics::PersistMetrics() {
+  // Callers would otherwise clobber each other's temporary file.
+  static std::mutex persist_mutex;
+  std::lock_guard<std::mutex> lock(persist_mutex);
 
-void DumpMetrics::PersistMetrics() {
-  std::ofstream ofs;
   std::string fpath = MemcachedUtils::GetDataFinalPath() + METRICS_FILE;
+  std::string tmp_fpath = fpath + ".tmp";
+
   // Open file with the truncate option to clear existing content.
-  ofs.open(fpath, std::ofstream::out | std::ofstream::trunc);
+  std::ofstream ofs;
+  ofs.open(tmp_fpath, std::ofstream::out | std::ofstream::trunc);
   ofs << MetricsAsJsonString();
   ofs.close();
+  if (!ofs) return Status::IOError("Could not write " + tmp_fpath);
+
+  if (rename(tmp_fpath.c_str(), fpath.c_str()) < 0) {
+    return Status::IOError("Could not rename " + tmp_fpath, strerror(errno));
+  }
+  return Status::OK();
 }
 
 std::string DumpMetrics::MetricsAsJsonString() {
@@ -62,6 +84,12 @@ std::string DumpMetrics::MetricsAsJsonString() {
       DumpMetrics::total_keys_ignored(), allocator);
   kv_metrics_obj.AddMember("filtered",
       DumpMetrics::total_keys_filtered(), allocator);
+  kv_metrics_obj.AddMember("unchanged",
+      DumpMetrics::total_keys_unchanged(), allocator);
+  kv_metrics_obj.AddMember("tombstones",
+      DumpMetrics::total_tombstones(), allocator);
+  kv_metrics_obj.AddMember("deduplicated",
+      DumpMetrics::total_dedup_refs(), allocator);
   root.AddMember("keyvalue_metrics", kv_metrics_obj, allocator);
 
   std::string elapsed_str = time_elapsed_str();
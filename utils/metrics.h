@@ -18,6 +18,7 @@
 
 #pragma once
 
+#include "utils/status.h"
 #include "utils/stopwatch.h"
 
 #include <atomic>
@@ -37,6 +38,11 @@ class DumpMetrics {
   static uint64_t total_keys_ignored() { return total_keys_ignored_; }
   static uint64_t total_keys_missing() { return total_keys_missing_; }
   static uint64_t total_keys_filtered() { return total_keys_filtered_; }
+  static uint64_t total_keys_unchanged() { return total_keys_unchanged_; }
+  static uint64_t total_tombstones() { return total_tombstones_; }
+  static uint64_t total_dedup_refs() { return total_dedup_refs_; }
+  static uint64_t total_memcached_waits() { return total_memcached_waits_; }
+  static uint64_t total_memcached_wait_us() { return total_memcached_wait_us_; }
 
   static void increment_total_metadump_keys(uint64_t num_keys) {
     total_metadump_keys_ += num_keys;
@@ -53,9 +59,25 @@ class DumpMetrics {
   static void update_total_keys_filtered(uint64_t num_keys) {
     total_keys_filtered_ = num_keys;
   }
+  static void update_total_keys_unchanged(uint64_t num_keys) {
+    total_keys_unchanged_ = num_keys;
+  }
+  static void update_total_tombstones(uint64_t num_keys) {
+    total_tombstones_ = num_keys;
+  }
+  static void increment_total_dedup_refs(uint64_t num_keys) {
+    total_dedup_refs_ += num_keys;
+  }
+  // Accounts 'wait_us' spent waiting on memcached to respond to a get, or to send
+  // more of the metadump.
+  static void record_memcached_wait(uint64_t wait_us) {
+    ++total_memcached_waits_;
+    total_memcached_wait_us_ += wait_us;
+  }
 
-  // Persist metrics to a file.
-  static void PersistMetrics();
+  // Persist metrics to a file. Readers of the file see either the previous or the
+  // new metrics, never a partial write.
+  static Status PersistMetrics();
 
   // Pretty format the metrics as a JSON string and return it.
   static std::string MetricsAsJsonString();
@@ -79,6 +101,19 @@ class DumpMetrics {
   static std::atomic_uint64_t total_keys_missing_;
   // Metric to track the number of total keys filtered out so far.
   static std::atomic_uint64_t total_keys_filtered_;
+  // Metric to track the number of total keys skipped since they're unchanged from
+  // the base dump (only for delta dumps).
+  static std::atomic_uint64_t total_keys_unchanged_;
+  // Metric to track the number of keys in the base dump that are no longer present
+  // (only for delta dumps).
+  static std::atomic_uint64_t total_tombstones_;
+  // Metric to track the number of keys whose value was written as a reference to
+  // an earlier record with the same value.
+  static std::atomic_uint64_t total_dedup_refs_;
+  // Metrics to track the number of times we waited on memcached, and the total
+  // time spent waiting. Used by the auto scaler to tell if memcached is keeping up.
+  static std::atomic_uint64_t total_memcached_waits_;
+  static std::atomic_uint64_t total_memcached_wait_us_;
 
 };
 
@@ -0,0 +1,203 @@
+/**
+ *
+ *  Copyright 2021 Netflix, Inc.
+ *
+ *     Licensed under the Apache License, Version 2.0 (the "License");
+ *     you may not use this file except in compliance with the License.
+ *     You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *     Unless required by applicable law or agreed to in writing, software
+ *     distributed under the License is distributed on an "AS IS" BASIS,
+ *     WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *     See the License for the specific language governing permissions and
+ *     limitations under the License.
+ *
+ */
+
+#include "utils/multipart_upload.h"
+
+#include "common/logger.h"
+#include "utils/aws_utils.h"
+#include "utils/file_finisher.h"
+#include "utils/memcache_utils.h"
+#include "utils/storage_sink.h"
+
+#include <openssl/evp.h>
+#include <openssl/md5.h>
+#include <string.h>
+
+#include <algorithm>
+
+// Key of the S3 object metadata that holds the MD5 of the object's parts.
+#define PARTS_MD5_METADATA "partsMd5"
+
+namespace memcachedumper {
+
+PartBufferPool::PartBufferPool(const std::vector<uint8_t*>& buffers)
+  : buffers_(buffers) {
+  for (size_t i = 0; i < buffers_.size(); ++i) {
+    free_buffers_.push_back(i);
+  }
+}
+
+int PartBufferPool::Acquire() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  released_cv_.wait(lock, [this] { return !free_buffers_.empty(); });
+  int buf_idx = free_buffers_.back();
+  free_buffers_.pop_back();
+  return buf_idx;
+}
+
+void PartBufferPool::Release(int buf_idx) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_buffers_.push_back(buf_idx);
+  }
+  released_cv_.notify_all();
+}
+
+void PartBufferPool::WaitAllReleased() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  released_cv_.wait(lock, [this] { return free_buffers_.size() == buffers_.size(); });
+}
+
+MultipartUpload::MultipartUpload(const std::string& tmp_filename,
+    std::shared_ptr<PartBufferPool> pool)
+  : tmp_key_(AwsUtils::S3KeyForFile(tmp_filename)),
+    pool_(std::move(pool)),
+    num_parts_(0),
+    parts_in_flight_(0) {
+}
+
+Status MultipartUpload::Begin() {
+  return MemcachedUtils::GetStorageSink()->CreateMultipartUpload(tmp_key_, &upload_id_);
+}
+
+Status MultipartUpload::SubmitPart(int buf_idx, size_t len,
+    std::shared_ptr<FinishGroup> group) {
+  if (num_parts_ == S3_MAX_PARTS) {
+    pool_->Release(buf_idx);
+    return Status::InvalidArgument("Too many parts for a multipart upload", tmp_key_);
+  }
+  int part_num = ++num_parts_;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    parts_.resize(part_num);
+    ++parts_in_flight_;
+  }
+
+  std::shared_ptr<MultipartUpload> self = shared_from_this();
+  auto upload_part = [self, part_num, buf_idx, len]() {
+    Status s = self->UploadPart(part_num, self->pool_->buffer(buf_idx), len);
+    self->pool_->Release(buf_idx);
+    {
+      std::lock_guard<std::mutex> lock(self->mutex_);
+      if (!s.ok() && self->first_error_.ok()) self->first_error_ = s;
+      --self->parts_in_flight_;
+    }
+    self->part_done_cv_.notify_all();
+    return s;
+  };
+
+  FileFinisher* uploader = MemcachedUtils::GetFileUploader();
+  if (uploader == nullptr) return upload_part();
+  uploader->Submit(upload_part, group);
+  return Status::OK();
+}
+
+Status MultipartUpload::UploadPart(int part_num, const uint8_t* buf, size_t len) {
+  uint8_t md5[MD5_DIGEST_LENGTH];
+  EVP_Digest(buf, len, md5, nullptr, EVP_md5(), nullptr);
+
+  std::string etag;
+  RETURN_ON_ERROR(MemcachedUtils::GetStorageSink()->UploadPart(tmp_key_, upload_id_,
+      part_num, buf, len, md5, &etag));
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  Part& part = parts_[part_num - 1];
+  part.etag = etag;
+  memcpy(part.md5, md5, MD5_DIGEST_LENGTH);
+  return Status::OK();
+}
+
+Status MultipartUpload::Complete(const std::string& filename,
+    const std::string& checksum_hex, std::shared_ptr<FinishGroup> group) {
+  Status status;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    part_done_cv_.wait(lock, [this] { return parts_in_flight_ == 0; });
+    status = first_error_;
+  }
+  if (!status.ok()) {
+    Abort();
+    return status;
+  }
+
+  // The parts' MD5s roll up the same way as S3 does for the object's ETag.
+  std::vector<std::string> part_etags;
+  std::vector<std::string> part_md5s;
+  for (const Part& part : parts_) {
+    part_etags.push_back(part.etag);
+    part_md5s.push_back(StorageSink::MD5ETag(part.md5));
+  }
+  std::string parts_md5_str = StorageSink::MultipartETag(part_md5s);
+  parts_md5_str.erase(std::remove(parts_md5_str.begin(), parts_md5_str.end(), '"'),
+      parts_md5_str.end());
+
+  std::string etag;
+  Status s = MemcachedUtils::GetStorageSink()->CompleteMultipartUpload(tmp_key_,
+      upload_id_, part_etags, &etag);
+  if (!s.ok()) {
+    Abort();
+    return s;
+  }
+
+  // Every part was already checked against its MD5. The ETag isn't an MD5 with
+  // some kinds of server side encryption, so a mismatch is only logged.
+  if (etag.find(parts_md5_str) == std::string::npos) {
+    LOG_ERROR("ETag of {0} does not match its parts: {1} != {2}", tmp_key_, etag,
+        parts_md5_str);
+  }
+
+  return Publish(filename, parts_md5_str, checksum_hex, group);
+}
+
+Status MultipartUpload::Publish(const std::string& filename,
+    const std::string& parts_md5, const std::string& checksum_hex,
+    std::shared_ptr<FinishGroup> group) {
+  StorageSink* sink = MemcachedUtils::GetStorageSink();
+  std::string key = AwsUtils::S3KeyForFile(filename);
+  std::string file_uri = sink->ObjectUri(key);
+
+  std::string obj_md_string;
+  RETURN_ON_ERROR(AwsUtils::SQSBodyForS3(file_uri, &obj_md_string));
+  ObjectMetadata metadata;
+  metadata.emplace(CACHE_DUMP_CHUNK_JSON, obj_md_string);
+  metadata.emplace(PARTS_MD5_METADATA, parts_md5);
+  if (!checksum_hex.empty()) {
+    metadata.emplace(FILE_CHECKSUM_METADATA, AwsUtils::FileChecksumMetadata(checksum_hex));
+  }
+
+  RETURN_ON_ERROR(sink->CopyObject(tmp_key_, key, metadata));
+
+  Status s = sink->DeleteObject(tmp_key_);
+  if (!s.ok()) {
+    // Harmless apart from the space it takes up; the file is already published.
+    LOG_ERROR("Could not delete {0}: {1}", tmp_key_, s.ToString());
+  }
+  LOG("Successfully uploaded {0} in {1} parts. Sending SQS notification...",
+      filename, parts_.size());
+
+  return AwsUtils::SendSQSNotification(file_uri, group);
+}
+
+void MultipartUpload::Abort() {
+  Status s = MemcachedUtils::GetStorageSink()->AbortMultipartUpload(tmp_key_, upload_id_);
+  if (!s.ok()) {
+    LOG_ERROR("Could not abort multipart upload of {0}: {1}", tmp_key_, s.ToString());
+  }
+}
+
+} // namespace memcachedumper
@@ -0,0 +1,134 @@
+/**
+ *
+ *  Copyright 2021 Netflix, Inc.
+ *
+ *     Licensed under the Apache License, Version 2.0 (the "License");
+ *     you may not use this file except in compliance with the License.
+ *     You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *     Unless required by applicable law or agreed to in writing, software
+ *     distributed under the License is distributed on an "AS IS" BASIS,
+ *     WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *     See the License for the specific language governing permissions and
+ *     limitations under the License.
+ *
+ */
+
+#pragma once
+
+#include "utils/status.h"
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// S3's limits on multipart uploads: every part but the last must be at least
+// S3_MIN_PART_SIZE bytes, and there can be at most S3_MAX_PARTS of them.
+#define S3_MIN_PART_SIZE (5 * 1024 * 1024)
+#define S3_MAX_PARTS 10000
+
+// Largest object S3 can copy in a single request.
+#define S3_MAX_COPY_SIZE (5ULL * 1024 * 1024 * 1024)
+
+// Number of part buffers each writer streams through: one being filled while
+// the others are uploaded.
+#define STREAM_UPLOAD_PART_BUFFERS 3
+
+namespace memcachedumper {
+
+class FinishGroup;
+
+/// The buffers a writer fills parts in. A buffer is acquired by the writer and
+/// released once the part in it is uploaded.
+class PartBufferPool {
+ public:
+  explicit PartBufferPool(const std::vector<uint8_t*>& buffers);
+
+  uint8_t* buffer(int buf_idx) { return buffers_[buf_idx]; }
+
+  // Returns the index of a free buffer, waiting for one if needed.
+  int Acquire();
+  void Release(int buf_idx);
+
+  // Waits until every buffer is released.
+  void WaitAllReleased();
+
+ private:
+  std::vector<uint8_t*> buffers_;
+
+  std::mutex mutex_;
+  // Signalled when a buffer is released.
+  std::condition_variable released_cv_;
+  std::vector<int> free_buffers_;
+};
+
+/// Streams a data file to the storage sink (see MemcachedUtils::GetStorageSink())
+/// as a multipart upload, one part per filled buffer, so that it never has to be
+/// written to local disk.
+///
+/// The parts go to a temporary object, since the file's final name depends on its
+/// checksum. Complete() copies it over to its final name with the same metadata
+/// as a file uploaded with S3UploadFileTask, plus the MD5 of its parts.
+class MultipartUpload : public std::enable_shared_from_this<MultipartUpload> {
+ public:
+  // Uploads to the object for 'tmp_filename' (see AwsUtils::S3KeyForFile()).
+  MultipartUpload(const std::string& tmp_filename, std::shared_ptr<PartBufferPool> pool);
+
+  // Starts the multipart upload.
+  Status Begin();
+
+  int num_parts() { return num_parts_; }
+
+  // Uploads the first 'len' bytes of buffer 'buf_idx' of the pool as the next part,
+  // and releases the buffer once done. That happens on an uploader thread (see
+  // MemcachedUtils::GetFileUploader()) if there are any, accounted to 'group'.
+  // Parts may complete in any order.
+  Status SubmitPart(int buf_idx, size_t len, std::shared_ptr<FinishGroup> group);
+
+  // Waits for every part, completes the upload, publishes it as 'filename' and
+  // sends its SQS notification (see AwsUtils::SendSQSNotification() for
+  // 'group'). 'checksum_hex' is stored with it if not empty (see
+  // FILE_CHECKSUM_METADATA). Aborts the upload on failure.
+  Status Complete(const std::string& filename, const std::string& checksum_hex,
+      std::shared_ptr<FinishGroup> group);
+
+  // Gives up on the upload, discarding the parts uploaded so far.
+  void Abort();
+
+ private:
+  struct Part {
+    std::string etag;
+    // MD5 digest of the part's contents.
+    uint8_t md5[16];
+  };
+
+  // Uploads part number 'part_num' (starting at 1) from 'buf'.
+  Status UploadPart(int part_num, const uint8_t* buf, size_t len);
+
+  // Copies the completed upload to 'filename' with its metadata, and removes the
+  // temporary object.
+  Status Publish(const std::string& filename, const std::string& parts_md5,
+      const std::string& checksum_hex, std::shared_ptr<FinishGroup> group);
+
+  const std::string tmp_key_;
+  std::shared_ptr<PartBufferPool> pool_;
+  std::string upload_id_;
+  // Number of parts submitted so far.
+  int num_parts_;
+
+  std::mutex mutex_;
+  // Signalled when a part upload completes.
+  std::condition_variable part_done_cv_;
+  // Indexed by part number - 1. Protected by 'mutex_'.
+  std::vector<Part> parts_;
+  int parts_in_flight_;
+  Status first_error_;
+};
+
+} // namespace memcachedumper
@@ -0,0 +1,176 @@
+/**
+ *
+ *  Copyright 2021 Netflix, Inc.
+ *
+ *     Licensed under the Apache License, Version 2.0 (the "License");
+ *     you may not use this file except in compliance with the License.
+ *     You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *     Unless required by applicable law or agreed to in writing, software
+ *     distributed under the License is distributed on an "AS IS" BASIS,
+ *     WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *     See the License for the specific language governing permissions and
+ *     limitations under the License.
+ *
+ */
+
+#include "utils/numa_topology.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <experimental/filesystem>
+#include <fstream>
+#include <set>
+#include <sstream>
+
+namespace fs = std::experimental::filesystem;
+
+namespace memcachedumper {
+
+namespace {
+
+// The node that the calling thread was last pinned to.
+thread_local int tls_numa_node = -1;
+
+} // anonymous namespace
+
+Status NumaTopology::ParseCpuList(const std::string& cpu_list, std::vector<int>* out_cpus) {
+  std::stringstream list_stream(cpu_list);
+  std::string range;
+  while (std::getline(list_stream, range, ',')) {
+    range.erase(std::remove_if(range.begin(), range.end(), ::isspace), range.end());
+    if (range.empty()) continue;
+
+    char* end;
+    long first = strtol(range.c_str(), &end, 10);
+    long last = first;
+    if (*end == '-') last = strtol(end + 1, &end, 10);
+    if (*end != '\0' || first < 0 || last < first || last >= CPU_SETSIZE) {
+      return Status::InvalidArgument("Bad CPU list", cpu_list);
+    }
+    for (long cpu = first; cpu <= last; ++cpu) {
+      out_cpus->push_back(static_cast<int>(cpu));
+    }
+  }
+  return Status::OK();
+}
+
+Status NumaTopology::Discover(const std::string& task_cpus,
+    const std::string& excluded_cpus, bool per_node,
+    std::unique_ptr<NumaTopology>* out_topology) {
+  std::vector<int> allowed_cpus;
+  if (task_cpus.empty()) {
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    if (sched_getaffinity(0, sizeof(cpu_set), &cpu_set) != 0) {
+      return Status::IOError("Could not get the CPU affinity", strerror(errno));
+    }
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+      if (CPU_ISSET(cpu, &cpu_set)) allowed_cpus.push_back(cpu);
+    }
+  } else {
+    RETURN_ON_ERROR(ParseCpuList(task_cpus, &allowed_cpus));
+  }
+
+  std::vector<int> excluded;
+  RETURN_ON_ERROR(ParseCpuList(excluded_cpus, &excluded));
+  std::set<int> usable_cpus(allowed_cpus.begin(), allowed_cpus.end());
+  for (int cpu : excluded) usable_cpus.erase(cpu);
+  if (usable_cpus.empty()) {
+    return Status::InvalidArgument("No CPUs left for the task threads", task_cpus);
+  }
+
+  // The kernel lists every node as a "node<id>" directory with a "cpulist" file.
+  std::vector<std::pair<int, std::vector<int>>> nodes;
+  std::error_code ec;
+  if (fs::is_directory(SYSFS_NODE_PATH, ec)) {
+    for (auto& entry : fs::directory_iterator(SYSFS_NODE_PATH)) {
+      std::string name = entry.path().filename();
+      if (name.rfind("node", 0) != 0 || name.size() == 4 ||
+          name.find_first_not_of("0123456789", 4) != std::string::npos) {
+        continue;
+      }
+
+      std::ifstream cpulist_file(entry.path() / "cpulist");
+      std::string cpulist;
+      std::getline(cpulist_file, cpulist);
+      std::vector<int> node_cpus;
+      RETURN_ON_ERROR(ParseCpuList(cpulist, &node_cpus));
+      nodes.emplace_back(atoi(name.c_str() + 4), std::move(node_cpus));
+    }
+  }
+  std::sort(nodes.begin(), nodes.end());
+  // Without NUMA, all the CPUs are on one node.
+  if (nodes.empty()) nodes.emplace_back(0, allowed_cpus);
+
+  std::unique_ptr<NumaTopology> topology(new NumaTopology(per_node));
+  for (auto& node : nodes) {
+    std::vector<int> node_cpus;
+    for (int cpu : node.second) {
+      if (usable_cpus.count(cpu) > 0) node_cpus.push_back(cpu);
+    }
+    if (node_cpus.empty()) continue;
+
+    if (!per_node && !topology->node_cpus_.empty()) {
+      topology->node_cpus_[0].insert(topology->node_cpus_[0].end(), node_cpus.begin(),
+          node_cpus.end());
+      continue;
+    }
+    topology->node_ids_.push_back(node.first);
+    topology->node_cpus_.push_back(std::move(node_cpus));
+  }
+  if (topology->node_cpus_.empty()) {
+    return Status::InvalidArgument("None of the task CPUs are on a NUMA node", task_cpus);
+  }
+
+  *out_topology = std::move(topology);
+  return Status::OK();
+}
+
+Status NumaTopology::PinThread(const std::vector<int>& cpus) {
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  for (int cpu : cpus) CPU_SET(cpu, &cpu_set);
+  int ret = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set);
+  if (ret != 0) {
+    return Status::IOError("Could not set the CPU affinity", strerror(ret));
+  }
+  return Status::OK();
+}
+
+Status NumaTopology::PinTaskThread(int thread_idx) {
+  return PinToNode(NodeForThread(thread_idx));
+}
+
+Status NumaTopology::PinToNode(int node) {
+  RETURN_ON_ERROR(PinThread(node_cpus_[node]));
+  tls_numa_node = node;
+  return Status::OK();
+}
+
+int NumaTopology::CurrentNode() {
+  return tls_numa_node;
+}
+
+std::string NumaTopology::ToString() {
+  std::stringstream out;
+  for (int i = 0; i < num_nodes(); ++i) {
+    if (i > 0) out << "; ";
+    if (per_node_) out << "node " << node_ids_[i] << ": ";
+    for (size_t j = 0; j < node_cpus_[i].size(); ++j) {
+      if (j > 0) out << ",";
+      out << node_cpus_[i][j];
+    }
+  }
+  return out.str();
+}
+
+} // namespace memcachedumper
@@ -0,0 +1,82 @@
+/**
+ *
+ *  Copyright 2021 Netflix, Inc.
+ *
+ *     Licensed under the Apache License, Version 2.0 (the "License");
+ *     you may not use this file except in compliance with the License.
+ *     You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *     Unless required by applicable law or agreed to in writing, software
+ *     distributed under the License is distributed on an "AS IS" BASIS,
+ *     WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *     See the License for the specific language governing permissions and
+ *     limitations under the License.
+ *
+ */
+
+#pragma once
+
+#include "utils/status.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// Where the kernel lists the NUMA nodes and their CPUs.
+#define SYSFS_NODE_PATH "/sys/devices/system/node/"
+
+namespace memcachedumper {
+
+/// The CPUs that task threads may run on, grouped by NUMA node.
+///
+/// Task threads are pinned to the CPUs of one node each, going round the nodes
+/// by thread index, or to all of them if the nodes aren't kept apart. A thread
+/// pinned to a node can then be handed buffers allocated on it (see
+/// MemoryManager).
+class NumaTopology {
+ public:
+  // Reads the nodes from sysfs and keeps the CPUs that are in 'task_cpus' (all
+  // the ones we may run on if empty) and not in 'excluded_cpus'. Both are in the
+  // kernel's list format, eg. "0-7,16-23". Hosts without NUMA have a single node.
+  // If 'per_node' is false, every thread is pinned to all the CPUs.
+  static Status Discover(const std::string& task_cpus, const std::string& excluded_cpus,
+      bool per_node, std::unique_ptr<NumaTopology>* out_topology);
+
+  // Parses a CPU list such as "0-7,16-23" into 'out_cpus'.
+  static Status ParseCpuList(const std::string& cpu_list, std::vector<int>* out_cpus);
+
+  // Number of nodes with CPUs left for task threads.
+  int num_nodes() { return static_cast<int>(node_cpus_.size()); }
+
+  // The node that the task thread 'thread_idx' is pinned to.
+  int NodeForThread(int thread_idx) { return per_node_ ? thread_idx % num_nodes() : 0; }
+
+  // Pins the calling thread to the CPUs of the task thread 'thread_idx'.
+  Status PinTaskThread(int thread_idx);
+
+  // Pins the calling thread to the CPUs of 'node'. CurrentNode() then returns it.
+  Status PinToNode(int node);
+
+  // The node that the calling thread was last pinned to, or -1 if it wasn't.
+  static int CurrentNode();
+
+  // Lists the nodes and their CPUs, for logging.
+  std::string ToString();
+
+ private:
+  NumaTopology(bool per_node) : per_node_(per_node) {}
+
+  // Pins the calling thread to 'cpus'.
+  static Status PinThread(const std::vector<int>& cpus);
+
+  bool per_node_;
+  // Ids of the nodes, as numbered by the kernel.
+  std::vector<int> node_ids_;
+  // CPUs of every node that task threads may run on. If 'per_node_' is false,
+  // there's a single entry with all of them.
+  std::vector<std::vector<int>> node_cpus_;
+};
+
+} // namespace memcachedumper
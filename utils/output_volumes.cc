@@ -0,0 +1,75 @@
+/**
+ *
+ *  Copyright 2021 Netflix, Inc.
+ *
+ *     Licensed under the Apache License, Version 2.0 (the "License");
+ *     you may not use this file except in compliance with the License.
+ *     You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *     Unless required by applicable law or agreed to in writing, software
+ *     distributed under the License is distributed on an "AS IS" BASIS,
+ *     WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *     See the License for the specific language governing permissions and
+ *     limitations under the License.
+ *
+ */
+
+#include "utils/output_volumes.h"
+
+#include "utils/file_util.h"
+
+#include <assert.h>
+
+namespace memcachedumper {
+
+OutputVolumes::OutputVolumes(const std::vector<std::string>& dir_paths) {
+  assert(!dir_paths.empty());
+  for (const std::string& dir_path : dir_paths) {
+    volumes_.push_back({dir_path, 0});
+  }
+}
+
+std::string OutputVolumes::KeyFilePath(int volume) const {
+  return volumes_[volume].dir_path + "/keyfile/";
+}
+
+std::string OutputVolumes::DataStagingPath(int volume) const {
+  return volumes_[volume].dir_path + "/datafiles_staging/";
+}
+
+std::string OutputVolumes::DataFinalPath(int volume) const {
+  return volumes_[volume].dir_path + "/datafiles_completed/";
+}
+
+int OutputVolumes::Acquire() {
+  std::lock_guard<std::mutex> lock(volumes_mutex_);
+  int best = 0;
+  if (volumes_.size() > 1) {
+    uint64_t best_score = 0;
+    for (size_t i = 0; i < volumes_.size(); ++i) {
+      uint64_t score = FileUtils::GetSpaceAvailable(volumes_[i].dir_path) /
+          (volumes_[i].queue_depth + 1);
+      if (score > best_score) {
+        best_score = score;
+        best = i;
+      }
+    }
+  }
+  ++volumes_[best].queue_depth;
+  return best;
+}
+
+void OutputVolumes::Release(int volume) {
+  std::lock_guard<std::mutex> lock(volumes_mutex_);
+  assert(volumes_[volume].queue_depth > 0);
+  --volumes_[volume].queue_depth;
+}
+
+int OutputVolumes::queue_depth(int volume) {
+  std::lock_guard<std::mutex> lock(volumes_mutex_);
+  return volumes_[volume].queue_depth;
+}
+
+} // namespace memcachedumper
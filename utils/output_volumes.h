@@ -0,0 +1,70 @@
+/**
+ *
+ *  Copyright 2021 Netflix, Inc.
+ *
+ *     Licensed under the Apache License, Version 2.0 (the "License");
+ *     you may not use this file except in compliance with the License.
+ *     You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *     Unless required by applicable law or agreed to in writing, software
+ *     distributed under the License is distributed on an "AS IS" BASIS,
+ *     WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *     See the License for the specific language governing permissions and
+ *     limitations under the License.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace memcachedumper {
+
+/// The output directories a dump is spread across, usually one per device.
+///
+/// The first one is the primary volume: it holds the key files, checkpoints and
+/// everything else that isn't a data file. Data files go to whichever volume
+/// Acquire() picks when they're opened.
+class OutputVolumes {
+ public:
+  explicit OutputVolumes(const std::vector<std::string>& dir_paths);
+
+  int size() const { return static_cast<int>(volumes_.size()); }
+  const std::string& dir_path(int volume) const { return volumes_[volume].dir_path; }
+
+  // Paths of the key file, data staging and completed data file directories of
+  // 'volume', with a trailing '/'.
+  std::string KeyFilePath(int volume) const;
+  std::string DataStagingPath(int volume) const;
+  std::string DataFinalPath(int volume) const;
+
+  // Picks the volume to write the next data file to, and counts it as being
+  // written to until Release() is called with it.
+  //
+  // Favors the volume with the most free space per file already being written to
+  // or completed on it, so that a slow or filling device gets fewer files.
+  int Acquire();
+
+  // Notes that a data file written to 'volume' is complete.
+  void Release(int volume);
+
+  // Number of data files being written to or completed on 'volume'.
+  int queue_depth(int volume);
+
+ private:
+  struct Volume {
+    std::string dir_path;
+    int queue_depth;
+  };
+
+  std::mutex volumes_mutex_;
+  std::vector<Volume> volumes_;
+};
+
+} // namespace memcachedumper
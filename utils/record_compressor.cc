@@ -0,0 +1,188 @@
+/**
+ *
+ *  Copyright 2021 Netflix, Inc.
+ *
+ *     Licensed under the Apache License, Version 2.0 (the "License");
+ *     you may not use this file except in compliance with the License.
+ *     You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *     Unless required by applicable law or agreed to in writing, software
+ *     distributed under the License is distributed on an "AS IS" BASIS,
+ *     WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *     See the License for the specific language governing permissions and
+ *     limitations under the License.
+ *
+ */
+
+#include "common/logger.h"
+#include "utils/file_util.h"
+#include "utils/memcache_utils.h"
+#include "utils/record_compressor.h"
+
+#ifdef HAVE_ZSTD
+#include <zdict.h>
+#include <zstd.h>
+#endif
+
+#include <sys/uio.h>
+
+#include <algorithm>
+#include <memory>
+
+namespace memcachedumper {
+
+struct RecordDictionary {
+  ~RecordDictionary() {
+#ifdef HAVE_ZSTD
+    ZSTD_freeCDict(cdict);
+#endif
+  }
+
+  std::string data;
+  uint32_t id = 0;
+#ifdef HAVE_ZSTD
+  ZSTD_CDict* cdict = nullptr;
+#endif
+};
+
+RecordDictTrainer::RecordDictTrainer(int level)
+  : level_(level),
+    state_(State::SAMPLING),
+    dict_(nullptr) {
+  samples_.reserve(RECORD_DICT_SAMPLE_BYTES + RECORD_DICT_MAX_SAMPLE_LEN);
+}
+
+RecordDictTrainer::~RecordDictTrainer() {
+  delete dict_.load();
+}
+
+void RecordDictTrainer::AddSample(const char* value, size_t len) {
+  if (!sampling()) return;
+
+  {
+    std::lock_guard<std::mutex> lock(sample_mutex_);
+    if (state_ != State::SAMPLING) return;
+
+    size_t sample_len = std::min(len, static_cast<size_t>(RECORD_DICT_MAX_SAMPLE_LEN));
+    if (sample_len == 0) return;
+    samples_.append(value, sample_len);
+    sample_lens_.push_back(sample_len);
+    if (samples_.size() < RECORD_DICT_SAMPLE_BYTES) return;
+
+    // We're the ones to train. Nobody touches the sample from here on.
+    state_ = State::TRAINING;
+  }
+
+  Status s = Train();
+  if (!s.ok()) {
+    LOG_ERROR("Could not train the record compression dictionary. Records will be "
+        "stored uncompressed. (Status: {0})", s.ToString());
+  }
+
+  // Free the sample.
+  std::string().swap(samples_);
+  std::vector<size_t>().swap(sample_lens_);
+  state_ = State::DONE;
+}
+
+Status RecordDictTrainer::Train() {
+#ifdef HAVE_ZSTD
+  std::unique_ptr<RecordDictionary> dict(new RecordDictionary());
+  dict->data.resize(RECORD_DICT_SIZE);
+  size_t dict_len = ZDICT_trainFromBuffer(&dict->data[0], dict->data.size(),
+      samples_.data(), sample_lens_.data(), sample_lens_.size());
+  if (ZDICT_isError(dict_len)) {
+    return Status::InvalidArgument("ZDICT_trainFromBuffer failed",
+        ZDICT_getErrorName(dict_len));
+  }
+  dict->data.resize(dict_len);
+  dict->id = ZDICT_getDictID(dict->data.data(), dict->data.size());
+  dict->cdict = ZSTD_createCDict(dict->data.data(), dict->data.size(), level_);
+  if (dict->cdict == nullptr) return Status::OutOfMemoryError("ZSTD_createCDict failed");
+  LOG("Trained record compression dictionary {0} ({1} bytes) on {2} values.",
+      dict->id, dict->data.size(), sample_lens_.size());
+
+  // Written like a data file, so that it's moved and uploaded along with them.
+  RotatingFile dict_file(
+      MemcachedUtils::GetDataStagingPath(),
+      MemcachedUtils::DictFilePrefix() + std::to_string(dict->id),
+      UINT64_MAX,
+      MemcachedUtils::GetDataFinalPath(),
+      true /* suffix checksum */,
+      MemcachedUtils::GetStorageSink() != nullptr /* Upload the file on close */);
+  RETURN_ON_ERROR(dict_file.Init());
+
+  struct iovec iov;
+  iov.iov_base = &dict->data[0];
+  iov.iov_len = dict->data.size();
+  ssize_t nwritten = 0;
+  RETURN_ON_ERROR(dict_file.WriteV(&iov, 1, &nwritten));
+
+  // Only start compressing with the dictionary once it's safely in the dump.
+  RecordDictionary* completed_dict = dict.release();
+  return dict_file.Finish([this, completed_dict](Status status) {
+    if (!status.ok()) {
+      LOG_ERROR("Could not write the record compression dictionary. Records will be "
+          "stored uncompressed. (Status: {0})", status.ToString());
+      delete completed_dict;
+      return;
+    }
+    dict_.store(completed_dict, std::memory_order_release);
+  });
+#else
+  return Status::NotSupported("Not built with zstd support");
+#endif
+}
+
+RecordCompressor::RecordCompressor(RecordDictTrainer* trainer)
+  : trainer_(trainer),
+    dict_(nullptr),
+    cctx_(nullptr) {
+#ifdef HAVE_ZSTD
+  cctx_ = ZSTD_createCCtx();
+#endif
+}
+
+RecordCompressor::~RecordCompressor() {
+#ifdef HAVE_ZSTD
+  ZSTD_freeCCtx(cctx_);
+#endif
+}
+
+void RecordCompressor::UpdateDictionary() {
+  if (dict_ == nullptr) dict_ = trainer_->dictionary();
+}
+
+size_t RecordCompressor::MaxCompressedLen(size_t len) {
+  if (dict_ == nullptr) return 0;
+#ifdef HAVE_ZSTD
+  return ZSTD_compressBound(len);
+#else
+  return 0;
+#endif
+}
+
+Status RecordCompressor::Compress(const char* value, size_t len, char* dst,
+    size_t dst_cap, uint32_t* out_dict_id, size_t* out_len) {
+  *out_dict_id = 0;
+  *out_len = len;
+  if (dict_ == nullptr) return Status::OK();
+
+#ifdef HAVE_ZSTD
+  if (cctx_ == nullptr) return Status::OutOfMemoryError("ZSTD_createCCtx failed");
+  size_t ret = ZSTD_compress_usingCDict(cctx_, dst, dst_cap, value, len, dict_->cdict);
+  if (ZSTD_isError(ret)) {
+    return Status::IOError("ZSTD_compress_usingCDict failed", ZSTD_getErrorName(ret));
+  }
+  // Values that don't shrink are stored as is.
+  if (ret < len) {
+    *out_dict_id = dict_->id;
+    *out_len = ret;
+  }
+#endif
+  return Status::OK();
+}
+
+} // namespace memcachedumper
@@ -0,0 +1,120 @@
+/**
+ *
+ *  Copyright 2021 Netflix, Inc.
+ *
+ *     Licensed under the Apache License, Version 2.0 (the "License");
+ *     you may not use this file except in compliance with the License.
+ *     You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *     Unless required by applicable law or agreed to in writing, software
+ *     distributed under the License is distributed on an "AS IS" BASIS,
+ *     WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *     See the License for the specific language governing permissions and
+ *     limitations under the License.
+ *
+ */
+
+#pragma once
+
+#include "utils/status.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Size of the dictionary trained for compressing records. zstd's default.
+#define RECORD_DICT_SIZE (110 * 1024)
+
+// Bytes of values to train the dictionary on. zstd recommends ~100x the size of
+// the dictionary.
+#define RECORD_DICT_SAMPLE_BYTES (100 * RECORD_DICT_SIZE)
+
+// Only this much of each value is sampled.
+#define RECORD_DICT_MAX_SAMPLE_LEN (16 * 1024)
+
+// zstd's opaque compression context.
+struct ZSTD_CCtx_s;
+
+namespace memcachedumper {
+
+struct RecordDictionary;
+
+/// Trains a zstd dictionary on the values of the first records dumped, and shares
+/// it with every thread's RecordCompressor. Records written before it is trained
+/// are stored uncompressed.
+///
+/// Once trained, the dictionary is written to a 'dict_' file alongside the data
+/// files, and is only handed out once that file is complete, so that no record
+/// refers to a dictionary that isn't in the dump.
+class RecordDictTrainer {
+ public:
+  // 'level' is the zstd compression level, 0 for the default.
+  RecordDictTrainer(int level);
+  ~RecordDictTrainer();
+
+  // Returns 'true' while values are still being sampled.
+  bool sampling() { return state_.load(std::memory_order_relaxed) == State::SAMPLING; }
+
+  // Adds (a prefix of) 'value' to the training sample. The call that fills up
+  // the sample trains the dictionary.
+  void AddSample(const char* value, size_t len);
+
+  // Returns the trained dictionary, or nullptr if it's not ready (yet).
+  const RecordDictionary* dictionary() { return dict_.load(std::memory_order_acquire); }
+
+ private:
+  enum class State {
+    SAMPLING,
+    TRAINING,
+    DONE
+  };
+
+  // Trains the dictionary on the sample and writes it out.
+  Status Train();
+
+  int level_;
+  std::atomic<State> state_;
+
+  std::mutex sample_mutex_;
+  // The sampled values back to back, and the length of each.
+  std::string samples_;
+  std::vector<size_t> sample_lens_;
+
+  std::atomic<const RecordDictionary*> dict_;
+};
+
+/// Compresses the values of records with the trained dictionary. Each writing
+/// thread has its own.
+class RecordCompressor {
+ public:
+  RecordCompressor(RecordDictTrainer* trainer);
+  ~RecordCompressor();
+
+  // Picks up the dictionary if it has been trained since the last call. The
+  // other calls see the same dictionary until this is called again.
+  void UpdateDictionary();
+
+  // Returns the largest size that a value of 'len' bytes can compress to. 0 if
+  // there is no dictionary to compress with.
+  size_t MaxCompressedLen(size_t len);
+
+  // Compresses 'len' bytes of 'value' into 'dst', which has room for 'dst_cap'
+  // bytes. Returns the ID of the dictionary used in 'out_dict_id' and the
+  // compressed length in 'out_len'. 'out_dict_id' is 0 if the value should be
+  // stored as is, ie. when there's no dictionary or it didn't compress.
+  Status Compress(const char* value, size_t len, char* dst, size_t dst_cap,
+      uint32_t* out_dict_id, size_t* out_len);
+
+ private:
+  RecordDictTrainer* trainer_;
+  const RecordDictionary* dict_;
+  ZSTD_CCtx_s* cctx_;
+};
+
+} // namespace memcachedumper
@@ -125,6 +125,29 @@ Status Socket::Send(const uint8_t* buf, size_t len, int32_t *nbytes_sent) {
   return Status::OK();
 }
 
+Status Socket::SendV(struct iovec* iovecs, int n_iovecs) {
+  while (n_iovecs > 0) {
+    ssize_t nbytes;
+    RETRY_ON_EINTR(nbytes, writev(fd_, iovecs, n_iovecs));
+    if (nbytes < 0) {
+      return Status::NetworkError("Send error", strerror(errno));
+    }
+
+    // Skip past what was sent and resume from the middle of a partially sent iovec.
+    while (n_iovecs > 0 && static_cast<size_t>(nbytes) >= iovecs->iov_len) {
+      nbytes -= iovecs->iov_len;
+      ++iovecs;
+      --n_iovecs;
+    }
+    if (n_iovecs > 0) {
+      iovecs->iov_base = static_cast<uint8_t*>(iovecs->iov_base) + nbytes;
+      iovecs->iov_len -= nbytes;
+    }
+  }
+
+  return Status::OK();
+}
+
 Status Socket::Close() {
   if (fd_ < 0) return Status::OK();
 
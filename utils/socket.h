@@ -24,6 +24,7 @@
 #include <cstddef>
 #include <cstdint>
 #include <poll.h>
+#include <sys/uio.h>
 
 namespace memcachedumper {
 
@@ -37,6 +38,9 @@ class Socket {
   Status Connect(const Sockaddr& remote_addr);
   Status Recv(uint8_t* buf, size_t len, int32_t *nbytes_read);
   Status Send(const uint8_t* buf, size_t len, int32_t *nbytes_sent);
+  // Sends everything in 'iovecs' unless there's an error. Note that 'iovecs' may be
+  // modified to account for partial sends.
+  Status SendV(struct iovec* iovecs, int n_iovecs);
   Status Close();
   Status Refresh();
 
@@ -21,6 +21,7 @@
 #include "common/logger.h"
 
 #include <iostream>
+#include <memory>
 #include <sstream>
 
 namespace memcachedumper {
@@ -28,21 +29,38 @@ namespace memcachedumper {
 SocketPool::SocketPool(std::string_view hostname, int port, int num_sockets)
   : hostname_(hostname),
     port_(port),
-    num_sockets_(num_sockets) {
+    num_sockets_(num_sockets),
+    num_open_(0) {
   sockets_.reserve(num_sockets_);
 }
 
+Status SocketPool::OpenSocket(Socket** out_sock) {
+  std::unique_ptr<Socket> sock(new Socket());
+  RETURN_ON_ERROR(sock->Create());
+
+  // TODO: Make configurable if necessary.
+  RETURN_ON_ERROR(sock->SetRecvTimeout(2));
+  RETURN_ON_ERROR(sock->Connect(sockaddr_));
+  *out_sock = sock.release();
+  return Status::OK();
+}
+
+void SocketPool::CloseSocket(Socket* sock) {
+  Status s = sock->Close();
+  if (!s.ok()) {
+    LOG_ERROR("Could not close memcached socket. (Status: {0})", s.ToString());
+  }
+  delete sock;
+}
+
 Status SocketPool::PrimeConnections() {
   RETURN_ON_ERROR(sockaddr_.ResolveAndPopulateSockaddr(hostname_, port_));
 
   for (size_t i = 0; i < num_sockets_; ++i) {
-    sockets_.push_back(new Socket());
-    Socket *sock = sockets_[i];
-    RETURN_ON_ERROR(sock->Create());
-
-    // TODO: Make configurable if necessary.
-    RETURN_ON_ERROR(sock->SetRecvTimeout(2));
-    RETURN_ON_ERROR(sock->Connect(sockaddr_));
+    Socket* sock;
+    RETURN_ON_ERROR(OpenSocket(&sock));
+    sockets_.push_back(sock);
+    ++num_open_;
   }
 
   {
@@ -53,21 +71,69 @@ Status SocketPool::PrimeConnections() {
   return Status::OK();
 }
 
-Socket* SocketPool::GetSocket() {
-  std::lock_guard<std::mutex> lock(mutex_);
+Status SocketPool::GetSocket(Socket** out_sock) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  // Sockets may all be taken for a while after the pool shrinks, until the threads
+  // that are retiring release theirs.
+  socket_cv_.wait(lock, [this]() { return !sockets_.empty() || num_open_ == 0; });
   if (sockets_.empty()) {
-    return nullptr;
+    return Status::NetworkError("No memcached sockets are open");
   }
 
-  Socket* sock = sockets_.back();
+  *out_sock = sockets_.back();
   sockets_.pop_back();
-  return sock;
+  return Status::OK();
 }
 
 void SocketPool::ReleaseSocket(Socket *sock) {
-  std::lock_guard<std::mutex> lock(mutex_);
-  assert(sockets_.size() < num_sockets_);
-  sockets_.push_back(sock);
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    assert(sockets_.size() < num_open_);
+    if (num_open_ <= num_sockets_) {
+      sockets_.push_back(sock);
+      socket_cv_.notify_one();
+      return;
+    }
+    // The pool shrank while the socket was in use.
+    --num_open_;
+  }
+  CloseSocket(sock);
+}
+
+Status SocketPool::Resize(size_t num_sockets) {
+  std::vector<Socket*> to_close;
+  size_t num_to_open = 0;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    num_sockets_ = num_sockets;
+    while (num_open_ > num_sockets_ && !sockets_.empty()) {
+      to_close.push_back(sockets_.back());
+      sockets_.pop_back();
+      --num_open_;
+    }
+    // Counted as open right away, so that released sockets aren't closed meanwhile.
+    if (num_open_ < num_sockets_) {
+      num_to_open = num_sockets_ - num_open_;
+      num_open_ = num_sockets_;
+    }
+  }
+
+  for (Socket* sock : to_close) CloseSocket(sock);
+
+  // Connecting can take a while, so it's done without holding up GetSocket().
+  for (size_t i = 0; i < num_to_open; ++i) {
+    Socket* sock;
+    Status s = OpenSocket(&sock);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!s.ok()) {
+      num_open_ -= num_to_open - i;
+      socket_cv_.notify_all();
+      return s;
+    }
+    sockets_.push_back(sock);
+    socket_cv_.notify_one();
+  }
+  return Status::OK();
 }
 
 } // namespace memcachedumper
@@ -22,6 +22,7 @@
 #include "utils/socket.h"
 #include "utils/status.h"
 
+#include <condition_variable>
 #include <mutex>
 #include <string>
 #include <vector>
@@ -34,18 +35,35 @@ class SocketPool {
 
   Status PrimeConnections();
 
-  Socket* GetSocket();
+  // Takes an idle socket into 'out_sock', waiting for one to be released if they're
+  // all in use.
+  Status GetSocket(Socket** out_sock);
 
   void ReleaseSocket(Socket *sock);
 
+  // Grows or shrinks the pool to 'num_sockets'. Idle sockets beyond that are closed
+  // right away, and ones in use once they're released.
+  Status Resize(size_t num_sockets);
+
  private:
+  // Opens a new connection to memcached in 'out_sock'.
+  Status OpenSocket(Socket** out_sock);
+
+  // Closes 'sock' and frees it.
+  static void CloseSocket(Socket* sock);
+
   std::string hostname_;
   int port_;
+  // Number of sockets the pool should have.
   size_t num_sockets_;
+  // Number of sockets the pool has, whether idle or in use.
+  size_t num_open_;
 
   Sockaddr sockaddr_;
   std::vector<Socket*> sockets_;
   std::mutex mutex_;
+  // Signaled when a socket becomes idle, or the pool loses its sockets.
+  std::condition_variable socket_cv_;
 };
 
 } // namespace memcachedumper
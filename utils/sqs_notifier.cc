@@ -0,0 +1,195 @@
+/**
+ *
+ *  Copyright 2021 Netflix, Inc.
+ *
+ *     Licensed under the Apache License, Version 2.0 (the "License");
+ *     you may not use this file except in compliance with the License.
+ *     You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *     Unless required by applicable law or agreed to in writing, software
+ *     distributed under the License is distributed on an "AS IS" BASIS,
+ *     WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *     See the License for the specific language governing permissions and
+ *     limitations under the License.
+ *
+ */
+
+#include "common/logger.h"
+#include "utils/sqs_notifier.h"
+
+#include <algorithm>
+
+#include <aws/sqs/model/SendMessageBatchRequest.h>
+#include <aws/sqs/model/SendMessageBatchRequestEntry.h>
+#include <aws/sqs/model/SendMessageBatchResult.h>
+
+namespace memcachedumper {
+
+SQSNotifier::SQSNotifier(Aws::SQS::SQSClient* sqs_client, const std::string& queue_url,
+    int max_delay_ms)
+  : sqs_client_(sqs_client),
+    queue_url_(queue_url),
+    max_delay_(max_delay_ms),
+    num_sending_(0),
+    num_waiters_(0),
+    shutting_down_(false) {
+}
+
+SQSNotifier::~SQSNotifier() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    shutting_down_ = true;
+  }
+  queue_cv_.notify_all();
+  if (thread_.joinable()) thread_.join();
+}
+
+void SQSNotifier::Start() {
+  thread_ = std::thread(&SQSNotifier::NotifierLoop, this);
+}
+
+void SQSNotifier::Notify(const std::string& msg_body,
+    std::function<void(Status)> on_sent) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    queue_.push_back({msg_body, on_sent, std::chrono::steady_clock::now(), 0});
+  }
+  queue_cv_.notify_all();
+}
+
+void SQSNotifier::WaitUntilIdle() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  ++num_waiters_;
+  queue_cv_.notify_all();
+  idle_cv_.wait(lock, [this] {
+    return queue_.empty() && backing_off_.empty() && num_sending_ == 0;
+  });
+  --num_waiters_;
+}
+
+void SQSNotifier::NotifierLoop() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    queue_cv_.wait(lock, [this] {
+      return shutting_down_ || !queue_.empty() || !backing_off_.empty();
+    });
+    QueueDueRetries(std::chrono::steady_clock::now());
+    if (queue_.empty()) {
+      if (backing_off_.empty()) return;
+      // Only retries left, and none of them due yet.
+      queue_cv_.wait_until(lock, backing_off_.begin()->first,
+          [this] { return shutting_down_ || !queue_.empty(); });
+      continue;
+    }
+
+    // Wait for a full batch, unless the oldest notification is due or someone
+    // is waiting for the queue to drain.
+    auto hurry = [this] {
+      return shutting_down_ || num_waiters_ > 0 || queue_.size() >= SQS_MAX_BATCH_ENTRIES;
+    };
+    queue_cv_.wait_until(lock, queue_.front().queued_at + max_delay_, hurry);
+
+    size_t batch_size = std::min(queue_.size(), static_cast<size_t>(SQS_MAX_BATCH_ENTRIES));
+    std::vector<Notification> batch(std::make_move_iterator(queue_.begin()),
+        std::make_move_iterator(queue_.begin() + batch_size));
+    queue_.erase(queue_.begin(), queue_.begin() + batch_size);
+    num_sending_ += batch_size;
+    lock.unlock();
+
+    std::vector<Notification> retries;
+    SendBatch(&batch, &retries);
+
+    lock.lock();
+    auto now = std::chrono::steady_clock::now();
+    for (Notification& retry : retries) {
+      auto backoff = std::chrono::milliseconds(SQS_RETRY_BACKOFF_MS << (retry.attempts - 1));
+      backing_off_.emplace(now + backoff, std::move(retry));
+    }
+    num_sending_ -= batch_size;
+    idle_cv_.notify_all();
+  }
+}
+
+void SQSNotifier::QueueDueRetries(std::chrono::steady_clock::time_point now) {
+  auto due_end = shutting_down_ ? backing_off_.end() : backing_off_.upper_bound(now);
+  if (due_end == backing_off_.begin()) return;
+
+  // Retries go out first, ahead of the notifications queued since.
+  std::vector<Notification> due;
+  for (auto it = backing_off_.begin(); it != due_end; ++it) {
+    due.push_back(std::move(it->second));
+  }
+  backing_off_.erase(backing_off_.begin(), due_end);
+  queue_.insert(queue_.begin(), std::make_move_iterator(due.begin()),
+      std::make_move_iterator(due.end()));
+}
+
+void SQSNotifier::SendBatch(std::vector<Notification>* batch,
+    std::vector<Notification>* retries) {
+  // Entries are identified by their index in the batch.
+  Aws::SQS::Model::SendMessageBatchRequest request;
+  request.SetQueueUrl(queue_url_);
+  for (size_t i = 0; i < batch->size(); ++i) {
+    Aws::SQS::Model::SendMessageBatchRequestEntry entry;
+    entry.SetId(std::to_string(i));
+    entry.SetMessageBody((*batch)[i].msg_body);
+    request.AddEntries(entry);
+    ++(*batch)[i].attempts;
+  }
+
+  auto outcome = sqs_client_->SendMessageBatch(request);
+  if (!outcome.IsSuccess()) {
+    Status status = Status::NetworkError("Error sending SQS messages to : " + queue_url_,
+        outcome.GetError().GetMessage());
+    for (Notification& notification : *batch) {
+      RetryOrFail(&notification, status, retries);
+    }
+    return;
+  }
+
+  // Whether SQS told us how each entry went.
+  std::vector<bool> answered(batch->size(), false);
+  for (const auto& sent : outcome.GetResult().GetSuccessful()) {
+    size_t idx = std::stoul(sent.GetId());
+    if (idx >= batch->size() || answered[idx]) continue;
+    answered[idx] = true;
+    Notification& notification = (*batch)[idx];
+    if (notification.on_sent) notification.on_sent(Status::OK());
+  }
+  for (const auto& failed : outcome.GetResult().GetFailed()) {
+    size_t idx = std::stoul(failed.GetId());
+    if (idx >= batch->size() || answered[idx]) continue;
+    answered[idx] = true;
+    Notification& notification = (*batch)[idx];
+    Status status = Status::NetworkError("Error sending SQS message to : " + queue_url_,
+        failed.GetCode() + " : " + failed.GetMessage());
+    if (failed.GetSenderFault()) {
+      // Resending the same message won't help.
+      notification.attempts = SQS_MAX_SEND_ATTEMPTS;
+    }
+    RetryOrFail(&notification, status, retries);
+  }
+  for (size_t i = 0; i < batch->size(); ++i) {
+    if (answered[i]) continue;
+    RetryOrFail(&(*batch)[i], Status::NetworkError(
+        "Error sending SQS message to : " + queue_url_, "No result for the message"),
+        retries);
+  }
+  LOG("Sent {0} SQS messages to {1} ({2} failed)", outcome.GetResult().GetSuccessful().size(),
+      queue_url_, outcome.GetResult().GetFailed().size());
+}
+
+void SQSNotifier::RetryOrFail(Notification* notification, const Status& status,
+    std::vector<Notification>* retries) {
+  if (notification->attempts < SQS_MAX_SEND_ATTEMPTS) {
+    retries->push_back(std::move(*notification));
+    return;
+  }
+  LOG_ERROR("Giving up on SQS message after {0} attempts: {1}", notification->attempts,
+      status.ToString());
+  if (notification->on_sent) notification->on_sent(status);
+}
+
+} // namespace memcachedumper
@@ -0,0 +1,117 @@
+/**
+ *
+ *  Copyright 2021 Netflix, Inc.
+ *
+ *     Licensed under the Apache License, Version 2.0 (the "License");
+ *     you may not use this file except in compliance with the License.
+ *     You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *     Unless required by applicable law or agreed to in writing, software
+ *     distributed under the License is distributed on an "AS IS" BASIS,
+ *     WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *     See the License for the specific language governing permissions and
+ *     limitations under the License.
+ *
+ */
+
+#pragma once
+
+#include "utils/status.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <aws/sqs/SQSClient.h>
+
+// Max. number of messages SQS takes in a single SendMessageBatch call.
+#define SQS_MAX_BATCH_ENTRIES 10
+
+// Number of times a notification is sent before giving up on it.
+#define SQS_MAX_SEND_ATTEMPTS 5
+
+// Delay before resending notifications that failed. Doubles with every attempt.
+#define SQS_RETRY_BACKOFF_MS 100
+
+namespace memcachedumper {
+
+/// Collects SQS notifications and sends them from a single thread with
+/// SendMessageBatch, up to SQS_MAX_BATCH_ENTRIES at a time. A batch goes out once
+/// it's full, or once its oldest notification has waited 'max_delay_ms'.
+///
+/// Notifications that fail, whether the whole call or just their entry, are
+/// resent with backoff, unless SQS says the message itself is at fault. They wait
+/// out their backoff aside, so the rest of the queue keeps going out meanwhile.
+class SQSNotifier {
+ public:
+  SQSNotifier(Aws::SQS::SQSClient* sqs_client, const std::string& queue_url,
+      int max_delay_ms);
+  // Sends whatever is still queued, without waiting out backoffs, and joins the
+  // notifier thread.
+  ~SQSNotifier();
+
+  void Start();
+
+  // Queues 'msg_body' to be sent. 'on_sent' is called on the notifier thread with
+  // the outcome, once the notification is sent or given up on.
+  void Notify(const std::string& msg_body, std::function<void(Status)> on_sent);
+
+  // Sends whatever is queued right away, and waits until every notification
+  // queued so far is sent or given up on.
+  void WaitUntilIdle();
+
+ private:
+  struct Notification {
+    std::string msg_body;
+    std::function<void(Status)> on_sent;
+    std::chrono::steady_clock::time_point queued_at;
+    // Number of times we've tried to send it.
+    int attempts;
+  };
+
+  void NotifierLoop();
+
+  // Sends 'batch', and moves the notifications that are worth resending to
+  // 'retries'. Entries that SQS reports neither as sent nor as failed count as
+  // failed.
+  void SendBatch(std::vector<Notification>* batch, std::vector<Notification>* retries);
+
+  // Resends 'notification' later if it has attempts left. Otherwise, gives up on
+  // it with 'status'.
+  void RetryOrFail(Notification* notification, const Status& status,
+      std::vector<Notification>* retries);
+
+  // Moves the notifications in 'backing_off_' that are due by 'now' (all of them if
+  // we're shutting down) to the front of 'queue_'. Called with 'mutex_' held.
+  void QueueDueRetries(std::chrono::steady_clock::time_point now);
+
+  Aws::SQS::SQSClient* sqs_client_;
+  const std::string queue_url_;
+  const std::chrono::milliseconds max_delay_;
+  std::thread thread_;
+
+  std::mutex mutex_;
+  // Signalled when a notification is queued, someone is waiting for the queue
+  // to drain, or we're shutting down.
+  std::condition_variable queue_cv_;
+  // Signalled when a batch is done with.
+  std::condition_variable idle_cv_;
+  std::deque<Notification> queue_;
+  // Notifications to resend, keyed by when their backoff is over.
+  std::multimap<std::chrono::steady_clock::time_point, Notification> backing_off_;
+  // Number of notifications taken off 'queue_' that are still being sent.
+  int num_sending_;
+  // Number of threads in WaitUntilIdle().
+  int num_waiters_;
+  bool shutting_down_;
+};
+
+} // namespace memcachedumper
@@ -0,0 +1,623 @@
+/**
+ *
+ *  Copyright 2021 Netflix, Inc.
+ *
+ *     Licensed under the Apache License, Version 2.0 (the "License");
+ *     you may not use this file except in compliance with the License.
+ *     You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *     Unless required by applicable law or agreed to in writing, software
+ *     distributed under the License is distributed on an "AS IS" BASIS,
+ *     WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *     See the License for the specific language governing permissions and
+ *     limitations under the License.
+ *
+ */
+
+#include "utils/storage_sink.h"
+
+#include "common/logger.h"
+#include "utils/file_util.h"
+
+#include <openssl/evp.h>
+#include <openssl/md5.h>
+#include <string.h>
+
+#include <algorithm>
+#include <experimental/filesystem>
+#include <fstream>
+#include <iterator>
+#include <memory>
+#include <streambuf>
+#include <thread>
+
+#include <rapidjson/document.h>
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
+
+#include <aws/core/Aws.h>
+#include <aws/core/http/HttpResponse.h>
+#include <aws/core/utils/HashingUtils.h>
+#include <aws/core/utils/StringUtils.h>
+#include <aws/s3/S3Client.h>
+#include <aws/s3/model/AbortMultipartUploadRequest.h>
+#include <aws/s3/model/CompleteMultipartUploadRequest.h>
+#include <aws/s3/model/CompletedMultipartUpload.h>
+#include <aws/s3/model/CompletedPart.h>
+#include <aws/s3/model/CopyObjectRequest.h>
+#include <aws/s3/model/CreateMultipartUploadRequest.h>
+#include <aws/s3/model/DeleteObjectRequest.h>
+#include <aws/s3/model/HeadObjectRequest.h>
+#include <aws/s3/model/MetadataDirective.h>
+#include <aws/s3/model/PutObjectRequest.h>
+#include <aws/s3/model/UploadPartRequest.h>
+
+// Suffix of the file that holds the metadata of an object in a LocalStorageSink.
+#define LOCAL_SINK_METADATA_SUFFIX ".metadata.json"
+
+namespace memcachedumper {
+
+namespace fs = std::experimental::filesystem;
+
+namespace {
+
+// Returns 'len' bytes of 'data' as lower case hex, as found in ETags.
+std::string ToHex(const uint8_t* data, size_t len) {
+  std::string out;
+  for (size_t i = 0; i < len; ++i) {
+    out.push_back("0123456789abcdef"[data[i] >> 4]);
+    out.push_back("0123456789abcdef"[data[i] & 0xF]);
+  }
+  return out;
+}
+
+template <class Outcome>
+Status S3Error(const Outcome& outcome) {
+  auto error = outcome.GetError();
+  return Status::NetworkError(error.GetExceptionName() + " : ", error.GetMessage());
+}
+
+// Reads straight out of a part buffer, so that the SDK doesn't need a copy of it.
+// It seeks back and forth over the body to sign and retry requests.
+class PartStreamBuf : public std::streambuf {
+ public:
+  PartStreamBuf(const uint8_t* buf, size_t len) {
+    char* begin = const_cast<char*>(reinterpret_cast<const char*>(buf));
+    setg(begin, begin, begin + len);
+  }
+
+ protected:
+  pos_type seekoff(off_type off, std::ios_base::seekdir dir,
+      std::ios_base::openmode which) override {
+    if (!(which & std::ios_base::in)) return pos_type(off_type(-1));
+    off_type pos = off;
+    if (dir == std::ios_base::cur) pos += gptr() - eback();
+    if (dir == std::ios_base::end) pos += egptr() - eback();
+    if (pos < 0 || pos > egptr() - eback()) return pos_type(off_type(-1));
+    setg(eback(), eback() + pos, egptr());
+    return pos_type(pos);
+  }
+
+  pos_type seekpos(pos_type pos, std::ios_base::openmode which) override {
+    return seekoff(off_type(pos), std::ios_base::beg, which);
+  }
+};
+
+} // anonymous namespace
+
+Status StorageSink::ParseType(const std::string& name, StorageSinkType* out_type) {
+  if (name == "s3") {
+    *out_type = StorageSinkType::S3;
+  } else if (name == "local") {
+    *out_type = StorageSinkType::LOCAL;
+  } else if (name == "fake") {
+    *out_type = StorageSinkType::FAKE;
+  } else {
+    return Status::InvalidArgument("Unknown storage sink", name);
+  }
+  return Status::OK();
+}
+
+const char* StorageSink::TypeName(StorageSinkType type) {
+  switch (type) {
+    case StorageSinkType::S3: return "s3";
+    case StorageSinkType::LOCAL: return "local";
+    case StorageSinkType::FAKE: return "fake";
+  }
+  return "unknown";
+}
+
+std::string StorageSink::MD5ETag(const uint8_t* md5) {
+  return "\"" + ToHex(md5, MD5_DIGEST_LENGTH) + "\"";
+}
+
+Status StorageSink::FileETag(const std::string& local_path, std::string* out_etag) {
+  std::ifstream in(local_path, std::ios_base::in | std::ios_base::binary);
+  if (!in.is_open()) return Status::IOError("Could not open " + local_path);
+
+  std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> ctx(
+      EVP_MD_CTX_new(), EVP_MD_CTX_free);
+  if (!ctx || EVP_DigestInit_ex(ctx.get(), EVP_md5(), nullptr) != 1) {
+    return Status::IOError("EVP_DigestInit_ex failed");
+  }
+  std::vector<char> buf(1024 * 1024);
+  while (in.read(buf.data(), buf.size()) || in.gcount() > 0) {
+    EVP_DigestUpdate(ctx.get(), buf.data(), in.gcount());
+  }
+  if (in.bad()) return Status::IOError("Could not read " + local_path);
+
+  uint8_t md5[EVP_MAX_MD_SIZE];
+  EVP_DigestFinal_ex(ctx.get(), md5, nullptr);
+  *out_etag = MD5ETag(md5);
+  return Status::OK();
+}
+
+std::string StorageSink::MultipartETag(const std::vector<std::string>& part_etags) {
+  std::unique_ptr<EVP_MD_CTX, decltype(&EVP_MD_CTX_free)> ctx(
+      EVP_MD_CTX_new(), EVP_MD_CTX_free);
+  EVP_DigestInit_ex(ctx.get(), EVP_md5(), nullptr);
+  for (const std::string& etag : part_etags) {
+    // Hex digits, possibly quoted.
+    std::string hex = etag;
+    hex.erase(std::remove(hex.begin(), hex.end(), '"'), hex.end());
+    uint8_t md5[MD5_DIGEST_LENGTH] = {0};
+    for (size_t i = 0; i < MD5_DIGEST_LENGTH && 2 * i + 1 < hex.size(); ++i) {
+      md5[i] = static_cast<uint8_t>(std::stoul(hex.substr(2 * i, 2), nullptr, 16));
+    }
+    EVP_DigestUpdate(ctx.get(), md5, MD5_DIGEST_LENGTH);
+  }
+  uint8_t digest[EVP_MAX_MD_SIZE];
+  EVP_DigestFinal_ex(ctx.get(), digest, nullptr);
+  return "\"" + ToHex(digest, MD5_DIGEST_LENGTH) + "-" +
+      std::to_string(part_etags.size()) + "\"";
+}
+
+S3StorageSink::S3StorageSink(Aws::S3::S3Client* s3_client, const std::string& bucket)
+  : s3_client_(s3_client),
+    bucket_(bucket) {
+}
+
+std::string S3StorageSink::ObjectUri(const std::string& key) {
+  return "s3://" + bucket_ + "/" + key;
+}
+
+Status S3StorageSink::PutFile(const std::string& local_path, const std::string& key,
+    const ObjectMetadata& metadata) {
+  const std::shared_ptr<Aws::IOStream> input_data =
+  Aws::MakeShared<Aws::FStream>("SampleAllocationTag",
+    local_path.c_str(),
+    std::ios_base::in | std::ios_base::binary);
+
+  Aws::S3::Model::PutObjectRequest object_request;
+  object_request.SetBucket(bucket_);
+  object_request.SetKey(key);
+  object_request.SetBody(input_data);
+
+  // The AWS SDK takes metadata as a map.
+  Aws::Map<Aws::String, Aws::String> md_map(metadata.begin(), metadata.end());
+  object_request.SetMetadata(md_map);
+
+  auto put_object_outcome = s3_client_->PutObject(object_request);
+  if (!put_object_outcome.IsSuccess()) return S3Error(put_object_outcome);
+  return Status::OK();
+}
+
+Status S3StorageSink::CreateMultipartUpload(const std::string& key,
+    std::string* out_upload_id) {
+  Aws::S3::Model::CreateMultipartUploadRequest request;
+  request.SetBucket(bucket_);
+  request.SetKey(key);
+
+  auto outcome = s3_client_->CreateMultipartUpload(request);
+  if (!outcome.IsSuccess()) return S3Error(outcome);
+  *out_upload_id = outcome.GetResult().GetUploadId();
+  return Status::OK();
+}
+
+Status S3StorageSink::UploadPart(const std::string& key, const std::string& upload_id,
+    int part_num, const uint8_t* buf, size_t len, const uint8_t* md5,
+    std::string* out_etag) {
+  PartStreamBuf stream_buf(buf, len);
+  auto body = Aws::MakeShared<Aws::IOStream>("StorageSink", &stream_buf);
+
+  Aws::S3::Model::UploadPartRequest request;
+  request.SetBucket(bucket_);
+  request.SetKey(key);
+  request.SetUploadId(upload_id);
+  request.SetPartNumber(part_num);
+  request.SetContentLength(len);
+  // Has S3 reject the part if it got corrupted on the way.
+  request.SetContentMD5(Aws::Utils::HashingUtils::Base64Encode(
+      Aws::Utils::ByteBuffer(md5, MD5_DIGEST_LENGTH)));
+  request.SetBody(body);
+
+  auto outcome = s3_client_->UploadPart(request);
+  if (!outcome.IsSuccess()) return S3Error(outcome);
+  *out_etag = outcome.GetResult().GetETag();
+  return Status::OK();
+}
+
+Status S3StorageSink::CompleteMultipartUpload(const std::string& key,
+    const std::string& upload_id, const std::vector<std::string>& part_etags,
+    std::string* out_etag) {
+  Aws::S3::Model::CompletedMultipartUpload completed;
+  for (size_t i = 0; i < part_etags.size(); ++i) {
+    completed.AddParts(Aws::S3::Model::CompletedPart()
+        .WithETag(part_etags[i])
+        .WithPartNumber(i + 1));
+  }
+
+  Aws::S3::Model::CompleteMultipartUploadRequest request;
+  request.SetBucket(bucket_);
+  request.SetKey(key);
+  request.SetUploadId(upload_id);
+  request.SetMultipartUpload(completed);
+
+  auto outcome = s3_client_->CompleteMultipartUpload(request);
+  if (!outcome.IsSuccess()) return S3Error(outcome);
+  *out_etag = outcome.GetResult().GetETag();
+  return Status::OK();
+}
+
+Status S3StorageSink::AbortMultipartUpload(const std::string& key,
+    const std::string& upload_id) {
+  Aws::S3::Model::AbortMultipartUploadRequest request;
+  request.SetBucket(bucket_);
+  request.SetKey(key);
+  request.SetUploadId(upload_id);
+
+  auto outcome = s3_client_->AbortMultipartUpload(request);
+  if (!outcome.IsSuccess()) return S3Error(outcome);
+  return Status::OK();
+}
+
+Status S3StorageSink::CopyObject(const std::string& src_key, const std::string& dst_key,
+    const ObjectMetadata& metadata) {
+  // A server side copy, so the data doesn't go over the wire again.
+  Aws::S3::Model::CopyObjectRequest request;
+  request.SetBucket(bucket_);
+  request.SetKey(dst_key);
+  request.SetCopySource(Aws::Utils::StringUtils::URLEncode(
+      (bucket_ + "/" + src_key).c_str()));
+  request.SetMetadataDirective(Aws::S3::Model::MetadataDirective::REPLACE);
+  request.SetMetadata(Aws::Map<Aws::String, Aws::String>(metadata.begin(), metadata.end()));
+
+  auto outcome = s3_client_->CopyObject(request);
+  if (!outcome.IsSuccess()) return S3Error(outcome);
+  return Status::OK();
+}
+
+Status S3StorageSink::DeleteObject(const std::string& key) {
+  Aws::S3::Model::DeleteObjectRequest request;
+  request.SetBucket(bucket_);
+  request.SetKey(key);
+
+  auto outcome = s3_client_->DeleteObject(request);
+  if (!outcome.IsSuccess()) return S3Error(outcome);
+  return Status::OK();
+}
+
+Status S3StorageSink::HeadObject(const std::string& key, ObjectInfo* out_info) {
+  Aws::S3::Model::HeadObjectRequest request;
+  request.SetBucket(bucket_);
+  request.SetKey(key);
+
+  auto outcome = s3_client_->HeadObject(request);
+  if (!outcome.IsSuccess()) {
+    auto response_code = outcome.GetError().GetResponseCode();
+    if (response_code == Aws::Http::HttpResponseCode::NOT_FOUND) {
+      return Status::NotFound("No such object", key);
+    }
+    // Without s3:ListBucket, S3 answers 403 rather than 404 for a missing key. We
+    // can't tell the two apart, so the object is taken to be missing.
+    if (response_code == Aws::Http::HttpResponseCode::FORBIDDEN) {
+      return Status::NotFound("No such object, or no permission to look it up", key);
+    }
+    return S3Error(outcome);
+  }
+  out_info->size = outcome.GetResult().GetContentLength();
+  out_info->etag = outcome.GetResult().GetETag();
+  const auto& md_map = outcome.GetResult().GetMetadata();
+  out_info->metadata = ObjectMetadata(md_map.begin(), md_map.end());
+  return Status::OK();
+}
+
+LocalStorageSink::LocalStorageSink(const std::string& root_path)
+  : root_path_(root_path),
+    next_upload_id_(0) {
+}
+
+std::string LocalStorageSink::ObjectPath(const std::string& key) {
+  return root_path_ + "/" + key;
+}
+
+std::string LocalStorageSink::UploadDir(const std::string& upload_id) {
+  return root_path_ + "/.uploads/" + upload_id + "/";
+}
+
+std::string LocalStorageSink::ObjectUri(const std::string& key) {
+  return "file://" + ObjectPath(key);
+}
+
+Status LocalStorageSink::WriteMetadata(const std::string& key,
+    const ObjectMetadata& metadata) {
+  rapidjson::StringBuffer strbuf;
+  rapidjson::Writer<rapidjson::StringBuffer> writer(strbuf);
+  writer.StartObject();
+  for (const auto& entry : metadata) {
+    writer.Key(entry.first.c_str());
+    writer.String(entry.second.c_str());
+  }
+  writer.EndObject();
+
+  PosixFile md_file(ObjectPath(key) + LOCAL_SINK_METADATA_SUFFIX);
+  RETURN_ON_ERROR(md_file.Open());
+  RETURN_ON_ERROR(md_file.PWrite(reinterpret_cast<const uint8_t*>(strbuf.GetString()),
+      strbuf.GetSize(), 0));
+  return md_file.Close();
+}
+
+Status LocalStorageSink::ReadMetadata(const std::string& key, ObjectMetadata* out_metadata) {
+  out_metadata->clear();
+  std::ifstream md_file(ObjectPath(key) + LOCAL_SINK_METADATA_SUFFIX);
+  // Objects stored without metadata have no file.
+  if (!md_file.is_open()) return Status::OK();
+  std::string md_json((std::istreambuf_iterator<char>(md_file)),
+      std::istreambuf_iterator<char>());
+
+  rapidjson::Document root;
+  root.Parse(md_json.c_str());
+  if (root.HasParseError() || !root.IsObject()) {
+    return Status::IOError("Malformed metadata of " + ObjectPath(key));
+  }
+  for (const auto& member : root.GetObject()) {
+    if (!member.value.IsString()) continue;
+    out_metadata->emplace(member.name.GetString(), member.value.GetString());
+  }
+  return Status::OK();
+}
+
+Status LocalStorageSink::PutFile(const std::string& local_path, const std::string& key,
+    const ObjectMetadata& metadata) {
+  std::string path = ObjectPath(key);
+  std::error_code ec;
+  fs::create_directories(fs::path(path).parent_path(), ec);
+  if (!fs::copy_file(local_path, path, fs::copy_options::overwrite_existing, ec)) {
+    return Status::IOError("Could not copy " + local_path + " to " + path, ec.message());
+  }
+  return WriteMetadata(key, metadata);
+}
+
+Status LocalStorageSink::CreateMultipartUpload(const std::string& key,
+    std::string* out_upload_id) {
+  *out_upload_id = std::to_string(next_upload_id_++);
+  std::error_code ec;
+  if (!fs::create_directories(UploadDir(*out_upload_id), ec)) {
+    return Status::IOError("Could not create " + UploadDir(*out_upload_id), ec.message());
+  }
+  return Status::OK();
+}
+
+Status LocalStorageSink::UploadPart(const std::string& key, const std::string& upload_id,
+    int part_num, const uint8_t* buf, size_t len, const uint8_t* md5,
+    std::string* out_etag) {
+  uint8_t part_md5[MD5_DIGEST_LENGTH];
+  EVP_Digest(buf, len, part_md5, nullptr, EVP_md5(), nullptr);
+  if (memcmp(part_md5, md5, MD5_DIGEST_LENGTH) != 0) {
+    return Status::Corruption("Part does not match its MD5", key);
+  }
+
+  PosixFile part_file(UploadDir(upload_id) + std::to_string(part_num));
+  RETURN_ON_ERROR(part_file.Open());
+  RETURN_ON_ERROR(part_file.PWrite(buf, len, 0));
+  RETURN_ON_ERROR(part_file.Close());
+  *out_etag = MD5ETag(md5);
+  return Status::OK();
+}
+
+Status LocalStorageSink::CompleteMultipartUpload(const std::string& key,
+    const std::string& upload_id, const std::vector<std::string>& part_etags,
+    std::string* out_etag) {
+  std::string path = ObjectPath(key);
+  std::error_code ec;
+  fs::create_directories(fs::path(path).parent_path(), ec);
+
+  std::ofstream out(path, std::ios_base::out | std::ios_base::binary | std::ios_base::trunc);
+  for (size_t i = 0; i < part_etags.size(); ++i) {
+    std::ifstream part(UploadDir(upload_id) + std::to_string(i + 1),
+        std::ios_base::in | std::ios_base::binary);
+    if (!part.is_open()) return Status::NotFound("Missing part of " + key);
+    out << part.rdbuf();
+  }
+  out.close();
+  if (!out) return Status::IOError("Could not write " + path);
+
+  *out_etag = MultipartETag(part_etags);
+  return FileUtils::RemoveDirectoryAndContents(UploadDir(upload_id));
+}
+
+Status LocalStorageSink::AbortMultipartUpload(const std::string& key,
+    const std::string& upload_id) {
+  return FileUtils::RemoveDirectoryAndContents(UploadDir(upload_id));
+}
+
+Status LocalStorageSink::CopyObject(const std::string& src_key, const std::string& dst_key,
+    const ObjectMetadata& metadata) {
+  std::error_code ec;
+  fs::create_directories(fs::path(ObjectPath(dst_key)).parent_path(), ec);
+  if (!fs::copy_file(ObjectPath(src_key), ObjectPath(dst_key),
+      fs::copy_options::overwrite_existing, ec)) {
+    return Status::IOError("Could not copy " + src_key + " to " + dst_key, ec.message());
+  }
+  return WriteMetadata(dst_key, metadata);
+}
+
+Status LocalStorageSink::DeleteObject(const std::string& key) {
+  std::error_code ec;
+  fs::remove(ObjectPath(key) + LOCAL_SINK_METADATA_SUFFIX, ec);
+  if (!fs::remove(ObjectPath(key), ec)) {
+    return Status::IOError("Could not delete " + ObjectPath(key), ec.message());
+  }
+  return Status::OK();
+}
+
+Status LocalStorageSink::HeadObject(const std::string& key, ObjectInfo* out_info) {
+  std::string path = ObjectPath(key);
+  std::error_code ec;
+  uint64_t size = fs::file_size(path, ec);
+  if (ec) return Status::NotFound("No such object", key);
+  out_info->size = size;
+  RETURN_ON_ERROR(ReadMetadata(key, &out_info->metadata));
+  return FileETag(path, &out_info->etag);
+}
+
+FakeStorageSink::FakeStorageSink(const Options& options)
+  : options_(options),
+    start_time_(std::chrono::steady_clock::now()),
+    rng_(std::random_device()()),
+    link_free_at_(start_time_),
+    next_upload_id_(0),
+    num_requests_(0),
+    num_errors_(0),
+    bytes_uploaded_(0) {
+}
+
+std::string FakeStorageSink::ObjectUri(const std::string& key) {
+  return "fake://" + key;
+}
+
+Status FakeStorageSink::SimulateRequest(uint64_t nbytes) {
+  auto now = std::chrono::steady_clock::now();
+  auto done_at = now + std::chrono::milliseconds(options_.latency_ms);
+  bool fail = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (options_.bandwidth > 0 && nbytes > 0) {
+      // Transfers queue up for the link, so more of them at once only helps hide
+      // the latency.
+      link_free_at_ = std::max(now, link_free_at_) + std::chrono::nanoseconds(
+          static_cast<uint64_t>(nbytes * 1e9 / options_.bandwidth));
+      done_at = link_free_at_ + std::chrono::milliseconds(options_.latency_ms);
+    }
+    fail = std::uniform_real_distribution<double>(0, 1)(rng_) < options_.error_rate;
+  }
+  ++num_requests_;
+  std::this_thread::sleep_until(done_at);
+
+  if (fail) {
+    ++num_errors_;
+    return Status::NetworkError("Injected error from the fake storage sink");
+  }
+  bytes_uploaded_ += nbytes;
+  return Status::OK();
+}
+
+Status FakeStorageSink::PutFile(const std::string& local_path, const std::string& key,
+    const ObjectMetadata& metadata) {
+  // Read the file like a real upload would.
+  std::ifstream in(local_path, std::ios_base::in | std::ios_base::binary);
+  if (!in.is_open()) return Status::IOError("Could not open " + local_path);
+  std::vector<char> buf(1024 * 1024);
+  uint64_t size = 0;
+  while (in.read(buf.data(), buf.size()) || in.gcount() > 0) {
+    size += in.gcount();
+  }
+
+  RETURN_ON_ERROR(SimulateRequest(size));
+  std::lock_guard<std::mutex> lock(mutex_);
+  objects_[key] = size;
+  return Status::OK();
+}
+
+Status FakeStorageSink::CreateMultipartUpload(const std::string& key,
+    std::string* out_upload_id) {
+  RETURN_ON_ERROR(SimulateRequest(0));
+  std::lock_guard<std::mutex> lock(mutex_);
+  *out_upload_id = std::to_string(next_upload_id_++);
+  uploads_[*out_upload_id];
+  return Status::OK();
+}
+
+Status FakeStorageSink::UploadPart(const std::string& key, const std::string& upload_id,
+    int part_num, const uint8_t* buf, size_t len, const uint8_t* md5,
+    std::string* out_etag) {
+  RETURN_ON_ERROR(SimulateRequest(len));
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = uploads_.find(upload_id);
+  if (it == uploads_.end()) return Status::NotFound("No such upload", upload_id);
+  it->second[part_num] = len;
+  *out_etag = MD5ETag(md5);
+  return Status::OK();
+}
+
+Status FakeStorageSink::CompleteMultipartUpload(const std::string& key,
+    const std::string& upload_id, const std::vector<std::string>& part_etags,
+    std::string* out_etag) {
+  RETURN_ON_ERROR(SimulateRequest(0));
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = uploads_.find(upload_id);
+  if (it == uploads_.end()) return Status::NotFound("No such upload", upload_id);
+  if (it->second.size() != part_etags.size()) {
+    return Status::InvalidArgument("Parts missing from upload", upload_id);
+  }
+  uint64_t size = 0;
+  for (const auto& part : it->second) size += part.second;
+  objects_[key] = size;
+  uploads_.erase(it);
+  *out_etag = MultipartETag(part_etags);
+  return Status::OK();
+}
+
+Status FakeStorageSink::AbortMultipartUpload(const std::string& key,
+    const std::string& upload_id) {
+  RETURN_ON_ERROR(SimulateRequest(0));
+  std::lock_guard<std::mutex> lock(mutex_);
+  uploads_.erase(upload_id);
+  return Status::OK();
+}
+
+Status FakeStorageSink::CopyObject(const std::string& src_key, const std::string& dst_key,
+    const ObjectMetadata& metadata) {
+  RETURN_ON_ERROR(SimulateRequest(0));
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = objects_.find(src_key);
+  if (it == objects_.end()) return Status::NotFound("No such object", src_key);
+  objects_[dst_key] = it->second;
+  return Status::OK();
+}
+
+Status FakeStorageSink::DeleteObject(const std::string& key) {
+  RETURN_ON_ERROR(SimulateRequest(0));
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (objects_.erase(key) == 0) return Status::NotFound("No such object", key);
+  return Status::OK();
+}
+
+Status FakeStorageSink::HeadObject(const std::string& key, ObjectInfo* out_info) {
+  RETURN_ON_ERROR(SimulateRequest(0));
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = objects_.find(key);
+  if (it == objects_.end()) return Status::NotFound("No such object", key);
+  out_info->size = it->second;
+  out_info->etag.clear();
+  out_info->metadata.clear();
+  return Status::OK();
+}
+
+void FakeStorageSink::LogStats() {
+  double elapsed_secs = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start_time_).count();
+  size_t num_objects;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    num_objects = objects_.size();
+  }
+  LOG("Fake storage sink: {0} objects, {1} requests ({2} failed), {3} MB uploaded "
+      "at {4:.1f} MB/s", num_objects, num_requests_.load(), num_errors_.load(),
+      bytes_uploaded_.load() / 1024 / 1024,
+      bytes_uploaded_.load() / 1024.0 / 1024.0 / std::max(elapsed_secs, 0.001));
+}
+
+} // namespace memcachedumper
@@ -0,0 +1,252 @@
+/**
+ *
+ *  Copyright 2021 Netflix, Inc.
+ *
+ *     Licensed under the Apache License, Version 2.0 (the "License");
+ *     you may not use this file except in compliance with the License.
+ *     You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *     Unless required by applicable law or agreed to in writing, software
+ *     distributed under the License is distributed on an "AS IS" BASIS,
+ *     WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *     See the License for the specific language governing permissions and
+ *     limitations under the License.
+ *
+ */
+
+#pragma once
+
+#include "utils/status.h"
+
+#include <stdint.h>
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Aws {
+namespace S3 {
+class S3Client;
+} // namespace S3
+} // namespace Aws
+
+namespace memcachedumper {
+
+// The object stores that dumped files can be uploaded to.
+enum class StorageSinkType {
+  S3,
+  LOCAL,
+  FAKE
+};
+
+// Metadata stored along with an object.
+using ObjectMetadata = std::map<std::string, std::string>;
+
+// What a sink knows about an object it holds.
+struct ObjectInfo {
+  uint64_t size = 0;
+  // Empty if the sink doesn't keep one.
+  std::string etag;
+  // Empty if the sink doesn't keep it.
+  ObjectMetadata metadata;
+};
+
+/// Interface to the object store that completed files are uploaded to. Keys are
+/// as returned by AwsUtils::S3KeyForFile(). Implementations must be thread safe.
+class StorageSink {
+ public:
+  virtual ~StorageSink() = default;
+
+  // Parses a sink name as used in the configuration ("s3", "local", "fake").
+  static Status ParseType(const std::string& name, StorageSinkType* out_type);
+
+  // Returns the name of 'type' as it appears in the configuration.
+  static const char* TypeName(StorageSinkType type);
+
+  // Returns the ETag that an object with parts of ETags 'part_etags' gets, the
+  // same way as S3 computes it: the MD5 of the parts' MD5s, followed by the
+  // number of parts.
+  static std::string MultipartETag(const std::vector<std::string>& part_etags);
+
+  // Returns the ETag of a part, or of an object uploaded in one go, with MD5
+  // digest 'md5'.
+  static std::string MD5ETag(const uint8_t* md5);
+
+  // Returns in 'out_etag' the ETag that the file at 'local_path' gets when
+  // uploaded in one go.
+  static Status FileETag(const std::string& local_path, std::string* out_etag);
+
+  virtual StorageSinkType type() = 0;
+
+  // Returns the URI that the object 'key' is announced with.
+  virtual std::string ObjectUri(const std::string& key) = 0;
+
+  // Uploads the file at 'local_path' as the object 'key'.
+  virtual Status PutFile(const std::string& local_path, const std::string& key,
+      const ObjectMetadata& metadata) = 0;
+
+  // Starts a multipart upload to 'key'. Returns its ID in 'out_upload_id'.
+  virtual Status CreateMultipartUpload(const std::string& key,
+      std::string* out_upload_id) = 0;
+
+  // Uploads 'len' bytes of 'buf' as part 'part_num' (starting at 1) of an upload.
+  // The part is rejected if it doesn't match its MD5 digest 'md5'. Returns the
+  // part's ETag in 'out_etag'.
+  virtual Status UploadPart(const std::string& key, const std::string& upload_id,
+      int part_num, const uint8_t* buf, size_t len, const uint8_t* md5,
+      std::string* out_etag) = 0;
+
+  // Assembles the object 'key' out of the parts with 'part_etags', in order.
+  // Returns the object's ETag in 'out_etag'.
+  virtual Status CompleteMultipartUpload(const std::string& key,
+      const std::string& upload_id, const std::vector<std::string>& part_etags,
+      std::string* out_etag) = 0;
+
+  // Discards an upload and the parts uploaded so far.
+  virtual Status AbortMultipartUpload(const std::string& key,
+      const std::string& upload_id) = 0;
+
+  // Copies the object 'src_key' to 'dst_key', with 'metadata' instead of its own.
+  virtual Status CopyObject(const std::string& src_key, const std::string& dst_key,
+      const ObjectMetadata& metadata) = 0;
+
+  virtual Status DeleteObject(const std::string& key) = 0;
+
+  // Looks up the object 'key'. Returns NotFound if there's no such object, or if
+  // the sink won't say (eg. S3 without s3:ListBucket).
+  virtual Status HeadObject(const std::string& key, ObjectInfo* out_info) = 0;
+
+  // Logs what the sink has seen so far, if it keeps track.
+  virtual void LogStats() {}
+};
+
+/// Uploads to an S3 bucket.
+class S3StorageSink : public StorageSink {
+ public:
+  S3StorageSink(Aws::S3::S3Client* s3_client, const std::string& bucket);
+
+  StorageSinkType type() override { return StorageSinkType::S3; }
+  std::string ObjectUri(const std::string& key) override;
+  Status PutFile(const std::string& local_path, const std::string& key,
+      const ObjectMetadata& metadata) override;
+  Status CreateMultipartUpload(const std::string& key,
+      std::string* out_upload_id) override;
+  Status UploadPart(const std::string& key, const std::string& upload_id,
+      int part_num, const uint8_t* buf, size_t len, const uint8_t* md5,
+      std::string* out_etag) override;
+  Status CompleteMultipartUpload(const std::string& key,
+      const std::string& upload_id, const std::vector<std::string>& part_etags,
+      std::string* out_etag) override;
+  Status AbortMultipartUpload(const std::string& key,
+      const std::string& upload_id) override;
+  Status CopyObject(const std::string& src_key, const std::string& dst_key,
+      const ObjectMetadata& metadata) override;
+  Status DeleteObject(const std::string& key) override;
+  Status HeadObject(const std::string& key, ObjectInfo* out_info) override;
+
+ private:
+  Aws::S3::S3Client* s3_client_;
+  const std::string bucket_;
+};
+
+/// Stores objects as files under a local directory, eg. a mounted network file
+/// system. An object's metadata goes in a JSON file next to it.
+class LocalStorageSink : public StorageSink {
+ public:
+  explicit LocalStorageSink(const std::string& root_path);
+
+  StorageSinkType type() override { return StorageSinkType::LOCAL; }
+  std::string ObjectUri(const std::string& key) override;
+  Status PutFile(const std::string& local_path, const std::string& key,
+      const ObjectMetadata& metadata) override;
+  Status CreateMultipartUpload(const std::string& key,
+      std::string* out_upload_id) override;
+  Status UploadPart(const std::string& key, const std::string& upload_id,
+      int part_num, const uint8_t* buf, size_t len, const uint8_t* md5,
+      std::string* out_etag) override;
+  Status CompleteMultipartUpload(const std::string& key,
+      const std::string& upload_id, const std::vector<std::string>& part_etags,
+      std::string* out_etag) override;
+  Status AbortMultipartUpload(const std::string& key,
+      const std::string& upload_id) override;
+  Status CopyObject(const std::string& src_key, const std::string& dst_key,
+      const ObjectMetadata& metadata) override;
+  Status DeleteObject(const std::string& key) override;
+  Status HeadObject(const std::string& key, ObjectInfo* out_info) override;
+
+ private:
+  std::string ObjectPath(const std::string& key);
+  // Directory that the parts of 'upload_id' are kept in until completed.
+  std::string UploadDir(const std::string& upload_id);
+  Status WriteMetadata(const std::string& key, const ObjectMetadata& metadata);
+  Status ReadMetadata(const std::string& key, ObjectMetadata* out_metadata);
+
+  const std::string root_path_;
+  std::atomic<uint64_t> next_upload_id_;
+};
+
+/// Accepts objects without keeping their contents, after the delay that a real
+/// store would take. Meant for measuring the upload pipeline without one.
+class FakeStorageSink : public StorageSink {
+ public:
+  struct Options {
+    // Time every request takes on top of its transfer.
+    int latency_ms = 0;
+    // Bytes per second shared by all transfers. 0 means unlimited.
+    uint64_t bandwidth = 0;
+    // Fraction of requests that fail.
+    double error_rate = 0;
+  };
+
+  explicit FakeStorageSink(const Options& options);
+
+  StorageSinkType type() override { return StorageSinkType::FAKE; }
+  std::string ObjectUri(const std::string& key) override;
+  Status PutFile(const std::string& local_path, const std::string& key,
+      const ObjectMetadata& metadata) override;
+  Status CreateMultipartUpload(const std::string& key,
+      std::string* out_upload_id) override;
+  Status UploadPart(const std::string& key, const std::string& upload_id,
+      int part_num, const uint8_t* buf, size_t len, const uint8_t* md5,
+      std::string* out_etag) override;
+  Status CompleteMultipartUpload(const std::string& key,
+      const std::string& upload_id, const std::vector<std::string>& part_etags,
+      std::string* out_etag) override;
+  Status AbortMultipartUpload(const std::string& key,
+      const std::string& upload_id) override;
+  Status CopyObject(const std::string& src_key, const std::string& dst_key,
+      const ObjectMetadata& metadata) override;
+  Status DeleteObject(const std::string& key) override;
+  Status HeadObject(const std::string& key, ObjectInfo* out_info) override;
+  void LogStats() override;
+
+ private:
+  // Waits out a request that transfers 'nbytes', and fails it as often as
+  // 'error_rate' says.
+  Status SimulateRequest(uint64_t nbytes);
+
+  const Options options_;
+  const std::chrono::steady_clock::time_point start_time_;
+
+  std::mutex mutex_;
+  std::mt19937_64 rng_;
+  // The link is busy with earlier transfers until then.
+  std::chrono::steady_clock::time_point link_free_at_;
+  // Size of every object stored, and of the parts of every upload in progress.
+  std::unordered_map<std::string, uint64_t> objects_;
+  std::unordered_map<std::string, std::map<int, uint64_t>> uploads_;
+  uint64_t next_upload_id_;
+
+  std::atomic<uint64_t> num_requests_;
+  std::atomic<uint64_t> num_errors_;
+  std::atomic<uint64_t> bytes_uploaded_;
+};
+
+} // namespace memcachedumper
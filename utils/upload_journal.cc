@@ -0,0 +1,162 @@
+/**
+ *
+ *  Copyright 2021 Netflix, Inc.
+ *
+ *     Licensed under the Apache License, Version 2.0 (the "License");
+ *     you may not use this file except in compliance with the License.
+ *     You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *     Unless required by applicable law or agreed to in writing, software
+ *     distributed under the License is distributed on an "AS IS" BASIS,
+ *     WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *     See the License for the specific language governing permissions and
+ *     limitations under the License.
+ *
+ */
+
+#include "utils/upload_journal.h"
+
+#include "utils/file_util.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+
+// Record types, as the first field of every line.
+#define JOURNAL_COMPLETED "C"
+#define JOURNAL_UPLOADED "U"
+#define JOURNAL_NOTIFIED "N"
+
+namespace memcachedumper {
+
+UploadJournal::UploadJournal(const std::string& path)
+  : path_(path),
+    offset_(0) {
+}
+
+UploadJournal::~UploadJournal() {
+  if (file_) IGNORE_RET_VAL(file_->Close());
+}
+
+Status UploadJournal::Open(bool keep_existing) {
+  file_.reset(new PosixFile(path_));
+  RETURN_ON_ERROR(file_->Open());
+
+  off_t end = 0;
+  if (keep_existing) {
+    end = lseek(file_->fd(), 0, SEEK_END);
+    if (end < 0) return Status::IOError(path_, strerror(errno));
+  }
+
+  // A record torn by a crash has no newline. Cut it off, or the first record we
+  // append would be glued onto it.
+  offset_ = end;
+  char buf[4096];
+  while (offset_ > 0) {
+    size_t len = std::min(static_cast<size_t>(offset_), sizeof(buf));
+    if (pread(file_->fd(), buf, len, offset_ - len) != static_cast<ssize_t>(len)) {
+      return Status::IOError("Could not read " + path_, strerror(errno));
+    }
+    const char* newline = static_cast<const char*>(memrchr(buf, '\n', len));
+    if (newline != nullptr) {
+      offset_ -= len - (newline - buf + 1);
+      break;
+    }
+    offset_ -= len;
+  }
+
+  if ((!keep_existing || offset_ < end) && ftruncate(file_->fd(), offset_) < 0) {
+    return Status::IOError("Could not truncate " + path_, strerror(errno));
+  }
+  return Status::OK();
+}
+
+Status UploadJournal::RecordCompleted(const std::string& filename,
+    const std::string& local_path) {
+  return Append(JOURNAL_COMPLETED "\t" + filename + "\t" + local_path + "\n");
+}
+
+Status UploadJournal::RecordUploaded(const std::string& filename) {
+  return Append(JOURNAL_UPLOADED "\t" + filename + "\n");
+}
+
+Status UploadJournal::RecordNotified(const std::string& filename) {
+  return Append(JOURNAL_NOTIFIED "\t" + filename + "\n");
+}
+
+Status UploadJournal::Append(const std::string& record) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  RETURN_ON_ERROR(file_->PWrite(reinterpret_cast<const uint8_t*>(record.data()),
+      record.size(), offset_));
+  offset_ += record.size();
+  if (fdatasync(file_->fd()) < 0) {
+    return Status::IOError("Could not fdatasync() " + path_, strerror(errno));
+  }
+  return Status::OK();
+}
+
+Status UploadJournal::Load(const std::string& path,
+    std::vector<PendingUpload>* out_pending) {
+  out_pending->clear();
+  std::ifstream journal(path);
+  if (!journal.is_open()) {
+    if (!FileUtils::FileExists(path)) return Status::OK();
+    return Status::IOError("Could not open " + path);
+  }
+
+  // Indexes into 'out_pending' by file name. Notified files are erased at the end.
+  std::unordered_map<std::string, size_t> index;
+  std::vector<bool> notified;
+  std::string line;
+  while (std::getline(journal, line)) {
+    // The last line is missing its newline if the crash came mid-append.
+    if (journal.eof()) break;
+
+    std::vector<std::string> fields;
+    std::istringstream line_stream(line);
+    std::string field;
+    while (std::getline(line_stream, field, '\t')) fields.push_back(field);
+    if (fields.size() < 2) continue;
+
+    const std::string& type = fields[0];
+    const std::string& filename = fields[1];
+    if (type == JOURNAL_COMPLETED && fields.size() == 3) {
+      // A file completed again (eg. by a resumed run) starts over.
+      auto it = index.find(filename);
+      if (it != index.end()) {
+        (*out_pending)[it->second] = {filename, fields[2], false};
+        notified[it->second] = false;
+        continue;
+      }
+      index.emplace(filename, out_pending->size());
+      out_pending->push_back({filename, fields[2], false});
+      notified.push_back(false);
+      continue;
+    }
+
+    auto it = index.find(filename);
+    if (it == index.end()) continue;
+    if (type == JOURNAL_UPLOADED) {
+      (*out_pending)[it->second].uploaded = true;
+    } else if (type == JOURNAL_NOTIFIED) {
+      notified[it->second] = true;
+    }
+  }
+
+  size_t n_pending = 0;
+  for (size_t i = 0; i < out_pending->size(); ++i) {
+    if (notified[i]) continue;
+    (*out_pending)[n_pending++] = (*out_pending)[i];
+  }
+  out_pending->resize(n_pending);
+  return Status::OK();
+}
+
+} // namespace memcachedumper
@@ -0,0 +1,82 @@
+/**
+ *
+ *  Copyright 2021 Netflix, Inc.
+ *
+ *     Licensed under the Apache License, Version 2.0 (the "License");
+ *     you may not use this file except in compliance with the License.
+ *     You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *     Unless required by applicable law or agreed to in writing, software
+ *     distributed under the License is distributed on an "AS IS" BASIS,
+ *     WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *     See the License for the specific language governing permissions and
+ *     limitations under the License.
+ *
+ */
+
+#pragma once
+
+#include "utils/status.h"
+
+#include <sys/types.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Name of the upload journal, kept next to the key files and their checkpoints.
+#define UPLOAD_JOURNAL_FILENAME "UPLOAD_JOURNAL"
+
+namespace memcachedumper {
+
+class PosixFile;
+
+/// Append-only record of where every completed file is on its way to the storage
+/// sink, so that a resumed dump can finish the uploads and notifications that a
+/// crash interrupted instead of redoing the key files they came from.
+///
+/// A file is COMPLETED once it's durable at its local path, then UPLOADED, then
+/// NOTIFIED. Every record is made durable before returning.
+class UploadJournal {
+ public:
+  // A file that was completed but never notified.
+  struct PendingUpload {
+    std::string filename;
+    std::string local_path;
+    // 'true' if the file made it to the sink, so only the notification is left.
+    bool uploaded = false;
+  };
+
+  explicit UploadJournal(const std::string& path);
+  ~UploadJournal();
+
+  // Opens the journal, keeping its records if 'keep_existing' is set. A record
+  // torn by a crash is cut off, so that new records start on a line of their own.
+  Status Open(bool keep_existing);
+
+  Status RecordCompleted(const std::string& filename, const std::string& local_path);
+  Status RecordUploaded(const std::string& filename);
+  Status RecordNotified(const std::string& filename);
+
+  // Reads the journal at 'path' and returns the files in it that were never
+  // notified in 'out_pending', in the order they were completed. A record torn
+  // by a crash is ignored.
+  static Status Load(const std::string& path, std::vector<PendingUpload>* out_pending);
+
+  const std::string& path() { return path_; }
+
+ private:
+  Status Append(const std::string& record);
+
+  const std::string path_;
+
+  // Serializes appends from the finisher and uploader threads.
+  std::mutex mutex_;
+  std::unique_ptr<PosixFile> file_;
+  off_t offset_;
+};
+
+} // namespace memcachedumper
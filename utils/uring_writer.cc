@@ -0,0 +1,172 @@
+/**
+ *
+ *  Copyright 2021 Netflix, Inc.
+ *
+ *     Licensed under the Apache License, Version 2.0 (the "License");
+ *     you may not use this file except in compliance with the License.
+ *     You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *     Unless required by applicable law or agreed to in writing, software
+ *     distributed under the License is distributed on an "AS IS" BASIS,
+ *     WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *     See the License for the specific language governing permissions and
+ *     limitations under the License.
+ *
+ */
+
+#include "common/logger.h"
+#include "utils/uring_writer.h"
+
+#include <string.h>
+
+#include <string>
+
+// Tags the completion of an fsync() request, since it has no buffer.
+#define FSYNC_REQUEST_TAG UINT64_MAX
+
+namespace memcachedumper {
+
+UringWriter::UringWriter()
+  : ring_initialized_(false),
+    buffer_size_(0),
+    n_inflight_(0) {
+}
+
+UringWriter::~UringWriter() {
+  if (!ring_initialized_) return;
+
+  // The kernel may still be reading from our buffers.
+  Status s = WaitAll();
+  if (!s.ok()) {
+    LOG_ERROR("io_uring writes failed during teardown. (Status: {0})", s.ToString());
+  }
+  io_uring_queue_exit(&ring_);
+}
+
+Status UringWriter::Init(const std::vector<uint8_t*>& buffers, size_t buffer_size) {
+  buffer_size_ = buffer_size;
+  for (uint8_t* buf : buffers) {
+    buffers_.push_back({buf, buffer_size});
+  }
+  inflight_len_.assign(buffers_.size(), -1);
+
+  // One entry per buffer, and one for the trailing fsync().
+  int ret = io_uring_queue_init(buffers_.size() + 1, &ring_, 0);
+  if (ret < 0) {
+    return Status::IOError("io_uring_queue_init() failed", strerror(-ret));
+  }
+  ring_initialized_ = true;
+
+  ret = io_uring_register_buffers(&ring_, buffers_.data(), buffers_.size());
+  if (ret < 0) {
+    return Status::IOError("io_uring_register_buffers() failed", strerror(-ret));
+  }
+  return Status::OK();
+}
+
+Status UringWriter::TakeError() {
+  Status s = error_;
+  error_ = Status::OK();
+  return s;
+}
+
+Status UringWriter::ReapCompletions(bool wait) {
+  struct io_uring_cqe* cqe = nullptr;
+  while (n_inflight_ > 0) {
+    int ret = wait ? io_uring_wait_cqe(&ring_, &cqe) : io_uring_peek_cqe(&ring_, &cqe);
+    if (ret == -EAGAIN) break;
+    if (ret < 0) return Status::IOError("Could not reap io_uring completion", strerror(-ret));
+    // Only block for the first one.
+    wait = false;
+
+    uint64_t tag = io_uring_cqe_get_data64(cqe);
+    int res = cqe->res;
+    io_uring_cqe_seen(&ring_, cqe);
+    --n_inflight_;
+
+    if (tag == FSYNC_REQUEST_TAG) {
+      if (res < 0 && error_.ok()) {
+        error_ = Status::IOError("io_uring fsync() failed", strerror(-res));
+      }
+      continue;
+    }
+
+    ssize_t expected_len = inflight_len_[tag];
+    inflight_len_[tag] = -1;
+    if (!error_.ok()) continue;
+    if (res < 0) {
+      error_ = Status::IOError("io_uring write failed", strerror(-res));
+    } else if (res != expected_len) {
+      error_ = Status::IOError("io_uring short write",
+          std::to_string(res) + " of " + std::to_string(expected_len) + " bytes");
+    }
+  }
+  return TakeError();
+}
+
+Status UringWriter::AcquireBuffer(int* buf_idx) {
+  // Pick up whatever has completed so far, without blocking.
+  RETURN_ON_ERROR(ReapCompletions(false));
+
+  while (true) {
+    for (size_t i = 0; i < inflight_len_.size(); ++i) {
+      if (inflight_len_[i] < 0) {
+        *buf_idx = i;
+        return Status::OK();
+      }
+    }
+    RETURN_ON_ERROR(ReapCompletions(true));
+  }
+}
+
+Status UringWriter::SubmitWrite(int fd, int buf_idx, size_t len, off_t offset) {
+  struct io_uring_sqe* sqe = io_uring_get_sqe(&ring_);
+  if (sqe == nullptr) return Status::IOError("io_uring submission queue is full");
+
+  io_uring_prep_write_fixed(sqe, fd, buffers_[buf_idx].iov_base, len, offset, buf_idx);
+  io_uring_sqe_set_data64(sqe, buf_idx);
+  inflight_len_[buf_idx] = len;
+  ++n_inflight_;
+
+  int ret = io_uring_submit(&ring_);
+  if (ret < 0) return Status::IOError("io_uring_submit() failed", strerror(-ret));
+  return Status::OK();
+}
+
+Status UringWriter::SubmitWriteAndFsync(int fd, int buf_idx, size_t len, off_t offset) {
+  if (len > 0) {
+    struct io_uring_sqe* sqe = io_uring_get_sqe(&ring_);
+    if (sqe == nullptr) return Status::IOError("io_uring submission queue is full");
+
+    io_uring_prep_write_fixed(sqe, fd, buffers_[buf_idx].iov_base, len, offset, buf_idx);
+    io_uring_sqe_set_data64(sqe, buf_idx);
+    // Wait for all earlier writes before starting, and hold back the fsync() until
+    // this one is done.
+    io_uring_sqe_set_flags(sqe, IOSQE_IO_DRAIN | IOSQE_IO_LINK);
+    inflight_len_[buf_idx] = len;
+    ++n_inflight_;
+  }
+
+  struct io_uring_sqe* sqe = io_uring_get_sqe(&ring_);
+  if (sqe == nullptr) return Status::IOError("io_uring submission queue is full");
+
+  io_uring_prep_fsync(sqe, fd, 0);
+  io_uring_sqe_set_data64(sqe, FSYNC_REQUEST_TAG);
+  if (len == 0) io_uring_sqe_set_flags(sqe, IOSQE_IO_DRAIN);
+  ++n_inflight_;
+
+  int ret = io_uring_submit(&ring_);
+  if (ret < 0) return Status::IOError("io_uring_submit() failed", strerror(-ret));
+  return Status::OK();
+}
+
+Status UringWriter::WaitAll() {
+  while (n_inflight_ > 0) {
+    RETURN_ON_ERROR(ReapCompletions(true));
+  }
+  return TakeError();
+}
+
+} // namespace memcachedumper
@@ -0,0 +1,96 @@
+/**
+ *
+ *  Copyright 2021 Netflix, Inc.
+ *
+ *     Licensed under the Apache License, Version 2.0 (the "License");
+ *     you may not use this file except in compliance with the License.
+ *     You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *     Unless required by applicable law or agreed to in writing, software
+ *     distributed under the License is distributed on an "AS IS" BASIS,
+ *     WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *     See the License for the specific language governing permissions and
+ *     limitations under the License.
+ *
+ */
+
+#pragma once
+
+#include "utils/status.h"
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <liburing.h>
+
+#include <vector>
+
+namespace memcachedumper {
+
+/// The 'UringWriter' writes out a fixed set of buffers through io_uring. The
+/// buffers are registered with the kernel up front, so writes from them skip the
+/// per-call page pinning of writev(). Writes are submitted without waiting for
+/// them to complete; we only wait when we need a buffer back and all of them
+/// are still in flight.
+///
+/// Only available when built with -DIO_URING_ENABLED=1. Not thread-safe.
+class UringWriter {
+ public:
+  UringWriter();
+  ~UringWriter();
+
+  // Sets up the ring and registers 'buffers', each of 'buffer_size' bytes.
+  // The buffers must outlive this object.
+  Status Init(const std::vector<uint8_t*>& buffers, size_t buffer_size);
+
+  // Returns a buffer with no write in flight in 'buf_idx'. Only blocks if every
+  // buffer is being written out.
+  Status AcquireBuffer(int* buf_idx);
+
+  uint8_t* buffer(int buf_idx) {
+    return static_cast<uint8_t*>(buffers_[buf_idx].iov_base);
+  }
+  size_t buffer_size() { return buffer_size_; }
+
+  // Submits a write of the first 'len' bytes of buffer 'buf_idx' to 'fd' at
+  // 'offset'. The buffer is not to be touched until it's handed out again by
+  // AcquireBuffer().
+  Status SubmitWrite(int fd, int buf_idx, size_t len, off_t offset);
+
+  // Same as SubmitWrite(), but also submits an fsync() of 'fd' linked to the
+  // write, that runs once every previously submitted write is done. 'len' may be
+  // 0, in which case only the fsync() is submitted.
+  Status SubmitWriteAndFsync(int fd, int buf_idx, size_t len, off_t offset);
+
+  // Waits for everything submitted so far to complete. Returns the first error
+  // seen by any of them.
+  Status WaitAll();
+
+ private:
+  // Processes completions. If 'wait' is true, blocks until at least one is
+  // available.
+  Status ReapCompletions(bool wait);
+
+  // Returns an error if a request failed since the last call.
+  Status TakeError();
+
+  struct io_uring ring_;
+  bool ring_initialized_;
+
+  std::vector<struct iovec> buffers_;
+  size_t buffer_size_;
+
+  // Number of bytes expected to be written from each buffer in flight, or -1 if
+  // the buffer is free.
+  std::vector<ssize_t> inflight_len_;
+
+  // Number of requests submitted that we're yet to see a completion for.
+  uint32_t n_inflight_;
+
+  // The first error seen while reaping completions.
+  Status error_;
+};
+
+} // namespace memcachedumper
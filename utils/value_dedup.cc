@@ -0,0 +1,80 @@
+/**
+ *
+ *  Copyright 2021 Netflix, Inc.
+ *
+ *     Licensed under the Apache License, Version 2.0 (the "License");
+ *     you may not use this file except in compliance with the License.
+ *     You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *     Unless required by applicable law or agreed to in writing, software
+ *     distributed under the License is distributed on an "AS IS" BASIS,
+ *     WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *     See the License for the specific language governing permissions and
+ *     limitations under the License.
+ *
+ */
+
+#include "utils/value_dedup.h"
+
+#ifdef HAVE_XXHASH
+#define XXH_INLINE_ALL
+#include <xxhash.h>
+#else
+#include <openssl/evp.h>
+#endif
+
+#include <string.h>
+
+namespace memcachedumper {
+
+namespace {
+
+void Fingerprint(const char* value, size_t len, uint64_t* hi, uint64_t* lo) {
+#ifdef HAVE_XXHASH
+  XXH128_hash_t hash = XXH3_128bits(value, len);
+  *hi = hash.high64;
+  *lo = hash.low64;
+#else
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  EVP_Digest(value, len, digest, nullptr, EVP_md5(), nullptr);
+  memcpy(hi, digest, 8);
+  memcpy(lo, digest + 8, 8);
+#endif
+}
+
+} // anonymous namespace
+
+ValueDedupTable::ValueDedupTable()
+  : slots_(DEDUP_TABLE_SLOTS),
+    generation_(1) {
+  for (Slot& slot : slots_) {
+    slot.generation = 0;
+  }
+}
+
+void ValueDedupTable::Clear() {
+  ++generation_;
+}
+
+bool ValueDedupTable::FindOrInsert(const char* value, size_t len, uint64_t offset,
+    uint64_t* out_offset) {
+  uint64_t hi, lo;
+  Fingerprint(value, len, &hi, &lo);
+
+  Slot& slot = slots_[lo % DEDUP_TABLE_SLOTS];
+  if (slot.generation == generation_ && slot.fingerprint_hi == hi &&
+      slot.fingerprint_lo == lo) {
+    *out_offset = slot.offset;
+    return true;
+  }
+
+  slot.fingerprint_hi = hi;
+  slot.fingerprint_lo = lo;
+  slot.offset = offset;
+  slot.generation = generation_;
+  return false;
+}
+
+} // namespace memcachedumper
@@ -0,0 +1,66 @@
+/**
+ *
+ *  Copyright 2021 Netflix, Inc.
+ *
+ *     Licensed under the Apache License, Version 2.0 (the "License");
+ *     you may not use this file except in compliance with the License.
+ *     You may obtain a copy of the License at
+ *
+ *         http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *     Unless required by applicable law or agreed to in writing, software
+ *     distributed under the License is distributed on an "AS IS" BASIS,
+ *     WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *     See the License for the specific language governing permissions and
+ *     limitations under the License.
+ *
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+// Number of values each writer remembers. Older ones are forgotten as their
+// slots get reused.
+#define DEDUP_TABLE_SLOTS (64 * 1024)
+
+// Values shorter than this aren't worth replacing with a back-reference.
+#define DEDUP_MIN_VALUE_LEN 64
+
+namespace memcachedumper {
+
+/// A bounded table of fingerprints (128-bit XXH3, or MD5 without xxHash) of the
+/// values recently written to a data file, and where their records start, for
+/// writing repeated values as back-references.
+///
+/// It's direct mapped: a new value takes over the slot of whatever value last
+/// hashed to it, so that lookups and inserts never allocate.
+class ValueDedupTable {
+ public:
+  ValueDedupTable();
+
+  // Forgets every value, eg. when moving on to a new file.
+  void Clear();
+
+  // If a value with the same contents as 'value' was inserted since the last
+  // Clear(), returns 'true' and the offset of its record in 'out_offset'.
+  // Otherwise notes that 'value' is in the record at 'offset' and returns 'false'.
+  bool FindOrInsert(const char* value, size_t len, uint64_t offset, uint64_t* out_offset);
+
+ private:
+  struct Slot {
+    uint64_t fingerprint_hi;
+    uint64_t fingerprint_lo;
+    uint64_t offset;
+    // Slots from before the last Clear() have an older generation.
+    uint32_t generation;
+  };
+
+  std::vector<Slot> slots_;
+  uint32_t generation_;
+};
+
+} // namespace memcachedumper